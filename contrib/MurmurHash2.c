@@ -14,8 +14,14 @@
 //    machines.
 
 #include "murmurhash2.h"
+#include <string.h>
 #define BIG_CONSTANT(x) (x##LLU)
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MURMUR_LANES_AVX2 1
+#endif
+
 //-----------------------------------------------------------------------------
 
 uint32_t MurmurHash2(const void *key, int len, uint32_t seed) {
@@ -187,4 +193,223 @@ uint64_t MurmurHash64B(const void *key, int len, uint64_t seed) {
     h = (h << 32) | h2;
 
     return h;
-}
\ No newline at end of file
+}
+//-----------------------------------------------------------------------------
+// Multi-lane versions of MurmurHash2 and MurmurHash64A_Bloom, hashing 8 (resp. 4)
+// keys of the same length at once with AVX2 when the CPU supports it. Results
+// are identical to the scalar functions, which are used for the remaining keys
+// and on other CPUs.
+
+#ifdef MURMUR_LANES_AVX2
+
+static int murmurHasAvx2(void) {
+    static int has = -1;
+    if (has < 0) {
+        __builtin_cpu_init();
+        has = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has;
+}
+
+static int sameLengths(const size_t *lens, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        if (lens[i] != lens[0]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Same as _mm256_set_m128i, which older compilers lack
+#define MURMUR_SET_M128I(hi, lo) _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1)
+
+// Mixes 'k', one word per lane, into 'h' as the MurmurHash2 loop does
+#define MURMUR2_AVX2_ROUND(h, k, m)                                                                \
+    do {                                                                                           \
+        __m256i _k = _mm256_mullo_epi32(k, m);                                                     \
+        _k = _mm256_xor_si256(_k, _mm256_srli_epi32(_k, 24));                                      \
+        _k = _mm256_mullo_epi32(_k, m);                                                            \
+        h = _mm256_xor_si256(_mm256_mullo_epi32(h, m), _k);                                        \
+    } while (0)
+
+static inline uint32_t load32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+__attribute__((target("avx2"))) static void MurmurHash2_avx2(const void *const *keys, int len,
+                                                             const uint32_t *seeds,
+                                                             uint32_t *out) {
+    const __m256i m = _mm256_set1_epi32(0x5bd1e995);
+    const unsigned char *d[8];
+    for (int i = 0; i < 8; i++) {
+        d[i] = (const unsigned char *)keys[i];
+    }
+
+    __m256i h = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)seeds),
+                                 _mm256_set1_epi32(len));
+    int off = 0;
+    // 16 bytes of each key are loaded at once and transposed to one word per lane
+    for (; len - off >= 16; off += 16) {
+        __m256i r[4], t[4];
+        for (int i = 0; i < 4; i++) {
+            r[i] = MURMUR_SET_M128I(_mm_loadu_si128((const __m128i *)(d[i + 4] + off)),
+                                    _mm_loadu_si128((const __m128i *)(d[i] + off)));
+        }
+        t[0] = _mm256_unpacklo_epi32(r[0], r[1]);
+        t[1] = _mm256_unpackhi_epi32(r[0], r[1]);
+        t[2] = _mm256_unpacklo_epi32(r[2], r[3]);
+        t[3] = _mm256_unpackhi_epi32(r[2], r[3]);
+        MURMUR2_AVX2_ROUND(h, _mm256_unpacklo_epi64(t[0], t[2]), m);
+        MURMUR2_AVX2_ROUND(h, _mm256_unpackhi_epi64(t[0], t[2]), m);
+        MURMUR2_AVX2_ROUND(h, _mm256_unpacklo_epi64(t[1], t[3]), m);
+        MURMUR2_AVX2_ROUND(h, _mm256_unpackhi_epi64(t[1], t[3]), m);
+    }
+    for (; len - off >= 4; off += 4) {
+        __m256i k = _mm256_setr_epi32(load32(d[0] + off), load32(d[1] + off), load32(d[2] + off),
+                                      load32(d[3] + off), load32(d[4] + off), load32(d[5] + off),
+                                      load32(d[6] + off), load32(d[7] + off));
+        MURMUR2_AVX2_ROUND(h, k, m);
+    }
+
+    if (len > off) {
+        uint32_t w[8];
+        for (int i = 0; i < 8; i++) {
+            uint32_t t = 0;
+            switch (len - off) {
+            case 3:
+                t ^= d[i][off + 2] << 16;
+            case 2:
+                t ^= d[i][off + 1] << 8;
+            case 1:
+                t ^= d[i][off];
+            };
+            w[i] = t;
+        }
+        h = _mm256_xor_si256(h, _mm256_loadu_si256((const __m256i *)w));
+        h = _mm256_mullo_epi32(h, m);
+    }
+
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, m);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    _mm256_storeu_si256((__m256i *)out, h);
+}
+
+// Low 64 bits of a * b, where 'bhi' holds the high halves of b. AVX2 has no such multiply.
+__attribute__((target("avx2"))) static inline __m256i mullo64(__m256i a, __m256i b, __m256i bhi) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, bhi));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+// Mixes 'k', one word per lane, into 'h' as the MurmurHash64A loop does
+#define MURMUR64A_AVX2_ROUND(h, k, m, mhi)                                                         \
+    do {                                                                                           \
+        __m256i _k = mullo64(k, m, mhi);                                                           \
+        _k = _mm256_xor_si256(_k, _mm256_srli_epi64(_k, 47));                                      \
+        _k = mullo64(_k, m, mhi);                                                                  \
+        h = mullo64(_mm256_xor_si256(h, _k), m, mhi);                                              \
+    } while (0)
+
+__attribute__((target("avx2"))) static void MurmurHash64A_Bloom_avx2(const void *const *keys,
+                                                                     int len,
+                                                                     const uint64_t *seeds,
+                                                                     uint64_t *out) {
+    const uint64_t m64 = BIG_CONSTANT(0xc6a4a7935bd1e995);
+    const __m256i m = _mm256_set1_epi64x(m64);
+    const __m256i mhi = _mm256_srli_epi64(m, 32);
+    const int r = 47;
+    const unsigned char *d[4];
+    for (int i = 0; i < 4; i++) {
+        d[i] = (const unsigned char *)keys[i];
+    }
+
+    __m256i h = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)seeds),
+                                 _mm256_set1_epi64x(len * m64));
+    int off = 0;
+    for (; len - off >= 16; off += 16) {
+        __m256i a = MURMUR_SET_M128I(_mm_loadu_si128((const __m128i *)(d[2] + off)),
+                                     _mm_loadu_si128((const __m128i *)(d[0] + off)));
+        __m256i b = MURMUR_SET_M128I(_mm_loadu_si128((const __m128i *)(d[3] + off)),
+                                     _mm_loadu_si128((const __m128i *)(d[1] + off)));
+        MURMUR64A_AVX2_ROUND(h, _mm256_unpacklo_epi64(a, b), m, mhi);
+        MURMUR64A_AVX2_ROUND(h, _mm256_unpackhi_epi64(a, b), m, mhi);
+    }
+    for (; len - off >= 8; off += 8) {
+        __m256i k = _mm256_setr_epi64x(load64(d[0] + off), load64(d[1] + off), load64(d[2] + off),
+                                       load64(d[3] + off));
+        MURMUR64A_AVX2_ROUND(h, k, m, mhi);
+    }
+
+    if (len > off) {
+        uint64_t w[4];
+        for (int i = 0; i < 4; i++) {
+            // Little endian load of the remaining bytes, as done by the scalar switch
+            uint64_t t = 0;
+            for (int j = len - off - 1; j >= 0; j--) {
+                t = t << 8 | d[i][off + j];
+            }
+            w[i] = t;
+        }
+        h = _mm256_xor_si256(h, _mm256_loadu_si256((const __m256i *)w));
+        h = mullo64(h, m, mhi);
+    }
+
+    h = _mm256_xor_si256(h, _mm256_srli_epi64(h, r));
+    h = mullo64(h, m, mhi);
+    h = _mm256_xor_si256(h, _mm256_srli_epi64(h, r));
+    _mm256_storeu_si256((__m256i *)out, h);
+}
+
+#endif
+
+void MurmurHash2_x(const void *const *keys, const size_t *lens, const uint32_t *seeds, size_t n,
+                   uint32_t *out) {
+    size_t i = 0;
+#ifdef MURMUR_LANES_AVX2
+    if (murmurHasAvx2()) {
+        for (; i + 8 <= n; i += 8) {
+            if (sameLengths(lens + i, 8)) {
+                MurmurHash2_avx2(keys + i, lens[i], seeds + i, out + i);
+            } else {
+                for (size_t j = i; j < i + 8; j++) {
+                    out[j] = MurmurHash2(keys[j], lens[j], seeds[j]);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = MurmurHash2(keys[i], lens[i], seeds[i]);
+    }
+}
+
+void MurmurHash64A_Bloom_x(const void *const *keys, const size_t *lens, const uint64_t *seeds,
+                           size_t n, uint64_t *out) {
+    size_t i = 0;
+#ifdef MURMUR_LANES_AVX2
+    if (murmurHasAvx2()) {
+        for (; i + 4 <= n; i += 4) {
+            if (sameLengths(lens + i, 4)) {
+                MurmurHash64A_Bloom_avx2(keys + i, lens[i], seeds + i, out + i);
+            } else {
+                for (size_t j = i; j < i + 4; j++) {
+                    out[j] = MurmurHash64A_Bloom(keys[j], lens[j], seeds[j]);
+                }
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = MurmurHash64A_Bloom(keys[i], lens[i], seeds[i]);
+    }
+}
@@ -22,6 +22,7 @@
 
 #include "bloom.h"
 #include "murmurhash2.h"
+#include "siphash.h"
 
 #define MAKESTRING(n) STRING(n)
 #define STRING(n) #n
@@ -63,6 +64,64 @@ bloom_hashval bloom_calc_hash64(const void *buffer, int len) {
     return rv;
 }
 
+bloom_hashval bloom_calc_hash_int(uint64_t item) {
+    bloom_hashval rv;
+    rv.a = MurmurHash64_Int(item, 0xc6a4a7935bd1e995ULL);
+    rv.b = MurmurHash64_Int(item, rv.a);
+    return rv;
+}
+
+bloom_hashval bloom_calc_hash_keyed(const void *buffer, size_t len, const uint64_t key[2]) {
+    bloom_hashval rv;
+    rv.a = SipHash13(buffer, len, key);
+    rv.b = SipHash13_Int(rv.a, key);
+    return rv;
+}
+
+bloom_hashval bloom_calc_hash_int_keyed(uint64_t item, const uint64_t key[2]) {
+    bloom_hashval rv;
+    rv.a = SipHash13_Int(item, key);
+    rv.b = SipHash13_Int(rv.a, key);
+    return rv;
+}
+
+// Items hashed per round by bloom_calc_hashes, bounding its stack use
+#define BLOOM_HASH_CHUNK 64
+
+void bloom_calc_hashes(const void *const *buffers, const size_t *lens, size_t n,
+                       bloom_hashval *out) {
+    uint32_t seeds[BLOOM_HASH_CHUNK], a[BLOOM_HASH_CHUNK], b[BLOOM_HASH_CHUNK];
+    for (size_t base = 0; base < n; base += BLOOM_HASH_CHUNK) {
+        size_t count = n - base < BLOOM_HASH_CHUNK ? n - base : BLOOM_HASH_CHUNK;
+        for (size_t i = 0; i < count; i++) {
+            seeds[i] = 0x9747b28c;
+        }
+        MurmurHash2_x(buffers + base, lens + base, seeds, count, a);
+        MurmurHash2_x(buffers + base, lens + base, a, count, b);
+        for (size_t i = 0; i < count; i++) {
+            out[base + i].a = a[i];
+            out[base + i].b = b[i];
+        }
+    }
+}
+
+void bloom_calc_hashes64(const void *const *buffers, const size_t *lens, size_t n,
+                         bloom_hashval *out) {
+    uint64_t seeds[BLOOM_HASH_CHUNK], a[BLOOM_HASH_CHUNK], b[BLOOM_HASH_CHUNK];
+    for (size_t base = 0; base < n; base += BLOOM_HASH_CHUNK) {
+        size_t count = n - base < BLOOM_HASH_CHUNK ? n - base : BLOOM_HASH_CHUNK;
+        for (size_t i = 0; i < count; i++) {
+            seeds[i] = 0xc6a4a7935bd1e995ULL;
+        }
+        MurmurHash64A_Bloom_x(buffers + base, lens + base, seeds, count, a);
+        MurmurHash64A_Bloom_x(buffers + base, lens + base, a, count, b);
+        for (size_t i = 0; i < count; i++) {
+            out[base + i].a = a[i];
+            out[base + i].b = b[i];
+        }
+    }
+}
+
 // This function is defined as a macro because newer filters use a power of two
 // for bit count, which is must faster to calculate. Older bloom filters don't
 // use powers of two, so they are slower. Rather than calculating this inside
@@ -89,21 +148,156 @@ bloom_hashval bloom_calc_hash64(const void *buffer, int len) {
     }                                                                                              \
     return found_unset;
 
-static int bloom_check_add32(struct bloom *bloom, bloom_hashval hashval, int mode) {
-    CHECK_ADD_FUNC(uint32_t, (1 << bloom->n2));
-}
-
-static int bloom_check_add64(struct bloom *bloom, bloom_hashval hashval, int mode) {
+static int bloom_check_add64(const struct bloom *bloom, bloom_hashval hashval, int mode) {
     CHECK_ADD_FUNC(uint64_t, (1LLU << bloom->n2));
 }
 
 // This function is used for older bloom filters whose bit count was not
 // 1 << X. This function is a bit slower, and isn't exposed in the API
 // directly because it's deprecated
-static int bloom_check_add_compat(struct bloom *bloom, bloom_hashval hashval, int mode) {
+static int bloom_check_add_compat(const struct bloom *bloom, bloom_hashval hashval, int mode) {
     CHECK_ADD_FUNC(uint64_t, bloom->bits)
 }
 
+static int bloom_check64(const struct bloom *bloom, bloom_hashval hash) {
+    return bloom_check_add64(bloom, hash, MODE_READ);
+}
+
+static int bloom_add64(struct bloom *bloom, bloom_hashval hash) {
+    return !bloom_check_add64(bloom, hash, MODE_WRITE);
+}
+
+static int bloom_check_compat(const struct bloom *bloom, bloom_hashval hash) {
+    return bloom_check_add_compat(bloom, hash, MODE_READ);
+}
+
+static int bloom_add_compat(struct bloom *bloom, bloom_hashval hash) {
+    return !bloom_check_add_compat(bloom, hash, MODE_WRITE);
+}
+
+// Kernels with the loop over the hashes unrolled for each number of hashes up
+// to BLOOM_MAX_UNROLLED_HASHES. They probe the same bits as CHECK_ADD_FUNC.
+// Power of two filters mask the positions instead of dividing them by a
+// modulus the compiler can't tell is a power of two. Other filters reduce them
+// with bloom_reduce. Positions are the same whether the filter was made for 32
+// or 64 bit hashes, so one family of each serves both.
+#define POS_MASK(i) ((hash.a + (i)*hash.b) & mask)
+#define POS_MOD(i) bloom_reduce(hash.a + (i)*hash.b, bits, inv)
+
+#define PROBE_READ(POS, i)                                                                         \
+    x = POS(i);                                                                                    \
+    if (!(bf[x >> 3] & (1 << (x & 7)))) {                                                          \
+        return 0;                                                                                  \
+    }
+
+#define PROBE_WRITE(POS, i)                                                                        \
+    x = POS(i);                                                                                    \
+    c = bf[x >> 3];                                                                                \
+    if (!(c & (1 << (x & 7)))) {                                                                   \
+        bf[x >> 3] = c | (1 << (x & 7));                                                           \
+        found_unset = 1;                                                                           \
+    }
+
+#define PROBES_1(P, POS) P(POS, 0)
+#define PROBES_2(P, POS) PROBES_1(P, POS) P(POS, 1)
+#define PROBES_3(P, POS) PROBES_2(P, POS) P(POS, 2)
+#define PROBES_4(P, POS) PROBES_3(P, POS) P(POS, 3)
+#define PROBES_5(P, POS) PROBES_4(P, POS) P(POS, 4)
+#define PROBES_6(P, POS) PROBES_5(P, POS) P(POS, 5)
+#define PROBES_7(P, POS) PROBES_6(P, POS) P(POS, 6)
+#define PROBES_8(P, POS) PROBES_7(P, POS) P(POS, 7)
+#define PROBES_9(P, POS) PROBES_8(P, POS) P(POS, 8)
+#define PROBES_10(P, POS) PROBES_9(P, POS) P(POS, 9)
+#define PROBES_11(P, POS) PROBES_10(P, POS) P(POS, 10)
+#define PROBES_12(P, POS) PROBES_11(P, POS) P(POS, 11)
+#define PROBES_13(P, POS) PROBES_12(P, POS) P(POS, 12)
+#define PROBES_14(P, POS) PROBES_13(P, POS) P(POS, 13)
+#define PROBES_15(P, POS) PROBES_14(P, POS) P(POS, 14)
+#define PROBES_16(P, POS) PROBES_15(P, POS) P(POS, 15)
+
+// SETUP declares what POS reads from the filter
+#define UNROLLED_KERNELS(k, name, SETUP, POS)                                                      \
+    static int bloom_check_##name##k(const struct bloom *bloom, bloom_hashval hash) {              \
+        const unsigned char *bf = bloom->bf;                                                       \
+        SETUP;                                                                                     \
+        uint64_t x;                                                                                \
+        PROBES_##k(PROBE_READ, POS) return 1;                                                      \
+    }                                                                                              \
+    static int bloom_add_##name##k(struct bloom *bloom, bloom_hashval hash) {                      \
+        unsigned char *bf = bloom->bf;                                                             \
+        SETUP;                                                                                     \
+        uint64_t x;                                                                                \
+        unsigned char c;                                                                           \
+        int found_unset = 0;                                                                       \
+        PROBES_##k(PROBE_WRITE, POS) return !found_unset;                                          \
+    }
+
+#define UNROLLED_FAMILY(name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(1, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(2, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(3, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(4, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(5, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(6, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(7, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(8, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(9, name, SETUP, POS)                                                          \
+    UNROLLED_KERNELS(10, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(11, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(12, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(13, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(14, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(15, name, SETUP, POS)                                                         \
+    UNROLLED_KERNELS(16, name, SETUP, POS)
+
+#define KERNEL_ENTRY(name, k) {bloom_check_##name##k, bloom_add_##name##k},
+
+#define KERNEL_TABLE(name)                                                                         \
+    static const struct {                                                                          \
+        int (*check)(const struct bloom *bloom, bloom_hashval hash);                               \
+        int (*add)(struct bloom *bloom, bloom_hashval hash);                                       \
+    } name##_kernels[BLOOM_MAX_UNROLLED_HASHES + 1] = {                                            \
+        {NULL, NULL},         KERNEL_ENTRY(name, 1)  KERNEL_ENTRY(name, 2)  KERNEL_ENTRY(name, 3)  \
+        KERNEL_ENTRY(name, 4) KERNEL_ENTRY(name, 5)  KERNEL_ENTRY(name, 6)  KERNEL_ENTRY(name, 7)  \
+        KERNEL_ENTRY(name, 8) KERNEL_ENTRY(name, 9)  KERNEL_ENTRY(name, 10) KERNEL_ENTRY(name, 11) \
+        KERNEL_ENTRY(name, 12) KERNEL_ENTRY(name, 13) KERNEL_ENTRY(name, 14)                       \
+        KERNEL_ENTRY(name, 15) KERNEL_ENTRY(name, 16)};
+
+UNROLLED_FAMILY(mask, const uint64_t mask = (1LLU << bloom->n2) - 1, POS_MASK)
+KERNEL_TABLE(mask)
+
+#ifdef __SIZEOF_INT128__
+// x % bits, given inv = floor((2^64 - 1) / bits). The quotient taken from the
+// high half of x * inv is either exact or one less, so one subtraction of bits
+// finishes the reduction, without the 64 bit division.
+static inline uint64_t bloom_reduce(uint64_t x, uint64_t bits, uint64_t inv) {
+    uint64_t q = (uint64_t)(((unsigned __int128)x * inv) >> 64);
+    uint64_t r = x - q * bits;
+    return r >= bits ? r - bits : r;
+}
+
+UNROLLED_FAMILY(mod, const uint64_t bits = bloom->bits; const uint64_t inv = bloom->bits_inv,
+                POS_MOD)
+KERNEL_TABLE(mod)
+#endif
+
+void bloom_select_kernels(struct bloom *bloom) {
+    int unrolled = bloom->hashes >= 1 && bloom->hashes <= BLOOM_MAX_UNROLLED_HASHES;
+    bloom->check = bloom_check_compat;
+    bloom->add = bloom_add_compat;
+    if (bloom->n2 > 0) {
+        bloom->check = unrolled ? mask_kernels[bloom->hashes].check : bloom_check64;
+        bloom->add = unrolled ? mask_kernels[bloom->hashes].add : bloom_add64;
+    }
+#ifdef __SIZEOF_INT128__
+    else if (unrolled && bloom->bits > 0) {
+        bloom->bits_inv = UINT64_MAX / bloom->bits;
+        bloom->check = mod_kernels[bloom->hashes].check;
+        bloom->add = mod_kernels[bloom->hashes].add;
+    }
+#endif
+}
+
 static double calc_bpe(double error) {
     static const double denom = 0.480453013918201; // ln(2)^2
     double num = log(error);
@@ -170,6 +364,13 @@ int bloom_init(struct bloom *bloom, uint64_t entries, double error, unsigned opt
 
     bloom->force64 = (options & BLOOM_OPT_FORCE64);
     bloom->hashes = (int)ceil(0.693147180559945 * bloom->bpe); // ln(2)
+    bloom->nofree = !!(options & BLOOM_OPT_NOALLOC);
+    bloom->packed = 0;
+    bloom_select_kernels(bloom);
+    if (bloom->nofree) {
+        bloom->bf = NULL;
+        return 0;
+    }
     bloom->bf = (unsigned char *)BLOOM_CALLOC(bloom->bytes, sizeof(unsigned char));
     if (bloom->bf == NULL) {
         return 1;
@@ -178,15 +379,24 @@ int bloom_init(struct bloom *bloom, uint64_t entries, double error, unsigned opt
     return 0;
 }
 
-int bloom_check_h(const struct bloom *bloom, bloom_hashval hash) {
+void bloom_prefetch_h(const struct bloom *bloom, bloom_hashval hash) {
+    // Same position as the first probe of bloom_check_h, the moduli used there
+    // being powers of two whenever n2 is set
+    uint64_t x = bloom->n2 > 0 ? hash.a & ((1LLU << bloom->n2) - 1) : hash.a % bloom->bits;
+    __builtin_prefetch(bloom->bf + (x >> 3), 0, 1);
+}
+
+void bloom_positions_h(const struct bloom *bloom, bloom_hashval hash, uint64_t *out) {
+    // Same positions as CHECK_ADD_FUNC, which reduces them in 64 bits for all variants
     if (bloom->n2 > 0) {
-        if (bloom->force64 || bloom->n2 > 31) {
-            return bloom_check_add64((void *)bloom, hash, MODE_READ);
-        } else {
-            return bloom_check_add32((void *)bloom, hash, MODE_READ);
+        const uint64_t mask = (1LLU << bloom->n2) - 1;
+        for (uint32_t i = 0; i < bloom->hashes; i++) {
+            out[i] = (hash.a + i * hash.b) & mask;
         }
-    } else {
-        return bloom_check_add_compat((void *)bloom, hash, MODE_READ);
+        return;
+    }
+    for (uint32_t i = 0; i < bloom->hashes; i++) {
+        out[i] = (hash.a + i * hash.b) % bloom->bits;
     }
 }
 
@@ -194,22 +404,14 @@ int bloom_check(const struct bloom *bloom, const void *buffer, int len) {
     return bloom_check_h(bloom, bloom_calc_hash(buffer, len));
 }
 
-int bloom_add_h(struct bloom *bloom, bloom_hashval hash) {
-    if (bloom->n2 > 0) {
-        if (bloom->force64 || bloom->n2 > 31) {
-            return !bloom_check_add64(bloom, hash, MODE_WRITE);
-        } else {
-            return !bloom_check_add32(bloom, hash, MODE_WRITE);
-        }
-    } else {
-        return !bloom_check_add_compat(bloom, hash, MODE_WRITE);
-    }
-}
-
 int bloom_add(struct bloom *bloom, const void *buffer, int len) {
     return bloom_add_h(bloom, bloom_calc_hash(buffer, len));
 }
 
-void bloom_free(struct bloom *bloom) { BLOOM_FREE(bloom->bf); }
+void bloom_free(struct bloom *bloom) {
+    if (!bloom->nofree) {
+        BLOOM_FREE(bloom->bf);
+    }
+}
 
 const char *bloom_version() { return MAKESTRING(BLOOM_VERSION); }
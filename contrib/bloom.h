@@ -14,6 +14,11 @@
 extern "C" {
 #endif
 
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+} bloom_hashval;
+
 /** ***************************************************************************
  * Structure to keep track of one bloom filter.  Caller needs to
  * allocate this and pass it to the functions below. First call for
@@ -24,6 +29,8 @@ struct bloom {
     uint32_t hashes;
     uint8_t force64;
     uint8_t n2;
+    uint8_t nofree; // bf is owned by the caller, see BLOOM_OPT_NOALLOC
+    uint8_t packed; // bf holds the compressed bits, see SBChain_Pack
     uint64_t entries;
 
     double error;
@@ -32,6 +39,11 @@ struct bloom {
     unsigned char *bf;
     uint64_t bytes;
     uint64_t bits;
+
+    uint64_t bits_inv; // floor((2^64 - 1) / bits) for the kernels of non power of two filters
+    // Probing kernels for the shape of the filter, see bloom_select_kernels
+    int (*check)(const struct bloom *bloom, bloom_hashval hash);
+    int (*add)(struct bloom *bloom, bloom_hashval hash);
 };
 
 /** ***************************************************************************
@@ -75,6 +87,21 @@ struct bloom {
 // Disable auto-scaling. Saves memory
 #define BLOOM_OPT_NO_SCALING 8
 
+// Chain also stores prefixes of each item (see SBChain_SetPrefixes)
+#define BLOOM_OPT_PREFIXES 16
+
+// Only compute the sizes; the caller sets bf to 'bytes' of zeroed memory it owns
+#define BLOOM_OPT_NOALLOC 32
+
+// Chain items are 64 bit integers hashed with bloom_calc_hash_int (see SBChain_UseItems)
+#define BLOOM_OPT_INTITEMS 64
+
+// Chain items are hashed with the chain's secret key (see SBChain_SetHashKey)
+#define BLOOM_OPT_KEYED 128
+
+// Chain doesn't grow past its memory budget (see SBChain_SetMaxBytes)
+#define BLOOM_OPT_MAXBYTES 256
+
 int bloom_init(struct bloom *bloom, uint64_t entries, double error, unsigned options);
 
 /** ***************************************************************************
@@ -83,12 +110,49 @@ int bloom_init(struct bloom *bloom, uint64_t entries, double error, unsigned opt
  */
 int bloom_init_size(struct bloom *bloom, uint64_t entries, double error, unsigned int cache_size);
 
-typedef struct {
-    uint64_t a;
-    uint64_t b;
-} bloom_hashval;
+/** ***************************************************************************
+ * Set the probing kernels of the filter, called by bloom_init. Filters whose
+ * fields are set directly (e.g. when loaded) must call it once hashes, n2 and
+ * bits are set, before checking or adding anything.
+ *
+ * Filters get a kernel unrolled for their number of hashes, up to
+ * BLOOM_MAX_UNROLLED_HASHES. Those whose number of bits is not a power of two
+ * (BLOOM_OPT_NOROUND) need 128 bit multiplication for theirs, and otherwise
+ * keep the generic loop.
+ *
+ */
+#define BLOOM_MAX_UNROLLED_HASHES 16
+
+void bloom_select_kernels(struct bloom *bloom);
 
 bloom_hashval bloom_calc_hash(const void *buffer, int len);
+bloom_hashval bloom_calc_hash64(const void *buffer, int len);
+
+/** ***************************************************************************
+ * Hash of an item given as a 64 bit integer, usable with filters of both
+ * hash widths. Unrelated to the hash of the integer's bytes or digits.
+ *
+ */
+bloom_hashval bloom_calc_hash_int(uint64_t item);
+
+/** ***************************************************************************
+ * Hashes of a string and of a 64 bit integer item under a secret 128 bit key,
+ * computed with SipHash. Without the key, nobody can pick items that probe the
+ * same bits. Usable with filters of both hash widths.
+ *
+ */
+bloom_hashval bloom_calc_hash_keyed(const void *buffer, size_t len, const uint64_t key[2]);
+bloom_hashval bloom_calc_hash_int_keyed(uint64_t item, const uint64_t key[2]);
+
+/** ***************************************************************************
+ * Same as bloom_calc_hash (resp. bloom_calc_hash64) for each of 'n' buffers,
+ * hashing several buffers of the same length at once where the CPU allows.
+ *
+ */
+void bloom_calc_hashes(const void *const *buffers, const size_t *lens, size_t n,
+                       bloom_hashval *out);
+void bloom_calc_hashes64(const void *const *buffers, const size_t *lens, size_t n,
+                         bloom_hashval *out);
 
 /** ***************************************************************************
  * Check if the given element is in the bloom filter. Remember this may
@@ -107,9 +171,27 @@ bloom_hashval bloom_calc_hash(const void *buffer, int len);
  *    -1 - bloom not initialized
  *
  */
-int bloom_check_h(const struct bloom *bloom, bloom_hashval hash);
+static inline int bloom_check_h(const struct bloom *bloom, bloom_hashval hash) {
+    return bloom->check(bloom, hash);
+}
 int bloom_check(const struct bloom *bloom, const void *buffer, int len);
 
+/** ***************************************************************************
+ * Hint the CPU to fetch the byte holding the first bit probed for 'hash', so
+ * that checking many hashes can overlap their cache misses. Has no effect on
+ * the filter.
+ *
+ */
+void bloom_prefetch_h(const struct bloom *bloom, bloom_hashval hash);
+
+/** ***************************************************************************
+ * Write to 'out' the positions of the bits that bloom_check_h and bloom_add_h
+ * probe for 'hash', in probing order. 'out' must have room for bloom->hashes
+ * positions, all below bloom->bits.
+ *
+ */
+void bloom_positions_h(const struct bloom *bloom, bloom_hashval hash, uint64_t *out);
+
 /** ***************************************************************************
  * Add the given element to the bloom filter.
  * The return code indicates if the element (or a collision) was already in,
@@ -128,7 +210,9 @@ int bloom_check(const struct bloom *bloom, const void *buffer, int len);
  *    -1 - bloom not initialized
  *
  */
-int bloom_add_h(struct bloom *bloom, bloom_hashval hash);
+static inline int bloom_add_h(struct bloom *bloom, bloom_hashval hash) {
+    return bloom->add(bloom, hash);
+}
 int bloom_add(struct bloom *bloom, const void *buffer, int len);
 
 /** ***************************************************************************
@@ -17,6 +17,27 @@ uint32_t MurmurHash2A(const void *key, int len, uint32_t seed);
 uint32_t MurmurHashNeutral2(const void *key, int len, uint32_t seed);
 uint32_t MurmurHashAligned2(const void *key, int len, uint32_t seed);
 #define murmurhash2 MurmurHash2
+
+// Same as calling MurmurHash2 (resp. MurmurHash64A_Bloom) on each of the 'n' keys
+// with its length and seed. Runs of keys sharing a length are hashed several at
+// a time on CPUs with AVX2.
+void MurmurHash2_x(const void *const *keys, const size_t *lens, const uint32_t *seeds, size_t n,
+                   uint32_t *out);
+void MurmurHash64A_Bloom_x(const void *const *keys, const size_t *lens, const uint64_t *seeds,
+                           size_t n, uint64_t *out);
+
+// Hash of a 64 bit integer item, for callers that take items as numbers rather
+// than strings. Mixes key and seed with the 64 bit finalizer of MurmurHash3,
+// which is a bijection, so distinct keys never collide for a given seed.
+static inline uint64_t MurmurHash64_Int(uint64_t key, uint64_t seed) {
+    uint64_t h = key + (seed + 1) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
 //-----------------------------------------------------------------------------
 
 #endif // _MURMURHASH2_H_
@@ -0,0 +1,72 @@
+//-----------------------------------------------------------------------------
+// SipHash was designed by Jean-Philippe Aumasson and Daniel J. Bernstein.
+// This implementation follows the reference description. Like MurmurHash2.c,
+// it reads blocks in the byte order of the machine, so results match the
+// reference on little-endian machines only.
+
+#include "siphash.h"
+#include <string.h>
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                                                   \
+    do {                                                                                           \
+        v0 += v1;                                                                                  \
+        v1 = ROTL(v1, 13);                                                                         \
+        v1 ^= v0;                                                                                  \
+        v0 = ROTL(v0, 32);                                                                         \
+        v2 += v3;                                                                                  \
+        v3 = ROTL(v3, 16);                                                                         \
+        v3 ^= v2;                                                                                  \
+        v0 += v3;                                                                                  \
+        v3 = ROTL(v3, 21);                                                                         \
+        v3 ^= v0;                                                                                  \
+        v2 += v1;                                                                                  \
+        v1 = ROTL(v1, 17);                                                                         \
+        v1 ^= v2;                                                                                  \
+        v2 = ROTL(v2, 32);                                                                         \
+    } while (0)
+
+// 'c' rounds per block and 'd' finalization rounds
+static inline uint64_t siphash(const unsigned char *in, size_t len, const uint64_t key[2], int c,
+                               int d) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+    const unsigned char *end = in + (len & ~(size_t)7);
+    for (; in != end; in += 8) {
+        uint64_t m;
+        memcpy(&m, in, sizeof(m));
+        v3 ^= m;
+        for (int i = 0; i < c; i++) {
+            SIPROUND;
+        }
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t)len << 56;
+    for (size_t i = len & 7; i > 0; i--) {
+        b |= (uint64_t)in[i - 1] << (8 * (i - 1));
+    }
+    v3 ^= b;
+    for (int i = 0; i < c; i++) {
+        SIPROUND;
+    }
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for (int i = 0; i < d; i++) {
+        SIPROUND;
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t SipHash13(const void *in, size_t len, const uint64_t key[2]) {
+    return siphash(in, len, key, 1, 3);
+}
+
+uint64_t SipHash13_Int(uint64_t v, const uint64_t key[2]) {
+    return siphash((const unsigned char *)&v, sizeof(v), key, 1, 3);
+}
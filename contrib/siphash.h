@@ -0,0 +1,21 @@
+//-----------------------------------------------------------------------------
+// SipHash was designed by Jean-Philippe Aumasson and Daniel J. Bernstein.
+// This implementation follows the reference description.
+
+#ifndef _SIPHASH_H_
+#define _SIPHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+
+// SipHash-1-3 of 'len' bytes under the 128 bit 'key', the variant Redis uses
+// for its own hash tables. Unlike MurmurHash, colliding or similar outputs
+// can't be searched for offline without knowing the key.
+uint64_t SipHash13(const void *in, size_t len, const uint64_t key[2]);
+
+// Same as SipHash13 of the 8 little endian bytes of 'v'
+uint64_t SipHash13_Int(uint64_t v, const uint64_t key[2]);
+
+#endif
@@ -6,6 +6,7 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <string.h>
+#include <strings.h>
 #define REDISMODULE_EXPERIMENTAL_API
 #include "util.h"
 
@@ -281,6 +282,130 @@ RedisModuleString **RMUtil_ParseVarArgs(RedisModuleString **argv, int argc, int
   return argv + 1;
 }
 
+int RMUtil_StringEquals(RedisModuleString *s1, RedisModuleString *s2) {
+  size_t l1, l2;
+  const char *c1 = RedisModule_StringPtrLen(s1, &l1);
+  const char *c2 = RedisModule_StringPtrLen(s2, &l2);
+  return l1 == l2 && memcmp(c1, c2, l1) == 0;
+}
+
+typedef struct {
+  const char *name;
+  size_t len;
+  int ix;
+} rmutil_keyRef;
+
+static int rmutil_cmpKeyRef(const void *a, const void *b) {
+  const rmutil_keyRef *ka = a, *kb = b;
+  size_t n = ka->len < kb->len ? ka->len : kb->len;
+  int rc = memcmp(ka->name, kb->name, n);
+  if (rc == 0 && ka->len != kb->len) {
+    rc = ka->len < kb->len ? -1 : 1;
+  }
+  return rc ? rc : ka->ix - kb->ix;
+}
+
+int RMUtil_SortByKey(RedisModuleString **argv, int argc, int offset, int step, int *order) {
+  int ngroups = (argc - offset) / step;
+  if (ngroups <= 0) {
+    return 0;
+  }
+  rmutil_keyRef *refs = RedisModule_Alloc(ngroups * sizeof(*refs));
+  for (int i = 0; i < ngroups; i++) {
+    refs[i].ix = offset + i * step;
+    refs[i].name = RedisModule_StringPtrLen(argv[refs[i].ix], &refs[i].len);
+  }
+  qsort(refs, ngroups, sizeof(*refs), rmutil_cmpKeyRef);
+
+  int nkeys = 0;
+  for (int i = 0; i < ngroups; i++) {
+    order[i] = refs[i].ix;
+    if (i == 0 || refs[i].len != refs[i - 1].len ||
+        memcmp(refs[i].name, refs[i - 1].name, refs[i].len)) {
+      nkeys++;
+    }
+  }
+  RedisModule_Free(refs);
+  return nkeys;
+}
+
+int RMUtil_ParseIntItem(RedisModuleString *arg, uint64_t *item) {
+  long long ll;
+  if (RedisModule_StringToLongLong(arg, &ll) == REDISMODULE_OK) {
+    *item = (uint64_t)ll;
+    return REDISMODULE_OK;
+  }
+  // Unsigned values above LLONG_MAX
+  size_t len;
+  const char *s = RedisModule_StringPtrLen(arg, &len);
+  if (len == 0 || len > 20 || s[0] < '1' || s[0] > '9') {
+    return REDISMODULE_ERR;
+  }
+  uint64_t v = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned digit = s[i] - '0';
+    if (digit > 9 || v > (UINT64_MAX - digit) / 10) {
+      return REDISMODULE_ERR;
+    }
+    v = v * 10 + digit;
+  }
+  *item = v;
+  return REDISMODULE_OK;
+}
+
+const char *RMUtil_PackedIntItems(RedisModuleString *arg, size_t *n) {
+  size_t len;
+  const char *s = RedisModule_StringPtrLen(arg, &len);
+  if (len == 0 || len % 8) {
+    return NULL;
+  }
+  *n = len / 8;
+  return s;
+}
+
+long long RMUtil_ParseIntItems(RedisModuleString **argv, int argc, uint64_t **items) {
+  *items = NULL;
+  if (argc < 1) {
+    return -1;
+  }
+  size_t len;
+  const char *first = RedisModule_StringPtrLen(argv[0], &len);
+  if (len != 6 || strncasecmp(first, "PACKED", 6)) {
+    *items = RedisModule_Alloc(argc * sizeof(**items));
+    for (int i = 0; i < argc; i++) {
+      if (RMUtil_ParseIntItem(argv[i], *items + i) != REDISMODULE_OK) {
+        goto fail;
+      }
+    }
+    return argc;
+  }
+
+  size_t total = 0, n;
+  for (int i = 1; i < argc; i++) {
+    if (!RMUtil_PackedIntItems(argv[i], &n)) {
+      return -1;
+    }
+    total += n;
+  }
+  if (total == 0) {
+    return -1;
+  }
+  *items = RedisModule_Alloc(total * sizeof(**items));
+  total = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *packed = RMUtil_PackedIntItems(argv[i], &n);
+    for (size_t j = 0; j < n; j++) {
+      (*items)[total++] = RMUtil_PackedIntItem(packed, j);
+    }
+  }
+  return total;
+
+fail:
+  RedisModule_Free(*items);
+  *items = NULL;
+  return -1;
+}
+
 void RMUtil_DefaultAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
   RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
   RedisModuleCallReply *rep = RedisModule_Call(ctx, "DUMP", "s", key);
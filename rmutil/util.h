@@ -72,6 +72,46 @@ int rmutil_vparseArgs(RedisModuleString **argv, int argc, int offset, const char
 RedisModuleString **RMUtil_ParseVarArgs(RedisModuleString **argv, int argc, int offset,
                                         const char *keyword, size_t *nargs);
 
+/** Returns 1 if both strings hold the same bytes, 0 otherwise */
+int RMUtil_StringEquals(RedisModuleString *s1, RedisModuleString *s2);
+
+/**
+ * Order the groups of `step` arguments starting at argv[offset], each beginning with
+ * a key name, by key, keeping the relative order of groups on the same key. This
+ * lets commands taking (key, args..) groups for many keys handle each key once.
+ * `order` receives the argv index of each group's key and must have room for
+ * (argc - offset) / step entries. Returns the number of distinct keys.
+ */
+int RMUtil_SortByKey(RedisModuleString **argv, int argc, int offset, int step, int *order);
+
+/**
+ * Parse a 64 bit integer item given in decimal. Negative values are taken as their
+ * two's complement, so -1 and 18446744073709551615 are the same item.
+ * Returns REDISMODULE_OK, or REDISMODULE_ERR if `arg` is not such an integer.
+ */
+int RMUtil_ParseIntItem(RedisModuleString *arg, uint64_t *item);
+
+/**
+ * Access the 64 bit integer items packed in `arg`, 8 little endian bytes each.
+ * Read them with RMUtil_PackedIntItem. Returns NULL if the length of `arg` is not
+ * a non-zero multiple of 8, otherwise sets `n` to the number of items.
+ */
+const char *RMUtil_PackedIntItems(RedisModuleString *arg, size_t *n);
+
+static inline uint64_t RMUtil_PackedIntItem(const char *items, size_t i) {
+  const unsigned char *p = (const unsigned char *)items + i * 8;
+  return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+         (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+/**
+ * Parse the integer items of a command: decimal integers as in RMUtil_ParseIntItem,
+ * or, if the first argument is PACKED, the items packed in the arguments after it.
+ * Returns the number of items, stored in a new array in `items` to be freed with
+ * RedisModule_Free, or -1 if an argument is invalid.
+ */
+long long RMUtil_ParseIntItems(RedisModuleString **argv, int argc, uint64_t **items);
+
 /**
  * Default implementation of an AoF rewrite function that simply calls DUMP/RESTORE
  * internally. To use this function, pass it as the .aof_rewrite value in
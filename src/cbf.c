@@ -0,0 +1,169 @@
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+
+#include "cbf.h"
+
+size_t CBF_CountersBytes(const CountingBloom *cbf) { return cbf->inner.bits / 2; }
+
+size_t CBF_Size(const CountingBloom *cbf) { return sizeof(*cbf) + CBF_CountersBytes(cbf); }
+
+CountingBloom *CBF_New(uint64_t capacity, double error) {
+    struct bloom inner;
+    if (capacity < 1 || bloom_init(&inner, capacity, error,
+                                   BLOOM_OPT_FORCE64 | BLOOM_OPT_NOALLOC) != 0 ||
+        inner.hashes > CBF_MAX_HASHES) {
+        return NULL;
+    }
+
+    CountingBloom *cbf = CBF_CALLOC(1, sizeof(*cbf));
+    cbf->inner = inner;
+    cbf->capacity = capacity;
+    cbf->counters = CBF_CALLOC(CBF_CountersBytes(cbf), 1);
+    if (cbf->counters == NULL) {
+        CBF_FREE(cbf);
+        return NULL;
+    }
+    return cbf;
+}
+
+void CBF_Free(CountingBloom *cbf) {
+    CBF_FREE(cbf->counters);
+    CBF_FREE(cbf);
+}
+
+bloom_hashval CBF_Hash(const void *item, size_t len) { return bloom_calc_hash64(item, len); }
+
+/*  Kernels working on the counters at the k positions of one item. They have
+    no data dependent branches, so their cost doesn't depend on the counters.
+    Positions of an item may repeat, in which case the counter is updated once
+    per occurrence, the same way when adding and deleting. */
+
+static inline unsigned counterShift(uint64_t pos) { return (pos & 1) << 2; }
+
+// Increments unsaturated counters, returning the smallest counter before incrementing
+static unsigned incrCounters(uint8_t *counters, const uint64_t *pos, uint32_t k) {
+    unsigned min = CBF_COUNTER_MAX;
+    for (uint32_t i = 0; i < k; i++) {
+        uint8_t *byte = counters + (pos[i] >> 1);
+        unsigned shift = counterShift(pos[i]);
+        unsigned v = (*byte >> shift) & 0xf;
+        min = v < min ? v : min;
+        *byte += (v != CBF_COUNTER_MAX) << shift;
+    }
+    return min;
+}
+
+// Decrements counters which are neither empty nor saturated
+static void decrCounters(uint8_t *counters, const uint64_t *pos, uint32_t k) {
+    for (uint32_t i = 0; i < k; i++) {
+        uint8_t *byte = counters + (pos[i] >> 1);
+        unsigned shift = counterShift(pos[i]);
+        unsigned v = (*byte >> shift) & 0xf;
+        *byte -= (v - 1 < CBF_COUNTER_MAX - 1) << shift;
+    }
+}
+
+// Smallest counter of the item
+static unsigned minCounter(const uint8_t *counters, const uint64_t *pos, uint32_t k) {
+    unsigned min = CBF_COUNTER_MAX;
+    for (uint32_t i = 0; i < k; i++) {
+        unsigned v = (counters[pos[i] >> 1] >> counterShift(pos[i])) & 0xf;
+        min = v < min ? v : min;
+    }
+    return min;
+}
+
+int CBF_Add(CountingBloom *cbf, bloom_hashval hash) {
+    uint64_t pos[CBF_MAX_HASHES];
+    bloom_positions_h(&cbf->inner, hash, pos);
+    cbf->size++;
+    return incrCounters(cbf->counters, pos, cbf->inner.hashes) == 0;
+}
+
+int CBF_Del(CountingBloom *cbf, bloom_hashval hash) {
+    uint64_t pos[CBF_MAX_HASHES];
+    bloom_positions_h(&cbf->inner, hash, pos);
+    if (minCounter(cbf->counters, pos, cbf->inner.hashes) == 0) {
+        return 0;
+    }
+    decrCounters(cbf->counters, pos, cbf->inner.hashes);
+    cbf->size--;
+    return 1;
+}
+
+int CBF_Exists(const CountingBloom *cbf, bloom_hashval hash) {
+    uint64_t pos[CBF_MAX_HASHES];
+    bloom_positions_h(&cbf->inner, hash, pos);
+    return minCounter(cbf->counters, pos, cbf->inner.hashes) > 0;
+}
+
+typedef struct __attribute__((packed)) {
+    uint64_t capacity;
+    double error;
+    uint64_t size;
+    uint64_t bytes;  // Of the counters, checked against the rebuilt filter
+    uint32_t hashes; // Same
+} dumpedCBFHeader;
+
+char *CBF_GetEncodedHeader(const CountingBloom *cbf, size_t *hdrlen) {
+    dumpedCBFHeader *hdr = malloc(sizeof(*hdr));
+    hdr->capacity = cbf->capacity;
+    hdr->error = cbf->inner.error;
+    hdr->size = cbf->size;
+    hdr->bytes = CBF_CountersBytes(cbf);
+    hdr->hashes = cbf->inner.hashes;
+    *hdrlen = sizeof(*hdr);
+    return (char *)hdr;
+}
+
+void CBF_FreeEncodedHeader(char *s) { free(s); }
+
+CountingBloom *CBF_NewFromHeader(const char *buf, size_t bufLen, const char **errmsg) {
+    dumpedCBFHeader hdr;
+    if (bufLen != sizeof(hdr)) {
+        *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+        return NULL; // LCOV_EXCL_LINE
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    CountingBloom *cbf = CBF_New(hdr.capacity, hdr.error);
+    if (cbf == NULL) {
+        *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+        return NULL; // LCOV_EXCL_LINE
+    }
+    if (CBF_CountersBytes(cbf) != hdr.bytes || cbf->inner.hashes != hdr.hashes) {
+        CBF_Free(cbf);
+        *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+        return NULL; // LCOV_EXCL_LINE
+    }
+    cbf->size = hdr.size;
+    return cbf;
+}
+
+const char *CBF_GetEncodedChunk(const CountingBloom *cbf, long long *curIter, size_t *len,
+                                size_t maxChunkSize) {
+    size_t bytes = CBF_CountersBytes(cbf);
+    if (*curIter < CBF_CHUNKITER_INIT || *curIter - CBF_CHUNKITER_INIT >= bytes) {
+        *curIter = CBF_CHUNKITER_DONE;
+        return NULL;
+    }
+
+    size_t offset = *curIter - CBF_CHUNKITER_INIT;
+    *len = bytes - offset < maxChunkSize ? bytes - offset : maxChunkSize;
+    *curIter += *len;
+    return (const char *)cbf->counters + offset;
+}
+
+int CBF_LoadEncodedChunk(CountingBloom *cbf, long long iter, const char *buf, size_t bufLen,
+                         const char **errmsg) {
+    // iter is the one returned with the chunk, past its end
+    iter -= bufLen + CBF_CHUNKITER_INIT;
+    size_t bytes = CBF_CountersBytes(cbf);
+    if (iter < 0 || iter > bytes || bufLen > bytes - iter) {
+        *errmsg = "ERR invalid chunk - Too big for current filter";
+        return -1;
+    }
+
+    memcpy(cbf->counters + iter, buf, bufLen);
+    return 0;
+}
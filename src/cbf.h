@@ -0,0 +1,85 @@
+#ifndef CBF_H
+#define CBF_H
+
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
+
+#include "bloom.h"
+
+#define REDIS_MODULE_TARGET
+#ifdef REDIS_MODULE_TARGET
+#include "redismodule.h"
+#define CBF_CALLOC(count, size) RedisModule_Calloc(count, size)
+#define CBF_FREE(ptr) RedisModule_Free(ptr)
+#else
+#define CBF_CALLOC(count, size) calloc(count, size)
+#define CBF_FREE(ptr) free(ptr)
+#endif
+
+#define CBF_COUNTER_MAX 15
+// Hash functions of the most accurate filter, about 1e-19 error rate
+#define CBF_MAX_HASHES 64
+
+/*  Counting Bloom filter. Each bit of a Bloom filter is replaced by a 4 bit
+    counter, two counters per byte with the low nibble first, so that items can
+    be deleted. The filter has the size and hash positions of a non scaling
+    bloom filter of the same capacity and error rate, and never grows.
+    Counters saturate at CBF_COUNTER_MAX; a saturated counter is never
+    decremented again, trading a little accuracy for no false negatives. */
+typedef struct CountingBloom {
+    struct bloom inner; // Sizes and hash positions only, inner.bf is unused
+    uint64_t capacity;  // As requested, inner.entries may be larger
+    uint64_t size;      // Items added minus items deleted
+    uint8_t *counters;  // inner.bits counters
+} CountingBloom;
+
+/* Creates an empty filter, or returns NULL if the parameters are invalid. */
+CountingBloom *CBF_New(uint64_t capacity, double error);
+
+void CBF_Free(CountingBloom *cbf);
+
+/* Hash of an item, to be passed to the functions below. */
+bloom_hashval CBF_Hash(const void *item, size_t len);
+
+/*  Increments the counters of the item. Returns 1 if the item was not in the
+    filter before, 0 if it (or a collision) was. */
+int CBF_Add(CountingBloom *cbf, bloom_hashval hash);
+
+/*  Decrements the counters of the item if it is in the filter. Returns 1 if it
+    was, 0 if it was not, in which case the filter is unchanged. Deleting an
+    item that was never added may cause false negatives for other items. */
+int CBF_Del(CountingBloom *cbf, bloom_hashval hash);
+
+/* Returns 1 if the item (or a collision) is in the filter, 0 otherwise. */
+int CBF_Exists(const CountingBloom *cbf, bloom_hashval hash);
+
+/* Number of bytes used by the counters, which is what dumps and RDB save. */
+size_t CBF_CountersBytes(const CountingBloom *cbf);
+
+/* Number of bytes used by the filter. */
+size_t CBF_Size(const CountingBloom *cbf);
+
+/*  Encoded header describing the filter, from which CBF_NewFromHeader rebuilds
+    an empty filter of the same shape. Free with CBF_FreeEncodedHeader. */
+char *CBF_GetEncodedHeader(const CountingBloom *cbf, size_t *hdrlen);
+void CBF_FreeEncodedHeader(char *s);
+
+#define CBF_CHUNKITER_INIT 1
+#define CBF_CHUNKITER_DONE 0
+
+/*  Returns the next chunk of counters, see SBChain_GetEncodedChunk. curIter
+    starts at CBF_CHUNKITER_INIT and is set to CBF_CHUNKITER_DONE, with NULL
+    returned, once all the counters were returned. */
+const char *CBF_GetEncodedChunk(const CountingBloom *cbf, long long *curIter, size_t *len,
+                                size_t maxChunkSize);
+
+/*  Creates an empty filter from a header, or returns NULL and sets errmsg if
+    the header is corrupt. */
+CountingBloom *CBF_NewFromHeader(const char *buf, size_t bufLen, const char **errmsg);
+
+/*  Copies a chunk returned by CBF_GetEncodedChunk into the counters. Returns 0
+    on success, nonzero with errmsg set on failure. */
+int CBF_LoadEncodedChunk(CountingBloom *cbf, long long iter, const char *buf, size_t bufLen,
+                         const char **errmsg);
+
+#endif
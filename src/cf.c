@@ -6,11 +6,10 @@
 #include "cuckoo.c"
 #include "cf.h"
 
-// Get the bucket corresponding to the given position. 'offset' is modified to be the
-// actual position (beginning of bucket) where `pos` is mapped to, with respect to
-// the current filter. The filter itself is not returned directly (but can be inferred)
-// via `offset`
-static uint8_t *getBucketPos(const CuckooFilter *cf, long long pos, size_t *offset) {
+// Get the index of the filter holding the bucket at the given position, -1 past the
+// last one. 'offset' is modified to be the actual position (beginning of bucket)
+// where `pos` is mapped to, with respect to that filter.
+static int getBucketFilterIx(const CuckooFilter *cf, long long pos, size_t *offset) {
     // Normalize the pos pointer to the beginning of the filter
     pos--;
     *offset = pos % cf->numBuckets;
@@ -19,24 +18,77 @@ static uint8_t *getBucketPos(const CuckooFilter *cf, long long pos, size_t *offs
 
     if (filterIx >= cf->numFilters) {
         // Last position
-        return NULL;
+        return -1;
     }
 
     if (*offset + 1 == cf->numBuckets) {
         *offset = 0;
         if (++filterIx == cf->numFilters) {
-            return NULL;
+            return -1;
+        }
+    }
+    return filterIx;
+}
+
+// Get the bucket corresponding to the given position, see getBucketFilterIx
+static uint8_t *getBucketPos(const CuckooFilter *cf, long long pos, size_t *offset) {
+    int ix = getBucketFilterIx(cf, pos, offset);
+    return ix < 0 ? NULL : cf->filters[ix].data + *offset;
+}
+
+// Values are dumped after all the buckets, as a byte stream over the value arrays of
+// all sub filters. Positions in that stream start at CF_VALUES_POS.
+// Returns the index of the filter holding 'pos', -1 past the last one. 'offset' is set
+// to the position inside that filter's values.
+static int getValuesFilterIx(const CuckooFilter *cf, long long pos, size_t *offset,
+                             size_t *avail) {
+    pos -= CF_VALUES_POS;
+    for (size_t ii = 0; ii < cf->numFilters; ++ii) {
+        const SubCF *filter = cf->filters + ii;
+        size_t size = CUCKOO_VALUES_SIZE(filter->numBuckets * filter->bucketSize,
+                                         filter->valueBits);
+        if (pos < size) {
+            *offset = pos;
+            *avail = size - pos;
+            return ii;
         }
+        pos -= size;
     }
-    return cf->filters[filterIx].data + *offset;
+    return -1;
+}
+
+static uint8_t *getValuesPos(const CuckooFilter *cf, long long pos, size_t *offset,
+                             size_t *avail) {
+    int ix = getValuesFilterIx(cf, pos, offset, avail);
+    return ix < 0 ? NULL : SUBCF_VALUES(&cf->filters[ix]) + *offset;
+}
+
+static const char *getValuesChunk(const CuckooFilter *cf, long long *pos, size_t *buflen,
+                                  size_t bytelimit) {
+    size_t offset, avail;
+    uint8_t *values = getValuesPos(cf, *pos, &offset, &avail);
+    if (!values) {
+        return NULL;
+    }
+    *buflen = avail < bytelimit ? avail : bytelimit;
+    *pos += *buflen;
+    return (const char *)values;
 }
 
 const char *CF_GetEncodedChunk(const CuckooFilter *cf, long long *pos, size_t *buflen,
                                size_t bytelimit) {
+    if (*pos >= CF_VALUES_POS) {
+        return getValuesChunk(cf, pos, buflen, bytelimit);
+    }
+
     size_t offset;
     uint8_t *bucket = getBucketPos(cf, *pos, &offset);
     if (!bucket) {
-        return NULL;
+        if (!CUCKOO_VALUEBITS(cf)) {
+            return NULL;
+        }
+        *pos = CF_VALUES_POS;
+        return getValuesChunk(cf, pos, buflen, bytelimit);
     }
     size_t chunksz = cf->numBuckets - offset;
     size_t max_buckets = (bytelimit / cf->bucketSize);
@@ -48,7 +100,64 @@ const char *CF_GetEncodedChunk(const CuckooFilter *cf, long long *pos, size_t *b
     return (const char *)bucket;
 }
 
+const char *CF_GetPackedChunk(const CuckooFilter *cf, long long *pos, size_t *buflen,
+                              size_t bytelimit, CFUnpackedSub *unpacked) {
+    // Sub filter read by CF_GetEncodedChunk, which moves past the buckets first
+    size_t offset, avail;
+    int ix = -1;
+    if (*pos < CF_VALUES_POS) {
+        ix = getBucketFilterIx(cf, *pos, &offset);
+    }
+    if (ix < 0 && CUCKOO_VALUEBITS(cf)) {
+        ix = getValuesFilterIx(cf, *pos < CF_VALUES_POS ? CF_VALUES_POS : *pos, &offset, &avail);
+    }
+    if (ix < 0 || !cf->filters[ix].packed) {
+        return CF_GetEncodedChunk(cf, pos, buflen, bytelimit);
+    }
+
+    // Reads from a copy of the sub filters, with only this one decoded
+    if (!unpacked->filters) {
+        unpacked->filters = CUCKOO_MALLOC(cf->numFilters * sizeof(*cf->filters));
+        memcpy(unpacked->filters, cf->filters, cf->numFilters * sizeof(*cf->filters));
+    }
+    if (!unpacked->data || unpacked->ix != ix) {
+        if (unpacked->data) {
+            unpacked->filters[unpacked->ix] = cf->filters[unpacked->ix];
+            CUCKOO_FREE(unpacked->data);
+        }
+        MyCuckooBucket *tmp;
+        unpacked->data = (MyCuckooBucket *)CuckooFilter_SubData(cf, ix, &tmp);
+        unpacked->ix = ix;
+        if (!unpacked->data) {
+            return NULL; // LCOV_EXCL_LINE
+        }
+        unpacked->filters[ix].data = unpacked->data;
+        unpacked->filters[ix].packed = 0;
+    }
+    CuckooFilter view = *cf;
+    view.filters = unpacked->filters;
+    return CF_GetEncodedChunk(&view, pos, buflen, bytelimit);
+}
+
+void CF_FreeUnpackedSub(CFUnpackedSub *unpacked) {
+    CUCKOO_FREE(unpacked->data);
+    CUCKOO_FREE(unpacked->filters);
+}
+
 int CF_LoadEncodedChunk(const CuckooFilter *cf, long long pos, const char *data, size_t datalen) {
+    if (pos > CF_VALUES_POS) {
+        // 'pos' is the position after this chunk
+        size_t offset, avail;
+        uint8_t *values;
+        if (!CUCKOO_VALUEBITS(cf) || datalen == 0 || pos - CF_VALUES_POS < datalen ||
+            (values = getValuesPos(cf, pos - datalen, &offset, &avail)) == NULL ||
+            datalen > avail) {
+            return REDISMODULE_ERR;
+        }
+        memcpy(values, data, datalen);
+        return REDISMODULE_OK;
+    }
+
     if (datalen == 0 || datalen % cf->bucketSize != 0) {
         // printf("problem with datalen!\n");
         return REDISMODULE_ERR;
@@ -82,7 +191,23 @@ int CF_LoadEncodedChunk(const CuckooFilter *cf, long long pos, const char *data,
 }
 
 CuckooFilter *CFHeader_Load(const CFHeader *header) {
-    CuckooFilter *filter = RedisModule_Calloc(1, sizeof(*filter));
+    CuckooFilter *filter;
+    SubCF sub = {.numBuckets = header->numFilters ? header->filtersNumBucket[0] : 0,
+                 .bucketSize = header->bucketSize,
+                 .valueBits = header->valueBits};
+    if (header->numFilters == 1 && SUBCF_DATA_SIZE(&sub) <= CUCKOO_INLINE_MAX_BYTES) {
+        filter = newInlineFilter(&sub);
+    } else {
+        filter = RedisModule_Calloc(1, sizeof(*filter));
+        filter->filters = RedisModule_Calloc(header->numFilters, sizeof(*filter->filters));
+        for (size_t ii = 0; ii < header->numFilters; ++ii) {
+            filter->filters[ii].bucketSize = header->bucketSize;
+            filter->filters[ii].numBuckets = header->filtersNumBucket[ii];
+            filter->filters[ii].valueBits = header->valueBits;
+            filter->filters[ii].data =
+                RedisModule_Calloc(SUBCF_DATA_SIZE(&filter->filters[ii]), sizeof(CuckooBucket));
+        }
+    }
     filter->numBuckets = header->numBuckets;
     filter->numFilters = header->numFilters;
     filter->numItems = header->numItems;
@@ -90,13 +215,13 @@ CuckooFilter *CFHeader_Load(const CFHeader *header) {
     filter->bucketSize = header->bucketSize;
     filter->maxIterations = header->maxIterations;
     filter->expansion = header->expansion;
-    filter->filters = RedisModule_Alloc(sizeof(*filter->filters) * header->numFilters);
-    for (size_t ii = 0; ii < filter->numFilters; ++ii) {
-        filter->filters[ii].bucketSize = header->bucketSize;
-        filter->filters[ii].numBuckets = header->filtersNumBucket[ii];
-        filter->filters[ii].data = RedisModule_Calloc(
-            filter->filters[ii].numBuckets * filter->bucketSize, sizeof(CuckooBucket));
-    }
+    filter->intItems = header->intItems;
+    filter->altChunk = header->altChunk;
+    filter->exactBuckets = header->exactBuckets;
+    filter->keyed = header->keyed;
+    filter->hashKey[0] = header->hashKey[0];
+    filter->hashKey[1] = header->hashKey[1];
+    filter->maxBytes = header->maxBytes;
     RedisModule_Free(header->filtersNumBucket);
     return filter;
 }
@@ -108,7 +233,14 @@ void fillCFHeader(CFHeader *header, const CuckooFilter *cf) {
                          .numFilters = cf->numFilters,
                          .bucketSize = cf->bucketSize,
                          .maxIterations = cf->maxIterations,
-                         .expansion = cf->expansion};
+                         .expansion = cf->expansion,
+                         .valueBits = CUCKOO_VALUEBITS(cf),
+                         .intItems = cf->intItems,
+                         .altChunk = cf->altChunk,
+                         .exactBuckets = cf->exactBuckets,
+                         .keyed = cf->keyed,
+                         .hashKey = {cf->hashKey[0], cf->hashKey[1]},
+                         .maxBytes = cf->maxBytes};
     header->filtersNumBucket =
         RedisModule_Calloc(cf->numFilters, sizeof(*header->filtersNumBucket));
     for (size_t ii = 0; ii < header->numFilters; ++ii) {
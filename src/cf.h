@@ -1,11 +1,30 @@
 #ifndef CF_H
 #define CF_H
+#include <stddef.h> // offsetof
 #include "cuckoo.h"
 
+// First dump position of the values of a filter with values
+#define CF_VALUES_POS (1LL << 62)
+
 const char *CF_GetEncodedChunk(const CuckooFilter *cf, long long *pos, size_t *buflen,
                                size_t bytelimit);
 int CF_LoadEncodedChunk(const CuckooFilter *cf, long long pos, const char *data, size_t datalen);
 
+// The packed sub filter last decoded by CF_GetPackedChunk, zero before the first call
+typedef struct {
+    uint16_t ix;
+    MyCuckooBucket *data;
+    SubCF *filters;
+} CFUnpackedSub;
+
+// Same as CF_GetEncodedChunk, for filters that may be packed. Chunks of a packed sub
+// filter are read from its data decoded into 'unpacked', which holds one sub filter at
+// a time, so the filter stays packed. Also returns NULL if packed data can't be
+// decoded. Free 'unpacked' with CF_FreeUnpackedSub once done.
+const char *CF_GetPackedChunk(const CuckooFilter *cf, long long *pos, size_t *buflen,
+                              size_t bytelimit, CFUnpackedSub *unpacked);
+void CF_FreeUnpackedSub(CFUnpackedSub *unpacked);
+
 typedef struct __attribute__((packed)) {
     uint64_t numItems;
     uint64_t numBuckets;
@@ -15,8 +34,24 @@ typedef struct __attribute__((packed)) {
     uint16_t maxIterations;
     uint16_t expansion;
     uint32_t *filtersNumBucket;
+    uint16_t valueBits;
+    uint16_t intItems;
+    uint16_t altChunk;
+    uint16_t exactBuckets;
+    uint16_t keyed;
+    uint64_t hashKey[2];
+    uint64_t maxBytes;
 } CFHeader;
 
+// Size of headers dumped before valueBits (resp. intItems, altChunk, exactBuckets, keyed,
+// maxBytes) was added
+#define CF_HEADER_NOVALUES_SIZE offsetof(CFHeader, valueBits)
+#define CF_HEADER_NOINTITEMS_SIZE offsetof(CFHeader, intItems)
+#define CF_HEADER_NOALTCHUNK_SIZE offsetof(CFHeader, altChunk)
+#define CF_HEADER_NOEXACT_SIZE offsetof(CFHeader, exactBuckets)
+#define CF_HEADER_NOKEY_SIZE offsetof(CFHeader, keyed)
+#define CF_HEADER_NOMAXBYTES_SIZE offsetof(CFHeader, maxBytes)
+
 CuckooFilter *CFHeader_Load(const CFHeader *header);
 void fillCFHeader(CFHeader *header, const CuckooFilter *cf);
 
@@ -2,9 +2,10 @@
 #include <math.h>   // q, ceil
 #include <stdio.h>  // printf
 #include <stdlib.h> // malloc
+#include <string.h> // memcmp, memmove
 
 #include "cms.h"
-#include "contrib/murmurhash2.h"
+#include "radix_sort.h"
 
 #define min(a,b) \
     ({ __typeof__ (a) _a = (a); \
@@ -12,7 +13,12 @@
        _a < _b ? _a : _b; })
 
 #define BIT64 64
-#define CMS_HASH(item, itemlen, i) MurmurHash2(item, itemlen, i)
+
+// Sparse entries at which the counters take less memory
+static uint32_t sparseLimitFor(size_t width, size_t depth) {
+    size_t limit = width * depth / (depth + 1) / 2;
+    return limit > CMS_SPARSE_MAX_ITEMS ? CMS_SPARSE_MAX_ITEMS : limit;
+}
 
 CMSketch *NewCMSketch(size_t width, size_t depth) {
     assert(width > 0);
@@ -23,11 +29,84 @@ CMSketch *NewCMSketch(size_t width, size_t depth) {
     cms->width = width;
     cms->depth = depth;
     cms->counter = 0;
-    cms->array = CMS_CALLOC(width * depth, sizeof(uint32_t));
+
+    cms->sparseLimit = sparseLimitFor(width, depth);
+    if (cms->sparseLimit == 0) {
+        cms->array = CMS_CALLOC(width * depth, sizeof(uint32_t));
+    }
 
     return cms;
 }
 
+void CMS_Densify(CMSketch *cms) {
+    if (!CMS_IS_SPARSE(cms)) {
+        return;
+    }
+    cms->array = CMS_CALLOC(cms->width * cms->depth, sizeof(uint32_t));
+    for (uint32_t e = 0; e < cms->nsparse; ++e) {
+        const uint32_t *entry = cms->sparse + e * CMS_SPARSE_STRIDE(cms);
+        for (size_t i = 0; i < cms->depth; ++i) {
+            cms->array[entry[i + 1] + (i * cms->width)] += entry[0];
+        }
+    }
+    CMS_FREE(cms->sparse);
+    cms->sparse = NULL;
+    cms->nsparse = 0;
+}
+
+size_t CMS_Size(const CMSketch *cms) {
+    if (CMS_IS_SPARSE(cms)) {
+        return sizeof(*cms) + cms->nsparse * CMS_SPARSE_STRIDE(cms) * sizeof(uint32_t);
+    }
+    return sizeof(*cms) + cms->width * cms->depth * sizeof(uint32_t);
+}
+
+// Value of counter 'col' in 'row', summed over the sparse entries mapping to it
+static uint32_t sparseCounter(const CMSketch *cms, size_t row, uint32_t col) {
+    uint32_t sum = 0;
+    const uint32_t *entry = cms->sparse;
+    for (uint32_t e = 0; e < cms->nsparse; ++e, entry += CMS_SPARSE_STRIDE(cms)) {
+        if (entry[row + 1] == col) {
+            sum += entry[0];
+        }
+    }
+    return sum;
+}
+
+// Returns the entry of the item, adding it if there is room. NULL if full.
+static uint32_t *sparseEntry(CMSketch *cms, SketchHashes *hashes) {
+    size_t stride = CMS_SPARSE_STRIDE(cms);
+    uint32_t *entry = cms->sparse;
+    for (uint32_t e = 0; e < cms->nsparse; ++e, entry += stride) {
+        size_t i = 0;
+        while (i < cms->depth && entry[i + 1] == SketchHashes_Row(hashes, i) % cms->width) {
+            ++i;
+        }
+        if (i == cms->depth) {
+            return entry;
+        }
+    }
+    if (cms->nsparse == cms->sparseLimit) {
+        return NULL;
+    }
+
+    cms->sparse = CMS_REALLOC(cms->sparse, (cms->nsparse + 1) * stride * sizeof(uint32_t));
+    entry = cms->sparse + cms->nsparse++ * stride;
+    entry[0] = 0;
+    for (size_t i = 0; i < cms->depth; ++i) {
+        entry[i + 1] = SketchHashes_Row(hashes, i) % cms->width;
+    }
+    return entry;
+}
+
+static size_t sparseQuery(const CMSketch *cms, SketchHashes *hashes) {
+    size_t minCount = (size_t)-1;
+    for (size_t i = 0; i < cms->depth; ++i) {
+        minCount = min(minCount, sparseCounter(cms, i, SketchHashes_Row(hashes, i) % cms->width));
+    }
+    return minCount;
+}
+
 void CMS_DimFromProb(double error, double delta, size_t *width, size_t *depth) {
     assert(error > 0 && error < 1);
     assert(delta > 0 && delta < 1);
@@ -36,23 +115,51 @@ void CMS_DimFromProb(double error, double delta, size_t *width, size_t *depth) {
     *depth = ceil(log10f(delta) / log10f(0.5));
 }
 
+int CMS_DimFromBytes(size_t bytes, double prob, size_t *width, size_t *depth) {
+    assert(prob > 0 && prob < 1);
+
+    *depth = ceil(log10f(prob) / log10f(0.5));
+    if (bytes <= sizeof(CMSketch)) {
+        return -1;
+    }
+    *width = (bytes - sizeof(CMSketch)) / (*depth * sizeof(uint32_t));
+    // Sparse entries keep columns in 32 bits
+    if (*width > UINT32_MAX) {
+        *width = UINT32_MAX;
+    }
+    return *width ? 0 : -1;
+}
+
 void CMS_Destroy(CMSketch *cms) {
     assert(cms);
 
     CMS_FREE(cms->array);
     cms->array = NULL;
+    CMS_FREE(cms->sparse);
+    cms->sparse = NULL;
 
     CMS_FREE(cms);
 }
 
-size_t CMS_IncrBy(CMSketch *cms, const char *item, size_t itemlen, size_t value) {
+size_t CMS_IncrByHashes(CMSketch *cms, SketchHashes *hashes, size_t value) {
     assert(cms);
-    assert(item);
+    assert(hashes);
+
+    if (CMS_IS_SPARSE(cms)) {
+        uint32_t *entry = sparseEntry(cms, hashes);
+        if (entry) {
+            entry[0] += value;
+            cms->counter += value;
+            return sparseQuery(cms, hashes);
+        }
+        CMS_Densify(cms);
+    }
 
     size_t minCount = (size_t)-1;
 
+    SketchHashes_Fill(hashes, cms->depth);
     for (size_t i = 0; i < cms->depth; ++i) {
-        uint32_t hash = CMS_HASH(item, itemlen, i);
+        uint32_t hash = SketchHashes_Row(hashes, i);
         cms->array[(hash % cms->width) + (i * cms->width)] += value;
         minCount = min(minCount, cms->array[(hash % cms->width) + (i * cms->width)]);
     }
@@ -60,41 +167,144 @@ size_t CMS_IncrBy(CMSketch *cms, const char *item, size_t itemlen, size_t value)
     return minCount;
 }
 
-size_t CMS_Query(CMSketch *cms, const char *item, size_t itemlen) {
-    assert(cms);
+// Positions sorted at once by CMS_IncrByHashesBatch, bounding its scratch memory
+#define CMS_SORTED_MAX_POSITIONS (1 << 22)
+// Counters of the smallest region of the sketch updated at once, a 4KB page
+#define CMS_SORTED_REGION_BITS 10
+
+void CMS_IncrByHashesBatch(CMSketch *cms, SketchHashes *hashes, const size_t *values, size_t n,
+                           size_t *counts) {
+    size_t i = 0;
+    for (; i < n && CMS_IS_SPARSE(cms); ++i) {
+        counts[i] = CMS_IncrByHashes(cms, &hashes[i], values[i]);
+    }
+    const size_t size = cms->width * cms->depth;
+    if (n - i < CMS_SORTED_MIN_BATCH || size * sizeof(uint32_t) < CMS_SORTED_MIN_BYTES) {
+        for (; i < n; ++i) {
+            counts[i] = CMS_IncrByHashes(cms, &hashes[i], values[i]);
+        }
+        return;
+    }
+
+    // Counters are updated one region at a time, each region in item order, so
+    // each item sees its counters as they are right after its own increment
+    const size_t depth = cms->depth;
+    const size_t chunk = CMS_SORTED_MAX_POSITIONS / depth ? CMS_SORTED_MAX_POSITIONS / depth : 1;
+    const unsigned shift = RadixSort_Shift(size, CMS_SORTED_REGION_BITS);
+    const size_t nbuckets = RadixSort_Buckets(size, shift);
+    uint64_t *pos = CMS_CALLOC(2 * chunk * depth, sizeof(*pos));
+    uint64_t *sorted = pos + chunk * depth;
+    uint32_t *order = CMS_CALLOC(chunk * depth, sizeof(*order));
+    size_t *starts = CMS_CALLOC(nbuckets + 1, sizeof(*starts));
+    for (size_t base = i; base < n; base += chunk) {
+        size_t end = base + chunk < n ? base + chunk : n;
+        for (size_t j = base; j < end; ++j) {
+            uint64_t *row = pos + (j - base) * depth;
+            SketchHashes_Fill(&hashes[j], depth);
+            for (size_t r = 0; r < depth; ++r) {
+                row[r] = (SketchHashes_Row(&hashes[j], r) % cms->width) + (r * cms->width);
+            }
+            counts[j] = (size_t)-1;
+            cms->counter += values[j];
+        }
+        size_t m = (end - base) * depth;
+        RadixSort_ByRegion(pos, m, shift, nbuckets, starts, sorted, order);
+        for (size_t e = 0; e < m; ++e) {
+            size_t j = base + order[e] / depth;
+            uint32_t *counter = &cms->array[sorted[e]];
+            *counter += values[j];
+            counts[j] = min(counts[j], *counter);
+        }
+    }
+    CMS_FREE(starts);
+    CMS_FREE(order);
+    CMS_FREE(pos);
+}
+
+size_t CMS_IncrBy(CMSketch *cms, const char *item, size_t itemlen, size_t value) {
     assert(item);
 
+    SketchHashes hashes;
+    SketchHashes_Init(&hashes, item, itemlen);
+    return CMS_IncrByHashes(cms, &hashes, value);
+}
+
+size_t CMS_QueryHashes(CMSketch *cms, SketchHashes *hashes) {
+    assert(cms);
+    assert(hashes);
+
+    if (CMS_IS_SPARSE(cms)) {
+        return sparseQuery(cms, hashes);
+    }
+
     size_t minCount = (size_t)-1;
 
+    SketchHashes_Fill(hashes, cms->depth);
     for (size_t i = 0; i < cms->depth; ++i) {
-        uint32_t hash = CMS_HASH(item, itemlen, i);
+        uint32_t hash = SketchHashes_Row(hashes, i);
         minCount = min(minCount, cms->array[(hash % cms->width) + (i * cms->width)]);
     }
     return minCount;
 }
 
+size_t CMS_Query(CMSketch *cms, const char *item, size_t itemlen) {
+    assert(item);
+
+    SketchHashes hashes;
+    SketchHashes_Init(&hashes, item, itemlen);
+    return CMS_QueryHashes(cms, &hashes);
+}
+
+int CMS_UseItems(CMSketch *cms, int intItems, int adopt) {
+    if (!!cms->intItems == !!intItems) {
+        return 0;
+    }
+    if (cms->counter) {
+        return -1;
+    }
+    if (adopt) {
+        cms->intItems = !!intItems;
+    }
+    return 0;
+}
+
 void CMS_Merge(CMSketch *dest, size_t quantity, const CMSketch **src, const long long *weights) {
     assert(dest);
     assert(src);
     assert(weights);
 
-    size_t itemCount = 0;
     size_t cmsCount = 0;
     size_t width = dest->width;
     size_t depth = dest->depth;
 
-    for (size_t i = 0; i < depth; ++i) {
-        for (size_t j = 0; j < width; ++j) {
-            itemCount = 0;
-            for (size_t k = 0; k < quantity; ++k) {
-                itemCount += src[k]->array[(i * width) + j] * weights[k];
+    // dest may be one of the sources, so sum into a new array
+    uint32_t *array = CMS_CALLOC(width * depth, sizeof(uint32_t));
+    for (size_t k = 0; k < quantity; ++k) {
+        if (CMS_IS_SPARSE(src[k])) {
+            const uint32_t *entry = src[k]->sparse;
+            for (uint32_t e = 0; e < src[k]->nsparse; ++e, entry += depth + 1) {
+                for (size_t i = 0; i < depth; ++i) {
+                    array[(i * width) + entry[i + 1]] += entry[0] * weights[k];
+                }
+            }
+        } else {
+            for (size_t j = 0; j < width * depth; ++j) {
+                array[j] += src[k]->array[j] * weights[k];
             }
-            dest->array[(i * width) + j] = itemCount;
         }
     }
+    CMS_FREE(dest->array);
+    CMS_FREE(dest->sparse);
+    dest->sparse = NULL;
+    dest->nsparse = 0;
+    dest->array = array;
 
     for (size_t i = 0; i < quantity; ++i) {
         cmsCount += src[i]->counter * weights[i];
+        // Sources that counted anything all take the same kind of items
+        if (src[i]->counter) {
+            dest->intItems = src[i]->intItems;
+        }
     }
     dest->counter = cmsCount;
 }
@@ -104,6 +314,78 @@ void CMS_MergeParams(mergeParams params) {
               (const long long *)params.weights);
 }
 
+// Sums two counters, saturating rather than wrapping so that no count shrinks
+static inline uint32_t addCounters(uint32_t a, uint32_t b) {
+    uint32_t sum = a + b;
+    return sum < b ? UINT32_MAX : sum;
+}
+
+// Folds the sparse entries, merging those of items that now share all their counters
+static void resizeSparse(CMSketch *cms, size_t width) {
+    const size_t stride = CMS_SPARSE_STRIDE(cms);
+    uint32_t n = 0;
+    for (uint32_t e = 0; e < cms->nsparse; ++e) {
+        uint32_t *entry = cms->sparse + e * stride;
+        for (size_t i = 0; i < cms->depth; ++i) {
+            entry[i + 1] %= width;
+        }
+        uint32_t *same = cms->sparse;
+        uint32_t k = 0;
+        for (; k < n; ++k, same += stride) {
+            if (memcmp(same + 1, entry + 1, cms->depth * sizeof(uint32_t)) == 0) {
+                same[0] = addCounters(same[0], entry[0]);
+                break;
+            }
+        }
+        if (k == n) {
+            memmove(cms->sparse + n++ * stride, entry, stride * sizeof(uint32_t));
+        }
+    }
+    cms->nsparse = n;
+    cms->width = width;
+    cms->sparseLimit = sparseLimitFor(width, cms->depth);
+    if (n > cms->sparseLimit || cms->sparseLimit == 0) {
+        CMS_Densify(cms);
+    } else if (n == 0) {
+        CMS_FREE(cms->sparse);
+        cms->sparse = NULL;
+    } else {
+        cms->sparse = CMS_REALLOC(cms->sparse, n * stride * sizeof(uint32_t));
+    }
+}
+
+int CMS_Resize(CMSketch *cms, size_t width) {
+    assert(cms);
+
+    if (width < 1 || cms->width % width != 0) {
+        return -1;
+    }
+    if (width == cms->width) {
+        return 0;
+    }
+    if (CMS_IS_SPARSE(cms)) {
+        resizeSparse(cms, width);
+        return 0;
+    }
+
+    // Each row is summed into its first 'width' counters, then moved next to
+    // the row before it. Rows only move towards the start of the array.
+    const size_t folds = cms->width / width;
+    for (size_t i = 0; i < cms->depth; ++i) {
+        uint32_t *row = cms->array + i * cms->width;
+        for (size_t k = 1; k < folds; ++k) {
+            const uint32_t *src = row + k * width;
+            for (size_t j = 0; j < width; ++j) {
+                row[j] = addCounters(row[j], src[j]);
+            }
+        }
+        memmove(cms->array + i * width, row, width * sizeof(uint32_t));
+    }
+    cms->width = width;
+    cms->array = CMS_REALLOC(cms->array, width * cms->depth * sizeof(uint32_t));
+    return 0;
+}
+
 
 /************ used for debugging *******************
 void CMS_Print(const CMSketch *cms) {
@@ -3,23 +3,39 @@
 
 #include <stdint.h> // uint32_t
 
+#include "sketch_hash.h"
+
 #define REDIS_MODULE_TARGET
 #ifdef REDIS_MODULE_TARGET 
 #include "redismodule.h"
 #define CMS_CALLOC(count, size) RedisModule_Calloc(count, size)
+#define CMS_REALLOC(ptr, size) RedisModule_Realloc(ptr, size)
 #define CMS_FREE(ptr) RedisModule_Free(ptr)
 #else
 #define CMS_CALLOC(count, size) calloc(count, size)
+#define CMS_REALLOC(ptr, size) realloc(ptr, size)
 #define CMS_FREE(ptr) free(ptr)
 #endif
 
+/*  Small sketches start sparse: instead of the full array they keep one entry
+    per distinct item, holding its count followed by its column in each row.
+    Counters are computed from the entries, so answers match the array exactly.
+    The array is allocated once the entries would reach half of its size. */
 typedef struct CMS {
     size_t width;
     size_t depth;
-    uint32_t *array;
+    uint32_t *array;      // NULL while sparse
     size_t counter;
+    uint32_t *sparse;     // nsparse entries of depth + 1 values
+    uint32_t nsparse;
+    uint32_t sparseLimit; // Number of entries that triggers conversion to the array
+    uint32_t intItems;    // Items are 64 bit integers, hashed by SketchHashes_InitInt
 } CMSketch;
 
+#define CMS_IS_SPARSE(cms) ((cms)->array == NULL)
+#define CMS_SPARSE_STRIDE(cms) ((cms)->depth + 1)
+#define CMS_SPARSE_MAX_ITEMS 64
+
 typedef struct {
     CMSketch *dest;
     long long numKeys;
@@ -30,19 +46,50 @@ typedef struct {
 /* Creates a new Count-Min Sketch with dimensions of width * depth */
 CMSketch *NewCMSketch(size_t width, size_t depth);
 
+/* Allocates the counter array of a sparse sketch. No-op if already dense. */
+void CMS_Densify(CMSketch *cms);
+
+/* Number of bytes used by the sketch */
+size_t CMS_Size(const CMSketch *cms);
+
 /*  Recommends width & depth for expected n different items,
     with probability of an error  - prob and over estimation
     error - overEst (use 1 for max accuracy) */
 void CMS_DimFromProb(double overEst, double prob, size_t *width, size_t *depth);
 
+/*  Recommends the depth for probability of an error - prob as CMS_DimFromProb,
+    and the widest rows keeping CMS_Size of the dense sketch within 'bytes'.
+    Returns -1 if not even one column fits. */
+int CMS_DimFromBytes(size_t bytes, double prob, size_t *width, size_t *depth);
+
 void CMS_Destroy(CMSketch *cms);
 
 /*  Increases item count in value.
     Value must be a non negative number */
 size_t CMS_IncrBy(CMSketch *cms, const char *item, size_t strlen, size_t value);
 
+/* Same as CMS_IncrBy, using row hashes that may be shared with other sketches */
+size_t CMS_IncrByHashes(CMSketch *cms, SketchHashes *hashes, size_t value);
+
+/*  Same as calling CMS_IncrByHashes for each of the 'n' items in order, storing
+    what it returns in counts[i]. Batches of at least CMS_SORTED_MIN_BATCH items
+    on a sketch of at least CMS_SORTED_MIN_BYTES sort the positions of all their
+    updates and apply them in one sweep over the counters, then derive the count
+    of each item. */
+#define CMS_SORTED_MIN_BATCH 65536
+#define CMS_SORTED_MIN_BYTES (1 << 23)
+void CMS_IncrByHashesBatch(CMSketch *cms, SketchHashes *hashes, const size_t *values, size_t n,
+                           size_t *counts);
+
 /* Returns an estimate counter for item */
 size_t CMS_Query(CMSketch *cms, const char *item, size_t strlen);
+size_t CMS_QueryHashes(CMSketch *cms, SketchHashes *hashes);
+
+/*  Returns 0 if the sketch takes items given as 64 bit integers when 'intItems'
+    is set, or as strings otherwise, -1 if it counted items of the other kind.
+    An empty sketch takes either kind, and with 'adopt' set only takes this kind
+    from then on. */
+int CMS_UseItems(CMSketch *cms, int intItems, int adopt);
 
 /*  Merges multiple CMSketches into a single one.
     All sketches must have identical width and depth.
@@ -51,6 +98,13 @@ size_t CMS_Query(CMSketch *cms, const char *item, size_t strlen);
 void CMS_Merge(CMSketch *dest, size_t quantity, const CMSketch **src, const long long *weights);
 void CMS_MergeParams(mergeParams params);
 
+/*  Shrinks the sketch to 'width' counters per row, which must divide its
+    width. Since an item is counted in column hash % width of each row, the
+    counters of columns j, j + width, j + 2 * width... are summed into column
+    j, giving exactly the counts of a sketch created with the new width.
+    Sums that don't fit a counter stay at UINT32_MAX. Returns 0 on success, -1 if 'width' doesn't divide the current width. */
+int CMS_Resize(CMSketch *cms, size_t width);
+
 /* Help function */
 void CMS_Print(const CMSketch *cms);
 
@@ -0,0 +1,181 @@
+#include <assert.h> // assert
+#include <math.h>   // ceil, log2
+#include <stdlib.h> // calloc
+
+#include "cs.h"
+
+CountSketch *NewCountSketch(size_t width, size_t depth) {
+    assert(width > 0 && width <= CS_MAX_WIDTH);
+    assert(depth > 0);
+
+    CountSketch *cs = CS_CALLOC(1, sizeof(CountSketch));
+    cs->width = width;
+    cs->depth = depth;
+    cs->array = CS_CALLOC(width * depth, sizeof(int64_t));
+    return cs;
+}
+
+void CS_Destroy(CountSketch *cs) {
+    assert(cs);
+
+    CS_FREE(cs->array);
+    CS_FREE(cs);
+}
+
+size_t CS_Size(const CountSketch *cs) {
+    return sizeof(*cs) + cs->width * cs->depth * sizeof(int64_t);
+}
+
+void CS_DimFromProb(double error, double prob, size_t *width, size_t *depth) {
+    assert(error > 0 && error < 1);
+    assert(prob > 0 && prob < 1);
+
+    // Clamped before the conversion, callers reject widths past CS_MAX_WIDTH
+    double w = ceil(3 / (error * error));
+    *width = w > CS_MAX_WIDTH ? CS_MAX_WIDTH + 1 : (size_t)w;
+    *depth = ceil(log2(1 / prob));
+    *depth |= 1;
+}
+
+/*  Sets *sum to a + b. Returns -1 if it falls outside +/-INT64_MAX, which keeps
+    counters negatable and INT64_MIN out of every counter. */
+static inline int addChecked(int64_t a, int64_t b, int64_t *sum) {
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < -INT64_MAX - b)) {
+        return -1;
+    }
+    *sum = a + b;
+    return 0;
+}
+
+// Sets *prod to a * b, same range as addChecked
+static inline int mulChecked(int64_t a, int64_t b, int64_t *prod) {
+    if (a == INT64_MIN || b == INT64_MIN) {
+        return -1;
+    }
+    if (a != 0 && (b > 0 ? b : -b) > INT64_MAX / (a > 0 ? a : -a)) {
+        return -1;
+    }
+    *prod = a * b;
+    return 0;
+}
+
+// Counter of the item in row 'i', and its sign in that row
+static inline int64_t *rowCounter(CountSketch *cs, SketchHashes *hashes, size_t i, int *sign) {
+    uint32_t hash = SketchHashes_Row(hashes, i);
+    *sign = (hash >> 31) ? -1 : 1;
+    return &cs->array[(hash & 0x7fffffff) % cs->width + i * cs->width];
+}
+
+// Median of the signed counters of the item
+static long long medianCount(CountSketch *cs, SketchHashes *hashes) {
+    int64_t buf[SKETCH_HASH_MAX_ROWS];
+    int64_t *est = cs->depth <= SKETCH_HASH_MAX_ROWS ? buf : CS_CALLOC(cs->depth, sizeof(*est));
+
+    // Insertion sort, sketches have few rows
+    for (size_t i = 0; i < cs->depth; ++i) {
+        int sign;
+        int64_t v = *rowCounter(cs, hashes, i, &sign) * sign;
+        size_t j = i;
+        for (; j > 0 && est[j - 1] > v; --j) {
+            est[j] = est[j - 1];
+        }
+        est[j] = v;
+    }
+
+    size_t mid = cs->depth / 2;
+    long long median = est[mid];
+    if (cs->depth % 2 == 0) {
+        // Halved first when the sum could overflow, rounding as (a + b) / 2 does
+        int64_t a = est[mid - 1], b = est[mid];
+        median = (a > 0) == (b > 0) ? a / 2 + b / 2 + (a % 2 + b % 2) / 2 : (a + b) / 2;
+    }
+    if (est != buf) {
+        CS_FREE(est);
+    }
+    return median;
+}
+
+int CS_IncrByHashes(CountSketch *cs, SketchHashes *hashes, long long value, long long *count) {
+    assert(cs);
+    assert(hashes);
+
+    // Every counter is checked before any changes, each row has its own
+    int64_t total, sum;
+    if (value == INT64_MIN || addChecked(cs->counter, value, &total) != 0) {
+        return -1;
+    }
+    SketchHashes_Fill(hashes, cs->depth);
+    for (size_t i = 0; i < cs->depth; ++i) {
+        int sign;
+        int64_t *counter = rowCounter(cs, hashes, i, &sign);
+        if (addChecked(*counter, value * sign, &sum) != 0) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < cs->depth; ++i) {
+        int sign;
+        *rowCounter(cs, hashes, i, &sign) += value * sign;
+    }
+    cs->counter = total;
+    *count = medianCount(cs, hashes);
+    return 0;
+}
+
+int CS_IncrBy(CountSketch *cs, const char *item, size_t itemlen, long long value,
+              long long *count) {
+    assert(item);
+
+    SketchHashes hashes;
+    SketchHashes_Init(&hashes, item, itemlen);
+    return CS_IncrByHashes(cs, &hashes, value, count);
+}
+
+long long CS_QueryHashes(CountSketch *cs, SketchHashes *hashes) {
+    assert(cs);
+    assert(hashes);
+
+    SketchHashes_Fill(hashes, cs->depth);
+    return medianCount(cs, hashes);
+}
+
+long long CS_Query(CountSketch *cs, const char *item, size_t itemlen) {
+    assert(item);
+
+    SketchHashes hashes;
+    SketchHashes_Init(&hashes, item, itemlen);
+    return CS_QueryHashes(cs, &hashes);
+}
+
+int CS_Merge(CountSketch *dest, size_t quantity, const CountSketch **src,
+             const long long *weights) {
+    assert(dest);
+    assert(src);
+    assert(weights);
+
+    size_t size = dest->width * dest->depth;
+    int64_t counter = 0;
+
+    // dest may be one of the sources, so sum into a new array
+    int64_t *array = CS_CALLOC(size, sizeof(int64_t));
+    for (size_t k = 0; k < quantity; ++k) {
+        assert(src[k]->width == dest->width && src[k]->depth == dest->depth);
+        int64_t prod;
+        for (size_t j = 0; j < size; ++j) {
+            if (mulChecked(src[k]->array[j], weights[k], &prod) != 0 ||
+                addChecked(array[j], prod, &array[j]) != 0) {
+                CS_FREE(array);
+                return -1;
+            }
+        }
+        if (mulChecked(src[k]->counter, weights[k], &prod) != 0 ||
+            addChecked(counter, prod, &counter) != 0) {
+            CS_FREE(array);
+            return -1;
+        }
+    }
+    CS_FREE(dest->array);
+    dest->array = array;
+    dest->counter = counter;
+    return 0;
+}
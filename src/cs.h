@@ -0,0 +1,66 @@
+#ifndef CS_H
+#define CS_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // int64_t
+
+#include "sketch_hash.h"
+
+#define REDIS_MODULE_TARGET
+#ifdef REDIS_MODULE_TARGET
+#include "redismodule.h"
+#define CS_CALLOC(count, size) RedisModule_Calloc(count, size)
+#define CS_FREE(ptr) RedisModule_Free(ptr)
+#else
+#define CS_CALLOC(count, size) calloc(count, size)
+#define CS_FREE(ptr) free(ptr)
+#endif
+
+// Columns are taken from the low 31 bits of the row hashes, the sign from the top bit
+#define CS_MAX_WIDTH (1UL << 31)
+
+/*  Count Sketch. Like the Count-Min Sketch, each row adds the increments of an
+    item to one counter, but each row also gives the item a sign of +1 or -1
+    and adds the signed increment. Other items cancel out on average instead of
+    always adding up, so counts may be decremented and the estimate, the median
+    of the signed counters of the item, may be lower as well as higher than the
+    actual count. Rows use the same hashes as the Count-Min Sketch. */
+typedef struct CountSketch {
+    size_t width;
+    size_t depth;
+    int64_t *array;  // depth rows of width counters
+    int64_t counter; // Sum of all increments
+} CountSketch;
+
+/* Creates a new Count Sketch with dimensions of width * depth */
+CountSketch *NewCountSketch(size_t width, size_t depth);
+
+void CS_Destroy(CountSketch *cs);
+
+/* Number of bytes used by the sketch */
+size_t CS_Size(const CountSketch *cs);
+
+/*  Recommends width & depth so that, with probability 1 - prob, an estimate is
+    off by at most 'error' times the root of the sum of squared counts of all
+    items. Depth is odd, so that the median is a single row. */
+void CS_DimFromProb(double error, double prob, size_t *width, size_t *depth);
+
+/*  Adds 'value', which may be negative, to the count of the item and sets
+    *count to the estimate of its count after the update. Returns -1, leaving
+    the sketch unchanged, if a counter would go past +/-INT64_MAX. */
+int CS_IncrBy(CountSketch *cs, const char *item, size_t itemlen, long long value,
+              long long *count);
+int CS_IncrByHashes(CountSketch *cs, SketchHashes *hashes, long long value, long long *count);
+
+/* Returns an estimate of the count of the item */
+long long CS_Query(CountSketch *cs, const char *item, size_t itemlen);
+long long CS_QueryHashes(CountSketch *cs, SketchHashes *hashes);
+
+/*  Sets dest to the sum of the 'quantity' sketches, each multiplied by its
+    weight, which may be negative. All sketches must have the width and depth
+    of dest, which may be one of them. Returns -1, leaving dest unchanged, if
+    a counter would go past +/-INT64_MAX. */
+int CS_Merge(CountSketch *dest, size_t quantity, const CountSketch **src,
+             const long long *weights);
+
+#endif
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include "zero_rle.h"
+#include "siphash.h"
 
 #ifndef CUCKOO_MALLOC
 #define CUCKOO_MALLOC malloc
@@ -13,7 +16,7 @@
 
 //int globalCuckooHash64Bit;
 
-static int CuckooFilter_Grow(CuckooFilter *filter);
+static int CuckooFilter_Grow(CuckooFilter *filter, uint16_t valueBits);
 
 static int isPower2(uint64_t num) {
     return (num & (num - 1)) == 0 && num != 0;
@@ -32,32 +35,236 @@ static uint64_t getNextN2(uint64_t n) {
 }
 
 int CuckooFilter_Init(CuckooFilter *filter, uint64_t capacity, uint16_t bucketSize, uint16_t maxIterations, uint16_t expansion) {
+    return CuckooFilter_InitWithValues(filter, capacity, bucketSize, maxIterations, expansion, 0);
+}
+
+static void initParams(CuckooFilter *filter, uint64_t capacity, uint16_t bucketSize,
+                       uint16_t maxIterations, uint16_t expansion, int exact) {
     memset(filter, 0, sizeof(*filter));
     filter->expansion = getNextN2(expansion);
     filter->bucketSize = bucketSize;
     filter->maxIterations = maxIterations;
-    filter->numBuckets = getNextN2(capacity / bucketSize);
+    if (exact) {
+        filter->exactBuckets = 1;
+        filter->numBuckets = (capacity + bucketSize - 1) / bucketSize;
+    } else {
+        filter->numBuckets = getNextN2(capacity / bucketSize);
+    }
     if (filter->numBuckets == 0) {
         filter->numBuckets = 1; 
     }
-    assert(isPower2(filter->numBuckets));   
+    assert(exact || isPower2(filter->numBuckets));
+}
 
-    if (CuckooFilter_Grow(filter) != 0) {
+int CuckooFilter_InitWithValues(CuckooFilter *filter, uint64_t capacity, uint16_t bucketSize,
+                                uint16_t maxIterations, uint16_t expansion, uint16_t valueBits) {
+    assert(valueBits <= CUCKOO_MAX_VALUEBITS);
+    initParams(filter, capacity, bucketSize, maxIterations, expansion, 0);
+
+    if (CuckooFilter_Grow(filter, valueBits) != 0) {
         return -1;          // LCOV_EXCL_LINE memory failure
     }
     return 0;
 }
 
+// Inline filters are laid out as [CuckooFilter][SubCF][data of the sub filter]
+#define INLINE_SUBCF(cf) ((SubCF *)((cf) + 1))
+
+static int filtersInline(const CuckooFilter *filter) {
+    return filter->numFilters > 0 && filter->filters[0].inlined &&
+           filter->filters == INLINE_SUBCF(filter);
+}
+
+// Allocates an inline filter with a single, zeroed, sub filter shaped as 'sub'
+static CuckooFilter *newInlineFilter(const SubCF *sub) {
+    CuckooFilter *filter = CUCKOO_CALLOC(1, sizeof(*filter) + sizeof(*sub) + SUBCF_DATA_SIZE(sub));
+    if (!filter) {
+        return NULL;        // LCOV_EXCL_LINE memory failure
+    }
+    filter->numFilters = 1;
+    filter->filters = INLINE_SUBCF(filter);
+    filter->filters[0] = *sub;
+    filter->filters[0].data = (MyCuckooBucket *)(filter->filters + 1);
+    filter->filters[0].inlined = 1;
+    return filter;
+}
+
+static CuckooFilter *newFilter(uint64_t capacity, uint16_t bucketSize, uint16_t maxIterations,
+                               uint16_t expansion, uint16_t valueBits, int exact) {
+    assert(valueBits <= CUCKOO_MAX_VALUEBITS);
+    CuckooFilter params;
+    initParams(&params, capacity, bucketSize, maxIterations, expansion, exact);
+
+    SubCF sub = {.numBuckets = params.numBuckets, .bucketSize = bucketSize, .valueBits = valueBits};
+    if (SUBCF_DATA_SIZE(&sub) > CUCKOO_INLINE_MAX_BYTES) {
+        CuckooFilter *filter = CUCKOO_MALLOC(sizeof(*filter));
+        if (!filter) {
+            return NULL;    // LCOV_EXCL_LINE memory failure
+        }
+        *filter = params;
+        if (CuckooFilter_Grow(filter, valueBits) != 0) {
+            CUCKOO_FREE(filter); // LCOV_EXCL_LINE memory failure
+            return NULL;         // LCOV_EXCL_LINE
+        }
+        return filter;
+    }
+
+    CuckooFilter *filter = newInlineFilter(&sub);
+    if (!filter) {
+        return NULL;        // LCOV_EXCL_LINE memory failure
+    }
+    params.numFilters = 1;
+    params.filters = filter->filters;
+    *filter = params;
+    return filter;
+}
+
+CuckooFilter *CuckooFilter_New(uint64_t capacity, uint16_t bucketSize, uint16_t maxIterations,
+                               uint16_t expansion, uint16_t valueBits) {
+    return newFilter(capacity, bucketSize, maxIterations, expansion, valueBits, 0);
+}
+
+CuckooFilter *CuckooFilter_NewExact(uint64_t capacity, uint16_t bucketSize,
+                                    uint16_t maxIterations, uint16_t expansion,
+                                    uint16_t valueBits) {
+    if ((capacity + bucketSize - 1) / bucketSize > UINT32_MAX) {
+        return NULL;
+    }
+    return newFilter(capacity, bucketSize, maxIterations, expansion, valueBits, 1);
+}
+
+CuckooFilter *CuckooFilter_Inline(CuckooFilter *filter) {
+    if (filter->numFilters != 1 || filtersInline(filter) ||
+        SUBCF_DATA_SIZE(&filter->filters[0]) > CUCKOO_INLINE_MAX_BYTES) {
+        return filter;
+    }
+    CuckooFilter *dst = newInlineFilter(&filter->filters[0]);
+    if (!dst) {
+        return filter;      // LCOV_EXCL_LINE memory failure
+    }
+    SubCF *filters = dst->filters;
+    memcpy(filters[0].data, filter->filters[0].data, SUBCF_DATA_SIZE(filters));
+
+    *dst = *filter;
+    dst->filters = filters;
+    CuckooFilter_Free(filter);
+    CUCKOO_FREE(filter);
+    return dst;
+}
+
 void CuckooFilter_Free(CuckooFilter *filter) {
     for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
-        CUCKOO_FREE(filter->filters[ii].data);
+        if (!filter->filters[ii].inlined) {
+            CUCKOO_FREE(filter->filters[ii].data);
+        }
+    }
+    if (!filtersInline(filter)) {
+        CUCKOO_FREE(filter->filters);
+    }
+}
+
+// Packed data is stored as its encoded length followed by the encoding
+size_t CuckooFilter_Pack(CuckooFilter *filter) {
+    size_t saved = 0;
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        SubCF *sub = &filter->filters[ii];
+        uint64_t size = SUBCF_DATA_SIZE(sub);
+        if (sub->packed || sub->inlined || size <= CUCKOO_INLINE_MAX_BYTES) {
+            continue;
+        }
+        uint64_t len = ZeroRLE_Encode(sub->data, size, NULL);
+        if (sizeof(len) + len > size / 4 * 3) {
+            continue;
+        }
+        MyCuckooBucket *packed = CUCKOO_MALLOC(sizeof(len) + len);
+        if (!packed) {
+            continue;       // LCOV_EXCL_LINE memory failure
+        }
+        memcpy(packed, &len, sizeof(len));
+        ZeroRLE_Encode(sub->data, size, packed + sizeof(len));
+        CUCKOO_FREE(sub->data);
+        sub->data = packed;
+        sub->packed = 1;
+        saved += size - sizeof(len) - len;
+    }
+    return saved;
+}
+
+// Decodes the data of a packed sub filter into a new allocation, NULL on failure
+static MyCuckooBucket *decodeSub(const SubCF *sub) {
+    uint64_t len;
+    memcpy(&len, sub->data, sizeof(len));
+    MyCuckooBucket *data = CUCKOO_MALLOC(SUBCF_DATA_SIZE(sub));
+    if (!data || ZeroRLE_Decode(sub->data + sizeof(len), len, data, SUBCF_DATA_SIZE(sub)) != 0) {
+        CUCKOO_FREE(data); // LCOV_EXCL_LINE
+        return NULL;       // LCOV_EXCL_LINE
+    }
+    return data;
+}
+
+const MyCuckooBucket *CuckooFilter_SubData(const CuckooFilter *filter, uint16_t ii,
+                                           MyCuckooBucket **tmp) {
+    const SubCF *sub = &filter->filters[ii];
+    *tmp = NULL;
+    if (!sub->packed) {
+        return sub->data;
+    }
+    return *tmp = decodeSub(sub);
+}
+
+int CuckooFilter_Unpack(CuckooFilter *filter) {
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        SubCF *sub = &filter->filters[ii];
+        if (!sub->packed) {
+            continue;
+        }
+        MyCuckooBucket *data = decodeSub(sub);
+        if (!data) {
+            return -1; // LCOV_EXCL_LINE
+        }
+        CUCKOO_FREE(sub->data);
+        sub->data = data;
+        sub->packed = 0;
+    }
+    return 0;
+}
+
+int CuckooFilter_IsPacked(const CuckooFilter *filter) {
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        if (filter->filters[ii].packed) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t CuckooFilter_DataBytes(const CuckooFilter *filter) {
+    size_t bytes = 0;
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        const SubCF *sub = &filter->filters[ii];
+        if (sub->packed) {
+            uint64_t len;
+            memcpy(&len, sub->data, sizeof(len));
+            bytes += sizeof(len) + len;
+        } else {
+            bytes += SUBCF_DATA_SIZE(sub);
+        }
     }
-    CUCKOO_FREE(filter->filters);
+    return bytes;
 }
 
-static int CuckooFilter_Grow(CuckooFilter *filter) {
-    SubCF *filtersArray = CUCKOO_REALLOC(filter->filters,
+static int CuckooFilter_Grow(CuckooFilter *filter, uint16_t valueBits) {
+    SubCF *filtersArray;
+    if (filtersInline(filter)) {
+        // The first sub filter's data stays in place, only the array moves out
+        filtersArray = CUCKOO_MALLOC(sizeof(*filtersArray) * (filter->numFilters + 1));
+        if (filtersArray) {
+            memcpy(filtersArray, filter->filters, sizeof(*filtersArray) * filter->numFilters);
+        }
+    } else {
+        filtersArray = CUCKOO_REALLOC(filter->filters,
                            sizeof(*filtersArray) * (filter->numFilters + 1));
+    }
 
     if (!filtersArray) {
         return -1;          // LCOV_EXCL_LINE memory failure
@@ -66,8 +273,10 @@ static int CuckooFilter_Grow(CuckooFilter *filter) {
     size_t growth = pow(filter->expansion, filter->numFilters);
     currentFilter->bucketSize = filter->bucketSize;
     currentFilter->numBuckets = filter->numBuckets * growth;
-    currentFilter->data = CUCKOO_CALLOC(currentFilter->numBuckets * filter->bucketSize,
-                                        sizeof(CuckooBucket));
+    currentFilter->valueBits = valueBits;
+    currentFilter->inlined = 0;
+    currentFilter->packed = 0;
+    currentFilter->data = CUCKOO_CALLOC(SUBCF_DATA_SIZE(currentFilter), sizeof(CuckooBucket));
     if (!currentFilter->data) {
         return -1;          // LCOV_EXCL_LINE memory failure
     }
@@ -79,24 +288,93 @@ static int CuckooFilter_Grow(CuckooFilter *filter) {
 
 typedef struct {
     CuckooHash h1;
-    CuckooHash h2;
     CuckooFingerprint fp;
 } LookupParams;
 
-static CuckooHash getAltHash(CuckooFingerprint fp, CuckooHash index) {
-    return ((CuckooHash)(index ^ ((CuckooHash)fp * 0x5bd1e995)));
+/*  Mask of the offset between the two buckets of fingerprint 'fp'. With
+    altChunk set, 3/4 of the fingerprints have both buckets in the same chunk of
+    altChunk buckets, 1/8 within 16 such chunks and 1/8 anywhere in the filter.
+    The few far moves are what keeps the load factor of classic placement. */
+static CuckooHash altMask(uint16_t altChunk, CuckooFingerprint fp) {
+    if (!altChunk || fp % 8 == 0) {
+        return ~(CuckooHash)0;
+    }
+    if (fp % 8 == 1) {
+        return altChunk * 16 - 1;
+    }
+    return altChunk - 1;
+}
+
+static CuckooHash getAltHash(uint16_t altChunk, CuckooFingerprint fp, CuckooHash index) {
+    return ((CuckooHash)(index ^ (((CuckooHash)fp * 0x5bd1e995) & altMask(altChunk, fp))));
 }
 
 static void getLookupParams(CuckooHash hash, LookupParams *params) {
     params->fp = hash % 255 + 1;
-
     params->h1 = hash;
-    params->h2 = getAltHash(params->fp, params->h1);
-    // assert(getAltHash(params->fp, params->h2, numBuckets) == params->h1);
 }
 
-static uint32_t SubCF_GetIndex(const SubCF *subCF, CuckooHash hash) {
-    return (hash % subCF->numBuckets) * subCF->bucketSize;
+/*  First bucket of 'hash' in 'sub'. Exact sized filters reduce the high half of
+    the hash by a multiplication and shift instead of a division. */
+static uint32_t SubCF_Bucket(const CuckooFilter *cf, const SubCF *sub, CuckooHash hash) {
+    if (cf->exactBuckets) {
+        return ((hash >> 32) * sub->numBuckets) >> 32;
+    }
+    return hash & (sub->numBuckets - 1);
+}
+
+/*  Other bucket of fingerprint 'fp' found in 'bucket', so that the alternate of
+    the alternate is the bucket itself. Power of two sized filters XOR an offset;
+    exact sized ones reflect the bucket as N - 1 - bucket - offset (mod N). Their
+    offset is a multiple of the ratio between the size of 'sub' and the first sub
+    filter's, so that dividing by the ratio of sizes maps the two buckets of an
+    item in a larger sub filter onto its two buckets in a smaller one. */
+static uint32_t SubCF_AltBucket(const CuckooFilter *cf, const SubCF *sub, CuckooFingerprint fp,
+                                uint32_t bucket) {
+    uint64_t numBuckets = sub->numBuckets;
+    if (!cf->exactBuckets) {
+        return getAltHash(cf->altChunk, fp, bucket) & (numBuckets - 1);
+    }
+    uint64_t offset = (uint64_t)(uint32_t)(fp * 0x5bd1e995u) * cf->numBuckets >> 32;
+    offset *= numBuckets / cf->numBuckets;
+    int64_t alt = (int64_t)numBuckets - 1 - bucket - (int64_t)offset;
+    return alt < 0 ? alt + numBuckets : alt;
+}
+
+static uint8_t *SubCF_BucketData(const SubCF *sub, uint32_t bucket) {
+    return &sub->data[(uint64_t)bucket * sub->bucketSize];
+}
+
+// Values are packed LSB first and may straddle two bytes
+static uint8_t SubCF_GetValue(const SubCF *filter, uint64_t slotIx) {
+    uint16_t valueBits = filter->valueBits;
+    uint64_t bit = slotIx * valueBits;
+    const uint8_t *p = SUBCF_VALUES(filter) + bit / 8;
+    uint16_t word = p[0];
+    if (bit % 8 + valueBits > 8) {
+        word |= (uint16_t)p[1] << 8;
+    }
+    return (word >> (bit % 8)) & ((1 << valueBits) - 1);
+}
+
+static void SubCF_SetValue(SubCF *filter, uint64_t slotIx, uint8_t value) {
+    uint16_t valueBits = filter->valueBits;
+    uint64_t bit = slotIx * valueBits;
+    uint8_t *p = SUBCF_VALUES(filter) + bit / 8;
+    uint16_t mask = ((1 << valueBits) - 1) << (bit % 8);
+    uint16_t shifted = (uint16_t)value << (bit % 8);
+    p[0] = (p[0] & ~mask) | (shifted & mask);
+    if (bit % 8 + valueBits > 8) {
+        p[1] = (p[1] & ~(mask >> 8)) | ((shifted & mask) >> 8);
+    }
+}
+
+// Places 'fp' and its value in 'slot', which belongs to 'filter'
+static void SubCF_PutSlot(SubCF *filter, uint8_t *slot, CuckooFingerprint fp, uint8_t value) {
+    *slot = fp;
+    if (filter->valueBits) {
+        SubCF_SetValue(filter, slot - filter->data, value);
+    }
 }
 
 static uint8_t *Bucket_Find(CuckooBucket bucket, uint16_t bucketSize, CuckooFingerprint fp) {
@@ -108,12 +386,12 @@ static uint8_t *Bucket_Find(CuckooBucket bucket, uint16_t bucketSize, CuckooFing
     return NULL;
 }
 
-static int Filter_Find(const SubCF *filter, const LookupParams *params) {
+static int Filter_Find(const CuckooFilter *cf, const SubCF *filter, const LookupParams *params) {
     uint8_t bucketSize = filter->bucketSize;
-    uint64_t loc1 = SubCF_GetIndex(filter, params->h1);
-    uint64_t loc2 = SubCF_GetIndex(filter, params->h2);
-    return Bucket_Find(&filter->data[loc1], bucketSize, params->fp) != NULL ||
-           Bucket_Find(&filter->data[loc2], bucketSize, params->fp) != NULL;
+    uint32_t b1 = SubCF_Bucket(cf, filter, params->h1);
+    uint32_t b2 = SubCF_AltBucket(cf, filter, params->fp, b1);
+    return Bucket_Find(SubCF_BucketData(filter, b1), bucketSize, params->fp) != NULL ||
+           Bucket_Find(SubCF_BucketData(filter, b2), bucketSize, params->fp) != NULL;
 }
 
 static int Bucket_Delete(CuckooBucket bucket, uint16_t bucketSize, CuckooFingerprint fp) {
@@ -126,17 +404,18 @@ static int Bucket_Delete(CuckooBucket bucket, uint16_t bucketSize, CuckooFingerp
     return 0;
 }
 
-static int Filter_Delete(const SubCF *filter, const LookupParams *params) {
+static int Filter_Delete(const CuckooFilter *cf, const SubCF *filter,
+                         const LookupParams *params) {
     uint8_t bucketSize = filter->bucketSize;
-    uint64_t loc1 = SubCF_GetIndex(filter, params->h1);
-    uint64_t loc2 = SubCF_GetIndex(filter, params->h2);
-    return Bucket_Delete(&filter->data[loc1], bucketSize, params->fp) ||
-           Bucket_Delete(&filter->data[loc2], bucketSize, params->fp);
+    uint32_t b1 = SubCF_Bucket(cf, filter, params->h1);
+    uint32_t b2 = SubCF_AltBucket(cf, filter, params->fp, b1);
+    return Bucket_Delete(SubCF_BucketData(filter, b1), bucketSize, params->fp) ||
+           Bucket_Delete(SubCF_BucketData(filter, b2), bucketSize, params->fp);
 }
 
 static int CuckooFilter_CheckFP(const CuckooFilter *filter, const LookupParams *params) {
     for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
-        if (Filter_Find(&filter->filters[ii], params)) {
+        if (Filter_Find(filter, &filter->filters[ii], params)) {
             return 1;
         }
     }
@@ -149,6 +428,163 @@ int CuckooFilter_Check(const CuckooFilter *filter, CuckooHash hash) {
     return CuckooFilter_CheckFP(filter, &params);
 }
 
+int CuckooFilter_UseLocalAlt(CuckooFilter *filter) {
+    if (filter->numItems || filter->exactBuckets) {
+        return -1;
+    }
+    uint16_t chunk = 1;
+    while (chunk * 2 * filter->bucketSize <= CUCKOO_ALT_CHUNK_BYTES) {
+        chunk *= 2;
+    }
+    filter->altChunk = chunk;
+    return 0;
+}
+
+int CuckooFilter_SetHashKey(CuckooFilter *filter, const uint64_t key[2]) {
+    if (filter->numItems) {
+        return -1;
+    }
+    filter->keyed = 1;
+    filter->hashKey[0] = key[0];
+    filter->hashKey[1] = key[1];
+    return 0;
+}
+
+int CuckooFilter_UseItems(CuckooFilter *filter, int intItems, int adopt) {
+    if (!!filter->intItems == !!intItems) {
+        return 0;
+    }
+    if (filter->numItems) {
+        return -1;
+    }
+    if (adopt) {
+        filter->intItems = !!intItems;
+    }
+    return 0;
+}
+
+uint64_t CuckooFilter_Bytes(const CuckooFilter *filter) {
+    uint64_t bytes = sizeof(*filter) + filter->numFilters * sizeof(*filter->filters);
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        bytes += SUBCF_DATA_SIZE(&filter->filters[ii]);
+    }
+    return bytes;
+}
+
+// Share of the slots of a sub filter that fill before an insert first fails, in
+// percent, by bucket size. Measured with the default of 20 iterations, at which
+// inserts give up well before the fill rates reached by long eviction chains.
+static const struct {
+    uint16_t bucketSize;
+    uint16_t fillPercent;
+} fillRates[] = {{1, 15}, {2, 30}, {4, 70}, {8, 83}};
+
+#define NUM_FILL_RATES (sizeof(fillRates) / sizeof(*fillRates))
+
+static uint16_t fillPercent(uint16_t bucketSize) {
+    uint16_t percent = fillRates[0].fillPercent;
+    for (size_t ii = 0; ii < NUM_FILL_RATES && fillRates[ii].bucketSize <= bucketSize; ++ii) {
+        percent = fillRates[ii].fillPercent;
+    }
+    return percent;
+}
+
+// Number of buckets of 'bucketSize' slots fitting in 'maxBytes', 0 if less than 2
+static uint64_t bucketsForBytes(uint64_t maxBytes, uint16_t valueBits, int exact,
+                                uint16_t bucketSize) {
+    uint64_t overhead = sizeof(CuckooFilter) + sizeof(SubCF);
+    if (maxBytes <= overhead) {
+        return 0;
+    }
+    SubCF sub = {.bucketSize = bucketSize, .valueBits = valueBits};
+    sub.numBuckets = (maxBytes - overhead) * 8 / ((8 + valueBits) * bucketSize);
+    if (sub.numBuckets > UINT32_MAX) {
+        sub.numBuckets = UINT32_MAX;
+    }
+    // Values round up to whole bytes
+    while (sub.numBuckets && SUBCF_DATA_SIZE(&sub) > maxBytes - overhead) {
+        sub.numBuckets--;
+    }
+    uint64_t numBuckets = sub.numBuckets;
+    if (!exact) {
+        while (numBuckets & (numBuckets - 1)) {
+            numBuckets &= numBuckets - 1;
+        }
+    }
+    return numBuckets < 2 ? 0 : numBuckets;
+}
+
+int CuckooFilter_FitBytes(uint64_t capacity, uint64_t maxBytes, uint16_t valueBits, int exact,
+                          uint16_t *bucketSize, uint64_t *filterCapacity) {
+    for (size_t ii = 0; ii < NUM_FILL_RATES; ++ii) {
+        uint16_t size = *bucketSize ? *bucketSize : fillRates[ii].bucketSize;
+        uint64_t numBuckets = bucketsForBytes(maxBytes, valueBits, exact, size);
+        if (numBuckets && capacity * 100 <= numBuckets * size * fillPercent(size)) {
+            *bucketSize = size;
+            *filterCapacity = numBuckets * size;
+            return 0;
+        }
+        if (*bucketSize) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Items hashed per round by CuckooFilter_GenHashes, bounding its stack use
+#define CUCKOO_HASH_CHUNK 64
+
+CuckooHash CuckooFilter_Hash(const CuckooFilter *filter, const void *s, size_t n) {
+    return filter->keyed ? SipHash13(s, n, filter->hashKey) : CUCKOO_GEN_HASH(s, n);
+}
+
+CuckooHash CuckooFilter_IntHash(const CuckooFilter *filter, uint64_t v) {
+    return filter->keyed ? SipHash13_Int(v, filter->hashKey) : CUCKOO_GEN_INT_HASH(v);
+}
+
+void CuckooFilter_GenHashes(const CuckooFilter *filter, const void *const *items,
+                            const size_t *lens, size_t n, CuckooHash *out) {
+    static const uint64_t seeds[CUCKOO_HASH_CHUNK] = {0};
+    if (filter->keyed) {
+        for (size_t ii = 0; ii < n; ++ii) {
+            out[ii] = SipHash13(items[ii], lens[ii], filter->hashKey);
+        }
+        return;
+    }
+    for (size_t base = 0; base < n; base += CUCKOO_HASH_CHUNK) {
+        size_t count = n - base < CUCKOO_HASH_CHUNK ? n - base : CUCKOO_HASH_CHUNK;
+        MurmurHash64A_Bloom_x(items + base, lens + base, seeds, count, out + base);
+    }
+}
+
+void CuckooFilter_CheckHashes(const CuckooFilter *filter, const CuckooHash *hashes, size_t n,
+                              int *found) {
+    LookupParams params[CUCKOO_PREFETCH_WINDOW];
+    for (size_t base = 0; base < n; base += CUCKOO_PREFETCH_WINDOW) {
+        size_t count = n - base < CUCKOO_PREFETCH_WINDOW ? n - base : CUCKOO_PREFETCH_WINDOW;
+        for (size_t ii = 0; ii < count; ++ii) {
+            getLookupParams(hashes[base + ii], &params[ii]);
+            found[base + ii] = 0;
+        }
+        for (uint16_t jj = 0; jj < filter->numFilters; ++jj) {
+            const SubCF *sub = &filter->filters[jj];
+            for (size_t ii = 0; ii < count; ++ii) {
+                if (!found[base + ii]) {
+                    uint32_t b1 = SubCF_Bucket(filter, sub, params[ii].h1);
+                    uint32_t b2 = SubCF_AltBucket(filter, sub, params[ii].fp, b1);
+                    __builtin_prefetch(SubCF_BucketData(sub, b1), 0, 1);
+                    __builtin_prefetch(SubCF_BucketData(sub, b2), 0, 1);
+                }
+            }
+            for (size_t ii = 0; ii < count; ++ii) {
+                if (!found[base + ii]) {
+                    found[base + ii] = Filter_Find(filter, sub, &params[ii]);
+                }
+            }
+        }
+    }
+}
+
 static uint16_t bucketCount(const CuckooBucket bucket, uint16_t bucketSize, CuckooFingerprint fp) {
     uint16_t ret = 0;
     for (uint16_t ii = 0; ii < bucketSize; ++ii) {
@@ -159,13 +595,14 @@ static uint16_t bucketCount(const CuckooBucket bucket, uint16_t bucketSize, Cuck
     return ret;
 }
 
-static uint64_t subFilterCount(const SubCF *filter, const LookupParams *params) {
+static uint64_t subFilterCount(const CuckooFilter *cf, const SubCF *filter,
+                               const LookupParams *params) {
     uint8_t bucketSize = filter->bucketSize;
-    uint64_t loc1 = SubCF_GetIndex(filter, params->h1);
-    uint64_t loc2 = SubCF_GetIndex(filter, params->h2);
+    uint32_t b1 = SubCF_Bucket(cf, filter, params->h1);
+    uint32_t b2 = SubCF_AltBucket(cf, filter, params->fp, b1);
 
-    return bucketCount(&filter->data[loc1], bucketSize, params->fp) +
-           bucketCount(&filter->data[loc2], bucketSize, params->fp);
+    return bucketCount(SubCF_BucketData(filter, b1), bucketSize, params->fp) +
+           bucketCount(SubCF_BucketData(filter, b2), bucketSize, params->fp);
 }
 
 uint64_t CuckooFilter_Count(const CuckooFilter *filter, CuckooHash hash) {
@@ -173,7 +610,7 @@ uint64_t CuckooFilter_Count(const CuckooFilter *filter, CuckooHash hash) {
     getLookupParams(hash, &params);
     uint64_t ret = 0;
     for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
-        ret += subFilterCount(&filter->filters[ii], &params);
+        ret += subFilterCount(filter, &filter->filters[ii], &params);
     }
     return ret;
 }
@@ -182,7 +619,7 @@ int CuckooFilter_Delete(CuckooFilter *filter, CuckooHash hash) {
     LookupParams params;
     getLookupParams(hash, &params);
     for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
-        if (Filter_Delete(&filter->filters[ii], &params)) {
+        if (Filter_Delete(filter, &filter->filters[ii], &params)) {
             filter->numItems--;
             filter->numDeletes++;
             if (filter->numFilters > 1 && filter->numDeletes > (double)filter->numItems * 0.10) {
@@ -203,26 +640,29 @@ static uint8_t *Bucket_FindAvailable(CuckooBucket bucket, uint16_t bucketSize) {
     return NULL;
 }
 
-static uint8_t *Filter_FindAvailable(SubCF *filter, const LookupParams *params) {
+// Free slot in either of the buckets 'b1' and 'b2' of 'filter', NULL if none
+static uint8_t *Filter_FindAvailable(SubCF *filter, uint32_t b1, uint32_t b2) {
     uint8_t *slot;
     uint8_t bucketSize = filter->bucketSize;
-    uint64_t loc1 = SubCF_GetIndex(filter, params->h1);
-    uint64_t loc2 = SubCF_GetIndex(filter, params->h2);
-    if ((slot = Bucket_FindAvailable(&filter->data[loc1], bucketSize)) ||
-        (slot = Bucket_FindAvailable(&filter->data[loc2], bucketSize))) {
+    if ((slot = Bucket_FindAvailable(SubCF_BucketData(filter, b1), bucketSize)) ||
+        (slot = Bucket_FindAvailable(SubCF_BucketData(filter, b2), bucketSize))) {
         return slot;
     }
     return NULL;
 }
 
 static CuckooInsertStatus Filter_KOInsert(CuckooFilter *filter, SubCF *curFilter, 
-                                          const LookupParams *params);
+                                          const LookupParams *params, uint8_t value);
 
-static CuckooInsertStatus CuckooFilter_InsertFP(CuckooFilter *filter, const LookupParams *params) {
+static CuckooInsertStatus CuckooFilter_InsertFP(CuckooFilter *filter, const LookupParams *params,
+                                                uint8_t value) {
     for (uint16_t ii = filter->numFilters; ii > 0; --ii) {
-        uint8_t *slot = Filter_FindAvailable(&filter->filters[ii - 1], params);
+        SubCF *sub = &filter->filters[ii - 1];
+        uint32_t b1 = SubCF_Bucket(filter, sub, params->h1);
+        uint8_t *slot =
+            Filter_FindAvailable(sub, b1, SubCF_AltBucket(filter, sub, params->fp, b1));
         if (slot) {
-            *slot = params->fp;
+            SubCF_PutSlot(sub, slot, params->fp, value);
             filter->numItems++;
             return CuckooInsert_Inserted;
         }
@@ -230,24 +670,34 @@ static CuckooInsertStatus CuckooFilter_InsertFP(CuckooFilter *filter, const Look
 
     // No space. Time to evict!
     CuckooInsertStatus status =
-        Filter_KOInsert(filter, &filter->filters[filter->numFilters - 1], params);
+        Filter_KOInsert(filter, &filter->filters[filter->numFilters - 1], params, value);
     if (status == CuckooInsert_Inserted) {
         filter->numItems++;
         return CuckooInsert_Inserted;
     }
 
-    if (CuckooFilter_Grow(filter) != 0) {
+    if (filter->maxBytes) {
+        // Size of the sub filter CuckooFilter_Grow would add
+        uint64_t slots = filter->numBuckets * (uint64_t)pow(filter->expansion, filter->numFilters) *
+                         filter->bucketSize;
+        if (CuckooFilter_Bytes(filter) + sizeof(SubCF) + slots +
+                CUCKOO_VALUES_SIZE(slots, CUCKOO_VALUEBITS(filter)) >
+            filter->maxBytes) {
+            return CuckooInsert_NoSpace;
+        }
+    }
+    if (CuckooFilter_Grow(filter, CUCKOO_VALUEBITS(filter)) != 0) {
         return CuckooInsert_MemAllocFailed;
     }
 
     // Try to insert the filter again
-    return CuckooFilter_InsertFP(filter, params);
+    return CuckooFilter_InsertFP(filter, params, value);
 }
 
 CuckooInsertStatus CuckooFilter_Insert(CuckooFilter *filter, CuckooHash hash) {
     LookupParams params;
     getLookupParams(hash, &params);
-    return CuckooFilter_InsertFP(filter, &params);
+    return CuckooFilter_InsertFP(filter, &params, 0);
 }
 
 CuckooInsertStatus CuckooFilter_InsertUnique(CuckooFilter *filter, CuckooHash hash) {
@@ -256,37 +706,86 @@ CuckooInsertStatus CuckooFilter_InsertUnique(CuckooFilter *filter, CuckooHash ha
     if (CuckooFilter_CheckFP(filter, &params)) {
         return CuckooInsert_Exists;
     }
-    return CuckooFilter_InsertFP(filter, &params);
+    return CuckooFilter_InsertFP(filter, &params, 0);
+}
+
+// Returns the first slot matching 'params', searching the oldest filter first
+static uint8_t *CuckooFilter_FindSlot(const CuckooFilter *filter, const LookupParams *params,
+                                      SubCF **subOut) {
+    for (uint16_t ii = 0; ii < filter->numFilters; ++ii) {
+        SubCF *sub = &filter->filters[ii];
+        uint32_t b1 = SubCF_Bucket(filter, sub, params->h1);
+        uint32_t b2 = SubCF_AltBucket(filter, sub, params->fp, b1);
+        uint8_t *slot;
+        if ((slot = Bucket_Find(SubCF_BucketData(sub, b1), sub->bucketSize, params->fp)) ||
+            (slot = Bucket_Find(SubCF_BucketData(sub, b2), sub->bucketSize, params->fp))) {
+            *subOut = sub;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+CuckooInsertStatus CuckooFilter_SetValue(CuckooFilter *filter, CuckooHash hash, uint8_t value) {
+    assert(CUCKOO_VALUEBITS(filter) && value < (1 << CUCKOO_VALUEBITS(filter)));
+    LookupParams params;
+    getLookupParams(hash, &params);
+    SubCF *sub;
+    uint8_t *slot = CuckooFilter_FindSlot(filter, &params, &sub);
+    if (slot) {
+        SubCF_SetValue(sub, slot - sub->data, value);
+        return CuckooInsert_Exists;
+    }
+    return CuckooFilter_InsertFP(filter, &params, value);
 }
 
-static void swapFPs(uint8_t *a, uint8_t *b) {
-    uint8_t temp = *a;
-    *a = *b;
-    *b = temp;
+int CuckooFilter_GetValue(const CuckooFilter *filter, CuckooHash hash, uint8_t *value) {
+    assert(CUCKOO_VALUEBITS(filter));
+    LookupParams params;
+    getLookupParams(hash, &params);
+    SubCF *sub;
+    uint8_t *slot = CuckooFilter_FindSlot(filter, &params, &sub);
+    if (!slot) {
+        return 0;
+    }
+    *value = SubCF_GetValue(sub, slot - sub->data);
+    return 1;
+}
+
+// Swaps the fingerprint and value in 'slot' with 'fp' and 'value'
+static void swapSlot(SubCF *filter, uint8_t *slot, CuckooFingerprint *fp, uint8_t *value) {
+    uint8_t temp = *slot;
+    *slot = *fp;
+    *fp = temp;
+    if (filter->valueBits) {
+        uint64_t slotIx = slot - filter->data;
+        temp = SubCF_GetValue(filter, slotIx);
+        SubCF_SetValue(filter, slotIx, *value);
+        *value = temp;
+    }
 }
 
 static CuckooInsertStatus Filter_KOInsert(CuckooFilter *filter, SubCF *curFilter, 
-                                          const LookupParams *params) {
+                                          const LookupParams *params, uint8_t value) {
     uint16_t maxIterations = filter->maxIterations;
-    uint32_t numBuckets = curFilter->numBuckets;
     uint16_t bucketSize = filter->bucketSize;
     CuckooFingerprint fp = params->fp;
 
     uint16_t counter = 0;
     uint32_t victimIx =  0;
-    uint32_t ii = params->h1 % numBuckets;
+    uint32_t ii = SubCF_Bucket(filter, curFilter, params->h1);
 
     while (counter++ < maxIterations) {
         uint8_t *bucket = &curFilter->data[ii * bucketSize];
-        swapFPs(bucket + victimIx, &fp);
-        ii = getAltHash(fp, ii) % numBuckets;
+        swapSlot(curFilter, bucket + victimIx, &fp, &value);
+        ii = SubCF_AltBucket(filter, curFilter, fp, ii);
         // Insert the new item in potentially the same bucket
         uint8_t *empty = Bucket_FindAvailable(&curFilter->data[ii * bucketSize], bucketSize);
         if (empty) {
             // printf("Found slot. Bucket[%lu], Pos=%lu\n", ii, empty - curFilter[ii]);
             // printf("Old FP Value: %d\n", *empty);
             // printf("Setting FP: %p\n", empty);
-            *empty = fp;
+            SubCF_PutSlot(curFilter, empty, fp, value);
             return CuckooInsert_Inserted;
         }
         victimIx = (victimIx + 1) % bucketSize;
@@ -296,14 +795,373 @@ static CuckooInsertStatus Filter_KOInsert(CuckooFilter *filter, SubCF *curFilter
     counter = 0;
     while (counter++ < maxIterations) {
         victimIx = (victimIx + bucketSize - 1) % bucketSize;
-        ii = getAltHash(fp, ii) % numBuckets;
+        ii = SubCF_AltBucket(filter, curFilter, fp, ii);
         uint8_t *bucket = &curFilter->data[ii * bucketSize];
-        swapFPs(bucket + victimIx, &fp);
+        swapSlot(curFilter, bucket + victimIx, &fp, &value);
     }
 
     return CuckooInsert_NoSpace;
 }
 
+// Buckets visited by a breadth first search of CuckooFilter_BulkLoad
+#define CUCKOO_BULK_BFS_NODES 512
+
+typedef struct {
+    uint32_t bucket;
+    int32_t parent;       // Index of the node whose fingerprint moves here, -1 for a root
+    uint16_t slotIx;      // Slot of that fingerprint in the parent's bucket
+    CuckooFingerprint fp; // That fingerprint, when the search was made
+} BFSNode;
+
+// Moves the fingerprint and value in 'from' to the empty slot 'to'
+static void moveSlot(SubCF *filter, uint8_t *from, uint8_t *to) {
+    uint8_t value = filter->valueBits ? SubCF_GetValue(filter, from - filter->data) : 0;
+    SubCF_PutSlot(filter, to, *from, value);
+    *from = CUCKOO_NULLFP;
+}
+
+// Finds the closest bucket with a free slot reachable from buckets 'b1' and 'b2' by
+// moving fingerprints to their alternate bucket. Returns its node, -1 if none.
+// Slots are read atomically as concurrent loads search while others write.
+static int Filter_BFSFind(const CuckooFilter *cf, const SubCF *filter, uint32_t b1, uint32_t b2,
+                          BFSNode *nodes) {
+    uint16_t bucketSize = filter->bucketSize;
+    int count = 0;
+    nodes[count++] = (BFSNode){.bucket = b1, .parent = -1};
+    nodes[count++] = (BFSNode){.bucket = b2, .parent = -1};
+
+    for (int head = 0; head < count; ++head) {
+        const uint8_t *bucket = &filter->data[(uint64_t)nodes[head].bucket * bucketSize];
+        for (uint16_t ii = 0; ii < bucketSize; ++ii) {
+            CuckooFingerprint fp = __atomic_load_n(&bucket[ii], __ATOMIC_RELAXED);
+            if (fp == CUCKOO_NULLFP) {
+                return head;
+            }
+            if (count == CUCKOO_BULK_BFS_NODES) {
+                continue;
+            }
+            uint32_t alt = SubCF_AltBucket(cf, filter, fp, nodes[head].bucket);
+            // A path through the same bucket twice would move a fingerprint twice
+            int onPath = 0;
+            for (int jj = head; jj >= 0 && !onPath; jj = nodes[jj].parent) {
+                onPath = nodes[jj].bucket == alt;
+            }
+            if (!onPath) {
+                nodes[count++] = (BFSNode){.bucket = alt, .parent = head, .slotIx = ii, .fp = fp};
+            }
+        }
+    }
+    return -1;
+}
+
+// Slot of the fingerprint moving to node 'jj' of a search
+static uint8_t *BFSNode_From(SubCF *filter, const BFSNode *nodes, int jj) {
+    return &filter->data[(uint64_t)nodes[nodes[jj].parent].bucket * filter->bucketSize +
+                         nodes[jj].slotIx];
+}
+
+// Places 'params' in the last sub filter, moving fingerprints along the path found by
+// Filter_BFSFind to free a slot in one of its buckets
+static int Filter_BFSInsert(const CuckooFilter *cf, SubCF *filter, const LookupParams *params,
+                            BFSNode *nodes) {
+    uint16_t bucketSize = filter->bucketSize;
+    uint32_t b1 = SubCF_Bucket(cf, filter, params->h1);
+    int jj = Filter_BFSFind(cf, filter, b1, SubCF_AltBucket(cf, filter, params->fp, b1), nodes);
+    if (jj < 0) {
+        return 0;
+    }
+
+    uint8_t *slot =
+        Bucket_FindAvailable(&filter->data[(uint64_t)nodes[jj].bucket * bucketSize], bucketSize);
+    for (; nodes[jj].parent >= 0; jj = nodes[jj].parent) {
+        uint8_t *from = BFSNode_From(filter, nodes, jj);
+        moveSlot(filter, from, slot);
+        slot = from;
+    }
+    SubCF_PutSlot(filter, slot, params->fp, 0);
+    return 1;
+}
+
+// Number of free slots in 'bucket'
+static uint16_t Bucket_CountFree(const CuckooBucket bucket, uint16_t bucketSize) {
+    uint16_t free = 0;
+    for (uint16_t ii = 0; ii < bucketSize; ++ii) {
+        free += bucket[ii] == CUCKOO_NULLFP;
+    }
+    return free;
+}
+
+// Places the items at 'left' which did not fit in 'sub' at first. Should the filter grow,
+// 'sub' is no longer its last sub filter and regular inserts take over.
+static int placeLeft(CuckooFilter *filter, SubCF *sub, const CuckooHash *hashes,
+                     const uint32_t *left, size_t nleft, BFSNode *nodes) {
+    const uint16_t numFilters = filter->numFilters;
+    LookupParams params;
+    for (size_t ii = 0; ii < nleft; ++ii) {
+        getLookupParams(hashes[left[ii]], &params);
+        if (filter->numFilters == numFilters && Filter_BFSInsert(filter, sub, &params, nodes)) {
+            filter->numItems++;
+        } else if (CuckooFilter_InsertFP(filter, &params, 0) == CuckooInsert_MemAllocFailed) {
+            return -1; // LCOV_EXCL_LINE memory failure
+        }
+    }
+    return 0;
+}
+
+int CuckooFilter_BulkLoad(CuckooFilter *filter, const CuckooHash *hashes, size_t n) {
+    SubCF *sub = &filter->filters[filter->numFilters - 1];
+    const uint16_t bucketSize = sub->bucketSize;
+    uint32_t *left = CUCKOO_MALLOC(n * sizeof(*left));
+    BFSNode *nodes = CUCKOO_MALLOC(CUCKOO_BULK_BFS_NODES * sizeof(*nodes));
+    if (!left || !nodes) {
+        CUCKOO_FREE(left);  // LCOV_EXCL_LINE memory failure
+        CUCKOO_FREE(nodes); // LCOV_EXCL_LINE
+        return -1;          // LCOV_EXCL_LINE
+    }
+
+    // Each item goes to the emptier of its buckets, fetched a window ahead
+    LookupParams params[CUCKOO_PREFETCH_WINDOW];
+    uint8_t *buckets[CUCKOO_PREFETCH_WINDOW][2];
+    size_t nleft = 0;
+    for (size_t base = 0; base < n; base += CUCKOO_PREFETCH_WINDOW) {
+        size_t count = n - base < CUCKOO_PREFETCH_WINDOW ? n - base : CUCKOO_PREFETCH_WINDOW;
+        for (size_t ii = 0; ii < count; ++ii) {
+            getLookupParams(hashes[base + ii], &params[ii]);
+            uint32_t bucket = SubCF_Bucket(filter, sub, params[ii].h1);
+            buckets[ii][0] = SubCF_BucketData(sub, bucket);
+            buckets[ii][1] =
+                SubCF_BucketData(sub, SubCF_AltBucket(filter, sub, params[ii].fp, bucket));
+            __builtin_prefetch(buckets[ii][0], 1, 1);
+            __builtin_prefetch(buckets[ii][1], 1, 1);
+        }
+        for (size_t ii = 0; ii < count; ++ii) {
+            uint8_t *b1 = buckets[ii][0];
+            uint8_t *b2 = buckets[ii][1];
+            uint16_t free1 = Bucket_CountFree(b1, bucketSize);
+            uint16_t free2 = Bucket_CountFree(b2, bucketSize);
+            if (!free1 && !free2) {
+                left[nleft++] = base + ii;
+                continue;
+            }
+            SubCF_PutSlot(sub, Bucket_FindAvailable(free1 >= free2 ? b1 : b2, bucketSize),
+                          params[ii].fp, 0);
+            filter->numItems++;
+        }
+    }
+
+    // Items finding both buckets full are placed by moving others along the
+    // shortest path to a free slot
+    int rc = placeLeft(filter, sub, hashes, left, nleft, nodes);
+
+    CUCKOO_FREE(left);
+    CUCKOO_FREE(nodes);
+    return rc;
+}
+
+/*  Concurrent bulk loads, in the manner of libcuckoo. The buckets of the last sub
+    filter are split in CUCKOO_LOCK_STRIPES ranges, each with its own lock. A worker
+    places an item holding the locks of its two buckets. When both are full, it
+    searches a path to a free slot without locks, then moves the fingerprints of
+    the path one at a time, from its end, holding the locks of the two buckets of
+    each move and checking first that the move is still possible. Every move keeps
+    the filter valid, so a path found out of date is simply searched again. Items
+    not placed after CUCKOO_LOAD_ATTEMPTS searches, or once a search failed, are
+    left to the calling thread, which may grow the filter once the workers are done.
+    Slots are written atomically, being read by the searches of other workers. */
+
+#define CUCKOO_LOCK_STRIPES 4096
+#define CUCKOO_LOAD_ATTEMPTS 8
+
+typedef struct {
+    const CuckooFilter *filter;
+    SubCF *sub;
+    const CuckooHash *hashes;
+    pthread_mutex_t locks[CUCKOO_LOCK_STRIPES];
+    uint32_t bucketsPerStripe;
+    int full; // Set once a search found no free slot, so that others stop searching
+} LoadShared;
+
+typedef struct {
+    LoadShared *shared;
+    size_t begin;
+    size_t end;
+    uint32_t *left; // Items of [begin, end) not placed, at most end - begin
+    size_t nleft;
+    uint64_t numItems;
+    BFSNode nodes[CUCKOO_BULK_BFS_NODES];
+} LoadWorker;
+
+static void lockBuckets(LoadShared *ls, uint32_t b1, uint32_t b2, int lock) {
+    uint32_t s1 = b1 / ls->bucketsPerStripe, s2 = b2 / ls->bucketsPerStripe;
+    // Always taken in the same order, so that workers never wait on each other
+    uint32_t lo = s1 < s2 ? s1 : s2, hi = s1 < s2 ? s2 : s1;
+    if (lock) {
+        pthread_mutex_lock(&ls->locks[lo]);
+        if (hi != lo) {
+            pthread_mutex_lock(&ls->locks[hi]);
+        }
+    } else {
+        if (hi != lo) {
+            pthread_mutex_unlock(&ls->locks[hi]);
+        }
+        pthread_mutex_unlock(&ls->locks[lo]);
+    }
+}
+
+// Moves the fingerprints of the path ending at node 'jj', returning 0 if a move is
+// no longer possible
+static int movePathLocked(LoadShared *ls, BFSNode *nodes, int jj) {
+    SubCF *sub = ls->sub;
+    for (; nodes[jj].parent >= 0; jj = nodes[jj].parent) {
+        uint32_t to = nodes[jj].bucket, from = nodes[nodes[jj].parent].bucket;
+        lockBuckets(ls, from, to, 1);
+        uint8_t *src = BFSNode_From(sub, nodes, jj);
+        uint8_t *dst = Bucket_FindAvailable(&sub->data[(uint64_t)to * sub->bucketSize],
+                                            sub->bucketSize);
+        // Any copy of the fingerprint in 'from' has its alternate bucket in 'to'
+        int ok = dst && *src == nodes[jj].fp;
+        if (ok) {
+            __atomic_store_n(dst, *src, __ATOMIC_RELAXED);
+            __atomic_store_n(src, CUCKOO_NULLFP, __ATOMIC_RELAXED);
+        }
+        lockBuckets(ls, from, to, 0);
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int concurrentInsert(LoadWorker *w, const LookupParams *params) {
+    LoadShared *ls = w->shared;
+    SubCF *sub = ls->sub;
+    uint16_t bucketSize = sub->bucketSize;
+    uint32_t b1 = SubCF_Bucket(ls->filter, sub, params->h1);
+    uint32_t b2 = SubCF_AltBucket(ls->filter, sub, params->fp, b1);
+    uint8_t *bucket1 = &sub->data[(uint64_t)b1 * bucketSize];
+    uint8_t *bucket2 = &sub->data[(uint64_t)b2 * bucketSize];
+
+    for (int attempt = 0; attempt < CUCKOO_LOAD_ATTEMPTS; ++attempt) {
+        lockBuckets(ls, b1, b2, 1);
+        uint16_t free1 = Bucket_CountFree(bucket1, bucketSize);
+        uint16_t free2 = Bucket_CountFree(bucket2, bucketSize);
+        if (free1 || free2) {
+            uint8_t *slot = Bucket_FindAvailable(free1 >= free2 ? bucket1 : bucket2, bucketSize);
+            __atomic_store_n(slot, params->fp, __ATOMIC_RELAXED);
+        }
+        lockBuckets(ls, b1, b2, 0);
+        if (free1 || free2) {
+            return 1;
+        }
+
+        // Frees a slot in one of the buckets, which the next attempt takes unless
+        // another worker was faster
+        if (__atomic_load_n(&ls->full, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+        int jj = Filter_BFSFind(ls->filter, sub, b1, b2, w->nodes);
+        if (jj < 0) {
+            __atomic_store_n(&ls->full, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        movePathLocked(ls, w->nodes, jj);
+    }
+    return 0;
+}
+
+static void *loadWorker(void *arg) {
+    LoadWorker *w = arg;
+    LookupParams params[CUCKOO_PREFETCH_WINDOW];
+    for (size_t base = w->begin; base < w->end; base += CUCKOO_PREFETCH_WINDOW) {
+        size_t count = w->end - base < CUCKOO_PREFETCH_WINDOW ? w->end - base
+                                                             : CUCKOO_PREFETCH_WINDOW;
+        for (size_t ii = 0; ii < count; ++ii) {
+            const SubCF *sub = w->shared->sub;
+            getLookupParams(w->shared->hashes[base + ii], &params[ii]);
+            uint32_t b1 = SubCF_Bucket(w->shared->filter, sub, params[ii].h1);
+            uint32_t b2 = SubCF_AltBucket(w->shared->filter, sub, params[ii].fp, b1);
+            __builtin_prefetch(SubCF_BucketData(sub, b1), 1, 1);
+            __builtin_prefetch(SubCF_BucketData(sub, b2), 1, 1);
+        }
+        for (size_t ii = 0; ii < count; ++ii) {
+            if (concurrentInsert(w, &params[ii])) {
+                w->numItems++;
+            } else {
+                w->left[w->nleft++] = base + ii;
+            }
+        }
+    }
+    return NULL;
+}
+
+int CuckooFilter_BulkLoadConcurrent(CuckooFilter *filter, const CuckooHash *hashes, size_t n,
+                                    int nthreads) {
+    if (nthreads > CUCKOO_MAX_LOAD_THREADS) {
+        nthreads = CUCKOO_MAX_LOAD_THREADS;
+    }
+    // Values share bytes across buckets, so they cannot be written concurrently
+    if (nthreads < 2 || n < (size_t)nthreads * CUCKOO_PREFETCH_WINDOW ||
+        CUCKOO_VALUEBITS(filter)) {
+        return CuckooFilter_BulkLoad(filter, hashes, n);
+    }
+
+    SubCF *sub = &filter->filters[filter->numFilters - 1];
+    LoadShared *ls = CUCKOO_MALLOC(sizeof(*ls));
+    LoadWorker *workers = CUCKOO_CALLOC(nthreads, sizeof(*workers));
+    uint32_t *left = CUCKOO_MALLOC(n * sizeof(*left));
+    if (!ls || !workers || !left) {
+        CUCKOO_FREE(ls);      // LCOV_EXCL_LINE memory failure
+        CUCKOO_FREE(workers); // LCOV_EXCL_LINE
+        CUCKOO_FREE(left);    // LCOV_EXCL_LINE
+        return -1;            // LCOV_EXCL_LINE
+    }
+    ls->filter = filter;
+    ls->sub = sub;
+    ls->hashes = hashes;
+    ls->full = 0;
+    ls->bucketsPerStripe = (sub->numBuckets + CUCKOO_LOCK_STRIPES - 1) / CUCKOO_LOCK_STRIPES;
+    for (int ii = 0; ii < CUCKOO_LOCK_STRIPES; ++ii) {
+        pthread_mutex_init(&ls->locks[ii], NULL);
+    }
+
+    pthread_t threads[CUCKOO_MAX_LOAD_THREADS];
+    int started[CUCKOO_MAX_LOAD_THREADS];
+    for (int ii = 0; ii < nthreads; ++ii) {
+        LoadWorker *w = &workers[ii];
+        w->shared = ls;
+        w->begin = n * ii / nthreads;
+        w->end = n * (ii + 1) / nthreads;
+        w->left = left + w->begin;
+        // The first slice is loaded by the calling thread, as is any whose thread fails to start
+        started[ii] = ii > 0 && pthread_create(&threads[ii], NULL, loadWorker, w) == 0;
+    }
+    for (int ii = 0; ii < nthreads; ++ii) {
+        if (!started[ii]) {
+            loadWorker(&workers[ii]);
+        }
+    }
+
+    size_t nleft = 0;
+    for (int ii = 0; ii < nthreads; ++ii) {
+        if (started[ii]) {
+            pthread_join(threads[ii], NULL);
+        }
+        filter->numItems += workers[ii].numItems;
+        memmove(left + nleft, workers[ii].left, workers[ii].nleft * sizeof(*left));
+        nleft += workers[ii].nleft;
+    }
+    for (int ii = 0; ii < CUCKOO_LOCK_STRIPES; ++ii) {
+        pthread_mutex_destroy(&ls->locks[ii]);
+    }
+
+    int rc = placeLeft(filter, sub, hashes, left, nleft, workers[0].nodes);
+
+    CUCKOO_FREE(ls);
+    CUCKOO_FREE(workers);
+    CUCKOO_FREE(left);
+    return rc;
+}
+
 #define RELOC_EMPTY 0
 #define RELOC_OK 1
 #define RELOC_FAIL -1
@@ -313,22 +1171,28 @@ static CuckooInsertStatus Filter_KOInsert(CuckooFilter *filter, SubCF *curFilter
  */
 static int relocateSlot(CuckooFilter *cf, CuckooBucket bucket, uint16_t filterIx, uint64_t bucketIx,
                         uint16_t slotIx) {
-    LookupParams params = { 0 };
-    if ((params.fp = bucket[slotIx]) == CUCKOO_NULLFP) {
+    CuckooFingerprint fp;
+    if ((fp = bucket[slotIx]) == CUCKOO_NULLFP) {
         // Nothing in this slot.
         return RELOC_EMPTY;
     }
 
-    // Because We try to insert in sub filter with less or equal number of
-    // buckets, our current fingerprint is sufficient
-    params.h1 = bucketIx;
-    params.h2 = getAltHash(params.fp, bucketIx);
+    uint8_t value = 0;
+    if (CUCKOO_VALUEBITS(cf)) {
+        value = SubCF_GetValue(&cf->filters[filterIx], bucket + slotIx - cf->filters[filterIx].data);
+    }
 
     // Look at all the prior filters and attempt to find a home
     for (uint16_t ii = 0; ii < filterIx; ++ii) {
-        uint8_t *slot = Filter_FindAvailable(&cf->filters[ii], &params);
+        SubCF *sub = &cf->filters[ii];
+        // Because we try to insert in sub filter with less or equal number of
+        // buckets, our current bucket is sufficient to find both buckets there
+        uint32_t b1 = cf->exactBuckets
+                          ? bucketIx / (cf->filters[filterIx].numBuckets / sub->numBuckets)
+                          : bucketIx & (sub->numBuckets - 1);
+        uint8_t *slot = Filter_FindAvailable(sub, b1, SubCF_AltBucket(cf, sub, fp, b1));
         if (slot) {
-            *slot = params.fp;
+            SubCF_PutSlot(sub, slot, fp, value);
             bucket[slotIx] = CUCKOO_NULLFP;
             return RELOC_OK;
         }
@@ -344,7 +1208,7 @@ static uint64_t CuckooFilter_CompactSingle(CuckooFilter *cf, uint16_t filterIx)
     int dirty = 0;
     uint64_t numRelocs = 0;
 
-    for (uint64_t bucketIx = 0; bucketIx < cf->numBuckets; ++bucketIx) {
+    for (uint64_t bucketIx = 0; bucketIx < cf->filters[filterIx].numBuckets; ++bucketIx) {
         for (uint16_t slotIx = 0; slotIx < cf->bucketSize; ++slotIx) {
             int status = relocateSlot(cf, &filter[bucketIx * cf->bucketSize], filterIx, bucketIx, slotIx);
             if (status == RELOC_FAIL) {
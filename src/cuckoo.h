@@ -10,6 +10,7 @@
 
 #define CUCKOO_BKTSIZE 2
 #define CUCKOO_NULLFP 0
+#define CUCKOO_MAX_VALUEBITS 8
 //extern int globalCuckooHash64Bit;
 
 typedef uint8_t CuckooFingerprint;
@@ -20,6 +21,11 @@ typedef uint8_t MyCuckooBucket;
 typedef struct {
     uint32_t numBuckets;
     uint8_t bucketSize;
+    uint8_t valueBits;
+    uint8_t inlined; // data shares the allocation of the CuckooFilter, see CuckooFilter_New
+    uint8_t packed;  // data is compressed, see CuckooFilter_Pack
+    // numBuckets * bucketSize fingerprints, followed by their values packed in
+    // valueBits each, if any
     MyCuckooBucket *data;
 } SubCF;
 
@@ -32,10 +38,40 @@ typedef struct {
     uint16_t bucketSize;
     uint16_t maxIterations;
     uint16_t expansion;
+    uint16_t intItems; // items are 64 bit integers hashed with CUCKOO_GEN_INT_HASH
+    uint16_t altChunk; // see CuckooFilter_UseLocalAlt
+    uint16_t exactBuckets; // numBuckets is not rounded to a power of two, see CuckooFilter_NewExact
+    uint16_t keyed; // items are hashed with the secret hashKey, see CuckooFilter_SetHashKey
+    uint64_t hashKey[2];
+    uint64_t maxBytes; // the filter doesn't grow past this CuckooFilter_Bytes, 0 if unbounded
     SubCF *filters;
+    void *idle; // Owned by the caller, which tracks idle filters to pack them
 } CuckooFilter;
 
+// Sub filters up to this size may share the filter's allocation, larger ones may be packed
+#define CUCKOO_INLINE_MAX_BYTES 8192
+
+// Bytes used by the values of 'numSlots' slots
+#define CUCKOO_VALUES_SIZE(numSlots, valueBits) (((uint64_t)(numSlots) * (valueBits) + 7) / 8)
+// Bits of the value stored with each fingerprint, 0 if none. The same for all sub filters
+#define CUCKOO_VALUEBITS(cf) ((cf)->filters[0].valueBits)
+#define SUBCF_VALUES(sub) ((sub)->data + (uint64_t)(sub)->numBuckets * (sub)->bucketSize)
+// Bytes allocated for the fingerprints and values of a sub filter
+#define SUBCF_DATA_SIZE(sub)                                                                       \
+    ((uint64_t)(sub)->numBuckets * (sub)->bucketSize +                                             \
+     CUCKOO_VALUES_SIZE((uint64_t)(sub)->numBuckets * (sub)->bucketSize, (sub)->valueBits))
+
 #define CUCKOO_GEN_HASH(s, n)  MurmurHash64A_Bloom(s, n, 0)
+#define CUCKOO_GEN_INT_HASH(v) MurmurHash64_Int(v, 0)
+
+/* Hash of an item of the filter: CUCKOO_GEN_HASH (resp. CUCKOO_GEN_INT_HASH),
+   or SipHash-1-3 with the secret key of keyed filters */
+CuckooHash CuckooFilter_Hash(const CuckooFilter *filter, const void *s, size_t n);
+CuckooHash CuckooFilter_IntHash(const CuckooFilter *filter, uint64_t v);
+
+/* Same as CuckooFilter_Hash for 'n' items, hashing several of them at once */
+void CuckooFilter_GenHashes(const CuckooFilter *filter, const void *const *items,
+                            const size_t *lens, size_t n, CuckooHash *out);
 
 /*
 #define CUCKOO_GEN_HASH(s, n)                       \
@@ -59,11 +95,105 @@ typedef enum {
 int CuckooFilter_Init(CuckooFilter *filter,
                       uint64_t capacity, uint16_t bucketSize, 
                       uint16_t maxIterations, uint16_t expansion);
+/* Same as CuckooFilter_Init, with a 'valueBits' wide value stored next to every
+   fingerprint. 0 means no values. */
+int CuckooFilter_InitWithValues(CuckooFilter *filter,
+                                uint64_t capacity, uint16_t bucketSize,
+                                uint16_t maxIterations, uint16_t expansion, uint16_t valueBits);
+/* Allocates a filter. If its data takes up to CUCKOO_INLINE_MAX_BYTES, the first
+   sub filter and its data share the filter's allocation. Sub filters added when
+   it grows are allocated separately.
+   Free with CuckooFilter_Free followed by CUCKOO_FREE. Returns NULL on failure. */
+CuckooFilter *CuckooFilter_New(uint64_t capacity, uint16_t bucketSize, uint16_t maxIterations,
+                               uint16_t expansion, uint16_t valueBits);
+/* Same as CuckooFilter_New, with capacity / bucketSize buckets (rounded up)
+   instead of the next power of two. Returns NULL if that is more than 2^32. */
+CuckooFilter *CuckooFilter_NewExact(uint64_t capacity, uint16_t bucketSize,
+                                    uint16_t maxIterations, uint16_t expansion,
+                                    uint16_t valueBits);
+/* Moves a filter with a single sub filter, allocated with CUCKOO_CALLOC, into
+   the layout of CuckooFilter_New. Returns the new filter; 'filter' must not be
+   used afterwards. Other filters are returned unchanged. */
+CuckooFilter *CuckooFilter_Inline(CuckooFilter *filter);
+/* Compresses the data of sub filters larger than CUCKOO_INLINE_MAX_BYTES, for
+   filters that are not expected to be used for a while. Sub filters are only
+   packed if that saves at least a quarter of their size. A packed filter must be
+   unpacked before any other call except CuckooFilter_Free, CuckooFilter_IsPacked,
+   CuckooFilter_DataBytes, CuckooFilter_SubData and CF_GetPackedChunk. Returns the number of bytes saved. */
+size_t CuckooFilter_Pack(CuckooFilter *filter);
+/* Restores the data of packed sub filters. Returns 0 on success. */
+int CuckooFilter_Unpack(CuckooFilter *filter);
+int CuckooFilter_IsPacked(const CuckooFilter *filter);
+/* Data of sub filter 'ii', for reading without unpacking the filter. The data of a
+   packed sub filter is decoded into a new allocation, also set in '*tmp' for the
+   caller to free, otherwise '*tmp' is NULL. Returns NULL if it can't be decoded. */
+const MyCuckooBucket *CuckooFilter_SubData(const CuckooFilter *filter, uint16_t ii,
+                                           MyCuckooBucket **tmp);
+/* Number of bytes used by the data of all sub filters, packed or not */
+size_t CuckooFilter_DataBytes(const CuckooFilter *filter);
 void CuckooFilter_Free(CuckooFilter *filter);
 CuckooInsertStatus CuckooFilter_InsertUnique(CuckooFilter *filter, CuckooHash hash);
 CuckooInsertStatus CuckooFilter_Insert(CuckooFilter *filter, CuckooHash hash);
+/* Sets the value of the first slot matching 'hash', inserting it if there is none.
+   Returns CuckooInsert_Exists if an existing slot was updated. */
+CuckooInsertStatus CuckooFilter_SetValue(CuckooFilter *filter, CuckooHash hash, uint8_t value);
+/* Returns 1 and fills 'value' if a slot matches 'hash', 0 otherwise. */
+int CuckooFilter_GetValue(const CuckooFilter *filter, CuckooHash hash, uint8_t *value);
+/* Same as CuckooFilter_Insert for each of 'n' items, placing them all at once in
+   the last sub filter. Buckets that no more items choose than they have free
+   slots are filled first, repeatedly, then the items left are placed by breadth
+   first searches for the closest free slot. Only items that do not fit this way
+   may grow the filter. Returns 0 on success, -1 on memory failure. */
+int CuckooFilter_BulkLoad(CuckooFilter *filter, const CuckooHash *hashes, size_t n);
+
+// Most threads used by CuckooFilter_BulkLoadConcurrent
+#define CUCKOO_MAX_LOAD_THREADS 64
+
+/* Same as CuckooFilter_BulkLoad, with the items split among 'nthreads' threads,
+   the calling one included, which insert them concurrently in the last sub
+   filter. Items are placed as by CuckooFilter_BulkLoad, possibly in other
+   slots. Filters with values are loaded by CuckooFilter_BulkLoad alone.
+   Returns 0 on success, -1 on memory failure. */
+int CuckooFilter_BulkLoadConcurrent(CuckooFilter *filter, const CuckooHash *hashes, size_t n,
+                                    int nthreads);
 int CuckooFilter_Delete(CuckooFilter *filter, CuckooHash hash);
 int CuckooFilter_Check(const CuckooFilter *filter, CuckooHash hash);
+// Bytes of fingerprints around a bucket in which local placement keeps most alternates
+#define CUCKOO_ALT_CHUNK_BYTES 4096
+
+/* Places the alternate bucket of most items in the same CUCKOO_ALT_CHUNK_BYTES
+   of fingerprints as their first bucket, so that both are usually fetched from
+   the same page. Only an empty filter sized to a power of two can switch;
+   returns -1 otherwise. */
+int CuckooFilter_UseLocalAlt(CuckooFilter *filter);
+/* Hashes the items of the filter with SipHash-1-3 keyed by 'key', so that which
+   items collide can't be predicted without the key. Only an empty filter can
+   switch; returns -1 otherwise. */
+int CuckooFilter_SetHashKey(CuckooFilter *filter, const uint64_t key[2]);
+/* Memory used by an unpacked filter: the filter, its sub filters and their data.
+   This is what maxBytes bounds: when a sub filter would exceed it, inserting
+   fails with CuckooInsert_NoSpace instead. */
+uint64_t CuckooFilter_Bytes(const CuckooFilter *filter);
+/* Picks the bucket size and the capacity to create a filter with, so that it
+   holds 'capacity' items with the lowest error rate within 'maxBytes' of
+   CuckooFilter_Bytes. That is the smallest bucket size at whose expected fill
+   rate they fit, unless *bucketSize is set, in which case it is kept. The
+   capacity fills the budget, with a power of two of buckets unless 'exact'.
+   Returns -1 if the items don't fit. */
+int CuckooFilter_FitBytes(uint64_t capacity, uint64_t maxBytes, uint16_t valueBits, int exact,
+                          uint16_t *bucketSize, uint64_t *filterCapacity);
+/* Returns 0 if the filter takes items given as 64 bit integers when 'intItems' is
+   set, or as strings otherwise, -1 if it holds items of the other kind. An empty
+   filter takes either kind, and with 'adopt' set only takes this kind from then on. */
+int CuckooFilter_UseItems(CuckooFilter *filter, int intItems, int adopt);
+
+// Number of items whose buckets are prefetched ahead of checking them
+#define CUCKOO_PREFETCH_WINDOW 16
+
+/* Sets found[i] as CuckooFilter_Check would for hashes[i], fetching the
+   buckets of a window of items in each sub filter before searching them */
+void CuckooFilter_CheckHashes(const CuckooFilter *filter, const CuckooHash *hashes, size_t n,
+                              int *found);
 uint64_t CuckooFilter_Count(const CuckooFilter *filter, CuckooHash);
 uint64_t CuckooFilter_Compact(CuckooFilter *filter);
 void CuckooFilter_GetInfo(const CuckooFilter *cf, CuckooHash hash, CuckooKey *out);
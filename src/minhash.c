@@ -0,0 +1,143 @@
+#include <assert.h> // assert
+#include <string.h> // memset
+
+#include "minhash.h"
+#include "murmurhash2.h"
+
+#define MH_EMPTY UINT32_MAX
+
+size_t MinHash_DataWords(uint32_t k, uint32_t bits) { return ((size_t)k * bits + 63) / 64; }
+
+size_t MinHash_Size(const MinHash *mh) {
+    return sizeof(MinHash) + MinHash_DataWords(mh->k, mh->bits) * sizeof(uint64_t);
+}
+
+int MinHash_ValidBits(uint32_t bits) {
+    return bits == 1 || bits == 2 || bits == 4 || bits == 8 || bits == 16;
+}
+
+MinHash *MinHash_Alloc(uint32_t k, uint32_t bits) {
+    MinHash *mh = MH_CALLOC(1, sizeof(MinHash) + MinHash_DataWords(k, bits) * sizeof(uint64_t));
+    mh->k = k;
+    mh->bits = bits;
+    return mh;
+}
+
+MinHash *MinHash_Create(uint32_t k) {
+    assert(k > 0);
+    MinHash *mh = MinHash_Alloc(k, MH_FULL_BITS);
+    memset(mh->data, 0xff, MinHash_DataWords(k, MH_FULL_BITS) * sizeof(uint64_t));
+    return mh;
+}
+
+void MinHash_Destroy(MinHash *mh) {
+    assert(mh);
+    MH_FREE(mh);
+}
+
+static inline uint32_t fmix32(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/*  The item is hashed once. Register i uses h1 + i * h2, finalized, as its
+    hash function (Kirsch-Mitzenmacher, as in the bloom filter). The loop has
+    no branches or cross-iteration dependencies so it is vectorized. */
+void MinHash_Add(MinHash *mh, const char *item, size_t len) {
+    assert(mh->bits == MH_FULL_BITS);
+
+    uint64_t hash = MurmurHash64A_Bloom(item, len, 0);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32);
+    uint32_t *regs = (uint32_t *)mh->data;
+    uint32_t k = mh->k;
+    uint32_t i = 0;
+    // fixed-width blocks get vectorized even under -O2's cheap cost model
+    for (; i + 8 <= k; i += 8) {
+        for (uint32_t j = i; j < i + 8; ++j) {
+            uint32_t h = fmix32(h1 + j * h2);
+            regs[j] = h < regs[j] ? h : regs[j];
+        }
+    }
+    for (; i < k; ++i) {
+        uint32_t h = fmix32(h1 + i * h2);
+        regs[i] = h < regs[i] ? h : regs[i];
+    }
+}
+
+void MinHash_Merge(MinHash *dest, const MinHash *src) {
+    assert(dest->k == src->k);
+    assert(dest->bits == MH_FULL_BITS && src->bits == MH_FULL_BITS);
+
+    uint32_t *d = (uint32_t *)dest->data;
+    const uint32_t *s = (const uint32_t *)src->data;
+    uint32_t k = dest->k;
+    for (uint32_t i = 0; i < k; ++i) {
+        d[i] = s[i] < d[i] ? s[i] : d[i];
+    }
+}
+
+static inline uint32_t getRegister(const MinHash *mh, uint32_t i) {
+    if (mh->bits == MH_FULL_BITS) {
+        return ((const uint32_t *)mh->data)[i];
+    }
+    // bits divides 64, so a register never spans two words
+    size_t pos = (size_t)i * mh->bits;
+    return (mh->data[pos / 64] >> (pos % 64)) & ((1U << mh->bits) - 1);
+}
+
+MinHash *MinHash_Compress(const MinHash *mh, uint32_t bits) {
+    assert(MinHash_ValidBits(bits) && bits < mh->bits);
+
+    MinHash *out = MinHash_Alloc(mh->k, bits);
+    uint32_t mask = (1U << bits) - 1;
+    for (uint32_t i = 0; i < mh->k; ++i) {
+        size_t pos = (size_t)i * bits;
+        out->data[pos / 64] |= (uint64_t)(getRegister(mh, i) & mask) << (pos % 64);
+    }
+    return out;
+}
+
+int MinHash_IsEmpty(const MinHash *mh) {
+    if (mh->bits != MH_FULL_BITS) {
+        return 0;
+    }
+    // Every item updates all registers, so they are either all empty or none is
+    const uint32_t *regs = (const uint32_t *)mh->data;
+    for (uint32_t i = 0; i < mh->k; ++i) {
+        if (regs[i] != MH_EMPTY) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*  With b-bit registers, unequal minimums still collide with probability
+    about 2^-b, so the match rate P is corrected: J = (P - 2^-b) / (1 - 2^-b). */
+double MinHash_Similarity(const MinHash *a, const MinHash *b) {
+    assert(a->k == b->k);
+
+    // Empty registers would all match, though empty sets share no items
+    if (MinHash_IsEmpty(a) || MinHash_IsEmpty(b)) {
+        return 0;
+    }
+
+    uint32_t bits = a->bits < b->bits ? a->bits : b->bits;
+    uint32_t mask = bits == MH_FULL_BITS ? MH_EMPTY : (1U << bits) - 1;
+    uint32_t matches = 0;
+    for (uint32_t i = 0; i < a->k; ++i) {
+        matches += (getRegister(a, i) & mask) == (getRegister(b, i) & mask);
+    }
+
+    double p = (double)matches / a->k;
+    if (bits == MH_FULL_BITS) {
+        return p;
+    }
+    double collide = 1.0 / (1U << bits);
+    double j = (p - collide) / (1 - collide);
+    return j < 0 ? 0 : j;
+}
@@ -0,0 +1,68 @@
+#ifndef MINHASH_H
+#define MINHASH_H
+
+#include <stdint.h> // uint32_t
+#include <stddef.h> // size_t
+
+#define REDIS_MODULE_TARGET
+#ifdef REDIS_MODULE_TARGET
+#include "redismodule.h"
+#define MH_CALLOC(count, size) RedisModule_Calloc(count, size)
+#define MH_FREE(ptr) RedisModule_Free(ptr)
+#else
+#define MH_CALLOC(count, size) calloc(count, size)
+#define MH_FREE(ptr) free(ptr)
+#endif
+
+#define MH_MAX_REGISTERS 65536
+#define MH_FULL_BITS 32
+
+/*  MinHash signature of k registers. Each register holds the minimum of one
+    hash function over all items added. A signature can be compressed to
+    b-bit registers (b in 1, 2, 4, 8, 16), in which case registers are packed
+    into 64 bit words, it takes much less space and can no longer be added to
+    or merged into. */
+typedef struct MinHash {
+    uint32_t k;
+    uint32_t bits;
+    uint64_t data[];
+} MinHash;
+
+/* Creates a signature of 'k' empty registers. */
+MinHash *MinHash_Create(uint32_t k);
+
+/* Allocates a zeroed signature of 'k' registers of 'bits' width, e.g. for loading. */
+MinHash *MinHash_Alloc(uint32_t k, uint32_t bits);
+
+void MinHash_Destroy(MinHash *mh);
+
+/* Returns 1 if 'bits' is a valid compression width. */
+int MinHash_ValidBits(uint32_t bits);
+
+/* Updates all registers with 'item'. Signature must not be compressed. */
+void MinHash_Add(MinHash *mh, const char *item, size_t len);
+
+/*  Sets every register of 'dest' to the minimum of itself and 'src'.
+    Both must have the same k and neither can be compressed. */
+void MinHash_Merge(MinHash *dest, const MinHash *src);
+
+/*  Returns a new signature holding the low 'bits' bits of each register.
+    Must not be empty, as empty registers can't be told apart once compressed. */
+MinHash *MinHash_Compress(const MinHash *mh, uint32_t bits);
+
+/*  Returns 1 if no item was added to the signature. Compressed signatures are
+    never empty, see MinHash_Compress. */
+int MinHash_IsEmpty(const MinHash *mh);
+
+/*  Estimates the Jaccard similarity of the two sets. Signatures must have
+    the same k. If their widths differ, the wider is truncated to the narrower.
+    Returns 0 if either set is empty. */
+double MinHash_Similarity(const MinHash *a, const MinHash *b);
+
+/* Number of 64 bit words used by k registers of the given width. */
+size_t MinHash_DataWords(uint32_t k, uint32_t bits);
+
+/* Number of bytes used by the signature. */
+size_t MinHash_Size(const MinHash *mh);
+
+#endif
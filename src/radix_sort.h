@@ -0,0 +1,57 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <string.h> // memset, memmove
+
+/*  Stable radix sort of bit and counter positions by their high bits, used to
+    apply very large batches of updates one region of memory at a time. Each
+    region is small enough to stay in cache while its updates are applied, and
+    regions are visited in address order. Updates of the same region keep the
+    order in which they were generated, so each position sees its updates in
+    the order of the items making them. */
+
+// At most 2^RADIX_SORT_MAX_BUCKET_BITS regions, bounding the bucket table
+#define RADIX_SORT_MAX_BUCKET_BITS 12
+
+/*  Shift giving the region of positions below 'limit', regions spanning at
+    least 2^regionBits positions. */
+static inline unsigned RadixSort_Shift(uint64_t limit, unsigned regionBits) {
+    unsigned keyBits = limit > 1 ? 64 - __builtin_clzll(limit - 1) : 1;
+    if (keyBits > regionBits + RADIX_SORT_MAX_BUCKET_BITS) {
+        return keyBits - RADIX_SORT_MAX_BUCKET_BITS;
+    }
+    return keyBits > regionBits ? regionBits : keyBits;
+}
+
+/*  Number of regions for positions below 'limit', see RadixSort_Shift. */
+static inline size_t RadixSort_Buckets(uint64_t limit, unsigned shift) {
+    return ((limit - 1) >> shift) + 1;
+}
+
+/*  Sorts the 'n' positions by region into 'sorted', writing in 'order' the index
+    each of them had in 'pos'. On return region b holds the entries from
+    starts[b] to starts[b + 1] - 1, in their original order. 'starts' must have
+    room for nbuckets + 1 values. */
+static inline void RadixSort_ByRegion(const uint64_t *pos, size_t n, unsigned shift,
+                                      size_t nbuckets, size_t *starts, uint64_t *sorted,
+                                      uint32_t *order) {
+    memset(starts, 0, (nbuckets + 1) * sizeof(*starts));
+    for (size_t i = 0; i < n; i++) {
+        starts[(pos[i] >> shift) + 1]++;
+    }
+    for (size_t b = 1; b <= nbuckets; b++) {
+        starts[b] += starts[b - 1];
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t dst = starts[pos[i] >> shift]++;
+        sorted[dst] = pos[i];
+        order[dst] = i;
+    }
+    // Each start was advanced to the start of the next region
+    memmove(starts + 1, starts, nbuckets * sizeof(*starts));
+    starts[0] = 0;
+}
+
+#endif
@@ -3,6 +3,12 @@
 #include "cf.h"
 #include "rm_cms.h"
 #include "rm_topk.h"
+#include "cms.h"
+#include "topk.h"
+#include "rm_tdigest.h"
+#include "rm_minhash.h"
+#include "rm_cbf.h"
+#include "rm_cs.h"
 #include "version.h"
 #include "rmutil/util.h"
 
@@ -10,11 +16,23 @@
 #include <strings.h> // strncasecmp
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdio.h> // fopen
 
 #define CF_MAX_ITERATIONS 20
 #define CF_DEFAULT_BUCKETSIZE 2
 #define CF_DEFAULT_EXPANSION 1
+// Smaller CF.BULKLOAD batches are not worth starting threads for, see CF_LOAD_THREADS
+#define CF_LOAD_THREADS_MIN_ITEMS 65536
 #define BF_DEFAULT_EXPANSION 2
+// Autocreated filters up to this capacity start with the sparse encoding
+#define BF_SPARSE_MAX_CAPACITY 1000
+// Most idle filters packed per command, bounding the latency it adds
+#define COLD_PACK_MAX 2
+// Most keys with single item checks queued at once, see BATCH_MAX
+#define BATCH_MAX_KEYS 128
+// Largest accepted BATCH_MAX, bounding the size of each queued batch
+#define BATCH_MAX_ITEMS 4096
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -27,9 +45,19 @@ static double BFDefaultErrorRate = 0.01;
 static size_t BFDefaultInitCapacity = 100;
 static size_t CFDefaultInitCapacity = 1000;
 static size_t CFMaxExpansions = 32;
+static long long CFLoadThreads = 1; // Threads loading large CF.BULKLOAD batches
+static long long ColdAfterMs = 0; // Filters unused for this long are packed, 0 to never pack
+static long long BatchMax = 0;    // Most single item checks answered together, 0 to not batch
 static int rsStrcasecmp(const RedisModuleString *rs1, const char *s2);
 
-typedef enum { SB_OK = 0, SB_MISSING, SB_EMPTY, SB_MISMATCH } lookupStatus;
+typedef enum {
+    SB_OK = 0,
+    SB_MISSING,
+    SB_EMPTY,
+    SB_MISMATCH,
+    SB_INT_ITEMS,   // Items given as strings to a filter of integer items
+    SB_STRING_ITEMS // and the other way around
+} lookupStatus;
 
 typedef struct {
     long long capacity;
@@ -58,12 +86,168 @@ static int getValue(RedisModuleKey *key, RedisModuleType *expType, void **sbout)
     }
 }
 
+/**
+ * Bloom and cuckoo filters which may be packed once idle, most recently used
+ * first. Filters leave the list when packed and are added back, unpacked, when
+ * next used. Packing happens while serving commands, see coldWarm.
+ * The lock is taken as lazy freeing may call the free callbacks from another thread.
+ */
+typedef struct IdleEntry {
+    struct IdleEntry *prev;
+    struct IdleEntry *next;
+    void *value;
+    int isCF;
+    long long atime;
+} IdleEntry;
+
+static IdleEntry *idleHead, *idleTail;
+static pthread_mutex_t idleLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void **idleSlot(void *value, int isCF) {
+    return isCF ? &((CuckooFilter *)value)->idle : &((SBChain *)value)->idle;
+}
+
+static int isPackable(const void *value, int isCF) {
+    if (isCF) {
+        const CuckooFilter *cf = value;
+        for (uint16_t ii = 0; ii < cf->numFilters; ++ii) {
+            if (!cf->filters[ii].inlined &&
+                SUBCF_DATA_SIZE(&cf->filters[ii]) > CUCKOO_INLINE_MAX_BYTES) {
+                return 1;
+            }
+        }
+    } else {
+        const SBChain *sb = value;
+        for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+            // Shared links are nofree, but may be packed once no longer shared
+            const SBLink *link = sb->filters + ii;
+            if ((!link->inner.nofree || link->refs) && link->inner.bytes > SB_INLINE_MAX_BYTES) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void idleUnlink(IdleEntry *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        idleHead = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        idleTail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void idleForget(void *value, int isCF) {
+    if (!ColdAfterMs) {
+        return;
+    }
+    pthread_mutex_lock(&idleLock);
+    IdleEntry *e = *idleSlot(value, isCF);
+    if (e) {
+        idleUnlink(e);
+        RedisModule_Free(e);
+        *idleSlot(value, isCF) = NULL;
+    }
+    pthread_mutex_unlock(&idleLock);
+}
+
+/**
+ * Records a use of the filter, and packs the filters which have been idle for
+ * ColdAfterMs, least recently used first.
+ */
+static void idleTouch(void *value, int isCF) {
+    if (!ColdAfterMs) {
+        return;
+    }
+    long long now = RedisModule_Milliseconds();
+    pthread_mutex_lock(&idleLock);
+    IdleEntry *e = *idleSlot(value, isCF);
+    if (e) {
+        idleUnlink(e);
+    } else if (isPackable(value, isCF)) {
+        e = RedisModule_Calloc(1, sizeof(*e));
+        e->value = value;
+        e->isCF = isCF;
+        *idleSlot(value, isCF) = e;
+    }
+    if (e) {
+        e->atime = now;
+        e->next = idleHead;
+        if (idleHead) {
+            idleHead->prev = e;
+        } else {
+            idleTail = e;
+        }
+        idleHead = e;
+    }
+
+    for (int ii = 0; ii < COLD_PACK_MAX && idleTail && idleTail->atime + ColdAfterMs <= now; ++ii) {
+        IdleEntry *cold = idleTail;
+        if (cold->isCF) {
+            CuckooFilter_Pack(cold->value);
+        } else {
+            SBChain_Pack(cold->value);
+        }
+        idleUnlink(cold);
+        *idleSlot(cold->value, cold->isCF) = NULL;
+        RedisModule_Free(cold);
+    }
+    pthread_mutex_unlock(&idleLock);
+}
+
+/** Unpacks the filter if it was packed while idle, and records its use */
+static void coldWarm(void *value, int isCF) {
+    if (!ColdAfterMs) {
+        return;
+    }
+    int rc = isCF ? CuckooFilter_Unpack(value) : SBChain_Unpack(value);
+    assert(rc == 0);
+    (void)rc;
+    idleTouch(value, isCF);
+}
+
 static int bfGetChain(RedisModuleKey *key, SBChain **sbout) {
-    return getValue(key, BFType, (void **)sbout);
+    int status = getValue(key, BFType, (void **)sbout);
+    if (status == SB_OK) {
+        coldWarm(*sbout, 0);
+    }
+    return status;
 }
 
 static int cfGetFilter(RedisModuleKey *key, CuckooFilter **cfout) {
-    return getValue(key, CFType, (void **)cfout);
+    int status = getValue(key, CFType, (void **)cfout);
+    if (status == SB_OK) {
+        coldWarm(*cfout, 1);
+    }
+    return status;
+}
+
+/**
+ * Same as bfGetChain and cfGetFilter, for commands given items as 64 bit integers
+ * if 'intItems' is set, or as strings otherwise. A filter taking the other kind
+ * of items fails with SB_INT_ITEMS or SB_STRING_ITEMS. With 'adopt' set, an
+ * empty filter takes only this kind of items from then on.
+ */
+static int bfGetItemChain(RedisModuleKey *key, SBChain **sbout, int intItems, int adopt) {
+    int status = bfGetChain(key, sbout);
+    if (status == SB_OK && SBChain_UseItems(*sbout, intItems, adopt) != 0) {
+        return intItems ? SB_STRING_ITEMS : SB_INT_ITEMS;
+    }
+    return status;
+}
+
+static int cfGetItemFilter(RedisModuleKey *key, CuckooFilter **cfout, int intItems, int adopt) {
+    int status = cfGetFilter(key, cfout);
+    if (status == SB_OK && CuckooFilter_UseItems(*cfout, intItems, adopt) != 0) {
+        return intItems ? SB_STRING_ITEMS : SB_INT_ITEMS;
+    }
+    return status;
 }
 
 static const char *statusStrerror(int status) {
@@ -73,6 +257,10 @@ static const char *statusStrerror(int status) {
         return "ERR not found";
     case SB_MISMATCH:
         return REDISMODULE_ERRORMSG_WRONGTYPE;
+    case SB_INT_ITEMS:
+        return "ERR filter takes integer items";
+    case SB_STRING_ITEMS:
+        return "ERR filter takes string items";
     case SB_OK:
         return "ERR item exists";
     default: // LCOV_EXCL_LINE
@@ -80,6 +268,218 @@ static const char *statusStrerror(int status) {
     }
 }
 
+/**
+ * Checks 'n' items against a Bloom or cuckoo filter, hashing all of them before
+ * probing so that the probes can be prefetched.
+ */
+static void checkItems(void *value, int isCF, const void *const *items, const size_t *lens,
+                       size_t n, int *found) {
+    if (isCF) {
+        CuckooHash *hashes = RedisModule_Alloc(n * sizeof(*hashes));
+        CuckooFilter_GenHashes(value, items, lens, n, hashes);
+        CuckooFilter_CheckHashes(value, hashes, n, found);
+        RedisModule_Free(hashes);
+    } else {
+        bloom_hashval *hashes = RedisModule_Alloc(n * sizeof(*hashes));
+        SBChain_GetHashes(value, items, lens, n, hashes);
+        SBChain_CheckHashes(value, hashes, n, found);
+        RedisModule_Free(hashes);
+    }
+}
+
+/**
+ * Single item BF.EXISTS and CF.EXISTS calls are answered in batches when
+ * BATCH_MAX is set. Instead of replying, the command queues its item on the
+ * batch of its key, then blocks its client and unblocks it right away. Redis
+ * runs the reply callbacks of unblocked clients before the event loop sleeps,
+ * once the commands read in this iteration have run. The first callback checks
+ * all queued batches with checkItems, the others only reply with their result.
+ *
+ * Only reads are batched, as delaying a write past the commands that follow it
+ * would reorder it in the replication stream and the AOF.
+ */
+typedef struct PendingCheck {
+    struct CheckBatch *batch;
+    int found; // -1 if the filter takes integer items
+    size_t len;
+    char item[];
+} PendingCheck;
+
+typedef struct CheckBatch {
+    struct CheckBatch *next;
+    int isCF;
+    int db;
+    int done;
+    size_t keylen;
+    char *key;
+    size_t n;
+    PendingCheck *checks[]; // BatchMax entries
+} CheckBatch;
+
+static CheckBatch *openBatches; // Queued since the batches were last checked
+static size_t nOpenBatches;
+// Checked batches, kept until the next check since a callback may still read them
+static CheckBatch *doneBatches;
+// Totals since the module loaded, reported by BF.BATCHINFO
+static long long batchesChecked, batchedItems, largestBatch;
+
+static void freeCheckBatches(CheckBatch *b) {
+    while (b) {
+        CheckBatch *next = b->next;
+        for (size_t ii = 0; ii < b->n; ++ii) {
+            RedisModule_Free(b->checks[ii]);
+        }
+        RedisModule_Free(b->key);
+        RedisModule_Free(b);
+        b = next;
+    }
+}
+
+static void runCheckBatch(RedisModuleCtx *ctx, CheckBatch *b) {
+    RedisModule_SelectDb(ctx, b->db);
+    RedisModuleString *keyname = RedisModule_CreateString(ctx, b->key, b->keylen);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+    void *value;
+    int status = b->isCF ? cfGetItemFilter(key, (CuckooFilter **)&value, 0, 0)
+                         : bfGetItemChain(key, (SBChain **)&value, 0, 0);
+    // As for unbatched checks, missing keys and other types answer 0
+    if (status == SB_INT_ITEMS) {
+        for (size_t ii = 0; ii < b->n; ++ii) {
+            b->checks[ii]->found = -1;
+        }
+    } else if (status == SB_OK) {
+        const void **items = RedisModule_Alloc(b->n * sizeof(*items));
+        size_t *lens = RedisModule_Alloc(b->n * sizeof(*lens));
+        int *found = RedisModule_Alloc(b->n * sizeof(*found));
+        for (size_t ii = 0; ii < b->n; ++ii) {
+            items[ii] = b->checks[ii]->item;
+            lens[ii] = b->checks[ii]->len;
+        }
+        checkItems(value, b->isCF, items, lens, b->n, found);
+        for (size_t ii = 0; ii < b->n; ++ii) {
+            b->checks[ii]->found = found[ii];
+        }
+        RedisModule_Free(items);
+        RedisModule_Free(lens);
+        RedisModule_Free(found);
+    }
+    RedisModule_CloseKey(key);
+    RedisModule_FreeString(ctx, keyname);
+    b->done = 1;
+    batchesChecked++;
+    batchedItems += b->n;
+    if ((long long)b->n > largestBatch) {
+        largestBatch = b->n;
+    }
+}
+
+static void runCheckBatches(RedisModuleCtx *ctx) {
+    // All callbacks for the previous batches ran in an earlier pass
+    freeCheckBatches(doneBatches);
+    int db = RedisModule_GetSelectedDb(ctx);
+    for (CheckBatch *b = openBatches; b; b = b->next) {
+        runCheckBatch(ctx, b);
+    }
+    RedisModule_SelectDb(ctx, db);
+    doneBatches = openBatches;
+    openBatches = NULL;
+    nOpenBatches = 0;
+}
+
+static int CheckBatch_Reply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+    PendingCheck *pc = RedisModule_GetBlockedClientPrivateData(ctx);
+    if (!pc->batch->done) {
+        runCheckBatches(ctx);
+    }
+    if (pc->found < 0) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(SB_INT_ITEMS));
+    }
+    return RedisModule_ReplyWithLongLong(ctx, pc->found);
+}
+
+// Newer than the vendored redismodule.h, so looked up at load time when
+// BATCH_MAX is set. The values match the server's.
+#ifndef REDISMODULE_CTX_FLAGS_LUA
+#define REDISMODULE_CTX_FLAGS_LUA 0x0001
+#endif
+#ifndef REDISMODULE_CTX_FLAGS_MULTI
+#define REDISMODULE_CTX_FLAGS_MULTI 0x0002
+#endif
+#ifndef REDISMODULE_CTX_FLAGS_DENY_BLOCKING
+#define REDISMODULE_CTX_FLAGS_DENY_BLOCKING (1 << 21)
+#endif
+static int (*RedisModule_GetContextFlags)(RedisModuleCtx *ctx);
+
+/**
+ * Queues a check of 'item' in the filter at 'keyname'. Returns 1 if the reply
+ * will be sent once the batch is checked, 0 if the caller should check it now.
+ */
+static int queueCheck(RedisModuleCtx *ctx, RedisModuleString *keyname, RedisModuleString *item,
+                      int isCF) {
+    const int noBlock = REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_MULTI |
+                        REDISMODULE_CTX_FLAGS_DENY_BLOCKING;
+    if (!BatchMax || (RedisModule_GetContextFlags(ctx) & noBlock)) {
+        return 0;
+    }
+    int db = RedisModule_GetSelectedDb(ctx);
+    size_t keylen;
+    const char *k = RedisModule_StringPtrLen(keyname, &keylen);
+    CheckBatch *b;
+    for (b = openBatches; b; b = b->next) {
+        if (b->isCF == isCF && b->db == db && b->n < BatchMax && b->keylen == keylen &&
+            !memcmp(b->key, k, keylen)) {
+            break;
+        }
+    }
+    if (!b) {
+        if (nOpenBatches == BATCH_MAX_KEYS) {
+            return 0;
+        }
+        b = RedisModule_Calloc(1, sizeof(*b) + BatchMax * sizeof(*b->checks));
+        b->isCF = isCF;
+        b->db = db;
+        b->keylen = keylen;
+        b->key = RedisModule_Alloc(keylen);
+        memcpy(b->key, k, keylen);
+        b->next = openBatches;
+        openBatches = b;
+        nOpenBatches++;
+    }
+
+    size_t len;
+    const char *s = RedisModule_StringPtrLen(item, &len);
+    PendingCheck *pc = RedisModule_Alloc(sizeof(*pc) + len);
+    pc->batch = b;
+    pc->found = 0;
+    pc->len = len;
+    memcpy(pc->item, s, len);
+    b->checks[b->n++] = pc;
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, CheckBatch_Reply, NULL, NULL, 0);
+    RedisModule_UnblockClient(bc, pc);
+    return 1;
+}
+
+/** Replies with the result of checkItems for each of the 'n' items */
+static void replyCheckItems(RedisModuleCtx *ctx, void *value, int isCF, RedisModuleString **argv,
+                            size_t n) {
+    const void **items = RedisModule_Alloc(n * sizeof(*items));
+    size_t *lens = RedisModule_Alloc(n * sizeof(*lens));
+    int *found = RedisModule_Alloc(n * sizeof(*found));
+    for (size_t ii = 0; ii < n; ++ii) {
+        items[ii] = RedisModule_StringPtrLen(argv[ii], &lens[ii]);
+    }
+    checkItems(value, isCF, items, lens, n, found);
+    for (size_t ii = 0; ii < n; ++ii) {
+        RedisModule_ReplyWithLongLong(ctx, found[ii]);
+    }
+    RedisModule_Free(items);
+    RedisModule_Free(lens);
+    RedisModule_Free(found);
+}
+
 /**
  * Common function for adding one or more items to a bloom filter.
  * capacity and error rate must not be 0.
@@ -93,39 +493,156 @@ static SBChain *bfCreateChain(RedisModuleKey *key, double error_rate,
     return sb;
 }
 
+/**
+ * Same as bfCreateChain, for filters created implicitly by adding items. Most of
+ * these stay tiny, so small ones start sparse.
+ */
+static SBChain *bfAutoCreateChain(RedisModuleKey *key, double error_rate,
+                                  size_t capacity, unsigned expansion, unsigned scaling) {
+    if (capacity > BF_SPARSE_MAX_CAPACITY) {
+        return bfCreateChain(key, error_rate, capacity, expansion, scaling);
+    }
+    SBChain *sb = SB_NewSparseChain(capacity, error_rate,
+                                    BLOOM_OPT_FORCE64 | scaling | BLOOM_OPT_NOROUND, expansion);
+    if (sb != NULL) {
+        RedisModule_ModuleTypeSetValue(key, BFType, sb);
+    }
+    return sb;
+}
+
 static CuckooFilter *cfCreate(RedisModuleKey *key, size_t capacity,
-                        size_t bucketSize, size_t maxIterations, size_t expansion) {
+                        size_t bucketSize, size_t maxIterations, size_t expansion,
+                        size_t valueBits, int exact) {
     if (capacity < bucketSize * 2) return NULL;
     
-    CuckooFilter *cf = RedisModule_Calloc(1, sizeof(*cf));
-    if (CuckooFilter_Init(cf, capacity, bucketSize, maxIterations, expansion) != 0) {
-        RedisModule_Free(cf); // LCOV_EXCL_LINE
-        cf = NULL; // LCOV_EXCL_LINE
+    CuckooFilter *cf =
+        exact ? CuckooFilter_NewExact(capacity, bucketSize, maxIterations, expansion, valueBits)
+              : CuckooFilter_New(capacity, bucketSize, maxIterations, expansion, valueBits);
+    if (cf == NULL) {
+        return NULL;
     }
     RedisModule_ModuleTypeSetValue(key, CFType, cf);
     return cf;
 }
 
+/**
+ * Parses a comma separated list of prefix lengths, e.g. "2,4,8".
+ * Returns the number of lengths written to 'lens', or -1 on bad input.
+ */
+static int parsePrefixLengths(RedisModuleString *arg, uint16_t *lens) {
+    size_t n;
+    const char *s = RedisModule_StringPtrLen(arg, &n);
+    const char *end = s + n;
+    int nlens = 0;
+    while (s < end) {
+        if (nlens == SB_MAX_PREFIXES || !isdigit(*s)) {
+            return -1;
+        }
+        unsigned long len = 0;
+        while (s < end && isdigit(*s)) {
+            len = len * 10 + (*s++ - '0');
+            if (len > UINT16_MAX) {
+                return -1;
+            }
+        }
+        if (len == 0 || (s < end && *s++ != ',')) {
+            return -1;
+        }
+        lens[nlens++] = len;
+    }
+    return nlens ? nlens : -1;
+}
+
+/**
+ * Parses the HASHKEY <RANDOM|key> option of the RESERVE commands, where key is
+ * 32 hex digits. Returns its index and fills 'hashKey' if given, -1 if not and
+ * -2 on bad input.
+ */
+static int parseHashKey(RedisModuleString **argv, int argc, uint64_t *hashKey) {
+    int loc = RMUtil_ArgIndex("HASHKEY", argv, argc);
+    if (loc == -1) {
+        return -1;
+    } else if (loc + 1 == argc) {
+        return -2;
+    }
+    if (!rsStrcasecmp(argv[loc + 1], "RANDOM")) {
+        FILE *f = fopen("/dev/urandom", "r");
+        size_t nread = f ? fread(hashKey, sizeof(*hashKey), 2, f) : 0;
+        if (f) {
+            fclose(f);
+        }
+        return nread == 2 ? loc : -2;
+    }
+
+    size_t n;
+    const char *s = RedisModule_StringPtrLen(argv[loc + 1], &n);
+    if (n != 32) {
+        return -2;
+    }
+    for (size_t ii = 0; ii < 2; ++ii) {
+        hashKey[ii] = 0;
+        for (size_t jj = 0; jj < 16; ++jj) {
+            char c = *s++;
+            if (!isxdigit(c)) {
+                return -2;
+            }
+            hashKey[ii] = hashKey[ii] << 4 | (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+        }
+    }
+    return loc;
+}
+
+/**
+ * Replicates a RESERVE command, with HASHKEY RANDOM replaced by the generated
+ * key so that replicas hash items the same way.
+ */
+static void replicateReserve(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int hk_loc,
+                             const uint64_t *hashKey) {
+    if (hk_loc < 0 || rsStrcasecmp(argv[hk_loc + 1], "RANDOM")) {
+        RedisModule_ReplicateVerbatim(ctx);
+        return;
+    }
+    RedisModuleString **args = RedisModule_Alloc((argc - 1) * sizeof(*args));
+    memcpy(args, argv + 1, (argc - 1) * sizeof(*args));
+    args[hk_loc] = RedisModule_CreateStringPrintf(ctx, "%016llx%016llx",
+                                                  (unsigned long long)hashKey[0],
+                                                  (unsigned long long)hashKey[1]);
+    size_t n;
+    const char *cmd = RedisModule_StringPtrLen(argv[0], &n);
+    RedisModule_Replicate(ctx, cmd, "v", args, (size_t)(argc - 1));
+    RedisModule_Free(args);
+}
+
 /**
  * Reserves a new empty filter with custom parameters:
  * BF.RESERVE <KEY> <ERROR_RATE (double)> <INITIAL_CAPACITY (int)> [NONSCALING]
+ *            [EXPANSION <expansion>] [PREFIXLEN <len>[,<len>...]]
+ *            [HASHKEY <RANDOM|key>]
+ * or, with the error rate chosen to fit a memory budget:
+ * BF.RESERVE <KEY> MAXMEMORY <BYTES (int)> <INITIAL_CAPACITY (int)> [options...]
  */
 static int BFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
 
-    if (argc < 4 || argc > 7) {
+    int budgeted = argc > 2 && !rsStrcasecmp(argv[2], "MAXMEMORY");
+    if (argc < 4 + budgeted || argc > 11 + budgeted) {
         return RedisModule_WrongArity(ctx);
     }
 
-    double error_rate;
-    if (RedisModule_StringToDouble(argv[2], &error_rate) != REDISMODULE_OK) {
+    double error_rate = 0;
+    long long maxBytes = 0;
+    if (budgeted) {
+        if (RedisModule_StringToLongLong(argv[3], &maxBytes) != REDISMODULE_OK || maxBytes <= 0) {
+            return RedisModule_ReplyWithError(ctx, "ERR bad MAXMEMORY");
+        }
+    } else if (RedisModule_StringToDouble(argv[2], &error_rate) != REDISMODULE_OK) {
         return RedisModule_ReplyWithError(ctx, "ERR bad error rate");
     } else if (error_rate >= 1 || error_rate <= 0) {
         return RedisModule_ReplyWithError(ctx, "ERR (0 < error rate range < 1) ");
     }
 
     long long capacity;
-    if (RedisModule_StringToLongLong(argv[3], &capacity) != REDISMODULE_OK) {
+    if (RedisModule_StringToLongLong(argv[3 + budgeted], &capacity) != REDISMODULE_OK) {
         return RedisModule_ReplyWithError(ctx, "ERR bad capacity");
     } else if (capacity <= 0) {
         return RedisModule_ReplyWithError(ctx, "ERR (capacity should be larger than 0)");
@@ -151,6 +668,36 @@ static int BFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         }
     }
 
+    uint16_t prefixes[SB_MAX_PREFIXES];
+    int nprefixes = 0;
+    int px_loc = RMUtil_ArgIndex("PREFIXLEN", argv, argc);
+    if (px_loc + 1 == argc) {
+        return RedisModule_ReplyWithError(ctx, "ERR no prefix length");
+    }
+    if (px_loc != -1) {
+        nprefixes = parsePrefixLengths(argv[px_loc + 1], prefixes);
+        if (nprefixes < 0) {
+            return RedisModule_ReplyWithError(ctx, "ERR bad prefix length");
+        }
+    }
+
+    uint64_t hashKey[2];
+    int hk_loc = parseHashKey(argv, argc, hashKey);
+    if (hk_loc == -2) {
+        return RedisModule_ReplyWithError(ctx, "ERR HASHKEY must be RANDOM or 32 hex digits");
+    } else if (hk_loc != -1 && nprefixes) {
+        return RedisModule_ReplyWithError(ctx, "ERR PREFIXLEN and HASHKEY can't be combined");
+    }
+
+    if (budgeted) {
+        // Same options as bfCreateChain
+        error_rate = SB_ErrorForBytes(capacity, maxBytes,
+                                      BLOOM_OPT_FORCE64 | nonScaling | BLOOM_OPT_NOROUND, expansion);
+        if (error_rate == 0) {
+            return RedisModule_ReplyWithError(ctx, "ERR MAXMEMORY too small for capacity");
+        }
+    }
+
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
     SBChain *sb;
     int status = bfGetChain(key, &sb);
@@ -158,12 +705,22 @@ static int BFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
-    if (bfCreateChain(key, error_rate, capacity, expansion, nonScaling) == NULL) {
+    sb = bfCreateChain(key, error_rate, capacity, expansion, nonScaling);
+    if (sb == NULL) {
         RedisModule_ReplyWithError(ctx, "ERR could not create filter"); // LCOV_EXCL_LINE
+    } else if (nprefixes && SBChain_SetPrefixes(sb, prefixes, nprefixes) != 0) {
+        RedisModule_DeleteKey(key);
+        return RedisModule_ReplyWithError(ctx, "ERR bad prefix length");
     } else {
+        if (hk_loc != -1) {
+            SBChain_SetHashKey(sb, hashKey);
+        }
+        if (budgeted) {
+            SBChain_SetMaxBytes(sb, maxBytes);
+        }
         RedisModule_ReplyWithSimpleString(ctx, "OK");
     }
-    RedisModule_ReplicateVerbatim(ctx);
+    replicateReserve(ctx, argv, argc, hk_loc, hashKey);
     return REDISMODULE_OK;
 }
 
@@ -186,9 +743,16 @@ static int BFCheck_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
         return RedisModule_WrongArity(ctx);
     }
 
+    if (!is_multi && queueCheck(ctx, argv[1], argv[2], 0)) {
+        return REDISMODULE_OK;
+    }
+
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
     SBChain *sb;
-    int status = bfGetChain(key, &sb);
+    int status = bfGetItemChain(key, &sb, 0, 0);
+    if (status == SB_INT_ITEMS) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
 
     int is_empty = 0;
     if (status != SB_OK) {
@@ -200,28 +764,58 @@ static int BFCheck_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
         RedisModule_ReplyWithArray(ctx, argc - 2);
     }
 
-    for (size_t ii = 2; ii < argc; ++ii) {
-        if (is_empty == 1) {
+    if (is_empty == 1) {
+        for (size_t ii = 2; ii < argc; ++ii) {
             RedisModule_ReplyWithLongLong(ctx, 0);
-        } else {
-            size_t n;
-            const char *s = RedisModule_StringPtrLen(argv[ii], &n);
-            int exists = SBChain_Check(sb, s, n);
-            RedisModule_ReplyWithLongLong(ctx, exists);
         }
+    } else if (!is_multi) {
+        size_t n;
+        const char *s = RedisModule_StringPtrLen(argv[2], &n);
+        RedisModule_ReplyWithLongLong(ctx, SBChain_Check(sb, s, n));
+    } else {
+        replyCheckItems(ctx, sb, 0, argv + 2, argc - 2);
     }
 
     return REDISMODULE_OK;
 }
 
+/**
+ * Check whether any item starting with the prefix was added
+ * BF.EXISTSPREFIX <KEY> <PREFIX>
+ * The prefix length must be one of the lengths given to BF.RESERVE PREFIXLEN
+ */
+static int BFExistsPrefix_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    SBChain *sb;
+    int status = bfGetChain(key, &sb);
+    if (status == SB_EMPTY) {
+        return RedisModule_ReplyWithLongLong(ctx, 0);
+    } else if (status != SB_OK) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+
+    size_t n;
+    const char *s = RedisModule_StringPtrLen(argv[2], &n);
+    int exists = SBChain_CheckPrefix(sb, s, n);
+    if (exists < 0) {
+        return RedisModule_ReplyWithError(ctx, "ERR prefix length not configured for filter");
+    }
+    return RedisModule_ReplyWithLongLong(ctx, exists);
+}
+
 static int bfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisModuleString **items,
                           size_t nitems, const BFInsertOptions *options) {
     RedisModuleKey *key = RedisModule_OpenKey(ctx, keystr, REDISMODULE_READ | REDISMODULE_WRITE);
     SBChain *sb;
-    const int status = bfGetChain(key, &sb);
+    const int status = bfGetItemChain(key, &sb, 0, 1);
     
     if (status == SB_EMPTY && options->autocreate) {
-        sb = bfCreateChain(key, options->error_rate, options->capacity, options->expansion, options->nonScaling);
+        sb = bfAutoCreateChain(key, options->error_rate, options->capacity, options->expansion, options->nonScaling);
         if (sb == NULL) {
             return RedisModule_ReplyWithError(ctx, "ERR could not create filter"); // LCOV_EXCL_LINE
         }
@@ -229,27 +823,32 @@ static int bfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisM
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
-    if (options->is_multi) {
-        RedisModule_ReplyWithArray(ctx,  REDISMODULE_POSTPONED_ARRAY_LEN);
+    // Items are hashed together first, which is faster for several items
+    const void **bufs = RedisModule_Alloc(nitems * sizeof(*bufs));
+    size_t *lens = RedisModule_Alloc(nitems * sizeof(*lens));
+    bloom_hashval *hashes = RedisModule_Alloc(nitems * sizeof(*hashes));
+    int *rv = RedisModule_Alloc(nitems * sizeof(*rv));
+    for (size_t ii = 0; ii < nitems; ++ii) {
+        bufs[ii] = RedisModule_StringPtrLen(items[ii], &lens[ii]);
     }
+    SBChain_GetHashes(sb, bufs, lens, nitems, hashes);
+    size_t array_len = SBChain_AddHashes(sb, bufs, lens, hashes, nitems, rv);
 
-    size_t array_len = 0;
-    int rv = 0;
-    for (size_t ii = 0; ii < nitems && rv != -2; ++ii) {
-        size_t n;
-        const char *s = RedisModule_StringPtrLen(items[ii], &n);
-        rv = SBChain_Add(sb, s, n);
-        if (rv == -2) { // decide if to make into an error
+    if (options->is_multi) {
+        RedisModule_ReplyWithArray(ctx, array_len);
+    }
+    for (size_t ii = 0; ii < array_len; ++ii) {
+        if (rv[ii] == -2) { // decide if to make into an error
             RedisModule_ReplyWithError(ctx, "ERR non scaling filter is full");
         } else {
-            RedisModule_ReplyWithLongLong(ctx, !!rv);
+            RedisModule_ReplyWithLongLong(ctx, !!rv[ii]);
         }
-        array_len++;
     }
 
-    if (options->is_multi) {
-        RedisModule_ReplySetArrayLength(ctx, array_len);
-    }
+    RedisModule_Free(bufs);
+    RedisModule_Free(lens);
+    RedisModule_Free(hashes);
+    RedisModule_Free(rv);
     RedisModule_ReplicateVerbatim(ctx);
     return REDISMODULE_OK;
 }
@@ -354,6 +953,208 @@ static int BFInsert_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     return bfInsertCommon(ctx, argv[1], argv + items_index, argc - items_index, &options);
 }
 
+/**
+ * BF.MADDKEYS <KEY> <ITEM> [<KEY> <ITEM> ...]
+ * BF.MEXISTSKEYS <KEY> <ITEM> [<KEY> <ITEM> ...]
+ *
+ * Same as BF.ADD and BF.EXISTS for every pair. All keys are looked up before
+ * anything is added, so a key of another type fails the whole BF.MADDKEYS, and
+ * the items of each key are then handled together.
+ * Returns an array with the result of each pair.
+ */
+static int BFMultiKey_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3 || (argc - 1) % 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+    const char *cmd = RedisModule_StringPtrLen(argv[0], NULL);
+    int isAdd = tolower(cmd[4]) == 'a';
+    int mode = isAdd ? REDISMODULE_READ | REDISMODULE_WRITE : REDISMODULE_READ;
+
+    size_t npairs = (argc - 1) / 2;
+    int *order = RedisModule_Alloc(npairs * sizeof(*order));
+    RMUtil_SortByKey(argv, argc, 1, 2, order);
+
+    RedisModuleKey **keys = RedisModule_Calloc(npairs, sizeof(*keys));
+    int *status = RedisModule_Calloc(npairs, sizeof(*status));
+    SBChain **chains = RedisModule_Calloc(npairs, sizeof(*chains));
+    int *results = RedisModule_Calloc(npairs, sizeof(*results));
+    const void **items = RedisModule_Alloc(npairs * sizeof(*items));
+    size_t *lens = RedisModule_Alloc(npairs * sizeof(*lens));
+    const char *err = NULL;
+
+    // Pairs are visited in key order, the first pair of each key opening it
+    for (size_t ii = 0; ii < npairs; ++ii) {
+        if (ii && RMUtil_StringEquals(argv[order[ii]], argv[order[ii - 1]])) {
+            keys[ii] = keys[ii - 1];
+            status[ii] = status[ii - 1];
+            continue;
+        }
+        keys[ii] = RedisModule_OpenKey(ctx, argv[order[ii]], mode);
+        status[ii] = bfGetItemChain(keys[ii], &chains[ii], 0, isAdd);
+        if ((isAdd && status[ii] == SB_MISMATCH) || status[ii] == SB_INT_ITEMS) {
+            err = statusStrerror(status[ii]);
+            goto done;
+        }
+    }
+
+    for (size_t ii = 0, end; ii < npairs; ii = end) {
+        for (end = ii + 1; end < npairs && RMUtil_StringEquals(argv[order[end]], argv[order[ii]]);
+             ++end) {
+        }
+        SBChain *sb = chains[ii];
+        if (isAdd && status[ii] == SB_EMPTY) {
+            sb = bfAutoCreateChain(keys[ii], BFDefaultErrorRate, BFDefaultInitCapacity,
+                                   BF_DEFAULT_EXPANSION, 0);
+            if (sb == NULL) {
+                err = "ERR could not create filter"; // LCOV_EXCL_LINE
+                goto done;                           // LCOV_EXCL_LINE
+            }
+        } else if (status[ii] != SB_OK) {
+            continue; // Checks of missing keys answer 0
+        }
+
+        for (size_t jj = ii; jj < end; ++jj) {
+            items[jj - ii] = RedisModule_StringPtrLen(argv[order[jj] + 1], &lens[jj - ii]);
+        }
+        if (isAdd) {
+            for (size_t jj = ii; jj < end; ++jj) {
+                results[(order[jj] - 1) / 2] = SBChain_Add(sb, items[jj - ii], lens[jj - ii]);
+            }
+        } else {
+            int *found = RedisModule_Alloc((end - ii) * sizeof(*found));
+            checkItems(sb, 0, items, lens, end - ii, found);
+            for (size_t jj = ii; jj < end; ++jj) {
+                results[(order[jj] - 1) / 2] = found[jj - ii];
+            }
+            RedisModule_Free(found);
+        }
+    }
+
+    RedisModule_ReplyWithArray(ctx, npairs);
+    for (size_t ii = 0; ii < npairs; ++ii) {
+        if (results[ii] == -2) {
+            RedisModule_ReplyWithError(ctx, "ERR non scaling filter is full");
+        } else {
+            RedisModule_ReplyWithLongLong(ctx, !!results[ii]);
+        }
+    }
+    if (isAdd) {
+        RedisModule_ReplicateVerbatim(ctx);
+    }
+
+done:
+    RedisModule_Free(order);
+    RedisModule_Free(keys);
+    RedisModule_Free(status);
+    RedisModule_Free(chains);
+    RedisModule_Free(results);
+    RedisModule_Free(items);
+    RedisModule_Free(lens);
+    if (err) {
+        return RedisModule_ReplyWithError(ctx, err);
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * BF.MADDINT <KEY> [PACKED] <ITEM...>
+ * BF.MEXISTSINT <KEY> [PACKED] <ITEM...>
+ * Same as BF.MADD and BF.MEXISTS for items that are 64 bit integers, given in
+ * decimal or, after PACKED, as strings of little endian 64 bit integers. Items
+ * are hashed as numbers, so a filter takes either integer or string items.
+ */
+static int BFIntItems_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+    const char *cmd = RedisModule_StringPtrLen(argv[0], NULL);
+    int isAdd = tolower(cmd[4]) == 'a';
+
+    uint64_t *items;
+    long long nitems = RMUtil_ParseIntItems(argv + 2, argc - 2, &items);
+    if (nitems < 0) {
+        return RedisModule_ReplyWithError(ctx, "ERR invalid integer item");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(
+        ctx, argv[1], isAdd ? REDISMODULE_READ | REDISMODULE_WRITE : REDISMODULE_READ);
+    SBChain *sb;
+    int status = bfGetItemChain(key, &sb, 1, isAdd);
+    if (isAdd && status == SB_EMPTY) {
+        sb = bfAutoCreateChain(key, BFDefaultErrorRate, BFDefaultInitCapacity,
+                               BF_DEFAULT_EXPANSION, 0);
+        if (sb == NULL) {
+            RedisModule_Free(items);                                             // LCOV_EXCL_LINE
+            return RedisModule_ReplyWithError(ctx, "ERR could not create filter"); // LCOV_EXCL_LINE
+        }
+        SBChain_UseItems(sb, 1, 1);
+    } else if (status == SB_EMPTY) {
+        RedisModule_Free(items);
+        RedisModule_ReplyWithArray(ctx, nitems);
+        for (long long ii = 0; ii < nitems; ++ii) {
+            RedisModule_ReplyWithLongLong(ctx, 0);
+        }
+        return REDISMODULE_OK;
+    } else if (status != SB_OK) {
+        RedisModule_Free(items);
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+
+    bloom_hashval *hashes = RedisModule_Alloc(nitems * sizeof(*hashes));
+    for (long long ii = 0; ii < nitems; ++ii) {
+        hashes[ii] = SBChain_GetIntHash(sb, items[ii]);
+    }
+    RedisModule_Free(items);
+
+    if (isAdd) {
+        // Integer chains have no prefixes, so the items' bytes are not needed
+        int *rv = RedisModule_Alloc(nitems * sizeof(*rv));
+        size_t array_len = SBChain_AddHashes(sb, NULL, NULL, hashes, nitems, rv);
+        RedisModule_ReplyWithArray(ctx, array_len);
+        for (size_t ii = 0; ii < array_len; ++ii) {
+            if (rv[ii] == -2) {
+                RedisModule_ReplyWithError(ctx, "ERR non scaling filter is full");
+            } else {
+                RedisModule_ReplyWithLongLong(ctx, !!rv[ii]);
+            }
+        }
+        RedisModule_Free(rv);
+        RedisModule_ReplicateVerbatim(ctx);
+    } else {
+        int *found = RedisModule_Alloc(nitems * sizeof(*found));
+        SBChain_CheckHashes(sb, hashes, nitems, found);
+        RedisModule_ReplyWithArray(ctx, nitems);
+        for (long long ii = 0; ii < nitems; ++ii) {
+            RedisModule_ReplyWithLongLong(ctx, found[ii]);
+        }
+        RedisModule_Free(found);
+    }
+    RedisModule_Free(hashes);
+    return REDISMODULE_OK;
+}
+
+/**
+ * BF.BATCHINFO
+ * returns the totals of the batched checks (see BATCH_MAX) since the module loaded.
+ */
+static int BFBatchInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    if (argc != 1) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModule_ReplyWithArray(ctx, 3 * 2);
+    RedisModule_ReplyWithSimpleString(ctx, "Batches checked");
+    RedisModule_ReplyWithLongLong(ctx, batchesChecked);
+    RedisModule_ReplyWithSimpleString(ctx, "Items checked");
+    RedisModule_ReplyWithLongLong(ctx, batchedItems);
+    RedisModule_ReplyWithSimpleString(ctx, "Largest batch");
+    RedisModule_ReplyWithLongLong(ctx, largestBatch);
+    return REDISMODULE_OK;
+}
+
 /**
  * BF.DEBUG KEY
  * returns some information about the bloom filter.
@@ -367,18 +1168,27 @@ static int BFDebug_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
 
     const SBChain *sb = NULL;
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    int status = bfGetChain(key, (SBChain **)&sb);
+    // Only reads the shape of the chain, which may stay packed
+    int status = getValue(key, BFType, (void **)&sb);
     if (status != SB_OK) {
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
     // Start writing info
-    RedisModule_ReplyWithArray(ctx, 1 + sb->nfilters);
+    RedisModule_ReplyWithArray(ctx, 1 + (SB_IS_SPARSE(sb) ? 1 : sb->nfilters));
 
     RedisModuleString *info_s = RedisModule_CreateStringPrintf(ctx, "size:%llu", sb->size);
     RedisModule_ReplyWithString(ctx, info_s);
     RedisModule_FreeString(ctx, info_s);
 
+    if (SB_IS_SPARSE(sb)) {
+        const SBSparse *sp = sb->sparse;
+        info_s = RedisModule_CreateStringPrintf(ctx, "sparse hashes:%u limit:%u capacity:%llu ratio:%g",
+                                                sp->n, sp->limit, sp->capacity, sp->error);
+        RedisModule_ReplyWithString(ctx, info_s);
+        RedisModule_FreeString(ctx, info_s);
+    }
+
     for (size_t ii = 0; ii < sb->nfilters; ++ii) {
         const SBLink *lb = sb->filters + ii;
         info_s = RedisModule_CreateStringPrintf(
@@ -479,7 +1289,47 @@ static int BFLoadChunk_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
     }
 }
 
-/** CF.RESERVE <KEY> <CAPACITY> [BUCKETSIZE] [MAXITERATIONS] [EXPANSION] */
+/**
+ * BF.COPY <SOURCE> <DESTINATION> [REPLACE]
+ * Replies 1 if copied, 0 if DESTINATION exists and REPLACE isn't given. The
+ * copy shares the full links of the source, see SBChain_Copy.
+ */
+static int BFCopy_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc != 3 && argc != 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+    int replace = argc == 4;
+    if (replace && rsStrcasecmp(argv[3], "REPLACE")) {
+        return RedisModule_ReplyWithError(ctx, "ERR syntax error");
+    }
+    if (RedisModule_StringCompare(argv[1], argv[2]) == 0) {
+        return RedisModule_ReplyWithError(ctx, "ERR source and destination objects are the same");
+    }
+
+    RedisModuleKey *srcKey = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    SBChain *sb;
+    int status = bfGetChain(srcKey, &sb);
+    if (status == SB_EMPTY) {
+        // Like COPY, a missing source copies nothing
+        return RedisModule_ReplyWithLongLong(ctx, 0);
+    } else if (status != SB_OK) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+
+    RedisModuleKey *dstKey = RedisModule_OpenKey(ctx, argv[2], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(dstKey) != REDISMODULE_KEYTYPE_EMPTY && !replace) {
+        return RedisModule_ReplyWithLongLong(ctx, 0);
+    }
+    // Replaces any existing value
+    RedisModule_ModuleTypeSetValue(dstKey, BFType, SBChain_Copy(sb));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithLongLong(ctx, 1);
+}
+
+/** CF.RESERVE <KEY> <CAPACITY> [BUCKETSIZE] [MAXITERATIONS] [EXPANSION] [VALUEBITS]
+ *             [PLACEMENT] [SIZING] [HASHKEY] [MAXMEMORY] */
 static int CFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     //
@@ -516,6 +1366,67 @@ static int CFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         }
     }
 
+    long long valueBits = 0;
+    int vb_loc = RMUtil_ArgIndex("VALUEBITS", argv, argc);
+    if (vb_loc != -1) {
+        if (RedisModule_StringToLongLong(argv[vb_loc + 1], &valueBits) != REDISMODULE_OK ||
+            valueBits < 1 || valueBits > CUCKOO_MAX_VALUEBITS) {
+            return RedisModule_ReplyWithError(ctx, "VALUEBITS must be between 1 and 8");
+        }
+    }
+
+    int localAlt = 0;
+    int pl_loc = RMUtil_ArgIndex("PLACEMENT", argv, argc);
+    if (pl_loc != -1) {
+        if (!rsStrcasecmp(argv[pl_loc + 1], "LOCAL")) {
+            localAlt = 1;
+        } else if (rsStrcasecmp(argv[pl_loc + 1], "GLOBAL")) {
+            return RedisModule_ReplyWithError(ctx, "PLACEMENT must be LOCAL or GLOBAL");
+        }
+    }
+
+    long long maxBytes = 0;
+    int mm_loc = RMUtil_ArgIndex("MAXMEMORY", argv, argc);
+    if (mm_loc != -1) {
+        if (RedisModule_StringToLongLong(argv[mm_loc + 1], &maxBytes) != REDISMODULE_OK ||
+            maxBytes <= 0) {
+            return RedisModule_ReplyWithError(ctx, "Couldn't parse MAXMEMORY");
+        }
+    }
+
+    // Filters within a budget make the most of it with exact sizing, unless told otherwise
+    int exact = maxBytes && !localAlt;
+    int sz_loc = RMUtil_ArgIndex("SIZING", argv, argc);
+    if (sz_loc != -1) {
+        if (!rsStrcasecmp(argv[sz_loc + 1], "EXACT")) {
+            exact = 1;
+        } else if (!rsStrcasecmp(argv[sz_loc + 1], "POWER2")) {
+            exact = 0;
+        } else {
+            return RedisModule_ReplyWithError(ctx, "SIZING must be EXACT or POWER2");
+        }
+    }
+    if (exact && localAlt) {
+        return RedisModule_ReplyWithError(ctx, "PLACEMENT LOCAL requires SIZING POWER2");
+    }
+
+    uint64_t hashKey[2];
+    int hk_loc = parseHashKey(argv, argc, hashKey);
+    if (hk_loc == -2) {
+        return RedisModule_ReplyWithError(ctx, "HASHKEY must be RANDOM or 32 hex digits");
+    }
+
+    if (maxBytes) {
+        uint16_t fitBucketSize = bs_loc != -1 ? bucketSize : 0;
+        uint64_t fitCapacity;
+        if (CuckooFilter_FitBytes(capacity, maxBytes, valueBits, exact, &fitBucketSize,
+                                  &fitCapacity) != 0) {
+            return RedisModule_ReplyWithError(ctx, "Capacity doesn't fit in MAXMEMORY");
+        }
+        bucketSize = fitBucketSize;
+        capacity = fitCapacity;
+    }
+
     if (bucketSize * 2 > capacity) {
         return RedisModule_ReplyWithError(ctx, "Capacity must be at least (BucketSize * 2)");
     }
@@ -527,11 +1438,18 @@ static int CFReserve_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
-    cf = cfCreate(key, capacity, bucketSize, maxIterations, expansion);
+    cf = cfCreate(key, capacity, bucketSize, maxIterations, expansion, valueBits, exact);
     if (cf == NULL) {
         return RedisModule_ReplyWithError(ctx, "Couldn't create Cuckoo Filter"); // LCOV_EXCL_LINE
     } else {
-        RedisModule_ReplicateVerbatim(ctx);
+        if (localAlt) {
+            CuckooFilter_UseLocalAlt(cf);
+        }
+        if (hk_loc != -1) {
+            CuckooFilter_SetHashKey(cf, hashKey);
+        }
+        cf->maxBytes = maxBytes;
+        replicateReserve(ctx, argv, argc, hk_loc, hashKey);
         return RedisModule_ReplyWithSimpleString(ctx, "OK");
     }
 }
@@ -540,17 +1458,23 @@ typedef struct {
     int is_nx;
     int autocreate;
     int is_multi;
-    long long capacity;
+    int is_bulk;
+    long long capacity; // 0 sizes new filters of CF.BULKLOAD for its items
 } CFInsertOptions;
 
 static int cfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisModuleString **items,
                           size_t nitems, const CFInsertOptions *options) {
     RedisModuleKey *key = RedisModule_OpenKey(ctx, keystr, REDISMODULE_READ | REDISMODULE_WRITE);
     CuckooFilter *cf = NULL;
-    int status = cfGetFilter(key, &cf);
+    int status = cfGetItemFilter(key, &cf, 0, 1);
 
     if (status == SB_EMPTY && options->autocreate) {
-        if ((cf = cfCreate(key, options->capacity, CF_DEFAULT_BUCKETSIZE, CF_MAX_ITERATIONS, CF_DEFAULT_EXPANSION)) == NULL) {
+        long long capacity = options->capacity;
+        if (options->is_bulk && capacity == 0) {
+            capacity = nitems > CF_DEFAULT_BUCKETSIZE * 2 ? nitems : CF_DEFAULT_BUCKETSIZE * 2;
+        }
+        if ((cf = cfCreate(key, capacity, CF_DEFAULT_BUCKETSIZE, CF_MAX_ITERATIONS,
+                            CF_DEFAULT_EXPANSION, 0, 0)) == NULL) {
             return RedisModule_ReplyWithError(ctx, "Could not create filter"); // LCOV_EXCL_LINE
         }
     } else if (status != SB_OK) {
@@ -569,15 +1493,36 @@ static int cfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisM
         RedisModule_ReplyWithArray(ctx, nitems);
     }
 
+    // Items are hashed together first, which is faster for several items
+    const void **elems = RedisModule_Alloc(nitems * sizeof(*elems));
+    size_t *lens = RedisModule_Alloc(nitems * sizeof(*lens));
+    CuckooHash *hashes = RedisModule_Alloc(nitems * sizeof(*hashes));
+    for (size_t ii = 0; ii < nitems; ++ii) {
+        elems[ii] = RedisModule_StringPtrLen(items[ii], &lens[ii]);
+    }
+    CuckooFilter_GenHashes(cf, elems, lens, nitems, hashes);
+    RedisModule_Free(elems);
+    RedisModule_Free(lens);
+
+    if (options->is_bulk) {
+        int nthreads = nitems >= CF_LOAD_THREADS_MIN_ITEMS ? CFLoadThreads : 1;
+        uint64_t before = cf->numItems;
+        int rc = CuckooFilter_BulkLoadConcurrent(cf, hashes, nitems, nthreads);
+        RedisModule_Free(hashes);
+        if (rc != 0) {
+            return RedisModule_ReplyWithError(ctx, "Memory allocation failure"); // LCOV_EXCL_LINE
+        }
+        RedisModule_ReplicateVerbatim(ctx);
+        // Less than nitems if the filter reached its MAXMEMORY
+        return RedisModule_ReplyWithLongLong(ctx, cf->numItems - before);
+    }
+
     for (size_t ii = 0; ii < nitems; ++ii) {
-        size_t elemlen;
-        const char *elem = RedisModule_StringPtrLen(items[ii], &elemlen);
-        CuckooHash hash = CUCKOO_GEN_HASH(elem, elemlen);
         CuckooInsertStatus insStatus;
         if (options->is_nx) {
-            insStatus = CuckooFilter_InsertUnique(cf, hash);
+            insStatus = CuckooFilter_InsertUnique(cf, hashes[ii]);
         } else {
-            insStatus = CuckooFilter_Insert(cf, hash);
+            insStatus = CuckooFilter_Insert(cf, hashes[ii]);
         }
         switch (insStatus)
         {
@@ -589,10 +1534,12 @@ static int cfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisM
             break;
         case CuckooInsert_NoSpace:
             if (!options->is_multi) {
+                RedisModule_Free(hashes);
                 return RedisModule_ReplyWithError(ctx, "Filter is full");
             } else {
                 RedisModule_ReplyWithLongLong(ctx, -1);
             }
+            break;
         case CuckooInsert_MemAllocFailed:
             RedisModule_ReplyWithError(ctx, "Memory allocation failure");// LCOV_EXCL_LINE
             break;
@@ -600,6 +1547,7 @@ static int cfInsertCommon(RedisModuleCtx *ctx, RedisModuleString *keystr, RedisM
             break;
         }
     }
+    RedisModule_Free(hashes);
 
     RedisModule_ReplicateVerbatim(ctx);
     return REDISMODULE_OK;
@@ -624,6 +1572,11 @@ static int CFAdd_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int
 
 /**
  * CF.INSERT <KEY> [NOCREATE] [CAPACITY <cap>] ITEMS <item...>
+ * CF.BULKLOAD <KEY> [NOCREATE] [CAPACITY <cap>] ITEMS <item...>
+ *
+ * CF.BULKLOAD places all items at once, see CuckooFilter_BulkLoad, and replies
+ * with their number. New filters default to a capacity of that many items.
+ * Large batches are spread over CF_LOAD_THREADS threads.
  */
 static int CFInsert_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
@@ -631,6 +1584,11 @@ static int CFInsert_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     size_t cmdlen;
     const char *cmdstr = RedisModule_StringPtrLen(argv[0], &cmdlen);
     options.is_nx = tolower(cmdstr[cmdlen - 1]) == 'x';
+    if (tolower(cmdstr[3]) == 'b') {
+        options.is_bulk = 1;
+        options.is_multi = 0;
+        options.capacity = 0;
+    }
     // Need <cmd> <key> <ITEMS> <n..> -- at least 4 arguments
     if (argc < 4) {
         return RedisModule_WrongArity(ctx);
@@ -689,9 +1647,16 @@ static int CFCheck_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
         return RedisModule_WrongArity(ctx);
     }
 
+    if (!is_multi && !is_count && queueCheck(ctx, argv[1], argv[2], 1)) {
+        return REDISMODULE_OK;
+    }
+
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
     CuckooFilter *cf;
-    int status = cfGetFilter(key, &cf);
+    int status = cfGetItemFilter(key, &cf, 0, 0);
+    if (status == SB_INT_ITEMS) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
 
     int is_empty = 0;
     if (status != SB_OK) {
@@ -703,13 +1668,18 @@ static int CFCheck_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
         RedisModule_ReplyWithArray(ctx, argc - 2);
     }
 
+    if (is_multi && !is_count && !is_empty) {
+        replyCheckItems(ctx, cf, 1, argv + 2, argc - 2);
+        return REDISMODULE_OK;
+    }
+
     for (size_t ii = 2; ii < argc; ++ii) {
         if (is_empty == 1) {
             RedisModule_ReplyWithLongLong(ctx, 0);
         } else {
             size_t n;
             const char *s = RedisModule_StringPtrLen(argv[ii], &n);
-            CuckooHash hash = CUCKOO_GEN_HASH(s, n);
+            CuckooHash hash = CuckooFilter_Hash(cf, s, n);
             long long rv;
             if (is_count) {
                 rv = CuckooFilter_Count(cf, hash);
@@ -722,6 +1692,171 @@ static int CFCheck_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
     return REDISMODULE_OK;
 }
 
+/**
+ * CF.ADDINT <KEY> [PACKED] <ITEM...>
+ * CF.EXISTSINT <KEY> [PACKED] <ITEM...>
+ * Same as CF.INSERT and CF.MEXISTS for items that are 64 bit integers, given in
+ * decimal or, after PACKED, as strings of little endian 64 bit integers. Items
+ * are hashed as numbers, so a filter takes either integer or string items.
+ */
+static int CFIntItems_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+    const char *cmd = RedisModule_StringPtrLen(argv[0], NULL);
+    int isAdd = tolower(cmd[3]) == 'a';
+
+    uint64_t *items;
+    long long nitems = RMUtil_ParseIntItems(argv + 2, argc - 2, &items);
+    if (nitems < 0) {
+        return RedisModule_ReplyWithError(ctx, "ERR invalid integer item");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(
+        ctx, argv[1], isAdd ? REDISMODULE_READ | REDISMODULE_WRITE : REDISMODULE_READ);
+    CuckooFilter *cf;
+    int status = cfGetItemFilter(key, &cf, 1, isAdd);
+    if (isAdd && status == SB_EMPTY) {
+        if ((cf = cfCreate(key, CFDefaultInitCapacity, CF_DEFAULT_BUCKETSIZE, CF_MAX_ITERATIONS,
+                           CF_DEFAULT_EXPANSION, 0, 0)) == NULL) {
+            RedisModule_Free(items);                                         // LCOV_EXCL_LINE
+            return RedisModule_ReplyWithError(ctx, "Could not create filter"); // LCOV_EXCL_LINE
+        }
+        CuckooFilter_UseItems(cf, 1, 1);
+    } else if (status == SB_EMPTY) {
+        RedisModule_Free(items);
+        RedisModule_ReplyWithArray(ctx, nitems);
+        for (long long ii = 0; ii < nitems; ++ii) {
+            RedisModule_ReplyWithLongLong(ctx, 0);
+        }
+        return REDISMODULE_OK;
+    } else if (status != SB_OK) {
+        RedisModule_Free(items);
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+    if (isAdd && cf->numFilters >= CFMaxExpansions) {
+        RedisModule_Free(items);
+        return RedisModule_ReplyWithError(ctx, "Maximum expansions reached");
+    }
+
+    CuckooHash *hashes = RedisModule_Alloc(nitems * sizeof(*hashes));
+    for (long long ii = 0; ii < nitems; ++ii) {
+        hashes[ii] = CuckooFilter_IntHash(cf, items[ii]);
+    }
+    RedisModule_Free(items);
+
+    RedisModule_ReplyWithArray(ctx, nitems);
+    if (isAdd) {
+        for (long long ii = 0; ii < nitems; ++ii) {
+            switch (CuckooFilter_Insert(cf, hashes[ii])) {
+            case CuckooInsert_Inserted:
+                RedisModule_ReplyWithLongLong(ctx, 1);
+                break;
+            case CuckooInsert_NoSpace:
+                RedisModule_ReplyWithLongLong(ctx, -1);
+                break;
+            default:
+                RedisModule_ReplyWithError(ctx, "Memory allocation failure"); // LCOV_EXCL_LINE
+                break;                                                         // LCOV_EXCL_LINE
+            }
+        }
+        RedisModule_ReplicateVerbatim(ctx);
+    } else {
+        int *found = RedisModule_Alloc(nitems * sizeof(*found));
+        CuckooFilter_CheckHashes(cf, hashes, nitems, found);
+        for (long long ii = 0; ii < nitems; ++ii) {
+            RedisModule_ReplyWithLongLong(ctx, found[ii]);
+        }
+        RedisModule_Free(found);
+    }
+    RedisModule_Free(hashes);
+    return REDISMODULE_OK;
+}
+
+/**
+ * CF.SETVAL <KEY> <ELEM> <VALUE>
+ *
+ * Sets the value stored with an item, adding the item if it is not found.
+ * The filter must have been created with VALUEBITS.
+ */
+static int CFSetVal_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc != 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    CuckooFilter *cf;
+    int status = cfGetItemFilter(key, &cf, 0, 1);
+    if (status != SB_OK) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+    if (!CUCKOO_VALUEBITS(cf)) {
+        return RedisModule_ReplyWithError(ctx, "Filter was not created with VALUEBITS");
+    }
+
+    long long value;
+    if (RedisModule_StringToLongLong(argv[3], &value) != REDISMODULE_OK || value < 0 ||
+        value >= (1 << CUCKOO_VALUEBITS(cf))) {
+        return RedisModule_ReplyWithError(ctx, "Value out of range");
+    }
+
+    if (cf->numFilters >= CFMaxExpansions) {
+        return RedisModule_ReplyWithError(ctx, "Maximum expansions reached");
+    }
+
+    size_t elemlen;
+    const char *elem = RedisModule_StringPtrLen(argv[2], &elemlen);
+    CuckooHash hash = CuckooFilter_Hash(cf, elem, elemlen);
+    switch (CuckooFilter_SetValue(cf, hash, value)) {
+    case CuckooInsert_Inserted:
+        RedisModule_ReplicateVerbatim(ctx);
+        return RedisModule_ReplyWithLongLong(ctx, 1);
+    case CuckooInsert_Exists:
+        RedisModule_ReplicateVerbatim(ctx);
+        return RedisModule_ReplyWithLongLong(ctx, 0);
+    case CuckooInsert_NoSpace:
+        return RedisModule_ReplyWithError(ctx, "Filter is full");
+    default:
+        return RedisModule_ReplyWithError(ctx, "Memory allocation failure"); // LCOV_EXCL_LINE
+    }
+}
+
+/**
+ * CF.GETVAL <KEY> <ELEM>
+ *
+ * Returns the value stored with an item, or nil if the item is not in the filter.
+ */
+static int CFGetVal_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    CuckooFilter *cf;
+    int status = cfGetItemFilter(key, &cf, 0, 0);
+    if (status == SB_EMPTY) {
+        return RedisModule_ReplyWithNull(ctx);
+    } else if (status != SB_OK) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    }
+    if (!CUCKOO_VALUEBITS(cf)) {
+        return RedisModule_ReplyWithError(ctx, "Filter was not created with VALUEBITS");
+    }
+
+    size_t elemlen;
+    const char *elem = RedisModule_StringPtrLen(argv[2], &elemlen);
+    uint8_t value;
+    if (!CuckooFilter_GetValue(cf, CuckooFilter_Hash(cf, elem, elemlen), &value)) {
+        return RedisModule_ReplyWithNull(ctx);
+    }
+    return RedisModule_ReplyWithLongLong(ctx, value);
+}
+
 static int CFDel_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
 
@@ -731,8 +1866,10 @@ static int CFDel_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int
 
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
     CuckooFilter *cf;
-    int status = cfGetFilter(key, &cf);
-    if (status != SB_OK) {
+    int status = cfGetItemFilter(key, &cf, 0, 0);
+    if (status == SB_INT_ITEMS) {
+        return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+    } else if (status != SB_OK) {
         return RedisModule_ReplyWithError(ctx, "Not found");
     }
 
@@ -740,7 +1877,7 @@ static int CFDel_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int
     
     size_t elemlen;
     const char *elem = RedisModule_StringPtrLen(argv[2], &elemlen);
-    CuckooHash hash = CUCKOO_GEN_HASH(elem, elemlen);
+    CuckooHash hash = CuckooFilter_Hash(cf, elem, elemlen);
     return RedisModule_ReplyWithLongLong(ctx, CuckooFilter_Delete(cf, hash));
 }
 
@@ -831,11 +1968,18 @@ static int CFLoadChunk_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
     if (pos == 1) {
         if (status != SB_EMPTY) {
             return RedisModule_ReplyWithError(ctx, statusStrerror(status));
-        } else if (bloblen != sizeof(CFHeader)) {
+        } else if (bloblen != sizeof(CFHeader) && bloblen != CF_HEADER_NOMAXBYTES_SIZE &&
+                   bloblen != CF_HEADER_NOKEY_SIZE && bloblen != CF_HEADER_NOEXACT_SIZE &&
+                   bloblen != CF_HEADER_NOALTCHUNK_SIZE && bloblen != CF_HEADER_NOINTITEMS_SIZE &&
+                   bloblen != CF_HEADER_NOVALUES_SIZE) {
             return RedisModule_ReplyWithError(ctx, "Invalid header");
         }
 
-        cf = CFHeader_Load((CFHeader *)blob);
+        // Headers of older versions have no valueBits, intItems, altChunk, exactBuckets, key
+        // or maxBytes
+        CFHeader header = {0};
+        memcpy(&header, blob, bloblen);
+        cf = CFHeader_Load(&header);
         if (cf == NULL) {
             return RedisModule_ReplyWithError(ctx, "Couldn't create filter!");
         }
@@ -853,7 +1997,220 @@ static int CFLoadChunk_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
     return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Multi-structure ingest                                                   ///
+////////////////////////////////////////////////////////////////////////////////
+typedef enum { SKETCH_CF = 0, SKETCH_BF, SKETCH_CMS, SKETCH_TOPK, SKETCH_NROLES } SketchRole;
+
+static const char *sketchRoleNames[SKETCH_NROLES] = {"CF", "BF", "CMS", "TOPK"};
+
+#define SKETCH_MAX_TARGETS 16
+
+typedef struct {
+    SketchRole role;
+    int keypos;
+    void *value;
+} SketchTarget;
+
+/* Items are ingested as strings, see SBChain_UseItems. Top-K only takes strings. */
+static int sketchUseStrings(SketchTarget *t, int adopt) {
+    switch (t->role) {
+    case SKETCH_CF:
+        return CuckooFilter_UseItems(t->value, 0, adopt);
+    case SKETCH_BF:
+        return SBChain_UseItems(t->value, 0, adopt);
+    case SKETCH_CMS:
+        return CMS_UseItems(t->value, 0, adopt);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * SKETCH.INGEST {CF|BF|CMS|TOPK} {key} [{CF|BF|CMS|TOPK} {key} ...] [NEWONLY]
+ *               ITEMS {item} [item ...]
+ *
+ * Adds every item to all the target keys. Each item is hashed once per hash
+ * family rather than once per key: CMS rows and Top-K positions share their
+ * MurmurHash2 row hashes, and all CF (resp. BF) targets share one hash.
+ * CF targets only add items not already present. With NEWONLY, only items new
+ * to every CF target are added to the other targets: items found in a CF
+ * target, or which a full CF target couldn't take, are not.
+ *
+ * Returns an array with, for each item, 1 if it was new to all CF targets (or
+ * there are none), 0 if it already existed, -1 if a CF or BF target is full.
+ * A CF target that reached its maximum expansions fails the whole command.
+ */
+static int SketchIngest_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    SketchTarget targets[SKETCH_MAX_TARGETS];
+    size_t ntargets = 0;
+    int items_index = -1;
+    int newonly = 0, hasCF = 0;
+    const char *parseError = NULL;
+
+    for (int pos = 1; pos < argc && items_index < 0 && !parseError;) {
+        if (!rsStrcasecmp(argv[pos], "ITEMS")) {
+            items_index = pos + 1;
+            continue;
+        }
+        if (!rsStrcasecmp(argv[pos], "NEWONLY")) {
+            newonly = 1;
+            pos++;
+            continue;
+        }
+        int role = -1;
+        for (int ii = 0; ii < SKETCH_NROLES; ++ii) {
+            if (!rsStrcasecmp(argv[pos], sketchRoleNames[ii])) {
+                role = ii;
+            }
+        }
+        if (role < 0 || pos + 1 == argc) {
+            parseError = "ERR expected CF, BF, CMS or TOPK followed by a key";
+        } else if (ntargets == SKETCH_MAX_TARGETS) {
+            parseError = "ERR too many target keys";
+        } else {
+            hasCF |= role == SKETCH_CF;
+            targets[ntargets].role = role;
+            targets[ntargets++].keypos = pos + 1;
+            pos += 2;
+        }
+    }
+
+    if (RedisModule_IsKeysPositionRequest(ctx)) {
+        for (size_t ii = 0; ii < ntargets; ++ii) {
+            RedisModule_KeyAtPos(ctx, targets[ii].keypos);
+        }
+        return REDISMODULE_OK;
+    }
+    if (parseError) {
+        return RedisModule_ReplyWithError(ctx, parseError);
+    }
+    if (ntargets == 0 || items_index < 0 || items_index == argc) {
+        return RedisModule_WrongArity(ctx);
+    }
+    if (newonly && !hasCF) {
+        return RedisModule_ReplyWithError(ctx, "ERR NEWONLY requires a CF target");
+    }
+
+    // Look up every target before touching any of them
+    RedisModuleType *types[SKETCH_NROLES] = {CFType, BFType, CMSketchType, TopKType};
+    for (size_t ii = 0; ii < ntargets; ++ii) {
+        SketchTarget *t = targets + ii;
+        RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[t->keypos],
+                                                  REDISMODULE_READ | REDISMODULE_WRITE);
+        int status = getValue(key, types[t->role], &t->value);
+        if (status != SB_OK) {
+            return RedisModule_ReplyWithError(ctx, statusStrerror(status));
+        }
+        if (t->role == SKETCH_CF || t->role == SKETCH_BF) {
+            coldWarm(t->value, t->role == SKETCH_CF);
+        }
+        if (t->role == SKETCH_CF && ((CuckooFilter *)t->value)->numFilters >= CFMaxExpansions) {
+            return RedisModule_ReplyWithError(ctx, "Maximum expansions reached");
+        }
+        if (sketchUseStrings(t, 0) != 0) {
+            return RedisModule_ReplyWithError(ctx, "ERR target takes integer items");
+        }
+    }
+    for (size_t ii = 0; ii < ntargets; ++ii) {
+        sketchUseStrings(targets + ii, 1);
+    }
+
+    RedisModule_ReplyWithArray(ctx, argc - items_index);
+    for (int ii = items_index; ii < argc; ++ii) {
+        size_t n;
+        const char *s = RedisModule_StringPtrLen(argv[ii], &n);
+
+        SketchHashes rows;
+        SketchHashes_Init(&rows, s, n);
+        // Shared by the targets hashing items the default way, keyed ones hash their own
+        CuckooHash cfHash = 0;
+        bloom_hashval bfHash[2];
+        int haveBfHash[2] = {0, 0};
+        uint32_t topkFp = 0;
+        int haveTopkFp = 0;
+
+        long long isNew = 1;
+        if (hasCF) {
+            cfHash = CUCKOO_GEN_HASH(s, n);
+            for (size_t jj = 0; jj < ntargets; ++jj) {
+                if (targets[jj].role != SKETCH_CF) {
+                    continue;
+                }
+                CuckooFilter *cf = targets[jj].value;
+                CuckooHash hash = cf->keyed ? CuckooFilter_Hash(cf, s, n) : cfHash;
+                switch (CuckooFilter_InsertUnique(cf, hash)) {
+                case CuckooInsert_Exists:
+                    if (isNew == 1) {
+                        isNew = 0;
+                    }
+                    break;
+                case CuckooInsert_NoSpace:
+                case CuckooInsert_MemAllocFailed:
+                    isNew = -1;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        if (newonly && isNew != 1) {
+            RedisModule_ReplyWithLongLong(ctx, isNew);
+            continue;
+        }
+
+        for (size_t jj = 0; jj < ntargets; ++jj) {
+            SketchTarget *t = targets + jj;
+            switch (t->role) {
+            case SKETCH_BF: {
+                SBChain *sb = t->value;
+                if (sb->options & BLOOM_OPT_KEYED) {
+                    if (SBChain_AddHashed(sb, s, n, SBChain_GetHash(sb, s, n)) < 0) {
+                        isNew = -1;
+                    }
+                    break;
+                }
+                int is64 = !!(sb->options & BLOOM_OPT_FORCE64);
+                if (!haveBfHash[is64]) {
+                    bfHash[is64] = SBChain_GetHash(sb, s, n);
+                    haveBfHash[is64] = 1;
+                }
+                if (SBChain_AddHashed(sb, s, n, bfHash[is64]) < 0) {
+                    isNew = -1;
+                }
+                break;
+            }
+            case SKETCH_CMS:
+                CMS_IncrByHashes(t->value, &rows, 1);
+                break;
+            case SKETCH_TOPK: {
+                if (!haveTopkFp) {
+                    topkFp = MurmurHash2(s, n, TOPK_HASH_SEED);
+                    haveTopkFp = 1;
+                }
+                char *expelled = TopK_AddHashes(t->value, &rows, topkFp, 1);
+                if (expelled) {
+                    TOPK_FREE(expelled);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        RedisModule_ReplyWithLongLong(ctx, isNew);
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
+}
+
 uint64_t BFCapacity(SBChain *bf) {
+    if (SB_IS_SPARSE(bf)) {
+        return bf->sparse->capacity;
+    }
     uint64_t capacity = 0;
     for(size_t ii = 0; ii < bf->nfilters; ++ii) {
         capacity += bf->filters[ii].inner.entries; // * sizeof(unsigned char);
@@ -862,10 +2219,10 @@ uint64_t BFCapacity(SBChain *bf) {
 }
 
 uint64_t BFSize(SBChain *bf) {
-    uint64_t bytes = 0;
-    for(size_t ii = 0; ii < bf->nfilters; ++ii) {
-        bytes += bf->filters[ii].inner.bytes; // * sizeof(unsigned char);
+    if (SB_IS_SPARSE(bf)) {
+        return sizeof(*bf) + sizeof(*bf->sparse) + bf->sparse->n * sizeof(*bf->sparse->hashes);
     }
+    uint64_t bytes = SBChain_DataBytes(bf);
 
     return  sizeof(*bf) + 
             sizeof(*bf->filters) * bf->nfilters +
@@ -881,12 +2238,16 @@ static int BFInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
 
     SBChain *bf;
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    int status = bfGetChain(key, &bf);
+    // Reports the current encoding, so doesn't unpack the chain
+    int status = getValue(key, BFType, (void **)&bf);
     if (status != REDISMODULE_OK) {
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
-    RedisModule_ReplyWithArray(ctx, 5 * 2);
+    int keyed = !!(bf->options & BLOOM_OPT_KEYED);
+    int budgeted = !!(bf->options & BLOOM_OPT_MAXBYTES);
+    RedisModule_ReplyWithArray(ctx,
+                               (5 + !!bf->prefixes + keyed + budgeted + !!ColdAfterMs) * 2);
     RedisModule_ReplyWithSimpleString(ctx, "Capacity");
     RedisModule_ReplyWithLongLong(ctx, BFCapacity(bf));
     RedisModule_ReplyWithSimpleString(ctx, "Size");
@@ -897,19 +2258,41 @@ static int BFInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
     RedisModule_ReplyWithLongLong(ctx, bf->size);
     RedisModule_ReplyWithSimpleString(ctx, "Expansion rate");
     RedisModule_ReplyWithLongLong(ctx, bf->growth);
+    if (bf->prefixes) {
+        size_t nprefixes = 0;
+        while (bf->prefixes[nprefixes]) {
+            ++nprefixes;
+        }
+        RedisModule_ReplyWithSimpleString(ctx, "Prefix lengths");
+        RedisModule_ReplyWithArray(ctx, nprefixes);
+        for (size_t ii = 0; ii < nprefixes; ++ii) {
+            RedisModule_ReplyWithLongLong(ctx, bf->prefixes[ii]);
+        }
+    }
+    if (keyed) {
+        RedisModule_ReplyWithSimpleString(ctx, "Hashing");
+        RedisModule_ReplyWithSimpleString(ctx, "keyed");
+    }
+    if (budgeted) {
+        RedisModule_ReplyWithSimpleString(ctx, "Max memory");
+        RedisModule_ReplyWithLongLong(ctx, bf->maxBytes);
+    }
+    if (ColdAfterMs) {
+        RedisModule_ReplyWithSimpleString(ctx, "Encoding");
+        RedisModule_ReplyWithSimpleString(ctx, SB_IS_SPARSE(bf)       ? "sparse"
+                                               : SBChain_IsPacked(bf) ? "packed"
+                                                                      : "dense");
+    }
 
     return REDISMODULE_OK;
 }
 
 uint64_t CFSize(CuckooFilter *cf) {
-    uint64_t numBuckets = 0;
-    for(uint16_t ii = 0; ii < cf->numFilters; ++ii) {
-        numBuckets += cf->filters[ii].numBuckets;
-    }
+    uint64_t dataSize = CuckooFilter_DataBytes(cf);
 
     return  sizeof(*cf) + 
             sizeof(*cf->filters) * cf->numFilters +
-            numBuckets * cf->bucketSize;
+            dataSize;
 }
 
 static int CFInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -920,12 +2303,16 @@ static int CFInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
 
     CuckooFilter *cf;
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    int status = cfGetFilter(key, &cf);
+    // Reports the current encoding, so doesn't unpack the filter
+    int status = getValue(key, CFType, (void **)&cf);
     if (status != REDISMODULE_OK) {
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
 
-    RedisModule_ReplyWithArray(ctx, 8 * 2);
+    RedisModule_ReplyWithArray(ctx,
+                               (8 + !!CUCKOO_VALUEBITS(cf) + !!cf->altChunk + !!cf->exactBuckets +
+                                !!cf->keyed + !!cf->maxBytes + !!ColdAfterMs) *
+                                   2);
     RedisModule_ReplyWithSimpleString(ctx, "Size");
     RedisModule_ReplyWithLongLong(ctx, CFSize(cf));
     RedisModule_ReplyWithSimpleString(ctx, "Number of buckets");
@@ -942,6 +2329,30 @@ static int CFInfo_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
     RedisModule_ReplyWithLongLong(ctx, cf->expansion);
     RedisModule_ReplyWithSimpleString(ctx, "Max iterations");
     RedisModule_ReplyWithLongLong(ctx, cf->maxIterations);
+    if (CUCKOO_VALUEBITS(cf)) {
+        RedisModule_ReplyWithSimpleString(ctx, "Value bits");
+        RedisModule_ReplyWithLongLong(ctx, CUCKOO_VALUEBITS(cf));
+    }
+    if (cf->altChunk) {
+        RedisModule_ReplyWithSimpleString(ctx, "Placement");
+        RedisModule_ReplyWithSimpleString(ctx, "local");
+    }
+    if (cf->exactBuckets) {
+        RedisModule_ReplyWithSimpleString(ctx, "Sizing");
+        RedisModule_ReplyWithSimpleString(ctx, "exact");
+    }
+    if (cf->keyed) {
+        RedisModule_ReplyWithSimpleString(ctx, "Hashing");
+        RedisModule_ReplyWithSimpleString(ctx, "keyed");
+    }
+    if (cf->maxBytes) {
+        RedisModule_ReplyWithSimpleString(ctx, "Max memory");
+        RedisModule_ReplyWithLongLong(ctx, cf->maxBytes);
+    }
+    if (ColdAfterMs) {
+        RedisModule_ReplyWithSimpleString(ctx, "Encoding");
+        RedisModule_ReplyWithSimpleString(ctx, CuckooFilter_IsPacked(cf) ? "packed" : "dense");
+    }
 
     return REDISMODULE_OK;
 }
@@ -954,7 +2365,7 @@ static int CFDebug_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
 
     CuckooFilter *cf;
     RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-    int status = cfGetFilter(key, &cf);
+    int status = getValue(key, CFType, (void **)&cf);
     if (status != REDISMODULE_OK) {
         return RedisModule_ReplyWithError(ctx, statusStrerror(status));
     }
@@ -974,8 +2385,85 @@ static int CFDebug_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
 #define BF_MIN_OPTIONS_ENC 2
 #define BF_ENCODING_VERSION 3
 #define BF_MIN_GROWTH_ENC 4
+#define BF_MIN_PREFIX_ENC 5
+#define BF_MIN_SPARSE_ENC 6
+#define BF_MIN_PAGED_ENC 7
+#define BF_MIN_KEYED_ENC 8
+#define BF_MIN_MAXBYTES_ENC 9
 
 #define CF_MIN_EXPANSION_VERSION 4
+#define CF_MIN_VALUES_VERSION 5
+#define CF_MIN_PAGED_VERSION 6
+#define CF_MIN_INTITEMS_VERSION 7
+#define CF_MIN_LOCALALT_VERSION 8
+#define CF_MIN_EXACT_VERSION 9
+#define CF_MIN_KEYED_VERSION 10
+#define CF_MIN_MAXBYTES_VERSION 11
+
+// Arrays are saved as runs of non-zero blocks of this size, see saveZeroPaged
+#define RDB_PAGE_SIZE 4096
+// Longest run, bounding the temporary buffer used to load it
+#define RDB_MAX_RUN (1 << 20)
+
+static int isZeroPage(const unsigned char *p, size_t len) {
+    // Branch-free so the compiler can vectorize it
+    uint64_t acc = 0, word;
+    size_t ii = 0;
+    for (; ii + sizeof(word) <= len; ii += sizeof(word)) {
+        memcpy(&word, p + ii, sizeof(word));
+        acc |= word;
+    }
+    for (; ii < len; ++ii) {
+        acc |= p[ii];
+    }
+    return acc == 0;
+}
+
+/**
+ * Saves only the page-sized blocks of `buf` holding non-zero bytes, as
+ * (offset, run) pairs terminated by `len`. Loading them into a calloc'ed array
+ * leaves the zero pages untouched, so they don't take resident memory.
+ */
+static void saveZeroPaged(RedisModuleIO *io, const unsigned char *buf, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = len - pos < RDB_PAGE_SIZE ? len - pos : RDB_PAGE_SIZE;
+        if (isZeroPage(buf + pos, n)) {
+            pos += n;
+            continue;
+        }
+        size_t end = pos + n;
+        while (end < len && end - pos < RDB_MAX_RUN) {
+            n = len - end < RDB_PAGE_SIZE ? len - end : RDB_PAGE_SIZE;
+            if (isZeroPage(buf + end, n)) {
+                break;
+            }
+            end += n;
+        }
+        RedisModule_SaveUnsigned(io, pos);
+        RedisModule_SaveStringBuffer(io, (const char *)buf + pos, end - pos);
+        pos = end;
+    }
+    RedisModule_SaveUnsigned(io, len);
+}
+
+/** Loads what saveZeroPaged saved into the zeroed `buf`. Returns 0 on success */
+static int loadZeroPaged(RedisModuleIO *io, unsigned char *buf, size_t len) {
+    for (;;) {
+        uint64_t pos = RedisModule_LoadUnsigned(io);
+        if (pos == len) {
+            return 0;
+        }
+        size_t n;
+        char *run = RedisModule_LoadStringBuffer(io, &n);
+        if (run == NULL || pos > len || n > len - pos) {
+            RedisModule_Free(run); // LCOV_EXCL_LINE
+            return -1;             // LCOV_EXCL_LINE
+        }
+        memcpy(buf + pos, run, n);
+        RedisModule_Free(run);
+    }
+}
 
 static void BFRdbSave(RedisModuleIO *io, void *obj) {
     // Save the setting!
@@ -985,6 +2473,29 @@ static void BFRdbSave(RedisModuleIO *io, void *obj) {
     RedisModule_SaveUnsigned(io, sb->nfilters);
     RedisModule_SaveUnsigned(io, sb->options);
     RedisModule_SaveUnsigned(io, sb->growth);
+    if (sb->options & BLOOM_OPT_PREFIXES) {
+        for (const uint16_t *p = sb->prefixes;; ++p) {
+            RedisModule_SaveUnsigned(io, *p);
+            if (*p == 0) {
+                break;
+            }
+        }
+    }
+    if (sb->options & BLOOM_OPT_KEYED) {
+        RedisModule_SaveUnsigned(io, sb->hashKey[0]);
+        RedisModule_SaveUnsigned(io, sb->hashKey[1]);
+    }
+    if (sb->options & BLOOM_OPT_MAXBYTES) {
+        RedisModule_SaveUnsigned(io, sb->maxBytes);
+    }
+
+    if (SB_IS_SPARSE(sb)) {
+        const SBSparse *sp = sb->sparse;
+        RedisModule_SaveUnsigned(io, sp->capacity);
+        RedisModule_SaveDouble(io, sp->error);
+        RedisModule_SaveUnsigned(io, sp->limit);
+        RedisModule_SaveStringBuffer(io, (const char *)sp->hashes, sp->n * sizeof(*sp->hashes));
+    }
 
     for (size_t ii = 0; ii < sb->nfilters; ++ii) {
         const SBLink *lb = sb->filters + ii;
@@ -996,7 +2507,17 @@ static void BFRdbSave(RedisModuleIO *io, void *obj) {
         RedisModule_SaveDouble(io, bm->bpe);
         RedisModule_SaveUnsigned(io, bm->bits);
         RedisModule_SaveUnsigned(io, bm->n2);
-        RedisModule_SaveStringBuffer(io, (const char *)bm->bf, bm->bytes);
+        RedisModule_SaveUnsigned(io, bm->bytes);
+        // Packed links are decoded one at a time, leaving the chain packed
+        unsigned char *tmp;
+        const unsigned char *bits = SBChain_LinkBits(sb, ii, &tmp);
+        if (bits) {
+            saveZeroPaged(io, bits, bm->bytes);
+        } else {
+            RedisModule_LogIOError(io, "warning", "Can't decode a packed Bloom filter link");
+            RedisModule_SaveUnsigned(io, bm->bytes); // LCOV_EXCL_LINE saved as all zeros
+        }
+        RedisModule_Free(tmp);
 
         // Save the number of actual entries stored thus far.
         RedisModule_SaveUnsigned(io, lb->size);
@@ -1004,7 +2525,7 @@ static void BFRdbSave(RedisModuleIO *io, void *obj) {
 }
 
 static void *BFRdbLoad(RedisModuleIO *io, int encver) {
-    if (encver > BF_MIN_GROWTH_ENC) {
+    if (encver > BF_MIN_MAXBYTES_ENC) {
         return NULL;
     }
 
@@ -1020,7 +2541,41 @@ static void *BFRdbLoad(RedisModuleIO *io, int encver) {
     } else {
         sb->growth = 2;
     }
-    
+    if (encver >= BF_MIN_PREFIX_ENC && (sb->options & BLOOM_OPT_PREFIXES)) {
+        uint16_t prefixes[SB_MAX_PREFIXES + 1];
+        size_t n = 0;
+        do {
+            assert(n <= SB_MAX_PREFIXES);
+            prefixes[n] = RedisModule_LoadUnsigned(io);
+        } while (prefixes[n++]);
+        sb->prefixes = RedisModule_Calloc(n, sizeof(*sb->prefixes));
+        memcpy(sb->prefixes, prefixes, n * sizeof(*sb->prefixes));
+    }
+    if (encver >= BF_MIN_KEYED_ENC && (sb->options & BLOOM_OPT_KEYED)) {
+        sb->hashKey[0] = RedisModule_LoadUnsigned(io);
+        sb->hashKey[1] = RedisModule_LoadUnsigned(io);
+    }
+    if (encver >= BF_MIN_MAXBYTES_ENC && (sb->options & BLOOM_OPT_MAXBYTES)) {
+        sb->maxBytes = RedisModule_LoadUnsigned(io);
+    }
+
+    if (encver >= BF_MIN_SPARSE_ENC && SB_IS_SPARSE(sb)) {
+        uint64_t capacity = RedisModule_LoadUnsigned(io);
+        double error = RedisModule_LoadDouble(io);
+        uint32_t limit = RedisModule_LoadUnsigned(io);
+        size_t len;
+        char *hashes = RedisModule_LoadStringBuffer(io, &len);
+        assert(len % sizeof(bloom_hashval) == 0 && len / sizeof(bloom_hashval) <= limit);
+
+        sb->sparse = RedisModule_Alloc(sizeof(*sb->sparse) + len);
+        sb->sparse->capacity = capacity;
+        sb->sparse->error = error;
+        sb->sparse->limit = limit;
+        sb->sparse->n = len / sizeof(bloom_hashval);
+        memcpy(sb->sparse->hashes, hashes, len);
+        RedisModule_Free(hashes);
+        return sb;
+    }
 
     // Sanity:
     assert(sb->nfilters < 1000);
@@ -1043,12 +2598,23 @@ static void *BFRdbLoad(RedisModuleIO *io, int encver) {
         if (sb->options & BLOOM_OPT_FORCE64) {
             bm->force64 = 1;
         }
-        size_t sztmp;
-        bm->bf = (unsigned char *)RedisModule_LoadStringBuffer(io, &sztmp);
-        bm->bytes = sztmp;
+        bloom_select_kernels(bm);
+        if (encver >= BF_MIN_PAGED_ENC) {
+            bm->bytes = RedisModule_LoadUnsigned(io);
+            bm->bf = RedisModule_Calloc(bm->bytes, sizeof(unsigned char));
+            int rc = loadZeroPaged(io, bm->bf, bm->bytes);
+            assert(rc == 0);
+            (void)rc;
+        } else {
+            size_t sztmp;
+            bm->bf = (unsigned char *)RedisModule_LoadStringBuffer(io, &sztmp);
+            bm->bytes = sztmp;
+        }
         lb->size = RedisModule_LoadUnsigned(io);
     }
 
+    sb = SBChain_Inline(sb);
+    idleTouch(sb, 0);
     return sb;
 }
 
@@ -1061,24 +2627,39 @@ static void BFAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value
 
     long long iter = SB_CHUNKITER_INIT;
     const char *chunk;
-    while ((chunk = SBChain_GetEncodedChunk(sb, &iter, &len, MAX_SCANDUMP_SIZE)) != NULL) {
+    SBUnpackedLink unpacked = {0};
+    while ((chunk = SBChain_GetPackedChunk(sb, &iter, &len, MAX_SCANDUMP_SIZE, &unpacked))) {
         RedisModule_EmitAOF(aof, "BF.LOADCHUNK", "slb", key, iter, chunk, len);
     }
+    if (iter != 0) {
+        RedisModule_LogIOError(aof, "warning", "Can't decode a packed Bloom filter link");
+    }
+    RedisModule_Free(unpacked.bits);
 }
 
-static void BFFree(void *value) { SBChain_Free(value); }
+static void BFFree(void *value) {
+    idleForget(value, 0);
+    SBChain_Free(value);
+}
 
 static size_t BFMemUsage(const void *value) {
     const SBChain *sb = value;
     size_t rv = sizeof(*sb);
-    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
-        rv += sizeof(*sb->filters);
-        rv += sb->filters[ii].inner.bytes;
+    if (SB_IS_SPARSE(sb)) {
+        rv += sizeof(*sb->sparse) + sb->sparse->n * sizeof(*sb->sparse->hashes);
+    }
+    rv += sizeof(*sb->filters) * sb->nfilters + SBChain_DataBytes(sb);
+    for (const uint16_t *p = sb->prefixes; p && *p; ++p) {
+        rv += sizeof(*p);
+    }
+    if (sb->prefixes) {
+        rv += sizeof(*sb->prefixes); // terminator
     }
     return rv;
 }
 
 static void CFFree(void *value) {
+    idleForget(value, 1);
     CuckooFilter_Free(value);
     RedisModule_Free(value);
 }
@@ -1092,17 +2673,35 @@ static void CFRdbSave(RedisModuleIO *io, void *obj) {
     RedisModule_SaveUnsigned(io, cf->bucketSize);
     RedisModule_SaveUnsigned(io, cf->maxIterations);
     RedisModule_SaveUnsigned(io, cf->expansion);
+    RedisModule_SaveUnsigned(io, CUCKOO_VALUEBITS(cf));
+    RedisModule_SaveUnsigned(io, cf->intItems);
+    RedisModule_SaveUnsigned(io, cf->altChunk);
+    RedisModule_SaveUnsigned(io, cf->exactBuckets);
+    RedisModule_SaveUnsigned(io, cf->keyed);
+    if (cf->keyed) {
+        RedisModule_SaveUnsigned(io, cf->hashKey[0]);
+        RedisModule_SaveUnsigned(io, cf->hashKey[1]);
+    }
+    RedisModule_SaveUnsigned(io, cf->maxBytes);
     for (size_t ii = 0; ii < cf->numFilters; ++ii) {
         RedisModule_SaveUnsigned(io, cf->filters[ii].numBuckets);
-        RedisModule_SaveStringBuffer(io, (char *)cf->filters[ii].data,
-                    cf->filters[ii].bucketSize *
-                    cf->filters[ii].numBuckets * 
-                    sizeof(*cf->filters[ii].data));
+        // Fingerprints and values together. Packed sub filters are decoded one at a
+        // time, leaving the filter packed
+        size_t size = SUBCF_DATA_SIZE(&cf->filters[ii]);
+        MyCuckooBucket *tmp;
+        const MyCuckooBucket *data = CuckooFilter_SubData(cf, ii, &tmp);
+        if (data) {
+            saveZeroPaged(io, data, size);
+        } else {
+            RedisModule_LogIOError(io, "warning", "Can't decode a packed cuckoo sub filter");
+            RedisModule_SaveUnsigned(io, size); // LCOV_EXCL_LINE saved as all zeros
+        }
+        RedisModule_Free(tmp);
     }
 }
 
 static void *CFRdbLoad(RedisModuleIO *io, int encver) {
-    if (encver > CF_MIN_EXPANSION_VERSION) {
+    if (encver > CF_MIN_MAXBYTES_VERSION) {
         return NULL;
     }
 /* RDBCF
@@ -1132,37 +2731,74 @@ static void *CFRdbLoad(RedisModuleIO *io, int encver) {
         cf->maxIterations = RedisModule_LoadUnsigned(io);
         cf->expansion = RedisModule_LoadUnsigned(io);
     }
+    uint16_t valueBits = 0;
+    if (encver >= CF_MIN_VALUES_VERSION) {
+        valueBits = RedisModule_LoadUnsigned(io);
+    }
+    if (encver >= CF_MIN_INTITEMS_VERSION) {
+        cf->intItems = RedisModule_LoadUnsigned(io);
+    }
+    if (encver >= CF_MIN_LOCALALT_VERSION) {
+        cf->altChunk = RedisModule_LoadUnsigned(io);
+    }
+    if (encver >= CF_MIN_EXACT_VERSION) {
+        cf->exactBuckets = RedisModule_LoadUnsigned(io);
+    }
+    if (encver >= CF_MIN_KEYED_VERSION) {
+        cf->keyed = RedisModule_LoadUnsigned(io);
+        if (cf->keyed) {
+            cf->hashKey[0] = RedisModule_LoadUnsigned(io);
+            cf->hashKey[1] = RedisModule_LoadUnsigned(io);
+        }
+    }
+    if (encver >= CF_MIN_MAXBYTES_VERSION) {
+        cf->maxBytes = RedisModule_LoadUnsigned(io);
+    }
 
     cf->filters = RedisModule_Calloc(cf->numFilters, sizeof(*cf->filters));
     for (size_t ii = 0, exp = 1; ii < cf->numFilters; ++ii, exp *= cf->expansion) {
         cf->filters[ii].bucketSize = cf->bucketSize;
+        cf->filters[ii].valueBits = valueBits;
 
         if (encver < CF_MIN_EXPANSION_VERSION) {
             cf->filters[ii].numBuckets = cf->numBuckets;
         } else {
             cf->filters[ii].numBuckets = RedisModule_LoadUnsigned(io);
         }
+
+        if (encver >= CF_MIN_PAGED_VERSION) {
+            cf->filters[ii].data = RedisModule_Calloc(SUBCF_DATA_SIZE(&cf->filters[ii]),
+                                                      sizeof(CuckooBucket));
+            int rc = loadZeroPaged(io, cf->filters[ii].data, SUBCF_DATA_SIZE(&cf->filters[ii]));
+            assert(rc == 0);
+            (void)rc;
+            continue;
+        }
         
         size_t lenDummy = 0;
         cf->filters[ii].data = (MyCuckooBucket *)RedisModule_LoadStringBuffer(io, &lenDummy);
         assert(cf->filters[ii].data != NULL && lenDummy == cf->filters[ii].bucketSize *
                                                            cf->filters[ii].numBuckets * 
                                                            sizeof(*cf->filters[ii].data));
+        if (valueBits) {
+            // Values are kept right after the fingerprints, in the same allocation
+            size_t fpSize = lenDummy;
+            char *values = RedisModule_LoadStringBuffer(io, &lenDummy);
+            assert(values != NULL && fpSize + lenDummy == SUBCF_DATA_SIZE(&cf->filters[ii]));
+            cf->filters[ii].data = RedisModule_Realloc(cf->filters[ii].data, fpSize + lenDummy);
+            memcpy(SUBCF_VALUES(&cf->filters[ii]), values, lenDummy);
+            RedisModule_Free(values);
+        }
     }
+    cf = CuckooFilter_Inline(cf);
+    idleTouch(cf, 1);
     return cf;
 }
 
 static size_t CFMemUsage(const void *value) {
     const CuckooFilter *cf = value;
 
-    size_t filtersSize = 0;
-    for (size_t ii = 0; ii < cf->numFilters; ++ii) {
-        filtersSize +=  cf->filters[ii].bucketSize * 
-                        cf->filters[ii].numBuckets * 
-                        sizeof(*cf->filters[ii].data);
-    }
-    
-    return sizeof(*cf) + sizeof(*cf->filters) * cf->numFilters + filtersSize;
+    return sizeof(*cf) + sizeof(*cf->filters) * cf->numFilters + CuckooFilter_DataBytes(cf);
 }
 
 static void CFAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *obj) {
@@ -1174,9 +2810,14 @@ static void CFAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *obj)
 
     long long pos = 1;
     RedisModule_EmitAOF(aof, "CF.LOADCHUNK", "slb", key, pos, (const char *)&header, sizeof header);
-    while ((chunk = CF_GetEncodedChunk(cf, &pos, &nchunk, MAX_SCANDUMP_SIZE))) {
+    CFUnpackedSub unpacked = {0};
+    while ((chunk = CF_GetPackedChunk(cf, &pos, &nchunk, MAX_SCANDUMP_SIZE, &unpacked))) {
         RedisModule_EmitAOF(aof, "CF.LOADCHUNK", "slb", key, pos, chunk, nchunk);
     }
+    if (unpacked.filters && !unpacked.data) {
+        RedisModule_LogIOError(aof, "warning", "Can't decode a packed cuckoo sub filter");
+    }
+    CF_FreeUnpackedSub(&unpacked);
 }
 
 static int rsStrcasecmp(const RedisModuleString *rs1, const char *s2) {
@@ -1241,11 +2882,36 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
                 BAIL("Invalid argument for 'CF_MAX_EXPANSIONS'", NULL);
             }
             CFMaxExpansions = l;
+        } else if (!rsStrcasecmp(argv[ii], "cold_after")) {
+            long long l;
+            if (RedisModule_StringToLongLong(argv[ii + 1], &l) == REDISMODULE_ERR || l < 0) {
+                BAIL("Invalid argument for 'COLD_AFTER'", NULL);
+            }
+            ColdAfterMs = l * 1000;
+        } else if (!rsStrcasecmp(argv[ii], "batch_max")) {
+            long long l;
+            if (RedisModule_StringToLongLong(argv[ii + 1], &l) == REDISMODULE_ERR || l < 0 ||
+                l > BATCH_MAX_ITEMS) {
+                BAIL("Invalid argument for 'BATCH_MAX'", NULL);
+            }
+            BatchMax = l;
+        } else if (!rsStrcasecmp(argv[ii], "cf_load_threads")) {
+            long long l;
+            if (RedisModule_StringToLongLong(argv[ii + 1], &l) == REDISMODULE_ERR || l < 1 ||
+                l > CUCKOO_MAX_LOAD_THREADS) {
+                BAIL("Invalid argument for 'CF_LOAD_THREADS'", NULL);
+            }
+            CFLoadThreads = l;
         } else {
             BAIL("Unrecognized option", NULL);
         } 
     } 
 
+    // Batched checks must not block clients in scripts and transactions
+    if (BatchMax && REDISMODULE_GET_API(GetContextFlags) != REDISMODULE_OK) {
+        BAIL("BATCH_MAX requires a server providing RedisModule_GetContextFlags", NULL);
+    }
+
 #define CREATE_CMD(name, tgt, attr)                                                                \
     do {                                                                                           \
         if (RedisModule_CreateCommand(ctx, name, tgt, attr, 1, 1, 1) != REDISMODULE_OK) {          \
@@ -1254,6 +2920,13 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     } while (0)
 #define CREATE_WRCMD(name, tgt) CREATE_CMD(name, tgt, "write deny-oom")
 #define CREATE_ROCMD(name, tgt) CREATE_CMD(name, tgt, "readonly fast")
+// Commands taking groups of 'step' arguments, each starting with a key
+#define CREATE_MULTIKEY_CMD(name, tgt, attr, step)                                                 \
+    do {                                                                                           \
+        if (RedisModule_CreateCommand(ctx, name, tgt, attr, 1, -1, step) != REDISMODULE_OK) {      \
+            return REDISMODULE_ERR;                                                                \
+        }                                                                                          \
+    } while (0)
 
     CREATE_WRCMD("bf.reserve", BFReserve_RedisCommand);
     CREATE_WRCMD("bf.add", BFAdd_RedisCommand);
@@ -1261,24 +2934,44 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     CREATE_WRCMD("bf.insert", BFInsert_RedisCommand);
     CREATE_ROCMD("bf.exists", BFCheck_RedisCommand);
     CREATE_ROCMD("bf.mexists", BFCheck_RedisCommand);
+    CREATE_ROCMD("bf.existsprefix", BFExistsPrefix_RedisCommand);
+    CREATE_MULTIKEY_CMD("bf.maddkeys", BFMultiKey_RedisCommand, "write deny-oom", 2);
+    CREATE_MULTIKEY_CMD("bf.mexistskeys", BFMultiKey_RedisCommand, "readonly", 2);
+    CREATE_WRCMD("bf.maddint", BFIntItems_RedisCommand);
+    CREATE_ROCMD("bf.mexistsint", BFIntItems_RedisCommand);
     CREATE_ROCMD("bf.info", BFInfo_RedisCommand);
 
     // Bloom - Debug
     CREATE_ROCMD("bf.debug", BFDebug_RedisCommand);
+    if (RedisModule_CreateCommand(ctx, "bf.batchinfo", BFBatchInfo_RedisCommand, "readonly fast",
+                                  0, 0, 0) != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
     
     // Bloom - AOF
     CREATE_ROCMD("bf.scandump", BFScanDump_RedisCommand);
     CREATE_WRCMD("bf.loadchunk", BFLoadChunk_RedisCommand);
 
+    // Keys are the source and the destination
+    if (RedisModule_CreateCommand(ctx, "bf.copy", BFCopy_RedisCommand, "write deny-oom", 1, 2,
+                                  1) != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+
     // Cuckoo Filter commands
     CREATE_WRCMD("cf.reserve", CFReserve_RedisCommand);
     CREATE_WRCMD("cf.add", CFAdd_RedisCommand);
     CREATE_WRCMD("cf.addnx", CFAdd_RedisCommand);
     CREATE_WRCMD("cf.insert", CFInsert_RedisCommand);
     CREATE_WRCMD("cf.insertnx", CFInsert_RedisCommand);
+    CREATE_WRCMD("cf.bulkload", CFInsert_RedisCommand);
     CREATE_ROCMD("cf.exists", CFCheck_RedisCommand);
     CREATE_ROCMD("cf.mexists", CFCheck_RedisCommand);
     CREATE_ROCMD("cf.count", CFCheck_RedisCommand);
+    CREATE_WRCMD("cf.addint", CFIntItems_RedisCommand);
+    CREATE_ROCMD("cf.existsint", CFIntItems_RedisCommand);
+    CREATE_WRCMD("cf.setval", CFSetVal_RedisCommand);
+    CREATE_ROCMD("cf.getval", CFGetVal_RedisCommand);
 
     // Technically a write command, but doesn't change memory profile
     CREATE_CMD("cf.del", CFDel_RedisCommand, "write fast");
@@ -1290,9 +2983,19 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
     CREATE_ROCMD("cf.info", CFInfo_RedisCommand);
     CREATE_ROCMD("cf.debug", CFDebug_RedisCommand);
-    
+
+    // Keys follow their role anywhere before ITEMS
+    if (RedisModule_CreateCommand(ctx, "sketch.ingest", SketchIngest_RedisCommand,
+                                  "write deny-oom getkeys-api", 0, 0, 0) != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+
     CMSModule_onLoad(ctx, argv, argc);
     TopKModule_onLoad(ctx, argv, argc);
+    TDigestModule_onLoad(ctx, argv, argc);
+    MinHashModule_onLoad(ctx, argv, argc);
+    CBFModule_onLoad(ctx, argv, argc);
+    CSModule_onLoad(ctx, argv, argc);
 
     static RedisModuleTypeMethods typeprocs = {.version = REDISMODULE_TYPE_METHOD_VERSION,
                                                .rdb_load = BFRdbLoad,
@@ -1300,7 +3003,7 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
                                                .aof_rewrite = BFAofRewrite,
                                                .free = BFFree,
                                                .mem_usage = BFMemUsage};
-    BFType = RedisModule_CreateDataType(ctx, "MBbloom--", BF_MIN_GROWTH_ENC, &typeprocs);
+    BFType = RedisModule_CreateDataType(ctx, "MBbloom--", BF_MIN_MAXBYTES_ENC, &typeprocs);
     if (BFType == NULL) {
         return REDISMODULE_ERR;
     }
@@ -1311,7 +3014,7 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
                                                  .aof_rewrite = CFAofRewrite,
                                                  .free = CFFree,
                                                  .mem_usage = CFMemUsage};
-    CFType = RedisModule_CreateDataType(ctx, "MBbloomCF", CF_MIN_EXPANSION_VERSION, &cfTypeProcs);
+    CFType = RedisModule_CreateDataType(ctx, "MBbloomCF", CF_MIN_MAXBYTES_VERSION, &cfTypeProcs);
     if (CFType == NULL) {
         return REDISMODULE_ERR;
     }
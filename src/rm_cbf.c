@@ -0,0 +1,295 @@
+#include <assert.h> // assert
+#include <string.h> // memcpy
+
+#include "rmutil/util.h"
+#include "version.h"
+
+#include "cbf.h"
+#include "rm_cbf.h"
+
+#define INNER_ERROR(x)                                                                             \
+    RedisModule_ReplyWithError(ctx, x);                                                            \
+    return REDISMODULE_ERR;
+
+RedisModuleType *CBFType;
+
+static int GetCBFKey(RedisModuleCtx *ctx, RedisModuleString *keyName, CountingBloom **cbf,
+                     int mode) {
+    // All using this function should call RedisModule_AutoMemory to prevent memory leak
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        INNER_ERROR("CBF: key does not exist");
+    } else if (RedisModule_ModuleTypeGetType(key) != CBFType) {
+        INNER_ERROR(REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    *cbf = RedisModule_ModuleTypeGetValue(key);
+    return REDISMODULE_OK;
+}
+
+/**
+ * CBF.RESERVE key error capacity
+ */
+static int CBF_Reserve_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    double error;
+    if (RedisModule_StringToDouble(argv[2], &error) != REDISMODULE_OK || error <= 0 ||
+        error >= 1) {
+        return RedisModule_ReplyWithError(ctx, "CBF: invalid error rate");
+    }
+    long long capacity;
+    if (RedisModule_StringToLongLong(argv[3], &capacity) != REDISMODULE_OK || capacity < 1) {
+        return RedisModule_ReplyWithError(ctx, "CBF: invalid capacity");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithError(ctx, "CBF: key already exists");
+    }
+
+    CountingBloom *cbf = CBF_New(capacity, error);
+    if (cbf == NULL) {
+        return RedisModule_ReplyWithError(ctx, "CBF: could not create filter");
+    }
+    RedisModule_ModuleTypeSetValue(key, CBFType, cbf);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+// Hashes of the items argv[first..argc-1], all at once
+static bloom_hashval *hashItems(RedisModuleCtx *ctx, RedisModuleString **argv, int first,
+                                int argc) {
+    size_t n = argc - first;
+    const void **items = RedisModule_PoolAlloc(ctx, n * sizeof(*items));
+    size_t *lens = RedisModule_PoolAlloc(ctx, n * sizeof(*lens));
+    bloom_hashval *hashes = RedisModule_PoolAlloc(ctx, n * sizeof(*hashes));
+    for (size_t i = 0; i < n; ++i) {
+        items[i] = RedisModule_StringPtrLen(argv[first + i], &lens[i]);
+    }
+    bloom_calc_hashes64((const void *const *)items, lens, n, hashes);
+    return hashes;
+}
+
+/**
+ * CBF.ADD key item [item ...]
+ * CBF.DEL key item [item ...]
+ * CBF.EXISTS key item [item ...]
+ * Reply with, for each item, 1 if it was new to the filter, deleted or found
+ * respectively, 0 otherwise.
+ */
+static int cbfItemsCommon(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int write,
+                          int (*op)(CountingBloom *, bloom_hashval)) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    CountingBloom *cbf;
+    int mode = write ? REDISMODULE_READ | REDISMODULE_WRITE : REDISMODULE_READ;
+    if (GetCBFKey(ctx, argv[1], &cbf, mode) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    bloom_hashval *hashes = hashItems(ctx, argv, 2, argc);
+    RedisModule_ReplyWithArray(ctx, argc - 2);
+    for (int i = 0; i < argc - 2; ++i) {
+        RedisModule_ReplyWithLongLong(ctx, op(cbf, hashes[i]));
+    }
+
+    if (write) {
+        RedisModule_ReplicateVerbatim(ctx);
+    }
+    return REDISMODULE_OK;
+}
+
+static int cbfExists(CountingBloom *cbf, bloom_hashval hash) { return CBF_Exists(cbf, hash); }
+
+static int CBF_Add_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    return cbfItemsCommon(ctx, argv, argc, 1, CBF_Add);
+}
+
+static int CBF_Del_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    return cbfItemsCommon(ctx, argv, argc, 1, CBF_Del);
+}
+
+static int CBF_Exists_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    return cbfItemsCommon(ctx, argv, argc, 0, cbfExists);
+}
+
+static int CBF_Info_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    CountingBloom *cbf;
+    if (GetCBFKey(ctx, argv[1], &cbf, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 5 * 2);
+    RedisModule_ReplyWithSimpleString(ctx, "Capacity");
+    RedisModule_ReplyWithLongLong(ctx, cbf->capacity);
+    RedisModule_ReplyWithSimpleString(ctx, "Size");
+    RedisModule_ReplyWithLongLong(ctx, CBF_Size(cbf));
+    RedisModule_ReplyWithSimpleString(ctx, "Number of items inserted");
+    RedisModule_ReplyWithLongLong(ctx, cbf->size);
+    RedisModule_ReplyWithSimpleString(ctx, "Number of counters");
+    RedisModule_ReplyWithLongLong(ctx, cbf->inner.bits);
+    RedisModule_ReplyWithSimpleString(ctx, "Number of hash functions");
+    RedisModule_ReplyWithLongLong(ctx, cbf->inner.hashes);
+
+    return REDISMODULE_OK;
+}
+
+/**
+ * CBF.SCANDUMP key iter
+ * Returns an (iterator,data) pair which can be used for LOADCHUNK later on
+ */
+static int CBF_ScanDump_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    CountingBloom *cbf;
+    if (GetCBFKey(ctx, argv[1], &cbf, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    long long iter;
+    if (RedisModule_StringToLongLong(argv[2], &iter) != REDISMODULE_OK) {
+        return RedisModule_ReplyWithError(ctx, "CBF: invalid iterator");
+    }
+
+    RedisModule_ReplyWithArray(ctx, 2);
+    if (iter == 0) {
+        size_t hdrlen;
+        char *hdr = CBF_GetEncodedHeader(cbf, &hdrlen);
+        RedisModule_ReplyWithLongLong(ctx, CBF_CHUNKITER_INIT);
+        RedisModule_ReplyWithStringBuffer(ctx, hdr, hdrlen);
+        CBF_FreeEncodedHeader(hdr);
+    } else {
+        size_t len = 0;
+        const char *chunk = CBF_GetEncodedChunk(cbf, &iter, &len, CBF_MAX_CHUNK_SIZE);
+        RedisModule_ReplyWithLongLong(ctx, iter);
+        RedisModule_ReplyWithStringBuffer(ctx, chunk, len);
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * CBF.LOADCHUNK key iter data
+ * Incrementally loads a filter dumped with CBF.SCANDUMP.
+ */
+static int CBF_LoadChunk_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long iter;
+    if (RedisModule_StringToLongLong(argv[2], &iter) != REDISMODULE_OK) {
+        return RedisModule_ReplyWithError(ctx, "CBF: invalid iterator");
+    }
+
+    size_t len;
+    const char *buf = RedisModule_StringPtrLen(argv[3], &len);
+    const char *errmsg;
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY && iter == CBF_CHUNKITER_INIT) {
+        CountingBloom *cbf = CBF_NewFromHeader(buf, len, &errmsg);
+        if (cbf == NULL) {
+            return RedisModule_ReplyWithError(ctx, errmsg);
+        }
+        RedisModule_ModuleTypeSetValue(key, CBFType, cbf);
+    } else {
+        CountingBloom *cbf;
+        if (GetCBFKey(ctx, argv[1], &cbf, REDISMODULE_READ | REDISMODULE_WRITE) !=
+            REDISMODULE_OK) {
+            return REDISMODULE_OK;
+        }
+        if (CBF_LoadEncodedChunk(cbf, iter, buf, len, &errmsg) != 0) {
+            return RedisModule_ReplyWithError(ctx, errmsg);
+        }
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**************** Module functions *********************************/
+
+static void CBFRdbSave(RedisModuleIO *io, void *obj) {
+    CountingBloom *cbf = obj;
+    RedisModule_SaveUnsigned(io, cbf->capacity);
+    RedisModule_SaveDouble(io, cbf->inner.error);
+    RedisModule_SaveUnsigned(io, cbf->size);
+    RedisModule_SaveStringBuffer(io, (const char *)cbf->counters, CBF_CountersBytes(cbf));
+}
+
+static void *CBFRdbLoad(RedisModuleIO *io, int encver) {
+    if (encver > CBF_ENC_VER) {
+        return NULL;
+    }
+
+    uint64_t capacity = RedisModule_LoadUnsigned(io);
+    double error = RedisModule_LoadDouble(io);
+    CountingBloom *cbf = CBF_New(capacity, error);
+    assert(cbf);
+    cbf->size = RedisModule_LoadUnsigned(io);
+
+    size_t length = 0;
+    char *counters = RedisModule_LoadStringBuffer(io, &length);
+    assert(length == CBF_CountersBytes(cbf));
+    memcpy(cbf->counters, counters, length);
+    RedisModule_Free(counters);
+
+    return cbf;
+}
+
+static void CBFAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    CountingBloom *cbf = value;
+    size_t len;
+    char *hdr = CBF_GetEncodedHeader(cbf, &len);
+    RedisModule_EmitAOF(aof, "CBF.LOADCHUNK", "slb", key, (long long)CBF_CHUNKITER_INIT, hdr,
+                        len);
+    CBF_FreeEncodedHeader(hdr);
+
+    long long iter = CBF_CHUNKITER_INIT;
+    const char *chunk;
+    while ((chunk = CBF_GetEncodedChunk(cbf, &iter, &len, CBF_MAX_CHUNK_SIZE)) != NULL) {
+        RedisModule_EmitAOF(aof, "CBF.LOADCHUNK", "slb", key, iter, chunk, len);
+    }
+}
+
+static void CBFFree(void *value) { CBF_Free(value); }
+
+static size_t CBFMemUsage(const void *value) { return CBF_Size(value); }
+
+int CBFModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                                 .rdb_load = CBFRdbLoad,
+                                 .rdb_save = CBFRdbSave,
+                                 .aof_rewrite = CBFAofRewrite,
+                                 .mem_usage = CBFMemUsage,
+                                 .free = CBFFree};
+
+    CBFType = RedisModule_CreateDataType(ctx, "CBFilter-", CBF_ENC_VER, &tm);
+    if (CBFType == NULL)
+        return REDISMODULE_ERR;
+
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cbf.reserve", CBF_Reserve_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "cbf.add", CBF_Add_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "cbf.del", CBF_Del_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "cbf.exists", CBF_Exists_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "cbf.info", CBF_Info_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "cbf.scandump", CBF_ScanDump_Cmd);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cbf.loadchunk", CBF_LoadChunk_Cmd);
+
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,13 @@
+#ifndef RM_CBF_H
+#define RM_CBF_H
+
+#include "redismodule.h"
+
+// Largest chunk returned by CBF.SCANDUMP, which keeps each call short
+#define CBF_MAX_CHUNK_SIZE (1 << 24)
+
+#define CBF_ENC_VER 0
+
+int CBFModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif
@@ -20,6 +20,45 @@ typedef struct {
     long long value;
 } CMSPair;
 
+// Increments gathered by CMS.INCRBY and CMS.INCRBYINT, applied and replied to
+// whenever CMS_SORTED_MIN_BATCH of them are pending
+typedef struct {
+    SketchHashes *hashes;
+    size_t *values;
+    size_t *counts;
+    size_t n;
+} CMSIncrBatch;
+
+static void incrBatchInit(CMSIncrBatch *batch, size_t total) {
+    size_t size = total < CMS_SORTED_MIN_BATCH ? total : CMS_SORTED_MIN_BATCH;
+    batch->hashes = CMS_CALLOC(size, sizeof(*batch->hashes));
+    batch->values = CMS_CALLOC(size, sizeof(*batch->values));
+    batch->counts = CMS_CALLOC(size, sizeof(*batch->counts));
+    batch->n = 0;
+}
+
+static void incrBatchFlush(RedisModuleCtx *ctx, CMSketch *cms, CMSIncrBatch *batch) {
+    CMS_IncrByHashesBatch(cms, batch->hashes, batch->values, batch->n, batch->counts);
+    for (size_t i = 0; i < batch->n; ++i) {
+        RedisModule_ReplyWithLongLong(ctx, (long long)batch->counts[i]);
+    }
+    batch->n = 0;
+}
+
+// Queues the increment of the item whose hashes were initialized in batch->hashes[batch->n]
+static void incrBatchPush(RedisModuleCtx *ctx, CMSketch *cms, CMSIncrBatch *batch, size_t value) {
+    batch->values[batch->n++] = value;
+    if (batch->n == CMS_SORTED_MIN_BATCH) {
+        incrBatchFlush(ctx, cms, batch);
+    }
+}
+
+static void incrBatchFree(CMSIncrBatch *batch) {
+    CMS_FREE(batch->hashes);
+    CMS_FREE(batch->values);
+    CMS_FREE(batch->counts);
+}
+
 static int GetCMSKey(RedisModuleCtx *ctx, RedisModuleString *keyName, CMSketch **cms, int mode) {
     // All using this function should call RedisModule_AutoMemory to prevent memory leak
     RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
@@ -32,6 +71,20 @@ static int GetCMSKey(RedisModuleCtx *ctx, RedisModuleString *keyName, CMSketch *
     return REDISMODULE_OK;
 }
 
+/* Same as GetCMSKey, for commands given items as 64 bit integers if 'intItems' is set,
+   or as strings otherwise. Writes make an empty sketch take only this kind of items. */
+static int GetCMSItemKey(RedisModuleCtx *ctx, RedisModuleString *keyName, CMSketch **cms,
+                         int mode, int intItems) {
+    if (GetCMSKey(ctx, keyName, cms, mode) != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
+    if (CMS_UseItems(*cms, intItems, mode & REDISMODULE_WRITE) != 0) {
+        INNER_ERROR(intItems ? "CMS: sketch takes string items"
+                             : "CMS: sketch takes integer items");
+    }
+    return REDISMODULE_OK;
+}
+
 static int parseCreateArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
                            long long *width, long long *depth) {
 
@@ -44,6 +97,19 @@ static int parseCreateArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
         if ((RedisModule_StringToLongLong(argv[3], depth) != REDISMODULE_OK) || *depth < 1) {
             INNER_ERROR("CMS: invalid depth");
         }
+    } else if (strcasecmp(cmd, "cms.initbymem") == 0) {
+        long long bytes = 0;
+        double prob = 0;
+        if ((RedisModule_StringToLongLong(argv[2], &bytes) != REDISMODULE_OK) || bytes < 1) {
+            INNER_ERROR("CMS: invalid memory size");
+        }
+        if ((RedisModule_StringToDouble(argv[3], &prob) != REDISMODULE_OK) ||
+            prob <= 0 || prob >= 1) {
+            INNER_ERROR("CMS: invalid prob value");
+        }
+        if (CMS_DimFromBytes(bytes, prob, (size_t *)width, (size_t *)depth) != 0) {
+            INNER_ERROR("CMS: memory size too small");
+        }
     } else {
         double overEst = 0, prob = 0;
         if ((RedisModule_StringToDouble(argv[2], &overEst) != REDISMODULE_OK) || overEst <= 0 ||
@@ -92,7 +158,12 @@ static int parseIncrByArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
                            int qty) {
     for (int i = 0; i < qty; ++i) {
         (*pairs)[i].key = RedisModule_StringPtrLen(argv[2 + i * 2], &(*pairs)[i].keylen);
-        RedisModule_StringToLongLong(argv[2 + i * 2 + 1], &((*pairs)[i].value));
+        // Counters are unsigned, a negative increment would wrap around
+        if (RedisModule_StringToLongLong(argv[2 + i * 2 + 1], &((*pairs)[i].value)) !=
+                REDISMODULE_OK ||
+            (*pairs)[i].value < 0) {
+            INNER_ERROR("CMS: invalid increment value");
+        }
     }
     return REDISMODULE_OK;
 }
@@ -104,33 +175,92 @@ int CMSketch_IncrBy(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
         return RedisModule_WrongArity(ctx);
     }
 
-    RedisModuleString *keyName = argv[1];
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ);
-    CMSketch *cms = NULL;
+    int pairCount = (argc - 2) / 2;
+    CMSPair *pairArray = CMS_CALLOC(pairCount, sizeof(CMSPair));
+    if (parseIncrByArgs(ctx, argv, argc, &pairArray, pairCount) != REDISMODULE_OK) {
+        CMS_FREE(pairArray);
+        return REDISMODULE_OK;
+    }
 
-    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
-        INNER_ERROR("CMS: key does not exist");
-    } else if (RedisModule_ModuleTypeGetType(key) != CMSketchType) {
-        return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
-    } else {
-        cms = RedisModule_ModuleTypeGetValue(key);
+    CMSketch *cms = NULL;
+    if (GetCMSItemKey(ctx, argv[1], &cms, REDISMODULE_READ | REDISMODULE_WRITE, 0) !=
+        REDISMODULE_OK) {
+        CMS_FREE(pairArray);
+        return REDISMODULE_OK;
     }
 
-    int pairCount = (argc - 2) / 2;
-    CMSPair *pairArray = CMS_CALLOC(pairCount, sizeof(CMSPair));
-    parseIncrByArgs(ctx, argv, argc, &pairArray, pairCount);
     RedisModule_ReplyWithArray(ctx, pairCount);
+    CMSIncrBatch batch;
+    incrBatchInit(&batch, pairCount);
     for (int i = 0; i < pairCount; ++i) {
-        size_t count = CMS_IncrBy(cms, pairArray[i].key, pairArray[i].keylen, pairArray[i].value);
-        RedisModule_ReplyWithLongLong(ctx, (long long)count);
+        SketchHashes_Init(&batch.hashes[batch.n], pairArray[i].key, pairArray[i].keylen);
+        incrBatchPush(ctx, cms, &batch, pairArray[i].value);
     }
+    incrBatchFlush(ctx, cms, &batch);
+    incrBatchFree(&batch);
 
     CMS_FREE(pairArray);
-    RedisModule_CloseKey(key);
     RedisModule_ReplicateVerbatim(ctx);
     return REDISMODULE_OK;
 }
 
+/**
+ * CMS.MINCRBY <key> <item> <increment> [<key> <item> <increment> ...]
+ * Same as CMS.INCRBY for every triple. All keys are looked up before any counter
+ * changes, then the items of each key are counted together.
+ */
+int CMSketch_MIncrBy(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    if (argc < 4 || (argc - 1) % 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    int count = (argc - 1) / 3;
+    long long *values = CMS_CALLOC(count, sizeof(long long));
+    int *order = CMS_CALLOC(count, sizeof(int));
+    CMSketch **sketches = CMS_CALLOC(count, sizeof(CMSketch *));
+    size_t *results = CMS_CALLOC(count, sizeof(size_t));
+
+    for (int i = 0; i < count; ++i) {
+        if (RedisModule_StringToLongLong(argv[3 + i * 3], &values[i]) != REDISMODULE_OK ||
+            values[i] < 0) {
+            RedisModule_ReplyWithError(ctx, "CMS: invalid increment value");
+            goto done;
+        }
+    }
+
+    RMUtil_SortByKey(argv, argc, 1, 3, order);
+    for (int i = 0; i < count; ++i) {
+        if (i > 0 && RMUtil_StringEquals(argv[order[i]], argv[order[i - 1]])) {
+            sketches[i] = sketches[i - 1];
+        } else if (GetCMSItemKey(ctx, argv[order[i]], &sketches[i],
+                                 REDISMODULE_READ | REDISMODULE_WRITE, 0) != REDISMODULE_OK) {
+            goto done;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        int triple = (order[i] - 1) / 3;
+        size_t len;
+        const char *item = RedisModule_StringPtrLen(argv[order[i] + 1], &len);
+        results[triple] = CMS_IncrBy(sketches[i], item, len, values[triple]);
+    }
+
+    RedisModule_ReplyWithArray(ctx, count);
+    for (int i = 0; i < count; ++i) {
+        RedisModule_ReplyWithLongLong(ctx, (long long)results[i]);
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+
+done:
+    CMS_FREE(values);
+    CMS_FREE(order);
+    CMS_FREE(sketches);
+    CMS_FREE(results);
+    return REDISMODULE_OK;
+}
+
 int CMSketch_Query(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc < 3) {
@@ -138,7 +268,7 @@ int CMSketch_Query(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     }
 
     CMSketch *cms = NULL;
-    if (GetCMSKey(ctx, argv[1], &cms, REDISMODULE_READ) != REDISMODULE_OK) {
+    if (GetCMSItemKey(ctx, argv[1], &cms, REDISMODULE_READ, 0) != REDISMODULE_OK) {
         return REDISMODULE_OK;
     }
 
@@ -153,6 +283,105 @@ int CMSketch_Query(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_OK;
 }
 
+/**
+ * CMS.INCRBYINT <key> [PACKED] <item> <increment> [<item> <increment> ...]
+ * Same as CMS.INCRBY for items that are 64 bit integers, given in decimal or, after
+ * PACKED, as strings of little endian 64 bit integers each incremented by the
+ * increment that follows. Items are hashed as numbers, so a sketch counts either
+ * integer or string items. Replies with the count of each item.
+ */
+int CMSketch_IncrByInt(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+
+    int packed = 0;
+    if (argc > 2) {
+        size_t len;
+        const char *arg = RedisModule_StringPtrLen(argv[2], &len);
+        packed = len == 6 && strncasecmp(arg, "PACKED", 6) == 0;
+    }
+    int first = 2 + packed;
+    if (argc < first + 2 || (argc - first) % 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    size_t total = 0;
+    for (int i = first; i < argc; i += 2) {
+        long long value;
+        if (RedisModule_StringToLongLong(argv[i + 1], &value) != REDISMODULE_OK || value < 0) {
+            return RedisModule_ReplyWithError(ctx, "CMS: invalid increment value");
+        }
+        size_t n = 1;
+        uint64_t item = 0;
+        if (packed ? RMUtil_PackedIntItems(argv[i], &n) == NULL
+                   : RMUtil_ParseIntItem(argv[i], &item) != REDISMODULE_OK) {
+            return RedisModule_ReplyWithError(ctx, "CMS: invalid integer item");
+        }
+        total += n;
+    }
+
+    CMSketch *cms = NULL;
+    if (GetCMSItemKey(ctx, argv[1], &cms, REDISMODULE_READ | REDISMODULE_WRITE, 1) !=
+        REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, total);
+    CMSIncrBatch batch;
+    incrBatchInit(&batch, total);
+    for (int i = first; i < argc; i += 2) {
+        long long value;
+        RedisModule_StringToLongLong(argv[i + 1], &value);
+        size_t n = 1;
+        uint64_t item = 0;
+        const char *items = NULL;
+        if (packed) {
+            items = RMUtil_PackedIntItems(argv[i], &n);
+        } else {
+            RMUtil_ParseIntItem(argv[i], &item);
+        }
+        for (size_t j = 0; j < n; ++j) {
+            SketchHashes_InitInt(&batch.hashes[batch.n],
+                                 packed ? RMUtil_PackedIntItem(items, j) : item);
+            incrBatchPush(ctx, cms, &batch, value);
+        }
+    }
+    incrBatchFlush(ctx, cms, &batch);
+    incrBatchFree(&batch);
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
+}
+
+/**
+ * CMS.QUERYINT <key> [PACKED] <item> [<item> ...]
+ * Same as CMS.QUERY for integer items, given as for CMS.INCRBYINT.
+ */
+int CMSketch_QueryInt(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    uint64_t *items;
+    long long n = RMUtil_ParseIntItems(argv + 2, argc - 2, &items);
+    if (n < 0) {
+        return RedisModule_ReplyWithError(ctx, "CMS: invalid integer item");
+    }
+    CMSketch *cms = NULL;
+    if (GetCMSItemKey(ctx, argv[1], &cms, REDISMODULE_READ, 1) != REDISMODULE_OK) {
+        RedisModule_Free(items);
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, n);
+    for (long long i = 0; i < n; ++i) {
+        SketchHashes hashes;
+        SketchHashes_InitInt(&hashes, items[i]);
+        RedisModule_ReplyWithLongLong(ctx, CMS_QueryHashes(cms, &hashes));
+    }
+    RedisModule_Free(items);
+    return REDISMODULE_OK;
+}
+
 static int parseMergeArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
                           mergeParams *params) {
     long long numKeys = params->numKeys;
@@ -174,6 +403,7 @@ static int parseMergeArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
 
     size_t width = params->dest->width;
     size_t depth = params->dest->depth;
+    int intItems = -1;
 
     for (int i = 0; i < numKeys; ++i) {
         if (pos == -1) {
@@ -189,6 +419,13 @@ static int parseMergeArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
         if (params->cmsArray[i]->width != width || params->cmsArray[i]->depth != depth) {
             INNER_ERROR("CMS: width/depth is not equal");
         }
+        // Counts of integer and string items can't be added up
+        if (params->cmsArray[i]->counter) {
+            if (intItems >= 0 && intItems != (int)params->cmsArray[i]->intItems) {
+                INNER_ERROR("CMS: sketches take different kinds of items");
+            }
+            intItems = params->cmsArray[i]->intItems;
+        }
     }
 
     return REDISMODULE_OK;
@@ -223,6 +460,33 @@ int CMSketch_Merge(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_OK;
 }
 
+/**
+ * CMS.RESIZE <key> <width>
+ * Shrinks the sketch to a width dividing its current one, keeping all counts.
+ */
+int CMSketch_Resize(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long width;
+    if (RedisModule_StringToLongLong(argv[2], &width) != REDISMODULE_OK || width < 1) {
+        return RedisModule_ReplyWithError(ctx, "CMS: invalid width");
+    }
+
+    CMSketch *cms = NULL;
+    if (GetCMSKey(ctx, argv[1], &cms, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    if (CMS_Resize(cms, width) != 0) {
+        return RedisModule_ReplyWithError(ctx, "CMS: width must divide the current width");
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
 int CMSKetch_Info(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc != 2)
@@ -249,8 +513,16 @@ void CMSRdbSave(RedisModuleIO *io, void *obj) {
     RedisModule_SaveUnsigned(io, cms->width);
     RedisModule_SaveUnsigned(io, cms->depth);
     RedisModule_SaveUnsigned(io, cms->counter);
-    RedisModule_SaveStringBuffer(io, (const char *)cms->array,
-                                 cms->width * cms->depth * sizeof(uint32_t));
+    if (CMS_IS_SPARSE(cms)) {
+        RedisModule_SaveUnsigned(io, cms->sparseLimit);
+        RedisModule_SaveStringBuffer(io, (const char *)cms->sparse,
+                                     cms->nsparse * CMS_SPARSE_STRIDE(cms) * sizeof(uint32_t));
+    } else {
+        RedisModule_SaveUnsigned(io, 0);
+        RedisModule_SaveStringBuffer(io, (const char *)cms->array,
+                                     cms->width * cms->depth * sizeof(uint32_t));
+    }
+    RedisModule_SaveUnsigned(io, cms->intItems);
 }
 
 void *CMSRdbLoad(RedisModuleIO *io, int encver) {
@@ -262,8 +534,23 @@ void *CMSRdbLoad(RedisModuleIO *io, int encver) {
     cms->width = RedisModule_LoadUnsigned(io);
     cms->depth = RedisModule_LoadUnsigned(io);
     cms->counter = RedisModule_LoadUnsigned(io);
-    size_t length = cms->width * cms->depth * sizeof(size_t);
-    cms->array = (uint32_t *)RedisModule_LoadStringBuffer(io, &length);
+    if (encver >= CMS_MIN_SPARSE_ENC_VER) {
+        cms->sparseLimit = RedisModule_LoadUnsigned(io);
+    }
+    size_t length;
+    uint32_t *buf = (uint32_t *)RedisModule_LoadStringBuffer(io, &length);
+    if (cms->sparseLimit) {
+        cms->sparse = length ? buf : NULL;
+        cms->nsparse = length / (CMS_SPARSE_STRIDE(cms) * sizeof(uint32_t));
+        if (!length) {
+            RedisModule_Free(buf);
+        }
+    } else {
+        cms->array = buf;
+    }
+    if (encver >= CMS_MIN_INTITEMS_ENC_VER) {
+        cms->intItems = RedisModule_LoadUnsigned(io);
+    }
 
     return cms;
 }
@@ -271,8 +558,7 @@ void *CMSRdbLoad(RedisModuleIO *io, int encver) {
 void CMSFree(void *value) { CMS_Destroy(value); }
 
 size_t CMSMemUsage(const void *value) {
-    CMSketch *cms = (CMSketch *)value;
-    return sizeof(cms) + cms->width * cms->depth * sizeof(size_t);
+    return CMS_Size(value);
 }
 
 int CMSModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -290,9 +576,18 @@ int CMSModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.initbydim", CMSketch_Create);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.initbyprob", CMSketch_Create);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.initbymem", CMSketch_Create);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.incrby", CMSketch_IncrBy);
+    // Keys are the first of every three arguments
+    if (RedisModule_CreateCommand(ctx, "cms.mincrby", CMSketch_MIncrBy, "write deny-oom", 1, -1,
+                                  3) != REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+    }
     RMUtil_RegisterReadCmd(ctx, "cms.query", CMSketch_Query);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.incrbyint", CMSketch_IncrByInt);
+    RMUtil_RegisterReadCmd(ctx, "cms.queryint", CMSketch_QueryInt);
     RMUtil_RegisterWriteDenyOOMCmd(ctx, "cms.merge", CMSketch_Merge);
+    RMUtil_RegisterWriteCmd(ctx, "cms.resize", CMSketch_Resize);
     RMUtil_RegisterReadCmd(ctx, "cms.info", CMSKetch_Info);
 
     return REDISMODULE_OK;
@@ -6,7 +6,11 @@
 #define DEFAULT_WIDTH 2.7
 #define DEFAULT_DEPTH 5
 
-#define CMS_ENC_VER 0
+#define CMS_MIN_SPARSE_ENC_VER 1
+#define CMS_MIN_INTITEMS_ENC_VER 2
+#define CMS_ENC_VER 2
+
+extern RedisModuleType *CMSketchType;
 
 int CMSModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 
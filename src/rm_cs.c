@@ -0,0 +1,279 @@
+#include <assert.h>  // assert
+#include <strings.h> // strcasecmp
+
+#include "rmutil/util.h"
+#include "version.h"
+
+#include "cs.h"
+#include "rm_cs.h"
+
+#define INNER_ERROR(x)                                                                             \
+    RedisModule_ReplyWithError(ctx, x);                                                            \
+    return REDISMODULE_ERR;
+
+RedisModuleType *CSType;
+
+static int GetCSKey(RedisModuleCtx *ctx, RedisModuleString *keyName, CountSketch **cs, int mode) {
+    // All using this function should call RedisModule_AutoMemory to prevent memory leak
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        INNER_ERROR("CS: key does not exist");
+    } else if (RedisModule_ModuleTypeGetType(key) != CSType) {
+        INNER_ERROR(REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    *cs = RedisModule_ModuleTypeGetValue(key);
+    return REDISMODULE_OK;
+}
+
+static int parseCreateArgs(RedisModuleCtx *ctx, RedisModuleString **argv, long long *width,
+                           long long *depth) {
+    const char *cmd = RedisModule_StringPtrLen(argv[0], NULL);
+    if (strcasecmp(cmd, "cs.initbydim") == 0) {
+        if (RedisModule_StringToLongLong(argv[2], width) != REDISMODULE_OK || *width < 1 ||
+            *width > CS_MAX_WIDTH) {
+            INNER_ERROR("CS: invalid width");
+        }
+        if (RedisModule_StringToLongLong(argv[3], depth) != REDISMODULE_OK || *depth < 1) {
+            INNER_ERROR("CS: invalid depth");
+        }
+    } else {
+        double error, prob;
+        if (RedisModule_StringToDouble(argv[2], &error) != REDISMODULE_OK || error <= 0 ||
+            error >= 1) {
+            INNER_ERROR("CS: invalid error value");
+        }
+        if (RedisModule_StringToDouble(argv[3], &prob) != REDISMODULE_OK || prob <= 0 ||
+            prob >= 1) {
+            INNER_ERROR("CS: invalid prob value");
+        }
+        size_t w, d;
+        CS_DimFromProb(error, prob, &w, &d);
+        if (w > CS_MAX_WIDTH) {
+            INNER_ERROR("CS: invalid error value");
+        }
+        *width = w;
+        *depth = d;
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * CS.INITBYDIM key width depth
+ * CS.INITBYPROB key error prob
+ */
+static int CS_Create_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long width, depth;
+    if (parseCreateArgs(ctx, argv, &width, &depth) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithError(ctx, "CS: key already exists");
+    }
+
+    RedisModule_ModuleTypeSetValue(key, CSType, NewCountSketch(width, depth));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * CS.INCRBY key item increment [item increment ...]
+ * Increments may be negative. Replies with the estimated count of each item
+ * after its increment.
+ */
+static int CS_IncrBy_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 4 || (argc % 2) == 1) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    // All increments are checked before any counter changes
+    int count = (argc - 2) / 2;
+    long long *values = RedisModule_PoolAlloc(ctx, count * sizeof(*values));
+    for (int i = 0; i < count; ++i) {
+        if (RedisModule_StringToLongLong(argv[3 + i * 2], &values[i]) != REDISMODULE_OK) {
+            return RedisModule_ReplyWithError(ctx, "CS: invalid increment value");
+        }
+    }
+
+    CountSketch *cs;
+    if (GetCSKey(ctx, argv[1], &cs, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    long long *counts = RedisModule_PoolAlloc(ctx, count * sizeof(*counts));
+    for (int i = 0; i < count; ++i) {
+        size_t len;
+        const char *item = RedisModule_StringPtrLen(argv[2 + i * 2], &len);
+        if (CS_IncrBy(cs, item, len, values[i], &counts[i]) != 0) {
+            // Undoes the earlier increments, which restores their counters exactly
+            long long unused;
+            while (i--) {
+                item = RedisModule_StringPtrLen(argv[2 + i * 2], &len);
+                CS_IncrBy(cs, item, len, -values[i], &unused);
+            }
+            return RedisModule_ReplyWithError(ctx, "CS: counter overflow");
+        }
+    }
+
+    RedisModule_ReplyWithArray(ctx, count);
+    for (int i = 0; i < count; ++i) {
+        RedisModule_ReplyWithLongLong(ctx, counts[i]);
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
+}
+
+/**
+ * CS.QUERY key item [item ...]
+ */
+static int CS_Query_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    CountSketch *cs;
+    if (GetCSKey(ctx, argv[1], &cs, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, argc - 2);
+    for (int i = 2; i < argc; ++i) {
+        size_t len;
+        const char *item = RedisModule_StringPtrLen(argv[i], &len);
+        RedisModule_ReplyWithLongLong(ctx, CS_Query(cs, item, len));
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * CS.MERGE dest numkeys src [src ...] [WEIGHTS weight [weight ...]]
+ * Weights may be negative, giving the difference of sketches.
+ */
+static int CS_Merge_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 4) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long numKeys;
+    if (RedisModule_StringToLongLong(argv[2], &numKeys) != REDISMODULE_OK || numKeys < 1) {
+        return RedisModule_ReplyWithError(ctx, "CS: invalid numkeys");
+    }
+    int pos = RMUtil_ArgIndex("WEIGHTS", argv, argc);
+    if (pos < 0 ? argc != 3 + numKeys : (pos != 3 + numKeys || argc != 4 + numKeys * 2)) {
+        return RedisModule_ReplyWithError(ctx, "CS: wrong number of keys/weights");
+    }
+
+    long long *weights = RedisModule_PoolAlloc(ctx, numKeys * sizeof(*weights));
+    for (long long i = 0; i < numKeys; ++i) {
+        weights[i] = 1;
+        if (pos >= 0 &&
+            RedisModule_StringToLongLong(argv[pos + 1 + i], &weights[i]) != REDISMODULE_OK) {
+            return RedisModule_ReplyWithError(ctx, "CS: invalid weight value");
+        }
+    }
+
+    CountSketch *dest;
+    if (GetCSKey(ctx, argv[1], &dest, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    const CountSketch **src = RedisModule_PoolAlloc(ctx, numKeys * sizeof(*src));
+    for (long long i = 0; i < numKeys; ++i) {
+        CountSketch *cs;
+        if (GetCSKey(ctx, argv[3 + i], &cs, REDISMODULE_READ) != REDISMODULE_OK) {
+            return REDISMODULE_OK;
+        }
+        if (cs->width != dest->width || cs->depth != dest->depth) {
+            return RedisModule_ReplyWithError(ctx, "CS: width/depth is not equal");
+        }
+        src[i] = cs;
+    }
+
+    if (CS_Merge(dest, numKeys, src, weights) != 0) {
+        return RedisModule_ReplyWithError(ctx, "CS: counter overflow");
+    }
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+static int CS_Info_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    CountSketch *cs;
+    if (GetCSKey(ctx, argv[1], &cs, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 3 * 2);
+    RedisModule_ReplyWithSimpleString(ctx, "width");
+    RedisModule_ReplyWithLongLong(ctx, cs->width);
+    RedisModule_ReplyWithSimpleString(ctx, "depth");
+    RedisModule_ReplyWithLongLong(ctx, cs->depth);
+    RedisModule_ReplyWithSimpleString(ctx, "count");
+    RedisModule_ReplyWithLongLong(ctx, cs->counter);
+
+    return REDISMODULE_OK;
+}
+
+/**************** Module functions *********************************/
+
+static void CSRdbSave(RedisModuleIO *io, void *obj) {
+    CountSketch *cs = obj;
+    RedisModule_SaveUnsigned(io, cs->width);
+    RedisModule_SaveUnsigned(io, cs->depth);
+    RedisModule_SaveSigned(io, cs->counter);
+    RedisModule_SaveStringBuffer(io, (const char *)cs->array,
+                                 cs->width * cs->depth * sizeof(int64_t));
+}
+
+static void *CSRdbLoad(RedisModuleIO *io, int encver) {
+    if (encver > CS_ENC_VER) {
+        return NULL;
+    }
+
+    CountSketch *cs = CS_CALLOC(1, sizeof(CountSketch));
+    cs->width = RedisModule_LoadUnsigned(io);
+    cs->depth = RedisModule_LoadUnsigned(io);
+    cs->counter = RedisModule_LoadSigned(io);
+    size_t length;
+    cs->array = (int64_t *)RedisModule_LoadStringBuffer(io, &length);
+    assert(length == cs->width * cs->depth * sizeof(int64_t));
+    return cs;
+}
+
+static void CSFree(void *value) { CS_Destroy(value); }
+
+static size_t CSMemUsage(const void *value) { return CS_Size(value); }
+
+int CSModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                                 .rdb_load = CSRdbLoad,
+                                 .rdb_save = CSRdbSave,
+                                 .aof_rewrite = RMUtil_DefaultAofRewrite,
+                                 .mem_usage = CSMemUsage,
+                                 .free = CSFree};
+
+    CSType = RedisModule_CreateDataType(ctx, "CSkt-TYPE", CS_ENC_VER, &tm);
+    if (CSType == NULL)
+        return REDISMODULE_ERR;
+
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cs.initbydim", CS_Create_Cmd);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cs.initbyprob", CS_Create_Cmd);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cs.incrby", CS_IncrBy_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "cs.query", CS_Query_Cmd);
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "cs.merge", CS_Merge_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "cs.info", CS_Info_Cmd);
+
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,10 @@
+#ifndef RM_CS_H
+#define RM_CS_H
+
+#include "redismodule.h"
+
+#define CS_ENC_VER 0
+
+int CSModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif
@@ -0,0 +1,249 @@
+#include <assert.h>  // assert
+#include <stdlib.h>  // malloc
+#include <string.h>  // memcpy
+#include <strings.h> // strncasecmp
+
+#include "rmutil/util.h"
+#include "version.h"
+
+#include "minhash.h"
+#include "rm_minhash.h"
+
+#define INNER_ERROR(x)                                                                             \
+    RedisModule_ReplyWithError(ctx, x);                                                            \
+    return REDISMODULE_ERR;
+
+RedisModuleType *MinHashType;
+
+static int GetMinHashKey(RedisModuleCtx *ctx, RedisModuleString *keyName, MinHash **mh,
+                         int mode) {
+    // All using this function should call RedisModule_AutoMemory to prevent memory leak
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        INNER_ERROR("MH: key does not exist");
+    } else if (RedisModule_ModuleTypeGetType(key) != MinHashType) {
+        INNER_ERROR(REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    *mh = RedisModule_ModuleTypeGetValue(key);
+    return REDISMODULE_OK;
+}
+
+/**
+ * MH.RESERVE key [k]
+ */
+static int MinHash_Reserve_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2 && argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long k = MINHASH_DEFAULT_K;
+    if (argc == 3 && (RedisModule_StringToLongLong(argv[2], &k) != REDISMODULE_OK || k < 1 ||
+                      k > MH_MAX_REGISTERS)) {
+        return RedisModule_ReplyWithError(ctx, "MH: invalid number of registers");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithError(ctx, "MH: key already exists");
+    }
+
+    RedisModule_ModuleTypeSetValue(key, MinHashType, MinHash_Create(k));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * MH.ADD key item [item ...]
+ */
+static int MinHash_Add_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    MinHash *mh;
+    if (GetMinHashKey(ctx, argv[1], &mh, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    if (mh->bits != MH_FULL_BITS) {
+        return RedisModule_ReplyWithError(ctx, "MH: signature is compressed");
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        size_t len;
+        const char *item = RedisModule_StringPtrLen(argv[i], &len);
+        MinHash_Add(mh, item, len);
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * MH.MERGE dest-key source-key [source-key ...]
+ */
+static int MinHash_Merge_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    MinHash *dest;
+    if (GetMinHashKey(ctx, argv[1], &dest, REDISMODULE_READ | REDISMODULE_WRITE) !=
+        REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    int srcCount = argc - 2;
+    MinHash **srcs = RedisModule_PoolAlloc(ctx, srcCount * sizeof(MinHash *));
+    for (int i = 0; i < srcCount; ++i) {
+        if (GetMinHashKey(ctx, argv[2 + i], &srcs[i], REDISMODULE_READ) != REDISMODULE_OK) {
+            return REDISMODULE_OK;
+        }
+        if (srcs[i]->k != dest->k) {
+            return RedisModule_ReplyWithError(ctx, "MH: number of registers mismatch");
+        }
+        if (srcs[i]->bits != MH_FULL_BITS) {
+            return RedisModule_ReplyWithError(ctx, "MH: signature is compressed");
+        }
+    }
+    if (dest->bits != MH_FULL_BITS) {
+        return RedisModule_ReplyWithError(ctx, "MH: signature is compressed");
+    }
+
+    for (int i = 0; i < srcCount; ++i) {
+        MinHash_Merge(dest, srcs[i]);
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * MH.SIMILARITY key key
+ */
+static int MinHash_Similarity_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    MinHash *a, *b;
+    if (GetMinHashKey(ctx, argv[1], &a, REDISMODULE_READ) != REDISMODULE_OK ||
+        GetMinHashKey(ctx, argv[2], &b, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    if (a->k != b->k) {
+        return RedisModule_ReplyWithError(ctx, "MH: number of registers mismatch");
+    }
+
+    return RedisModule_ReplyWithDouble(ctx, MinHash_Similarity(a, b));
+}
+
+/**
+ * MH.COMPRESS key bits
+ * Keeps only the low 'bits' bits of every register. Irreversible.
+ */
+static int MinHash_Compress_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    MinHash *mh;
+    if (GetMinHashKey(ctx, argv[1], &mh, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    long long bits;
+    if (RedisModule_StringToLongLong(argv[2], &bits) != REDISMODULE_OK ||
+        !MinHash_ValidBits(bits)) {
+        return RedisModule_ReplyWithError(ctx, "MH: bits should be one of 1, 2, 4, 8, 16");
+    }
+    if (bits >= mh->bits) {
+        return RedisModule_ReplyWithError(ctx, "MH: signature is already compressed");
+    }
+    if (MinHash_IsEmpty(mh)) {
+        return RedisModule_ReplyWithError(ctx, "MH: signature is empty");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    RedisModule_ModuleTypeSetValue(key, MinHashType, MinHash_Compress(mh, bits));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+static int MinHash_Info_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    MinHash *mh;
+    if (GetMinHashKey(ctx, argv[1], &mh, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 2 * 2);
+    RedisModule_ReplyWithSimpleString(ctx, "k");
+    RedisModule_ReplyWithLongLong(ctx, mh->k);
+    RedisModule_ReplyWithSimpleString(ctx, "bits");
+    RedisModule_ReplyWithLongLong(ctx, mh->bits);
+
+    return REDISMODULE_OK;
+}
+
+/**************** Module functions *********************************/
+
+static void MinHashRdbSave(RedisModuleIO *io, void *obj) {
+    MinHash *mh = obj;
+    RedisModule_SaveUnsigned(io, mh->k);
+    RedisModule_SaveUnsigned(io, mh->bits);
+    RedisModule_SaveStringBuffer(io, (const char *)mh->data,
+                                 MinHash_DataWords(mh->k, mh->bits) * sizeof(uint64_t));
+}
+
+static void *MinHashRdbLoad(RedisModuleIO *io, int encver) {
+    if (encver > MINHASH_ENC_VER) {
+        return NULL;
+    }
+
+    uint32_t k = RedisModule_LoadUnsigned(io);
+    uint32_t bits = RedisModule_LoadUnsigned(io);
+    MinHash *mh = MinHash_Alloc(k, bits);
+
+    size_t length = 0;
+    char *data = RedisModule_LoadStringBuffer(io, &length);
+    assert(bits <= MH_FULL_BITS && length == MinHash_DataWords(k, bits) * sizeof(uint64_t));
+    memcpy(mh->data, data, length);
+    RedisModule_Free(data);
+
+    return mh;
+}
+
+static void MinHashFree(void *value) { MinHash_Destroy(value); }
+
+static size_t MinHashMemUsage(const void *value) { return MinHash_Size(value); }
+
+int MinHashModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                                 .rdb_load = MinHashRdbLoad,
+                                 .rdb_save = MinHashRdbSave,
+                                 .aof_rewrite = RMUtil_DefaultAofRewrite,
+                                 .mem_usage = MinHashMemUsage,
+                                 .free = MinHashFree};
+
+    MinHashType = RedisModule_CreateDataType(ctx, "MinH-TYPE", MINHASH_ENC_VER, &tm);
+    if (MinHashType == NULL)
+        return REDISMODULE_ERR;
+
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "mh.reserve", MinHash_Reserve_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "mh.add", MinHash_Add_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "mh.merge", MinHash_Merge_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "mh.compress", MinHash_Compress_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "mh.similarity", MinHash_Similarity_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "mh.info", MinHash_Info_Cmd);
+
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,12 @@
+#ifndef RM_MINHASH_H
+#define RM_MINHASH_H
+
+#include "redismodule.h"
+
+#define MINHASH_DEFAULT_K 128
+
+#define MINHASH_ENC_VER 0
+
+int MinHashModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif
@@ -0,0 +1,310 @@
+#include <assert.h>  // assert
+#include <float.h>   // DBL_MAX
+#include <math.h>    // isnan
+#include <stdlib.h>  // malloc
+#include <string.h>  // memcpy
+#include <strings.h> // strncasecmp
+
+#include "rmutil/util.h"
+#include "version.h"
+
+#include "tdigest.h"
+#include "rm_tdigest.h"
+
+#define INNER_ERROR(x)                                                                             \
+    RedisModule_ReplyWithError(ctx, x);                                                            \
+    return REDISMODULE_ERR;
+
+RedisModuleType *TDigestType;
+
+static int GetTDigestKey(RedisModuleCtx *ctx, RedisModuleString *keyName, TDigest **td, int mode) {
+    // All using this function should call RedisModule_AutoMemory to prevent memory leak
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, mode);
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY) {
+        INNER_ERROR("TDIGEST: key does not exist");
+    } else if (RedisModule_ModuleTypeGetType(key) != TDigestType) {
+        INNER_ERROR(REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+    *td = RedisModule_ModuleTypeGetValue(key);
+    return REDISMODULE_OK;
+}
+
+static int parseDoubles(RedisModuleCtx *ctx, RedisModuleString **argv, int count, double *out,
+                        double min, double max, const char *errmsg) {
+    for (int i = 0; i < count; ++i) {
+        if (RedisModule_StringToDouble(argv[i], &out[i]) != REDISMODULE_OK || isnan(out[i]) ||
+            out[i] < min || out[i] > max) {
+            INNER_ERROR(errmsg);
+        }
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * TDIGEST.CREATE key [compression]
+ */
+static int TDigest_Create_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2 && argc != 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    long long compression = TD_DEFAULT_COMPRESSION;
+    if (argc == 3 && (RedisModule_StringToLongLong(argv[2], &compression) != REDISMODULE_OK ||
+                      compression < 1 || compression > TD_MAX_COMPRESSION)) {
+        return RedisModule_ReplyWithError(ctx, "TDIGEST: invalid compression");
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY) {
+        return RedisModule_ReplyWithError(ctx, "TDIGEST: key already exists");
+    }
+
+    RedisModule_ModuleTypeSetValue(key, TDigestType, TDigest_Create(compression));
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * TDIGEST.RESET key
+ */
+static int TDigest_Reset_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    TDigest *td;
+    if (GetTDigestKey(ctx, argv[1], &td, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+    TDigest_Reset(td);
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * TDIGEST.ADD key value [value ...]
+ * All values are validated before any is added.
+ */
+static int TDigest_Add_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    TDigest *td;
+    if (GetTDigestKey(ctx, argv[1], &td, REDISMODULE_READ | REDISMODULE_WRITE) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    int valueCount = argc - 2;
+    double *values = RedisModule_PoolAlloc(ctx, valueCount * sizeof(double));
+    // Samples must be finite, and small enough that differences between centroid
+    // means stay finite, or means and every later answer become inf or NaN
+    if (parseDoubles(ctx, argv + 2, valueCount, values, -DBL_MAX / 2, DBL_MAX / 2,
+                     "TDIGEST: invalid value") != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    for (int i = 0; i < valueCount; ++i) {
+        TDigest_Add(td, values[i], 1);
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * TDIGEST.MERGE dest-key source-key [source-key ...]
+ */
+static int TDigest_Merge_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    TDigest *dest;
+    if (GetTDigestKey(ctx, argv[1], &dest, REDISMODULE_READ | REDISMODULE_WRITE) !=
+        REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    int srcCount = argc - 2;
+    TDigest **srcs = RedisModule_PoolAlloc(ctx, srcCount * sizeof(TDigest *));
+    for (int i = 0; i < srcCount; ++i) {
+        if (GetTDigestKey(ctx, argv[2 + i], &srcs[i], REDISMODULE_READ) != REDISMODULE_OK) {
+            return REDISMODULE_OK;
+        }
+    }
+
+    for (int i = 0; i < srcCount; ++i) {
+        if (srcs[i] != dest) {
+            TDigest_Merge(dest, srcs[i]);
+        }
+    }
+
+    RedisModule_ReplicateVerbatim(ctx);
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/**
+ * TDIGEST.QUANTILE key quantile [quantile ...]
+ * TDIGEST.CDF key value [value ...]
+ */
+static int TDigest_Estimate_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 3) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    size_t cmdlen;
+    const char *cmd = RedisModule_StringPtrLen(argv[0], &cmdlen);
+    int isCDF = strcasecmp(cmd, "tdigest.cdf") == 0;
+
+    TDigest *td;
+    if (GetTDigestKey(ctx, argv[1], &td, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    int count = argc - 2;
+    double *args = RedisModule_PoolAlloc(ctx, count * sizeof(double));
+    int rv = isCDF ? parseDoubles(ctx, argv + 2, count, args, -HUGE_VAL, HUGE_VAL,
+                                  "TDIGEST: invalid value")
+                   : parseDoubles(ctx, argv + 2, count, args, 0, 1,
+                                  "TDIGEST: quantile should be in [0,1]");
+    if (rv != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, count);
+    for (int i = 0; i < count; ++i) {
+        RedisModule_ReplyWithDouble(ctx, isCDF ? TDigest_CDF(td, args[i])
+                                               : TDigest_Quantile(td, args[i]));
+    }
+    return REDISMODULE_OK;
+}
+
+/**
+ * TDIGEST.MIN key
+ * TDIGEST.MAX key
+ */
+static int TDigest_MinMax_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    size_t cmdlen;
+    const char *cmd = RedisModule_StringPtrLen(argv[0], &cmdlen);
+    int isMin = strcasecmp(cmd, "tdigest.min") == 0;
+
+    TDigest *td;
+    if (GetTDigestKey(ctx, argv[1], &td, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    if (TDigest_TotalWeight(td) == 0) {
+        return RedisModule_ReplyWithDouble(ctx, NAN);
+    }
+    return RedisModule_ReplyWithDouble(ctx, isMin ? td->min : td->max);
+}
+
+static int TDigest_Info_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc != 2) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    TDigest *td;
+    if (GetTDigestKey(ctx, argv[1], &td, REDISMODULE_READ) != REDISMODULE_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithArray(ctx, 7 * 2);
+    RedisModule_ReplyWithSimpleString(ctx, "Compression");
+    RedisModule_ReplyWithLongLong(ctx, td->compression);
+    RedisModule_ReplyWithSimpleString(ctx, "Capacity");
+    RedisModule_ReplyWithLongLong(ctx, td->capacity);
+    RedisModule_ReplyWithSimpleString(ctx, "Merged nodes");
+    RedisModule_ReplyWithLongLong(ctx, td->numMerged);
+    RedisModule_ReplyWithSimpleString(ctx, "Unmerged nodes");
+    RedisModule_ReplyWithLongLong(ctx, td->numUnmerged);
+    RedisModule_ReplyWithSimpleString(ctx, "Merged weight");
+    RedisModule_ReplyWithDouble(ctx, td->mergedWeight);
+    RedisModule_ReplyWithSimpleString(ctx, "Unmerged weight");
+    RedisModule_ReplyWithDouble(ctx, td->unmergedWeight);
+    RedisModule_ReplyWithSimpleString(ctx, "Total compressions");
+    RedisModule_ReplyWithLongLong(ctx, td->numCompressions);
+
+    return REDISMODULE_OK;
+}
+
+/**************** Module functions *********************************/
+
+static void TDigestRdbSave(RedisModuleIO *io, void *obj) {
+    TDigest *td = obj;
+    RedisModule_SaveDouble(io, td->compression);
+    RedisModule_SaveDouble(io, td->min);
+    RedisModule_SaveDouble(io, td->max);
+    RedisModule_SaveUnsigned(io, td->numMerged);
+    RedisModule_SaveUnsigned(io, td->numUnmerged);
+    RedisModule_SaveUnsigned(io, td->numCompressions);
+    RedisModule_SaveDouble(io, td->mergedWeight);
+    RedisModule_SaveDouble(io, td->unmergedWeight);
+    RedisModule_SaveStringBuffer(io, (const char *)td->nodes,
+                                 (td->numMerged + td->numUnmerged) * sizeof(TDigestCentroid));
+}
+
+static void *TDigestRdbLoad(RedisModuleIO *io, int encver) {
+    if (encver > TDIGEST_ENC_VER) {
+        return NULL;
+    }
+
+    TDigest *td = TDigest_Create(RedisModule_LoadDouble(io));
+    td->min = RedisModule_LoadDouble(io);
+    td->max = RedisModule_LoadDouble(io);
+    td->numMerged = RedisModule_LoadUnsigned(io);
+    td->numUnmerged = RedisModule_LoadUnsigned(io);
+    td->numCompressions = RedisModule_LoadUnsigned(io);
+    td->mergedWeight = RedisModule_LoadDouble(io);
+    td->unmergedWeight = RedisModule_LoadDouble(io);
+
+    size_t length = 0;
+    char *nodes = RedisModule_LoadStringBuffer(io, &length);
+    assert(td->numMerged + td->numUnmerged <= td->capacity &&
+           length == (td->numMerged + td->numUnmerged) * sizeof(TDigestCentroid));
+    memcpy(td->nodes, nodes, length);
+    RedisModule_Free(nodes);
+
+    return td;
+}
+
+static void TDigestFree(void *value) { TDigest_Destroy(value); }
+
+static size_t TDigestMemUsage(const void *value) { return TDigest_Size(value); }
+
+int TDigestModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                                 .rdb_load = TDigestRdbLoad,
+                                 .rdb_save = TDigestRdbSave,
+                                 .aof_rewrite = RMUtil_DefaultAofRewrite,
+                                 .mem_usage = TDigestMemUsage,
+                                 .free = TDigestFree};
+
+    TDigestType = RedisModule_CreateDataType(ctx, "TDIS-TYPE", TDIGEST_ENC_VER, &tm);
+    if (TDigestType == NULL)
+        return REDISMODULE_ERR;
+
+    RMUtil_RegisterWriteDenyOOMCmd(ctx, "tdigest.create", TDigest_Create_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "tdigest.reset", TDigest_Reset_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "tdigest.add", TDigest_Add_Cmd);
+    RMUtil_RegisterWriteCmd(ctx, "tdigest.merge", TDigest_Merge_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "tdigest.quantile", TDigest_Estimate_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "tdigest.cdf", TDigest_Estimate_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "tdigest.min", TDigest_MinMax_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "tdigest.max", TDigest_MinMax_Cmd);
+    RMUtil_RegisterReadCmd(ctx, "tdigest.info", TDigest_Info_Cmd);
+
+    return REDISMODULE_OK;
+}
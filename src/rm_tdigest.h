@@ -0,0 +1,10 @@
+#ifndef TDIGEST_MODULE_H
+#define TDIGEST_MODULE_H
+
+#include "redismodule.h"
+
+#define TDIGEST_ENC_VER 0
+
+int TDigestModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif
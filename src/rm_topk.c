@@ -1,6 +1,7 @@
 //#include <math.h>     ceil, log10f
 //#include <strings.h>  strncasecmp
 #include <assert.h>
+#include <strings.h> // strcasecmp
 
 #include "version.h"
 #include "rmutil/util.h"
@@ -36,7 +37,22 @@ static int createTopK(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, T
     if ((RedisModule_StringToLongLong(argv[2], &k) != REDISMODULE_OK) || k < 1) {
         INNER_ERROR("TopK: invalid k");
     }
-    if (argc == 6) {
+    if (argc == 5) {
+        // MAXMEMORY <bytes>, with the default depth and decay
+        long long bytes;
+        if (strcasecmp(RedisModule_StringPtrLen(argv[3], NULL), "MAXMEMORY") != 0) {
+            INNER_ERROR("TopK: invalid arguments");
+        }
+        if ((RedisModule_StringToLongLong(argv[4], &bytes) != REDISMODULE_OK) || bytes < 1) {
+            INNER_ERROR("TopK: invalid memory size");
+        }
+        depth = 7;
+        decay = 0.9;
+        width = TopK_WidthForBytes(bytes, k, depth);
+        if (width < 1) {
+            INNER_ERROR("TopK: memory size too small");
+        }
+    } else if (argc == 6) {
         if ((RedisModule_StringToLongLong(argv[3], &width) != REDISMODULE_OK) || width < 1) {
             INNER_ERROR("TopK: invalid width");
         }
@@ -57,7 +73,7 @@ static int createTopK(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, T
 }
 
 static int TopK_Create_Cmd(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    if (argc != 3 && argc != 6) {
+    if (argc < 3 || argc > 6 || argc == 4) {
         return RedisModule_WrongArity(ctx);
     }
 
@@ -6,6 +6,8 @@
 #define TOPK_ENC_VER 0
 #define REDIS_MODULE_TARGET
 
+extern RedisModuleType *TopKType;
+
 int TopKModule_onLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,8 @@
 #define BLOOM_CALLOC RedisModule_Calloc
 #define BLOOM_FREE RedisModule_Free
 #include "contrib/bloom.c"
+#include "zero_rle.h"
+#include "radix_sort.h"
 #include <string.h>
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -13,9 +15,31 @@
 #define ERROR_TIGHTENING_RATIO 0.5
 #define CUR_FILTER(sb) ((sb)->filters + ((sb)->nfilters - 1))
 
+// Inline chains are laid out as [SBChain][SBLink][bits of the link]
+#define INLINE_LINK(sb) ((SBLink *)((sb) + 1))
+
+static int filtersInline(const SBChain *sb) {
+    // Only inline chains own the memory past the struct, so check nofree first
+    return sb->nfilters > 0 && sb->filters[0].inner.nofree && sb->filters == INLINE_LINK(sb);
+}
+
+static SBChain *newInlineChain(uint64_t bytes) {
+    SBChain *sb = RedisModule_Calloc(1, sizeof(*sb) + sizeof(SBLink) + bytes);
+    sb->filters = INLINE_LINK(sb);
+    sb->nfilters = 1;
+    sb->filters[0].inner.bf = (unsigned char *)(sb->filters + 1);
+    sb->filters[0].inner.nofree = 1;
+    return sb;
+}
+
 static int SBChain_AddLink(SBChain *chain, uint64_t size, double error_rate) {
     if (!chain->filters) {
         chain->filters = RedisModule_Calloc(1, sizeof(*chain->filters));
+    } else if (filtersInline(chain)) {
+        // The first link's bits stay in place, only the array moves out
+        SBLink *filters = RedisModule_Calloc(chain->nfilters + 1, sizeof(*filters));
+        memcpy(filters, chain->filters, sizeof(*filters) * chain->nfilters);
+        chain->filters = filters;
     } else {
         chain->filters =
             RedisModule_Realloc(chain->filters, sizeof(*chain->filters) * (chain->nfilters + 1));
@@ -23,15 +47,44 @@ static int SBChain_AddLink(SBChain *chain, uint64_t size, double error_rate) {
 
     SBLink *newlink = chain->filters + chain->nfilters;
     newlink->size = 0;
+    newlink->refs = NULL;
     chain->nfilters++;
     return bloom_init(&newlink->inner, size, error_rate, chain->options);
 }
 
+// Shared links are nofree, their bits are freed with the last reference. The
+// count is atomic as lazy freeing may free chains from another thread.
+static void linkRelease(SBLink *link) {
+    if (!link->refs) {
+        bloom_free(&link->inner);
+    } else if (__atomic_sub_fetch(link->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        RedisModule_Free(link->inner.bf);
+        RedisModule_Free(link->refs);
+    }
+}
+
+// Gives the link bits of its own, before writing them
+static void linkUnshare(SBLink *link) {
+    if (!link->refs) {
+        return;
+    }
+    unsigned char *bf = RedisModule_Alloc(link->inner.bytes);
+    memcpy(bf, link->inner.bf, link->inner.bytes);
+    linkRelease(link);
+    link->refs = NULL;
+    link->inner.bf = bf;
+    link->inner.nofree = 0;
+}
+
 void SBChain_Free(SBChain *sb) {
     for (size_t ii = 0; ii < sb->nfilters; ++ii) {
-        bloom_free(&sb->filters[ii].inner);
+        linkRelease(&sb->filters[ii]);
+    }
+    RedisModule_Free(sb->prefixes);
+    // Also frees sb->sparse, which shares the pointer
+    if (!filtersInline(sb)) {
+        RedisModule_Free(sb->filters);
     }
-    RedisModule_Free(sb->filters);
     RedisModule_Free(sb);
 }
 
@@ -45,17 +98,257 @@ static int SBChain_AddToLink(SBLink *lb, bloom_hashval hash) {
     }
 }
 
-static bloom_hashval SBChain_GetHash(const SBChain *chain, const void *buf, size_t len) {
-    if (chain->options & BLOOM_OPT_FORCE64) {
+bloom_hashval SBChain_GetHash(const SBChain *chain, const void *buf, size_t len) {
+    if (chain->options & BLOOM_OPT_KEYED) {
+        return bloom_calc_hash_keyed(buf, len, chain->hashKey);
+    } else if (chain->options & BLOOM_OPT_FORCE64) {
         return bloom_calc_hash64(buf, len);
     } else {
         return bloom_calc_hash(buf, len);
     }
 }
 
-int SBChain_Add(SBChain *sb, const void *data, size_t len) {
+void SBChain_GetHashes(const SBChain *chain, const void *const *items, const size_t *lens, size_t n,
+                       bloom_hashval *out) {
+    if (chain->options & BLOOM_OPT_KEYED) {
+        for (size_t ii = 0; ii < n; ++ii) {
+            out[ii] = bloom_calc_hash_keyed(items[ii], lens[ii], chain->hashKey);
+        }
+    } else if (chain->options & BLOOM_OPT_FORCE64) {
+        bloom_calc_hashes64(items, lens, n, out);
+    } else {
+        bloom_calc_hashes(items, lens, n, out);
+    }
+}
+
+bloom_hashval SBChain_GetIntHash(const SBChain *chain, uint64_t item) {
+    if (chain->options & BLOOM_OPT_KEYED) {
+        return bloom_calc_hash_int_keyed(item, chain->hashKey);
+    }
+    return bloom_calc_hash_int(item);
+}
+
+int SBChain_SetHashKey(SBChain *sb, const uint64_t key[2]) {
+    if (sb->size || sb->prefixes) {
+        return -1;
+    }
+    sb->options |= BLOOM_OPT_KEYED;
+    sb->hashKey[0] = key[0];
+    sb->hashKey[1] = key[1];
+    return 0;
+}
+
+uint64_t SBChain_Bytes(const SBChain *sb) {
+    uint64_t bytes = sizeof(*sb) + sb->nfilters * sizeof(*sb->filters);
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        bytes += sb->filters[ii].inner.bytes;
+    }
+    return bytes;
+}
+
+// SBChain_Bytes of a new chain with the links SB_ErrorForBytes keeps room for,
+// or UINT64_MAX if they can't be created
+static uint64_t budgetBytes(uint64_t initsize, double error_rate, unsigned options,
+                            unsigned growth) {
+    options |= BLOOM_OPT_NOALLOC;
+    int scaling = !(options & BLOOM_OPT_NO_SCALING);
+    struct bloom first = {0}, second = {0};
+    if (bloom_init(&first, initsize, error_rate * (scaling ? ERROR_TIGHTENING_RATIO : 1),
+                   options) != 0) {
+        return UINT64_MAX;
+    }
+    uint64_t bytes = sizeof(SBChain) + sizeof(SBLink) + first.bytes;
+    if (scaling) {
+        if (bloom_init(&second, first.entries * (size_t)growth,
+                       first.error * ERROR_TIGHTENING_RATIO, options) != 0) {
+            return UINT64_MAX;
+        }
+        bytes += sizeof(SBLink) + second.bytes;
+    }
+    return bytes;
+}
+
+double SB_ErrorForBytes(uint64_t initsize, uint64_t maxBytes, unsigned options, unsigned growth) {
+    // Memory only decreases as the error rate grows, so bisect on its logarithm
+    double lo = log(SB_MIN_BUDGET_ERROR), hi = log(0.99);
+    if (budgetBytes(initsize, exp(hi), options, growth) > maxBytes) {
+        return 0;
+    }
+    if (budgetBytes(initsize, exp(lo), options, growth) <= maxBytes) {
+        return SB_MIN_BUDGET_ERROR;
+    }
+    for (int ii = 0; ii < 64; ++ii) {
+        double mid = (lo + hi) / 2;
+        if (budgetBytes(initsize, exp(mid), options, growth) <= maxBytes) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return exp(hi);
+}
+
+void SBChain_SetMaxBytes(SBChain *sb, uint64_t maxBytes) {
+    sb->options |= BLOOM_OPT_MAXBYTES;
+    sb->maxBytes = maxBytes;
+}
+
+#define PREFIX_M 0xc6a4a7935bd1e995ULL
+#define PREFIX_R 47
+#define PREFIX_SEED 0x8445d61a4e774912ULL
+
+static inline uint64_t prefixMixBlock(uint64_t k) {
+    k *= PREFIX_M;
+    k ^= k >> PREFIX_R;
+    k *= PREFIX_M;
+    return k;
+}
+
+static bloom_hashval prefixFinalize(uint64_t h, const unsigned char *tail, size_t len) {
+    uint64_t t = 0;
+    for (size_t ii = len & 7; ii > 0; --ii) {
+        t = (t << 8) | tail[ii - 1];
+    }
+    h ^= prefixMixBlock(t);
+    // Murmur seeds with the length, which is not known upfront when streaming
+    h ^= len * PREFIX_M;
+    h *= PREFIX_M;
+    h ^= h >> PREFIX_R;
+    h *= PREFIX_M;
+    h ^= h >> PREFIX_R;
+
+    bloom_hashval rv = {.a = h, .b = prefixMixBlock(h ^ PREFIX_SEED)};
+    rv.b ^= rv.b >> PREFIX_R;
+    return rv;
+}
+
+/*  Hashes the first lens[i] bytes of 'data' for each prefix length not longer than
+    'len', in a single pass. A Murmur64A style state is carried over 8 byte blocks and
+    each prefix is finalized from it as the pass reaches its length. Prefix hashes
+    use a different seed than items, so a prefix never matches an item of the same
+    bytes. Returns the number of hashes written to 'out'. */
+static size_t prefixHashes(const unsigned char *data, size_t len, const uint16_t *lens,
+                           bloom_hashval *out) {
+    uint64_t h = PREFIX_SEED;
+    size_t pos = 0, n = 0;
+    for (; lens[n] && lens[n] <= len; ++n) {
+        size_t end = lens[n] & ~(size_t)7;
+        for (; pos < end; pos += 8) {
+            uint64_t k;
+            memcpy(&k, data + pos, sizeof k);
+            h ^= prefixMixBlock(k);
+            h *= PREFIX_M;
+        }
+        out[n] = prefixFinalize(h, data + pos, lens[n]);
+    }
+    return n;
+}
+
+static inline int hashCmp(bloom_hashval x, bloom_hashval y) {
+    if (x.a != y.a) {
+        return x.a < y.a ? -1 : 1;
+    }
+    return x.b < y.b ? -1 : x.b > y.b;
+}
+
+// Returns 1 if 'h' is in the sparse chain. 'pos' is set to its insertion point
+static int sparseFind(const SBSparse *sp, bloom_hashval h, uint32_t *pos) {
+    uint32_t lo = 0, hi = sp->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = hashCmp(sp->hashes[mid], h);
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+static size_t sparseSize(uint32_t n) {
+    return sizeof(SBSparse) + n * sizeof(bloom_hashval);
+}
+
+SBChain *SB_NewSparseChain(uint64_t initsize, double error_rate, unsigned options,
+                           unsigned growth) {
+    if (initsize == 0 || error_rate == 0 || error_rate >= 1) {
+        return NULL;
+    }
+    double tightening = (options & BLOOM_OPT_NO_SCALING) ? 1 : ERROR_TIGHTENING_RATIO;
+    double error = error_rate * tightening;
+
+    // Stay sparse while the hashes take less memory than the link would
+    double linkBytes = initsize * calc_bpe(error) / 8 + sizeof(SBLink);
+    double limit = linkBytes / sizeof(bloom_hashval);
+    if (limit > initsize) {
+        limit = initsize;
+    }
+    if (limit > SB_SPARSE_MAX_HASHES) {
+        limit = SB_SPARSE_MAX_HASHES;
+    }
+    if (limit < 1) {
+        return SB_NewChain(initsize, error_rate, options, growth);
+    }
+
+    SBChain *sb = RedisModule_Calloc(1, sizeof(*sb));
+    sb->growth = growth;
+    sb->options = options;
+    sb->sparse = RedisModule_Calloc(1, sparseSize(0));
+    sb->sparse->capacity = initsize;
+    sb->sparse->error = error;
+    sb->sparse->limit = limit;
+    return sb;
+}
+
+int SBChain_Densify(SBChain *sb) {
+    if (!SB_IS_SPARSE(sb)) {
+        return 0;
+    }
+    SBSparse *sp = sb->sparse;
+    sb->filters = NULL;
+    if (SBChain_AddLink(sb, sp->capacity, sp->error) != 0) {
+        RedisModule_Free(sb->filters); // LCOV_EXCL_LINE
+        sb->nfilters = 0;              // LCOV_EXCL_LINE
+        sb->sparse = sp;               // LCOV_EXCL_LINE
+        return -1;                     // LCOV_EXCL_LINE
+    }
+    for (uint32_t ii = 0; ii < sp->n; ++ii) {
+        SBChain_AddToLink(CUR_FILTER(sb), sp->hashes[ii]);
+    }
+    RedisModule_Free(sp);
+    return 0;
+}
+
+static int SBChain_AddSparse(SBChain *sb, bloom_hashval h) {
+    SBSparse *sp = sb->sparse;
+    uint32_t pos;
+    if (sparseFind(sp, h, &pos)) {
+        return 0;
+    }
+    sp = sb->sparse = RedisModule_Realloc(sp, sparseSize(sp->n + 1));
+    memmove(sp->hashes + pos + 1, sp->hashes + pos, (sp->n - pos) * sizeof(*sp->hashes));
+    sp->hashes[pos] = h;
+    sp->n++;
+    return 1;
+}
+
+static int SBChain_AddHash(SBChain *sb, bloom_hashval h) {
+    if (SB_IS_SPARSE(sb)) {
+        uint32_t pos;
+        if (sb->sparse->n < sb->sparse->limit || sparseFind(sb->sparse, h, &pos)) {
+            return SBChain_AddSparse(sb, h);
+        }
+        if (SBChain_Densify(sb) != 0) {
+            return -1; // LCOV_EXCL_LINE
+        }
+    }
+
     // Does it already exist?
-    bloom_hashval h = SBChain_GetHash(sb, data, len);
     for (int ii = sb->nfilters - 1; ii >= 0; --ii) {
         if (bloom_check_h(&sb->filters[ii].inner, h)) {
             return 0;
@@ -69,21 +362,53 @@ int SBChain_Add(SBChain *sb, const void *data, size_t len) {
             return -2;
         }
         double error = cur->inner.error * ERROR_TIGHTENING_RATIO;
-        if (SBChain_AddLink(sb, cur->inner.entries * (size_t)sb->growth, error) != 0) {
+        uint64_t size = cur->inner.entries * (size_t)sb->growth;
+        if (sb->options & BLOOM_OPT_MAXBYTES) {
+            struct bloom next = {0};
+            if (bloom_init(&next, size, error, sb->options | BLOOM_OPT_NOALLOC) != 0 ||
+                SBChain_Bytes(sb) + sizeof(SBLink) + next.bytes > sb->maxBytes) {
+                return -2;
+            }
+        }
+        if (SBChain_AddLink(sb, size, error) != 0) {
             return -1;
         }
         cur = CUR_FILTER(sb);
     }
 
-    int rv = SBChain_AddToLink(cur, h);
-    if (rv) {
+    return SBChain_AddToLink(cur, h);
+}
+
+int SBChain_Add(SBChain *sb, const void *data, size_t len) {
+    return SBChain_AddHashed(sb, data, len, SBChain_GetHash(sb, data, len));
+}
+
+int SBChain_AddHashed(SBChain *sb, const void *data, size_t len, bloom_hashval hash) {
+    if (sb->prefixes) {
+        // Prefixes are stored as entries of their own, and count toward link capacity.
+        // They are added first so a full filter never has an item without its prefixes.
+        bloom_hashval ph[SB_MAX_PREFIXES];
+        size_t n = prefixHashes(data, len, sb->prefixes, ph);
+        for (size_t ii = 0; ii < n; ++ii) {
+            int rv = SBChain_AddHash(sb, ph[ii]);
+            if (rv < 0) {
+                return rv;
+            }
+        }
+    }
+
+    int rv = SBChain_AddHash(sb, hash);
+    if (rv > 0) {
         sb->size++;
     }
     return rv;
 }
 
-int SBChain_Check(const SBChain *sb, const void *data, size_t len) {
-    bloom_hashval hv = SBChain_GetHash(sb, data, len);
+static int SBChain_CheckHash(const SBChain *sb, bloom_hashval hv) {
+    if (SB_IS_SPARSE(sb)) {
+        uint32_t pos;
+        return sparseFind(sb->sparse, hv, &pos);
+    }
     for (int ii = sb->nfilters - 1; ii >= 0; --ii) {
         if (bloom_check_h(&sb->filters[ii].inner, hv)) {
             return 1;
@@ -92,21 +417,369 @@ int SBChain_Check(const SBChain *sb, const void *data, size_t len) {
     return 0;
 }
 
+int SBChain_Check(const SBChain *sb, const void *data, size_t len) {
+    return SBChain_CheckHash(sb, SBChain_GetHash(sb, data, len));
+}
+
+// Sets found[i] for the items found in one of the first 'nlinks' links of a dense chain
+static void checkLinks(const SBChain *sb, int nlinks, const bloom_hashval *hashes, size_t n,
+                       int *found) {
+    for (int jj = nlinks - 1; jj >= 0; --jj) {
+        const struct bloom *inner = &sb->filters[jj].inner;
+        for (size_t base = 0; base < n; base += SB_PREFETCH_WINDOW) {
+            size_t end = base + SB_PREFETCH_WINDOW < n ? base + SB_PREFETCH_WINDOW : n;
+            for (size_t ii = base; ii < end; ++ii) {
+                if (!found[ii]) {
+                    bloom_prefetch_h(inner, hashes[ii]);
+                }
+            }
+            for (size_t ii = base; ii < end; ++ii) {
+                if (!found[ii]) {
+                    found[ii] = bloom_check_h(inner, hashes[ii]);
+                }
+            }
+        }
+    }
+}
+
+void SBChain_CheckHashes(const SBChain *sb, const bloom_hashval *hashes, size_t n, int *found) {
+    if (SB_IS_SPARSE(sb)) {
+        for (size_t ii = 0; ii < n; ++ii) {
+            found[ii] = SBChain_CheckHash(sb, hashes[ii]);
+        }
+        return;
+    }
+    memset(found, 0, n * sizeof(*found));
+    checkLinks(sb, sb->nfilters, hashes, n, found);
+}
+
+// Positions sorted at once by SBChain_AddSorted, bounding its scratch memory
+#define SB_SORTED_MAX_POSITIONS (1 << 22)
+// Bits of the smallest region of the link updated at once, a 4KB page
+#define SB_SORTED_REGION_BITS 15
+
+// Adds 'n' items to the current link, which has room for all of them, as
+// SBChain_AddHashed would one after the other. Such items never grow the chain,
+// so an item is new if it is not in an older link and finds one of its bits
+// unset in the current one. The bits are set one region of the link at a time,
+// each region in item order, so the first item setting a bit is the one finding
+// it unset.
+static void SBChain_AddSorted(SBChain *sb, const bloom_hashval *hashes, size_t n, int *rv) {
+    SBLink *cur = CUR_FILTER(sb);
+    struct bloom *inner = &cur->inner;
+
+    memset(rv, 0, n * sizeof(*rv));
+    checkLinks(sb, sb->nfilters - 1, hashes, n, rv);
+    uint32_t *todo = RedisModule_Alloc(n * sizeof(*todo));
+    size_t ntodo = 0;
+    for (size_t ii = 0; ii < n; ++ii) {
+        if (!rv[ii]) {
+            todo[ntodo++] = ii;
+        }
+        rv[ii] = 0;
+    }
+
+    const size_t k = inner->hashes;
+    const size_t chunk = SB_SORTED_MAX_POSITIONS / k ? SB_SORTED_MAX_POSITIONS / k : 1;
+    const unsigned shift = RadixSort_Shift(inner->bits, SB_SORTED_REGION_BITS);
+    const size_t nbuckets = RadixSort_Buckets(inner->bits, shift);
+    uint64_t *pos = RedisModule_Alloc(2 * chunk * k * sizeof(*pos));
+    uint64_t *sorted = pos + chunk * k;
+    uint32_t *order = RedisModule_Alloc(chunk * k * sizeof(*order));
+    size_t *starts = RedisModule_Alloc((nbuckets + 1) * sizeof(*starts));
+    uint8_t *isNew = RedisModule_Alloc(chunk);
+    size_t added = 0;
+    for (size_t base = 0; base < ntodo; base += chunk) {
+        size_t end = base + chunk < ntodo ? base + chunk : ntodo;
+        for (size_t ii = base; ii < end; ++ii) {
+            bloom_positions_h(inner, hashes[todo[ii]], pos + (ii - base) * k);
+        }
+        size_t m = (end - base) * k;
+        RadixSort_ByRegion(pos, m, shift, nbuckets, starts, sorted, order);
+        memset(isNew, 0, end - base);
+        for (size_t e = 0; e < m; ++e) {
+            uint64_t x = sorted[e];
+            uint8_t mask = 1 << (x % 8);
+            if (!(inner->bf[x >> 3] & mask)) {
+                inner->bf[x >> 3] |= mask;
+                isNew[order[e] / k] = 1;
+            }
+        }
+        for (size_t ii = base; ii < end; ++ii) {
+            rv[todo[ii]] = isNew[ii - base];
+            added += isNew[ii - base];
+        }
+    }
+    cur->size += added;
+    sb->size += added;
+    RedisModule_Free(isNew);
+    RedisModule_Free(starts);
+    RedisModule_Free(order);
+    RedisModule_Free(pos);
+    RedisModule_Free(todo);
+}
+
+size_t SBChain_AddHashes(SBChain *sb, const void *const *items, const size_t *lens,
+                         const bloom_hashval *hashes, size_t n, int *rv) {
+    size_t ii = 0;
+    while (ii < n) {
+        const SBLink *cur = SB_IS_SPARSE(sb) ? NULL : CUR_FILTER(sb);
+        size_t room = cur && cur->size < cur->inner.entries ? cur->inner.entries - cur->size : 0;
+        if (!sb->prefixes && n - ii >= SB_SORTED_MIN_BATCH && room >= SB_SORTED_MIN_BATCH &&
+            cur->inner.bytes >= SB_SORTED_MIN_BYTES) {
+            size_t len = n - ii < room ? n - ii : room;
+            SBChain_AddSorted(sb, hashes + ii, len, rv + ii);
+            ii += len;
+            continue;
+        }
+        rv[ii] = SBChain_AddHashed(sb, items ? items[ii] : NULL, items ? lens[ii] : 0, hashes[ii]);
+        if (rv[ii++] == -2) {
+            break;
+        }
+    }
+    return ii;
+}
+
+int SBChain_CheckPrefix(const SBChain *sb, const void *prefix, size_t len) {
+    if (!sb->prefixes) {
+        return -1;
+    }
+    uint16_t lens[2] = {0, 0};
+    for (const uint16_t *p = sb->prefixes; *p; ++p) {
+        if (*p == len) {
+            lens[0] = *p;
+        }
+    }
+    if (!lens[0]) {
+        return -1;
+    }
+
+    bloom_hashval hv;
+    prefixHashes(prefix, len, lens, &hv);
+    return SBChain_CheckHash(sb, hv);
+}
+
+static int cmpPrefixLen(const void *a, const void *b) {
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+int SBChain_SetPrefixes(SBChain *sb, const uint16_t *lens, size_t nlens) {
+    if (sb->size || nlens == 0 || nlens > SB_MAX_PREFIXES || (sb->options & BLOOM_OPT_KEYED)) {
+        return -1;
+    }
+    uint16_t *prefixes = RedisModule_Calloc(nlens + 1, sizeof(*prefixes));
+    memcpy(prefixes, lens, nlens * sizeof(*prefixes));
+    qsort(prefixes, nlens, sizeof(*prefixes), cmpPrefixLen);
+    for (size_t ii = 0; ii < nlens; ++ii) {
+        if (prefixes[ii] == 0 || (ii > 0 && prefixes[ii] == prefixes[ii - 1])) {
+            RedisModule_Free(prefixes);
+            return -1;
+        }
+    }
+    RedisModule_Free(sb->prefixes);
+    sb->prefixes = prefixes;
+    sb->options |= BLOOM_OPT_PREFIXES;
+    return 0;
+}
+
+int SBChain_UseItems(SBChain *sb, int intItems, int adopt) {
+    if (!!(sb->options & BLOOM_OPT_INTITEMS) == !!intItems) {
+        return 0;
+    }
+    if (sb->size || (intItems && sb->prefixes)) {
+        return -1;
+    }
+    if (adopt) {
+        sb->options ^= BLOOM_OPT_INTITEMS;
+    }
+    return 0;
+}
+
 SBChain *SB_NewChain(uint64_t initsize, double error_rate, unsigned options, unsigned growth) {
     if (initsize == 0 || error_rate == 0 || error_rate >= 1) {
         return NULL;
     }
-    SBChain *sb = RedisModule_Calloc(1, sizeof(*sb));
-    sb->growth = growth;
-    sb->options = options;
     double tightening = (options & BLOOM_OPT_NO_SCALING) ? 1 : ERROR_TIGHTENING_RATIO;
-    if (SBChain_AddLink(sb, initsize, error_rate * tightening) != 0) {
-        SBChain_Free(sb);
-        sb = NULL;
+    struct bloom inner = {0};
+    if (bloom_init(&inner, initsize, error_rate * tightening, options | BLOOM_OPT_NOALLOC) != 0) {
+        return NULL;
+    }
+
+    SBChain *sb;
+    if (inner.bytes <= SB_INLINE_MAX_BYTES) {
+        sb = newInlineChain(inner.bytes);
+        inner.bf = sb->filters[0].inner.bf;
+    } else {
+        sb = RedisModule_Calloc(1, sizeof(*sb));
+        sb->filters = RedisModule_Calloc(1, sizeof(*sb->filters));
+        sb->nfilters = 1;
+        inner.bf = RedisModule_Calloc(inner.bytes, sizeof(unsigned char));
+        inner.nofree = 0;
     }
+    sb->growth = growth;
+    sb->options = options;
+    sb->filters[0].inner = inner;
     return sb;
 }
 
+SBChain *SBChain_Inline(SBChain *sb) {
+    if (sb->nfilters != 1 || filtersInline(sb) || sb->filters[0].inner.bytes > SB_INLINE_MAX_BYTES) {
+        return sb;
+    }
+
+    SBLink link = sb->filters[0];
+    SBChain *dst = newInlineChain(link.inner.bytes);
+    SBLink *filters = dst->filters;
+    unsigned char *bf = filters[0].inner.bf;
+    memcpy(bf, link.inner.bf, link.inner.bytes);
+
+    *dst = *sb;
+    dst->filters = filters;
+    dst->filters[0] = link;
+    dst->filters[0].inner.bf = bf;
+    dst->filters[0].inner.nofree = 1;
+
+    bloom_free(&link.inner);
+    RedisModule_Free(sb->filters);
+    RedisModule_Free(sb);
+    return dst;
+}
+
+SBChain *SBChain_Copy(SBChain *sb) {
+    assert(!SBChain_IsPacked(sb));
+    SBChain *dst = RedisModule_Alloc(sizeof(*dst));
+    *dst = *sb;
+    dst->idle = NULL;
+    if (sb->prefixes) {
+        size_t n = 0;
+        while (sb->prefixes[n++]) {
+        }
+        dst->prefixes = RedisModule_Alloc(n * sizeof(*dst->prefixes));
+        memcpy(dst->prefixes, sb->prefixes, n * sizeof(*dst->prefixes));
+    }
+    if (SB_IS_SPARSE(sb)) {
+        dst->sparse = RedisModule_Alloc(sparseSize(sb->sparse->n));
+        memcpy(dst->sparse, sb->sparse, sparseSize(sb->sparse->n));
+        return dst;
+    }
+
+    dst->filters = RedisModule_Alloc(sb->nfilters * sizeof(*dst->filters));
+    memcpy(dst->filters, sb->filters, sb->nfilters * sizeof(*dst->filters));
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        SBLink *src = sb->filters + ii, *link = dst->filters + ii;
+        // Inline bits belong to the source's allocation, small enough to copy
+        int isInline = src->inner.nofree && !src->refs;
+        if (ii + 1 < sb->nfilters && !isInline) {
+            if (!src->refs) {
+                src->refs = RedisModule_Alloc(sizeof(*src->refs));
+                *src->refs = 1;
+                src->inner.nofree = 1;
+            }
+            __atomic_add_fetch(src->refs, 1, __ATOMIC_RELAXED);
+            link->refs = src->refs;
+            link->inner.nofree = 1;
+        } else {
+            link->refs = NULL;
+            link->inner.bf = RedisModule_Alloc(src->inner.bytes);
+            memcpy(link->inner.bf, src->inner.bf, src->inner.bytes);
+            link->inner.nofree = 0;
+        }
+    }
+    return SBChain_Inline(dst);
+}
+
+// Packed bits are stored as their encoded length followed by the encoding
+size_t SBChain_Pack(SBChain *sb) {
+    size_t saved = 0;
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        SBLink *link = sb->filters + ii;
+        struct bloom *inner = &link->inner;
+        // Copies sharing the link may all have been freed
+        if (link->refs && __atomic_load_n(link->refs, __ATOMIC_ACQUIRE) == 1) {
+            RedisModule_Free(link->refs);
+            link->refs = NULL;
+            inner->nofree = 0;
+        }
+        if (inner->packed || inner->nofree || inner->bytes <= SB_INLINE_MAX_BYTES) {
+            continue;
+        }
+        uint64_t len = ZeroRLE_Encode(inner->bf, inner->bytes, NULL);
+        if (sizeof(len) + len > inner->bytes / 4 * 3) {
+            continue;
+        }
+        unsigned char *packed = RedisModule_Alloc(sizeof(len) + len);
+        memcpy(packed, &len, sizeof(len));
+        ZeroRLE_Encode(inner->bf, inner->bytes, packed + sizeof(len));
+        RedisModule_Free(inner->bf);
+        inner->bf = packed;
+        inner->packed = 1;
+        saved += inner->bytes - sizeof(len) - len;
+    }
+    return saved;
+}
+
+// Decodes the bits of a packed link into a new allocation, NULL on failure
+static unsigned char *decodeLink(const struct bloom *inner) {
+    uint64_t len;
+    memcpy(&len, inner->bf, sizeof(len));
+    unsigned char *bf = RedisModule_Alloc(inner->bytes);
+    if (ZeroRLE_Decode(inner->bf + sizeof(len), len, bf, inner->bytes) != 0) {
+        RedisModule_Free(bf); // LCOV_EXCL_LINE
+        return NULL;          // LCOV_EXCL_LINE
+    }
+    return bf;
+}
+
+int SBChain_Unpack(SBChain *sb) {
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        struct bloom *inner = &sb->filters[ii].inner;
+        if (!inner->packed) {
+            continue;
+        }
+        unsigned char *bf = decodeLink(inner);
+        if (!bf) {
+            return -1; // LCOV_EXCL_LINE
+        }
+        RedisModule_Free(inner->bf);
+        inner->bf = bf;
+        inner->packed = 0;
+    }
+    return 0;
+}
+
+const unsigned char *SBChain_LinkBits(const SBChain *sb, size_t ii, unsigned char **tmp) {
+    const struct bloom *inner = &sb->filters[ii].inner;
+    *tmp = NULL;
+    if (!inner->packed) {
+        return inner->bf;
+    }
+    return *tmp = decodeLink(inner);
+}
+
+int SBChain_IsPacked(const SBChain *sb) {
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        if (sb->filters[ii].inner.packed) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+size_t SBChain_DataBytes(const SBChain *sb) {
+    size_t bytes = 0;
+    for (size_t ii = 0; ii < sb->nfilters; ++ii) {
+        const struct bloom *inner = &sb->filters[ii].inner;
+        if (inner->packed) {
+            uint64_t len;
+            memcpy(&len, inner->bf, sizeof(len));
+            bytes += sizeof(len) + len;
+        } else {
+            bytes += inner->bytes;
+        }
+    }
+    return bytes;
+}
+
 typedef struct __attribute__((packed)) {
     uint64_t bytes;
     uint64_t bits;
@@ -185,8 +858,69 @@ const char *SBChain_GetEncodedChunk(const SBChain *sb, long long *curIter, size_
     return (const char *)(link->inner.bf + offset);
 }
 
+const char *SBChain_GetPackedChunk(const SBChain *sb, long long *curIter, size_t *len,
+                                   size_t maxChunkSize, SBUnpackedLink *unpacked) {
+    size_t offset = 0;
+    SBLink *link = getLinkPos(sb, *curIter, &offset);
+    if (!link || !link->inner.packed) {
+        return SBChain_GetEncodedChunk(sb, curIter, len, maxChunkSize);
+    }
+    size_t ix = link - sb->filters;
+    if (!unpacked->bits || unpacked->ix != ix) {
+        RedisModule_Free(unpacked->bits);
+        unpacked->bits = decodeLink(&link->inner);
+        unpacked->ix = ix;
+        if (!unpacked->bits) {
+            return NULL; // LCOV_EXCL_LINE
+        }
+    }
+    *len = link->inner.bytes - offset < maxChunkSize ? link->inner.bytes - offset : maxChunkSize;
+    *curIter += *len;
+    return (const char *)(unpacked->bits + offset);
+}
+
+typedef struct __attribute__((packed)) {
+    uint64_t capacity;
+    double error;
+    uint32_t limit;
+    uint32_t n;
+} dumpedSparse;
+
+// Prefix lengths are appended after the links, including the terminating 0
+static size_t prefixesEncodedLen(const uint16_t *prefixes) {
+    size_t n = 0;
+    if (prefixes) {
+        while (prefixes[n++]) {
+        }
+    }
+    return n * sizeof(*prefixes);
+}
+
+// The hash key of keyed chains follows the prefix lengths
+static size_t keyEncodedLen(const SBChain *sb) {
+    return (sb->options & BLOOM_OPT_KEYED) ? sizeof(sb->hashKey) : 0;
+}
+
+// Then the memory budget of chains that have one
+static size_t maxBytesEncodedLen(const SBChain *sb) {
+    return (sb->options & BLOOM_OPT_MAXBYTES) ? sizeof(sb->maxBytes) : 0;
+}
+
+// Sparse chains have no links; their hashes follow, so the header holds the whole chain
+static size_t sparseEncodedLen(const SBChain *sb) {
+    if (!SB_IS_SPARSE(sb)) {
+        return 0;
+    }
+    return sizeof(dumpedSparse) + sb->sparse->n * sizeof(*sb->sparse->hashes);
+}
+
 char *SBChain_GetEncodedHeader(const SBChain *sb, size_t *hdrlen) {
-    *hdrlen = sizeof(dumpedChainHeader) + (sizeof(dumpedChainLink) * sb->nfilters);
+    size_t linkslen = sizeof(dumpedChainHeader) + (sizeof(dumpedChainLink) * sb->nfilters);
+    size_t prefixlen = prefixesEncodedLen(sb->prefixes);
+    size_t keylen = keyEncodedLen(sb);
+    size_t maxlen = maxBytesEncodedLen(sb);
+    size_t sparselen = sparseEncodedLen(sb);
+    *hdrlen = linkslen + prefixlen + keylen + maxlen + sparselen;
     dumpedChainHeader *hdr = malloc(*hdrlen);
     hdr->size = sb->size;
     hdr->nfilters = sb->nfilters;
@@ -201,6 +935,23 @@ char *SBChain_GetEncodedHeader(const SBChain *sb, size_t *hdrlen) {
         X_ENCODED_LINK(X, dstlink, srclink)
 #undef X
     }
+    if (prefixlen) {
+        memcpy((char *)hdr + linkslen, sb->prefixes, prefixlen);
+    }
+    if (keylen) {
+        memcpy((char *)hdr + linkslen + prefixlen, sb->hashKey, keylen);
+    }
+    if (maxlen) {
+        memcpy((char *)hdr + linkslen + prefixlen + keylen, &sb->maxBytes, maxlen);
+    }
+    if (sparselen) {
+        const SBSparse *sp = sb->sparse;
+        dumpedSparse dsp = {
+            .capacity = sp->capacity, .error = sp->error, .limit = sp->limit, .n = sp->n};
+        char *pos = (char *)hdr + linkslen + prefixlen + keylen + maxlen;
+        memcpy(pos, &dsp, sizeof(dsp));
+        memcpy(pos + sizeof(dsp), sp->hashes, sp->n * sizeof(*sp->hashes));
+    }
     return (char *)hdr;
 }
 
@@ -213,17 +964,92 @@ SBChain *SB_NewChainFromHeader(const char *buf, size_t bufLen, const char **errm
         return NULL; // LCOV_EXCL_LINE
     }
 
-    if (bufLen != sizeof(*header) + (sizeof(header->links[0]) * header->nfilters)) {
+    size_t linkslen = sizeof(*header) + (sizeof(header->links[0]) * header->nfilters);
+    if (bufLen < linkslen) {
         *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
         return NULL; // LCOV_EXCL_LINE
     }
+    const char *pos = buf + linkslen;
+    const char *end = buf + bufLen;
 
-    SBChain *sb = RedisModule_Calloc(1, sizeof(*sb));
-    sb->filters = RedisModule_Calloc(header->nfilters, sizeof(*sb->filters));
+    uint16_t prefixes[SB_MAX_PREFIXES + 1];
+    size_t nprefixes = 0;
+    if (header->options & BLOOM_OPT_PREFIXES) {
+        do {
+            if (nprefixes > SB_MAX_PREFIXES || end - pos < sizeof(*prefixes)) {
+                *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+                return NULL; // LCOV_EXCL_LINE
+            }
+            memcpy(prefixes + nprefixes, pos, sizeof(*prefixes));
+            pos += sizeof(*prefixes);
+        } while (prefixes[nprefixes++]);
+    }
+
+    uint64_t hashKey[2] = {0, 0};
+    if (header->options & BLOOM_OPT_KEYED) {
+        if (end - pos < sizeof(hashKey)) {
+            *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+            return NULL; // LCOV_EXCL_LINE
+        }
+        memcpy(hashKey, pos, sizeof(hashKey));
+        pos += sizeof(hashKey);
+    }
+
+    uint64_t maxBytes = 0;
+    if (header->options & BLOOM_OPT_MAXBYTES) {
+        if (end - pos < sizeof(maxBytes)) {
+            *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+            return NULL; // LCOV_EXCL_LINE
+        }
+        memcpy(&maxBytes, pos, sizeof(maxBytes));
+        pos += sizeof(maxBytes);
+    }
+
+    dumpedSparse dsp = {0};
+    if (header->nfilters == 0) {
+        if (end - pos < sizeof(dsp)) {
+            *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+            return NULL; // LCOV_EXCL_LINE
+        }
+        memcpy(&dsp, pos, sizeof(dsp));
+        pos += sizeof(dsp);
+        if (dsp.n > dsp.limit || dsp.limit > SB_SPARSE_MAX_HASHES ||
+            end - pos < dsp.n * sizeof(bloom_hashval)) {
+            *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+            return NULL; // LCOV_EXCL_LINE
+        }
+        pos += dsp.n * sizeof(bloom_hashval);
+    }
+
+    if (pos != end) {
+        *errmsg = "ERR received bad data"; // LCOV_EXCL_LINE
+        return NULL; // LCOV_EXCL_LINE
+    }
+
+    SBChain *sb;
+    if (header->nfilters == 1 && header->links[0].bytes <= SB_INLINE_MAX_BYTES) {
+        sb = newInlineChain(header->links[0].bytes);
+    } else {
+        sb = RedisModule_Calloc(1, sizeof(*sb));
+    }
     sb->nfilters = header->nfilters;
     sb->options = header->options;
     sb->size = header->size;
     sb->growth = sb->growth;
+    memcpy(sb->hashKey, hashKey, sizeof(hashKey));
+    sb->maxBytes = maxBytes;
+
+    if (header->nfilters == 0) {
+        sb->sparse = RedisModule_Alloc(sparseSize(dsp.n));
+        sb->sparse->capacity = dsp.capacity;
+        sb->sparse->error = dsp.error;
+        sb->sparse->limit = dsp.limit;
+        sb->sparse->n = dsp.n;
+        memcpy(sb->sparse->hashes, end - dsp.n * sizeof(bloom_hashval),
+               dsp.n * sizeof(bloom_hashval));
+    } else if (!sb->filters) {
+        sb->filters = RedisModule_Calloc(header->nfilters, sizeof(*sb->filters));
+    }
 
     for (size_t ii = 0; ii < header->nfilters; ++ii) {
         SBLink *dstlink = sb->filters + ii;
@@ -231,10 +1057,19 @@ SBChain *SB_NewChainFromHeader(const char *buf, size_t bufLen, const char **errm
 #define X(encfld, dstfld) dstfld = encfld;
         X_ENCODED_LINK(X, srclink, dstlink)
 #undef X
-        dstlink->inner.bf = RedisModule_Alloc(dstlink->inner.bytes);
+        if (!dstlink->inner.nofree) {
+            dstlink->inner.bf = RedisModule_Alloc(dstlink->inner.bytes);
+        }
         if (sb->options & BLOOM_OPT_FORCE64) {
             dstlink->inner.force64 = 1;
         }
+        bloom_select_kernels(&dstlink->inner);
+    }
+
+    if (nprefixes) {
+        // sb->size is non-zero here, so bypass SBChain_SetPrefixes
+        sb->prefixes = RedisModule_Calloc(nprefixes, sizeof(*sb->prefixes));
+        memcpy(sb->prefixes, prefixes, nprefixes * sizeof(*sb->prefixes));
     }
 
     return sb;
@@ -258,6 +1093,7 @@ int SBChain_LoadEncodedChunk(SBChain *sb, long long iter, const char *buf, size_
     }
 
     // printf("Copying to %p. Offset=%lu, Len=%lu\n", link, offset, bufLen);
+    linkUnshare(link);
     memcpy(link->inner.bf + offset, buf, bufLen);
     return 0;
 }
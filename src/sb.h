@@ -12,27 +12,118 @@ extern "C" {
 typedef struct SBLink {
     struct bloom inner; //< Inner structure
     size_t size;        // < Number of items in the link
+    uint32_t *refs;     //< Number of chains sharing inner.bf, or NULL if not shared, see SBChain_Copy
 } SBLink;
 
+/**
+ * Exact encoding of a small chain before its first link is allocated: the sorted
+ * hashes of the items added so far. Converted to a link once it would take more
+ * memory than the link, see SB_NewSparseChain.
+ */
+typedef struct SBSparse {
+    uint64_t capacity;      //< Capacity of the first link
+    double error;           //< Error rate of the first link
+    uint32_t limit;         //< Number of hashes at which the chain becomes dense
+    uint32_t n;             //< Number of hashes
+    bloom_hashval hashes[]; //< Sorted by a, then b
+} SBSparse;
+
 /** A chain of one or more bloom filters */
 typedef struct SBChain {
-    SBLink *filters;  //< Current filter
+    union {
+        SBLink *filters;  //< Current filter
+        SBSparse *sparse; //< Used while nfilters == 0
+    };
     size_t size;      //< Total number of items in all filters
     size_t nfilters;  //< Number of links in chain
     unsigned options; //< Options passed directly to bloom_init
     unsigned growth;
+    uint16_t *prefixes; //< 0-terminated ascending prefix lengths stored with items, or NULL
+    void *idle;         //< Owned by the caller, which tracks idle chains to pack them
+    uint64_t hashKey[2]; //< Secret key of BLOOM_OPT_KEYED chains
+    uint64_t maxBytes;   //< Memory budget of BLOOM_OPT_MAXBYTES chains, see SBChain_Bytes
 } SBChain;
 
+#define SB_MAX_PREFIXES 8
+
+#define SB_IS_SPARSE(sb) ((sb)->nfilters == 0)
+
+// Largest number of hashes kept by a sparse chain, bounding the cost of inserts
+#define SB_SPARSE_MAX_HASHES 64
+
+// Links up to this size share the chain's allocation, larger ones may be packed
+#define SB_INLINE_MAX_BYTES 8192
+
 /**
  * Create a new chain
  * initsize: The initial desired capacity of the chain
  * error_rate: desired maximum error probability.
  * options: Options passed to bloom_init.
  *
+ * If its bits take up to SB_INLINE_MAX_BYTES, the chain, its first link and the
+ * link's bits share a single allocation. Links added when the chain scales are
+ * allocated separately.
+ *
  * Free with SBChain_Free when done.
  */
 SBChain *SB_NewChain(uint64_t initsize, double error_rate, unsigned options, unsigned growth);
 
+/**
+ * Move a chain with a single link into one allocation, as made by SB_NewChain.
+ * Returns the new chain; `sb` must not be used afterwards. Chains that have
+ * several links, are too large or are already inline are returned unchanged.
+ */
+SBChain *SBChain_Inline(SBChain *sb);
+
+/**
+ * Copy a chain. Links other than the last one are full and never written
+ * again, so the copy shares their bits with `sb`, which are freed along with
+ * the last chain using them. Only the last link is copied. Links written by
+ * SBChain_LoadEncodedChunk stop being shared first.
+ * `sb` must not be packed. Free the copy with SBChain_Free.
+ */
+SBChain *SBChain_Copy(SBChain *sb);
+
+/**
+ * Compress the bits of links larger than SB_INLINE_MAX_BYTES, for chains that
+ * are not expected to be used for a while. Links are only packed if that saves
+ * at least a quarter of their size, and shared links are not packed.
+ * A packed chain must be unpacked before any other call except SBChain_Free,
+ * SBChain_IsPacked, SBChain_DataBytes, SBChain_LinkBits and SBChain_GetPackedChunk.
+ * Returns the number of bytes saved.
+ */
+size_t SBChain_Pack(SBChain *sb);
+
+/** Restore the bits of packed links. Returns 0 on success. */
+int SBChain_Unpack(SBChain *sb);
+
+int SBChain_IsPacked(const SBChain *sb);
+
+/**
+ * Bits of link `ii`, for reading without unpacking the chain. The bits of a
+ * packed link are decoded into a new allocation, also set in `*tmp` for the
+ * caller to free with RedisModule_Free, otherwise `*tmp` is NULL. Returns NULL
+ * if the packed bits can't be decoded.
+ */
+const unsigned char *SBChain_LinkBits(const SBChain *sb, size_t ii, unsigned char **tmp);
+
+/** Number of bytes used by the bits of all links, packed or not */
+size_t SBChain_DataBytes(const SBChain *sb);
+
+/**
+ * Same as SB_NewChain, but the chain starts with the sparse encoding and only
+ * allocates its first link once it holds enough items for the link to be
+ * smaller. Answers are exact while sparse.
+ */
+SBChain *SB_NewSparseChain(uint64_t initsize, double error_rate, unsigned options,
+                           unsigned growth);
+
+/**
+ * Convert a sparse chain to its first link. No-op for chains that are not sparse.
+ * Returns 0 on success.
+ */
+int SBChain_Densify(SBChain *sb);
+
 /**
  * Create a new chain from a 'template'. This template will copy an existing
  * chain, but not its internal data - which is reset from scratch. This is
@@ -49,12 +140,116 @@ void SBChain_Free(SBChain *sb);
  */
 int SBChain_Add(SBChain *sb, const void *data, size_t len);
 
+/**
+ * Hash an item for this chain. Chains with the same BLOOM_OPT_FORCE64 setting
+ * and without BLOOM_OPT_KEYED hash items identically, so the result may be
+ * reused across them.
+ */
+bloom_hashval SBChain_GetHash(const SBChain *sb, const void *data, size_t len);
+
+/** Same as SBChain_GetHash for an item given as a 64 bit integer */
+bloom_hashval SBChain_GetIntHash(const SBChain *sb, uint64_t item);
+
+/**
+ * Make the chain hash items with SipHash under the secret 'key' instead of
+ * MurmurHash, so that items probing the same bits can't be found without it.
+ * Must be called on an empty chain without prefixes.
+ * Returns 0 on success, nonzero otherwise.
+ */
+int SBChain_SetHashKey(SBChain *sb, const uint64_t key[2]);
+
+// Smallest error rate chosen by SB_ErrorForBytes, however large the budget
+#define SB_MIN_BUDGET_ERROR 1e-9
+
+/**
+ * Memory used by a dense chain: the chain, its links and their bits. This is
+ * what SBChain_SetMaxBytes bounds.
+ */
+uint64_t SBChain_Bytes(const SBChain *sb);
+
+/**
+ * Error rate giving the most accurate chain of 'initsize' items, created by
+ * SB_NewChain with 'options' and 'growth', whose SBChain_Bytes stay within
+ * 'maxBytes'. Non-scaling chains spend the whole budget on their only link,
+ * scaling ones keep room for their second link, so they can grow once.
+ * Returns 0 if the budget is too small even for an error rate close to 1.
+ */
+double SB_ErrorForBytes(uint64_t initsize, uint64_t maxBytes, unsigned options, unsigned growth);
+
+/**
+ * Keep the chain within 'maxBytes', as counted by SBChain_Bytes: a link that
+ * would exceed it is not added, and adding items fails as for a full
+ * non-scaling chain instead.
+ */
+void SBChain_SetMaxBytes(SBChain *sb, uint64_t maxBytes);
+
+/** Same as SBChain_GetHash for 'n' items, hashing several of them at once */
+void SBChain_GetHashes(const SBChain *sb, const void *const *items, const size_t *lens, size_t n,
+                       bloom_hashval *out);
+
+/**
+ * Same as SBChain_Add, with 'hash' already computed by SBChain_GetHash.
+ */
+int SBChain_AddHashed(SBChain *sb, const void *data, size_t len, bloom_hashval hash);
+
+// Batches of at least this many items are added by SBChain_AddHashes in bit
+// order, when the current link has room for them and is at least
+// SB_SORTED_MIN_BYTES large. Smaller links stay in cache anyway.
+#define SB_SORTED_MIN_BATCH 65536
+#define SB_SORTED_MIN_BYTES (1 << 23)
+
+/**
+ * Same as calling SBChain_AddHashed for each of the 'n' items in order, setting
+ * rv[i] to what it returns for the ith item. Stops after an item returning -2.
+ * `items` may be NULL for chains without prefixes, such as those taking integer
+ * items. Large batches compute the positions of all their bits, sort them and
+ * set them in one sweep over the link, then derive which items were new.
+ * Returns the number of items processed.
+ */
+size_t SBChain_AddHashes(SBChain *sb, const void *const *items, const size_t *lens,
+                         const bloom_hashval *hashes, size_t n, int *rv);
+
 /**
  * Check if an item was previously seen by the chain
  * Return 0 if the item is unknown to the chain, nonzero otherwise
  */
 int SBChain_Check(const SBChain *sb, const void *data, size_t len);
 
+// Number of items whose first probe is prefetched ahead of checking them
+#define SB_PREFETCH_WINDOW 16
+
+/**
+ * Check 'n' items hashed by SBChain_GetHash, setting found[i] as SBChain_Check
+ * would for hashes[i]. Each link is probed in windows of SB_PREFETCH_WINDOW
+ * items, fetching the memory for a whole window before testing it.
+ */
+void SBChain_CheckHashes(const SBChain *sb, const bloom_hashval *hashes, size_t n, int *found);
+
+/**
+ * Configure the chain to also store the first `lens[i]` bytes of every item
+ * added from now on. Must be called on an empty chain. Up to SB_MAX_PREFIXES
+ * lengths may be given, in any order.
+ * Returns 0 on success, nonzero if the lengths are invalid.
+ */
+int SBChain_SetPrefixes(SBChain *sb, const uint16_t *lens, size_t nlens);
+
+/**
+ * Check if any item starting with the given prefix was previously seen.
+ * Return -1 if `len` is not one of the chain's prefix lengths, otherwise
+ * the same as SBChain_Check.
+ */
+int SBChain_CheckPrefix(const SBChain *sb, const void *prefix, size_t len);
+
+/**
+ * Check that the chain takes items given as 64 bit integers if 'intItems' is
+ * set, or as strings otherwise. Integer items are hashed with SBChain_GetIntHash
+ * and added with SBChain_AddHashed. An empty chain takes either kind, and with
+ * 'adopt' set only takes this kind from then on. Chains with prefixes only take
+ * strings.
+ * Returns 0 if the chain takes items of this kind, -1 otherwise.
+ */
+int SBChain_UseItems(SBChain *sb, int intItems, int adopt);
+
 /**
  * Get an encoded header. This is the first step to serializing a bloom filter.
  * The length of the header will be written to in hdrlen.
@@ -81,6 +276,21 @@ void SB_FreeEncodedHeader(char *s);
 const char *SBChain_GetEncodedChunk(const SBChain *sb, long long *curIter, size_t *len,
                                     size_t maxChunkSize);
 
+/** The packed link last decoded by SBChain_GetPackedChunk */
+typedef struct {
+    size_t ix;
+    unsigned char *bits; // NULL before the first packed link, free with RedisModule_Free
+} SBUnpackedLink;
+
+/**
+ * Same as SBChain_GetEncodedChunk, for chains that may be packed. Chunks of a
+ * packed link are read from its bits decoded into `unpacked`, which holds one
+ * link at a time, so the chain stays packed. Also returns NULL if packed bits
+ * can't be decoded.
+ */
+const char *SBChain_GetPackedChunk(const SBChain *sb, long long *curIter, size_t *len,
+                                   size_t maxChunkSize, SBUnpackedLink *unpacked);
+
 /**
  * Creates a new chain from the encoded parameters returned by SBChain_GetEncodedHeader.
  * This function will return NULL if the header is corrupt or in a format not understood
@@ -0,0 +1,83 @@
+#ifndef SKETCH_HASH_H
+#define SKETCH_HASH_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+
+#include "contrib/murmurhash2.h"
+
+#define SKETCH_HASH_MAX_ROWS 32
+
+/*  Row hashes of an item, shared by the Count-Min Sketch and Top-K.
+    Both index row 'i' with MurmurHash2(item, itemlen, i), so an item updating
+    several sketches only needs each row hashed once. Rows are computed lazily
+    and cached up to SKETCH_HASH_MAX_ROWS; deeper rows are recomputed on use.
+    Items given as 64 bit integers, see SketchHashes_InitInt, index row 'i' with
+    MurmurHash64_Int(item, i) instead. */
+typedef struct {
+    const char *item; // NULL for integer items
+    size_t itemlen;
+    uint64_t intItem;
+    uint32_t nrows;
+    uint32_t rows[SKETCH_HASH_MAX_ROWS];
+} SketchHashes;
+
+static inline void SketchHashes_Init(SketchHashes *h, const char *item, size_t itemlen) {
+    h->item = item;
+    h->itemlen = itemlen;
+    h->nrows = 0;
+}
+
+static inline void SketchHashes_InitInt(SketchHashes *h, uint64_t item) {
+    h->item = NULL;
+    h->itemlen = 0;
+    h->intItem = item;
+    h->nrows = 0;
+}
+
+static inline uint32_t SketchHashes_Compute(const SketchHashes *h, uint32_t row) {
+    if (h->item == NULL) {
+        return (uint32_t)MurmurHash64_Int(h->intItem, row);
+    }
+    return MurmurHash2(h->item, h->itemlen, row);
+}
+
+static inline uint32_t SketchHashes_Row(SketchHashes *h, uint32_t row) {
+    if (row >= SKETCH_HASH_MAX_ROWS) {
+        return SketchHashes_Compute(h, row);
+    }
+    while (h->nrows <= row) {
+        h->rows[h->nrows] = SketchHashes_Compute(h, h->nrows);
+        h->nrows++;
+    }
+    return h->rows[row];
+}
+
+/* Computes the first 'nrows' rows at once, hashing several of them in parallel
+   where the CPU allows. For callers about to read all rows of a sketch. */
+static inline void SketchHashes_Fill(SketchHashes *h, uint32_t nrows) {
+    if (nrows > SKETCH_HASH_MAX_ROWS) {
+        nrows = SKETCH_HASH_MAX_ROWS;
+    }
+    if (h->nrows >= nrows) {
+        return;
+    }
+    if (h->item == NULL) {
+        // Integer rows are cheap enough to compute one at a time
+        SketchHashes_Row(h, nrows - 1);
+        return;
+    }
+    const void *keys[SKETCH_HASH_MAX_ROWS];
+    size_t lens[SKETCH_HASH_MAX_ROWS];
+    uint32_t seeds[SKETCH_HASH_MAX_ROWS];
+    uint32_t n = nrows - h->nrows;
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i] = h->item;
+        lens[i] = h->itemlen;
+        seeds[i] = h->nrows + i;
+    }
+    MurmurHash2_x(keys, lens, seeds, n, h->rows + h->nrows);
+    h->nrows = nrows;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#include <assert.h> // assert
+#include <math.h>   // NAN, M_PI, log
+#include <stdlib.h> // calloc
+#include <string.h> // memset
+
+#include "tdigest.h"
+
+static uint32_t capacityFromCompression(double compression) {
+    return (uint32_t)(6 * compression) + 10;
+}
+
+TDigest *TDigest_Create(double compression) {
+    assert(compression > 0);
+
+    uint32_t capacity = capacityFromCompression(compression);
+    TDigest *td = TD_CALLOC(1, sizeof(TDigest) + capacity * sizeof(TDigestCentroid));
+    td->compression = compression;
+    td->capacity = capacity;
+    TDigest_Reset(td);
+    return td;
+}
+
+void TDigest_Destroy(TDigest *td) {
+    assert(td);
+    TD_FREE(td);
+}
+
+void TDigest_Reset(TDigest *td) {
+    td->numMerged = 0;
+    td->numUnmerged = 0;
+    td->numCompressions = 0;
+    td->mergedWeight = 0;
+    td->unmergedWeight = 0;
+    td->min = INFINITY;
+    td->max = -INFINITY;
+}
+
+double TDigest_TotalWeight(const TDigest *td) { return td->mergedWeight + td->unmergedWeight; }
+
+size_t TDigest_Size(const TDigest *td) {
+    return sizeof(TDigest) + td->capacity * sizeof(TDigestCentroid);
+}
+
+// In-place heapsort by mean. Avoids qsort, which may allocate scratch memory.
+static void siftDown(TDigestCentroid *nodes, size_t start, size_t end) {
+    size_t root = start;
+    while (root * 2 + 1 < end) {
+        size_t child = root * 2 + 1;
+        if (child + 1 < end && nodes[child].mean < nodes[child + 1].mean) {
+            ++child;
+        }
+        if (nodes[root].mean >= nodes[child].mean) {
+            return;
+        }
+        TDigestCentroid tmp = nodes[root];
+        nodes[root] = nodes[child];
+        nodes[child] = tmp;
+        root = child;
+    }
+}
+
+static void sortCentroids(TDigestCentroid *nodes, size_t n) {
+    if (n < 2) {
+        return;
+    }
+    for (size_t start = n / 2; start-- > 0;) {
+        siftDown(nodes, start, n);
+    }
+    for (size_t end = n - 1; end > 0; --end) {
+        TDigestCentroid tmp = nodes[0];
+        nodes[0] = nodes[end];
+        nodes[end] = tmp;
+        siftDown(nodes, 0, end);
+    }
+}
+
+void TDigest_Compress(TDigest *td) {
+    if (td->numUnmerged == 0) {
+        return;
+    }
+
+    size_t n = td->numMerged + td->numUnmerged;
+    TDigestCentroid *nodes = td->nodes;
+    sortCentroids(nodes, n);
+
+    double total = TDigest_TotalWeight(td);
+    double denom = 2 * M_PI * total * log(total);
+    double normalizer = denom > 0 ? td->compression / denom : INFINITY;
+
+    // Merge neighbours while the combined centroid stays under the size bound
+    // for its quantile. Writes never overtake reads, so this is done in place.
+    size_t cur = 0;
+    double weightSoFar = 0;
+    for (size_t i = 1; i < n; ++i) {
+        double proposed = nodes[cur].weight + nodes[i].weight;
+        double z = proposed * normalizer;
+        double q0 = weightSoFar / total;
+        double q2 = (weightSoFar + proposed) / total;
+        if (z <= q0 * (1 - q0) && z <= q2 * (1 - q2)) {
+            // Scaling by the weight ratio, not the weight, keeps large means finite
+            nodes[cur].mean += (nodes[i].mean - nodes[cur].mean) * (nodes[i].weight / proposed);
+            nodes[cur].weight = proposed;
+        } else {
+            weightSoFar += nodes[cur].weight;
+            nodes[++cur] = nodes[i];
+        }
+    }
+
+    td->numMerged = cur + 1;
+    td->numUnmerged = 0;
+    td->mergedWeight = total;
+    td->unmergedWeight = 0;
+    td->numCompressions++;
+}
+
+void TDigest_Add(TDigest *td, double value, double weight) {
+    assert(td);
+    assert(weight > 0);
+
+    if (td->numMerged + td->numUnmerged >= td->capacity) {
+        TDigest_Compress(td);
+    }
+
+    TDigestCentroid *node = &td->nodes[td->numMerged + td->numUnmerged++];
+    node->mean = value;
+    node->weight = weight;
+    td->unmergedWeight += weight;
+    if (value < td->min) {
+        td->min = value;
+    }
+    if (value > td->max) {
+        td->max = value;
+    }
+}
+
+void TDigest_Merge(TDigest *dest, const TDigest *src) {
+    assert(dest);
+    assert(src);
+
+    size_t n = src->numMerged + src->numUnmerged;
+    for (size_t i = 0; i < n; ++i) {
+        TDigest_Add(dest, src->nodes[i].mean, src->nodes[i].weight);
+    }
+    // Centroid means lie inside [min, max]; carry the exact extremes over.
+    if (n > 0) {
+        if (src->min < dest->min) {
+            dest->min = src->min;
+        }
+        if (src->max > dest->max) {
+            dest->max = src->max;
+        }
+    }
+}
+
+double TDigest_Quantile(TDigest *td, double q) {
+    assert(td);
+
+    TDigest_Compress(td);
+    size_t n = td->numMerged;
+    if (n == 0) {
+        return NAN;
+    }
+
+    const TDigestCentroid *nodes = td->nodes;
+    if (n == 1) {
+        return nodes[0].mean;
+    }
+
+    double total = td->mergedWeight;
+    double index = q * total;
+
+    // Tails interpolate between the extremes and the outermost centroids.
+    double leftHalf = nodes[0].weight / 2;
+    if (index <= leftHalf) {
+        return td->min + (index / leftHalf) * (nodes[0].mean - td->min);
+    }
+    double rightHalf = nodes[n - 1].weight / 2;
+    if (index >= total - rightHalf) {
+        return td->max - ((total - index) / rightHalf) * (td->max - nodes[n - 1].mean);
+    }
+
+    double weightSoFar = leftHalf;
+    for (size_t i = 0; i < n - 1; ++i) {
+        double dw = (nodes[i].weight + nodes[i + 1].weight) / 2;
+        if (weightSoFar + dw >= index) {
+            return nodes[i].mean + (index - weightSoFar) / dw * (nodes[i + 1].mean - nodes[i].mean);
+        }
+        weightSoFar += dw;
+    }
+    return nodes[n - 1].mean;
+}
+
+double TDigest_CDF(TDigest *td, double value) {
+    assert(td);
+
+    TDigest_Compress(td);
+    size_t n = td->numMerged;
+    if (n == 0) {
+        return NAN;
+    }
+    if (value < td->min) {
+        return 0;
+    }
+    if (value >= td->max) {
+        return 1;
+    }
+
+    const TDigestCentroid *nodes = td->nodes;
+    double total = td->mergedWeight;
+
+    if (value < nodes[0].mean) {
+        return (value - td->min) / (nodes[0].mean - td->min) * nodes[0].weight / 2 / total;
+    }
+    if (value > nodes[n - 1].mean) {
+        return 1 - (td->max - value) / (td->max - nodes[n - 1].mean) * nodes[n - 1].weight / 2 /
+                       total;
+    }
+
+    double weightSoFar = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (value == nodes[i].mean) {
+            // Several centroids may share a mean; count half of the whole run.
+            double dw = 0;
+            while (i < n && nodes[i].mean == value) {
+                dw += nodes[i++].weight;
+            }
+            return (weightSoFar + dw / 2) / total;
+        }
+        if (value < nodes[i].mean) {
+            const TDigestCentroid *left = &nodes[i - 1];
+            double dw = (left->weight + nodes[i].weight) / 2;
+            double center = weightSoFar - left->weight / 2;
+            return (center + dw * ((value - left->mean) / (nodes[i].mean - left->mean))) / total;
+        }
+        weightSoFar += nodes[i].weight;
+    }
+    return 1;
+}
@@ -0,0 +1,72 @@
+#ifndef TDIGEST_H
+#define TDIGEST_H
+
+#include <stdint.h> // uint32_t
+#include <stddef.h> // size_t
+
+#define REDIS_MODULE_TARGET
+#ifdef REDIS_MODULE_TARGET
+#include "redismodule.h"
+#define TD_CALLOC(count, size) RedisModule_Calloc(count, size)
+#define TD_FREE(ptr) RedisModule_Free(ptr)
+#else
+#define TD_CALLOC(count, size) calloc(count, size)
+#define TD_FREE(ptr) free(ptr)
+#endif
+
+#define TD_DEFAULT_COMPRESSION 100
+#define TD_MAX_COMPRESSION 10000
+
+typedef struct {
+    double mean;
+    double weight;
+} TDigestCentroid;
+
+/*  Merging t-digest. Merged centroids occupy nodes[0, numMerged) sorted by mean,
+    incoming samples are appended to nodes[numMerged, numMerged + numUnmerged).
+    Once the array is full it is sorted and compressed in place, so adding
+    never allocates after creation. */
+typedef struct TDigest {
+    double compression;
+    uint32_t capacity;
+    uint32_t numMerged;
+    uint32_t numUnmerged;
+    uint32_t numCompressions;
+    double mergedWeight;
+    double unmergedWeight;
+    double min;
+    double max;
+    TDigestCentroid nodes[];
+} TDigest;
+
+/* Creates a new t-digest. Centroids are held in a single allocation whose
+   size is derived from 'compression'. */
+TDigest *TDigest_Create(double compression);
+
+void TDigest_Destroy(TDigest *td);
+
+/* Empties the digest, keeping its compression. */
+void TDigest_Reset(TDigest *td);
+
+/* Adds 'value' with 'weight' to the digest. Complexity - amortized O(log n) */
+void TDigest_Add(TDigest *td, double value, double weight);
+
+/* Adds all the centroids of 'src' to 'dest'. */
+void TDigest_Merge(TDigest *dest, const TDigest *src);
+
+/* Sorts and compresses pending samples into the merged centroids. */
+void TDigest_Compress(TDigest *td);
+
+/* Returns the estimated value at quantile 'q' (0 <= q <= 1). NAN if empty. */
+double TDigest_Quantile(TDigest *td, double q);
+
+/* Returns the estimated fraction of samples <= 'value'. NAN if empty. */
+double TDigest_CDF(TDigest *td, double value);
+
+/* Total weight of all samples added. */
+double TDigest_TotalWeight(const TDigest *td);
+
+/* Number of bytes used by a digest with the given compression. */
+size_t TDigest_Size(const TDigest *td);
+
+#endif
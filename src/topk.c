@@ -14,7 +14,6 @@
 #include "../contrib/murmurhash2.h"
 
 #define TOPK_HASH(item, itemlen, i) MurmurHash2(item, itemlen, i)
-#define GA 1919
 
 static inline uint32_t max(uint32_t a, uint32_t b) {
   return a > b ? a : b;
@@ -78,6 +77,15 @@ TopK *TopK_Create(uint32_t k, uint32_t width, uint32_t depth, double decay) {
     return topk;
 }
 
+uint32_t TopK_WidthForBytes(size_t bytes, uint32_t k, uint32_t depth) {
+    size_t fixed = sizeof(TopK) + (size_t)k * sizeof(HeapBucket);
+    if (bytes <= fixed) {
+        return 0;
+    }
+    size_t width = (bytes - fixed) / ((size_t)depth * sizeof(Bucket));
+    return width > UINT32_MAX ? UINT32_MAX : width;
+}
+
 void TopK_Destroy(TopK *topk) {
     assert(topk);
  
@@ -94,7 +102,7 @@ void TopK_Destroy(TopK *topk) {
 
 // Complexity O(k + strlen)
 static HeapBucket *checkExistInHeap(TopK *topk, const char *item, size_t itemlen) {
-    uint32_t fp = TOPK_HASH(item, itemlen, GA);
+    uint32_t fp = TOPK_HASH(item, itemlen, TOPK_HASH_SEED);
     HeapBucket *runner = topk->heap;
  
     for(int32_t i = topk->k - 1; i >= 0; --i) 
@@ -106,22 +114,32 @@ static HeapBucket *checkExistInHeap(TopK *topk, const char *item, size_t itemlen
 }
 
 char *TopK_Add(TopK *topk, const char *item, size_t itemlen, uint32_t increment) {
-    assert(topk);
     assert(item);
     assert(itemlen);
 
+    SketchHashes hashes;
+    SketchHashes_Init(&hashes, item, itemlen);
+    return TopK_AddHashes(topk, &hashes, TOPK_HASH(item, itemlen, TOPK_HASH_SEED), increment);
+}
+
+char *TopK_AddHashes(TopK *topk, SketchHashes *hashes, uint32_t fp, uint32_t increment) {
+    assert(topk);
+    assert(hashes);
+
+    const char *item = hashes->item;
+    size_t itemlen = hashes->itemlen;
     Bucket *runner;
     counter_t *countPtr;
     counter_t maxCount = 0;
-    uint32_t fp = TOPK_HASH(item, itemlen, GA);
 
     bool heapSearched = false;
     HeapBucket *itemHeapPtr = NULL;
     counter_t heapMin = topk->heap->count;
 
     // get max item count 
+    SketchHashes_Fill(hashes, topk->depth);
     for(uint32_t i = 0; i < topk->depth; ++i) {
-        uint32_t loc = TOPK_HASH(item, itemlen, i) % topk->width;
+        uint32_t loc = SketchHashes_Row(hashes, i) % topk->width;
         runner = topk->data + i * topk->width + loc;
         countPtr = &runner->count;
         if(*countPtr == 0) {
@@ -189,7 +207,7 @@ size_t TopK_Count(TopK *topk, const char *item, size_t itemlen) {
     assert(itemlen);
 
     Bucket *runner = NULL;
-    uint32_t fp = TOPK_HASH(item, itemlen, GA);    
+    uint32_t fp = TOPK_HASH(item, itemlen, TOPK_HASH_SEED);    
     // TODO: The optimization of >heapMin should be revisited for performance
     counter_t heapMin = topk->heap->count;
     HeapBucket *heapPtr = checkExistInHeap(topk, item, itemlen);
@@ -12,6 +12,8 @@
 #include <string.h>     //  memcpy
 #include <stdlib.h>     //  calloc
 
+#include "sketch_hash.h"
+
 #define REDIS_MODULE_TARGET
 #ifdef REDIS_MODULE_TARGET 
 #include "redismodule.h"
@@ -24,6 +26,9 @@
 
 #define TOPK_DECAY_LOOKUP_TABLE 256
 
+//  Seed of the item fingerprint, see TopK_AddHashes
+#define TOPK_HASH_SEED 1919
+
 typedef uint32_t counter_t;
 
 typedef struct HeapBucket {
@@ -57,6 +62,11 @@ typedef struct topk
     Complexity - O(1) */
 TopK *TopK_Create(uint32_t k, uint32_t width, uint32_t depth, double decay);
 
+/*  Returns the widest rows for which a Top-K DS with 'k' heavyhitters and
+    'depth' arrays takes at most 'bytes', not counting the heavyhitters' item
+    strings, or 0 if not even one counter fits. */
+uint32_t TopK_WidthForBytes(size_t bytes, uint32_t k, uint32_t depth);
+
 /*  Releases resources of a Top-K DS.
     Complexity - O(k) */
 void TopK_Destroy(TopK *topk);
@@ -68,6 +78,10 @@ void TopK_Destroy(TopK *topk);
     Complexity - O(k) */
 char *TopK_Add(TopK *topk, const char *item, size_t itemlen, uint32_t increment);
 
+/*  Same as TopK_Add, using row hashes that may be shared with other sketches.
+    'fp' must be MurmurHash2(item, itemlen, TOPK_HASH_SEED). */
+char *TopK_AddHashes(TopK *topk, SketchHashes *hashes, uint32_t fp, uint32_t increment);
+
 /*  Checks whether an 'item' is in Top-K list of 'topk'. 
     Complexity - O(k) */
 bool TopK_Query(TopK *topk, const char *item, size_t itemlen);
@@ -0,0 +1,118 @@
+#ifndef ZERO_RLE_H
+#define ZERO_RLE_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint8_t
+#include <string.h> // memcpy
+
+/*  Run-length coding of zero bytes, used to keep idle filters compressed.
+    Sparse Bloom filters and cuckoo tables are mostly made of zero bytes, which
+    this codes at a fraction of a bit each while copying other bytes verbatim.
+
+    The stream is a sequence of runs, each starting with a varint holding
+    (length << 1 | isZero). Literal runs are followed by their bytes. */
+
+// Zero runs shorter than this are kept in the surrounding literal run
+#define ZERO_RLE_MIN_RUN 4
+
+static inline size_t ZeroRLE_PutRun(uint8_t *dst, size_t pos, uint64_t len, int zero) {
+    uint64_t v = len << 1 | (zero ? 1 : 0);
+    do {
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        if (dst) {
+            dst[pos] = b | (v ? 0x80 : 0);
+        }
+        pos++;
+    } while (v);
+    return pos;
+}
+
+static inline size_t ZeroRLE_ZeroRun(const uint8_t *src, size_t pos, size_t len) {
+    size_t start = pos;
+    uint64_t word;
+    while (len - pos >= sizeof(word)) {
+        memcpy(&word, src + pos, sizeof(word));
+        if (word) {
+            break;
+        }
+        pos += sizeof(word);
+    }
+    while (pos < len && !src[pos]) {
+        pos++;
+    }
+    return pos - start;
+}
+
+/* Encodes 'len' bytes of 'src' into 'dst' and returns the encoded length.
+   With a NULL 'dst', only computes the length. */
+static inline size_t ZeroRLE_Encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t out = 0, pos = 0, lit = 0;
+    while (pos < len) {
+        size_t zeros = src[pos] ? 0 : ZeroRLE_ZeroRun(src, pos, len);
+        if (zeros < ZERO_RLE_MIN_RUN && pos + zeros < len) {
+            pos += zeros ? zeros : 1;
+            continue;
+        }
+        if (zeros < ZERO_RLE_MIN_RUN) {
+            // Trailing zeros too short for a run of their own
+            pos += zeros;
+            break;
+        }
+        if (pos > lit) {
+            out = ZeroRLE_PutRun(dst, out, pos - lit, 0);
+            if (dst) {
+                memcpy(dst + out, src + lit, pos - lit);
+            }
+            out += pos - lit;
+        }
+        out = ZeroRLE_PutRun(dst, out, zeros, 1);
+        pos += zeros;
+        lit = pos;
+    }
+    if (pos > lit) {
+        out = ZeroRLE_PutRun(dst, out, pos - lit, 0);
+        if (dst) {
+            memcpy(dst + out, src + lit, pos - lit);
+        }
+        out += pos - lit;
+    }
+    return out;
+}
+
+/* Decodes 'len' bytes of 'src' into exactly 'dstlen' bytes of 'dst'.
+   Returns 0 on success, -1 if the stream is corrupt. */
+static inline int ZeroRLE_Decode(const uint8_t *src, size_t len, uint8_t *dst, size_t dstlen) {
+    size_t pos = 0, out = 0;
+    while (pos < len) {
+        uint64_t v = 0;
+        unsigned shift = 0;
+        uint8_t b;
+        do {
+            if (pos == len || shift > 63) {
+                return -1;
+            }
+            b = src[pos++];
+            v |= (uint64_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+
+        uint64_t run = v >> 1;
+        if (run > dstlen - out) {
+            return -1;
+        }
+        if (v & 1) {
+            memset(dst + out, 0, run);
+        } else {
+            if (run > len - pos) {
+                return -1;
+            }
+            memcpy(dst + out, src + pos, run);
+            pos += run;
+        }
+        out += run;
+    }
+    return out == dstlen ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#!/usr/bin/env python
+from rmtest import ModuleTestCase
+from redis import ResponseError
+import sys
+
+if sys.version >= '3':
+    xrange = range
+
+class CountingBloomTest(ModuleTestCase('../redisbloom.so')):
+    def test_simple(self):
+        self.assertOk(self.cmd('cbf.reserve', 'cbf', '0.001', '1000'))
+        self.assertEqual([1, 1, 0], self.cmd('cbf.add', 'cbf', 'foo', 'bar', 'foo'))
+        self.assertEqual([1, 1, 0], self.cmd('cbf.exists', 'cbf', 'foo', 'bar', 'baz'))
+
+        # foo was added twice, so it takes two deletions
+        self.assertEqual([1, 1], self.cmd('cbf.del', 'cbf', 'foo', 'bar'))
+        self.assertEqual([1, 0], self.cmd('cbf.exists', 'cbf', 'foo', 'bar'))
+        self.assertEqual([1, 0], self.cmd('cbf.del', 'cbf', 'foo', 'bar'))
+        self.assertEqual([0, 0], self.cmd('cbf.exists', 'cbf', 'foo', 'bar'))
+
+        info = self.cmd('cbf.info', 'cbf')
+        self.assertEqual(1000, info[1])
+        self.assertEqual(0, info[5])
+
+    def test_validation(self):
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf', '0', '100')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf', '1', '100')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf', '0.01', '0')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf', '0.01', 'blah')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.add', 'cbf', 'foo')
+
+        self.assertOk(self.cmd('cbf.reserve', 'cbf', '0.01', '100'))
+        self.assertRaises(ResponseError, self.cmd, 'cbf.reserve', 'cbf', '0.01', '100')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.add', 'cbf')
+
+        self.cmd('set', 'str', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'cbf.add', 'str', 'foo')
+
+    def test_deletes(self):
+        self.assertOk(self.cmd('cbf.reserve', 'cbf', '0.01', '10000'))
+        items = ['item{}'.format(x) for x in xrange(10000)]
+        self.cmd('cbf.add', 'cbf', *items)
+        self.assertEqual([1] * 5000, self.cmd('cbf.del', 'cbf', *items[:5000]))
+
+        # deleted items are gone up to the error rate, the others are all there
+        self.assertEqual([1] * 5000, self.cmd('cbf.exists', 'cbf', *items[5000:]))
+        found = sum(self.cmd('cbf.exists', 'cbf', *items[:5000]))
+        self.assertLess(found, 5000 * 0.02)
+
+        # saturated counters are never decremented, so there are no false negatives
+        self.assertOk(self.cmd('cbf.reserve', 'hot', '0.01', '100'))
+        for _ in xrange(20):
+            self.cmd('cbf.add', 'hot', 'foo')
+        self.cmd('cbf.add', 'hot', 'bar')
+        for _ in xrange(20):
+            self.cmd('cbf.del', 'hot', 'foo')
+        self.assertEqual([1], self.cmd('cbf.exists', 'hot', 'bar'))
+
+    def test_scandump(self):
+        self.assertOk(self.cmd('cbf.reserve', 'cbf', '0.01', '1000'))
+        self.cmd('cbf.add', 'cbf', *xrange(0, 1000, 2))
+        expected = self.cmd('cbf.exists', 'cbf', *xrange(1000))
+
+        chunks = []
+        iter = 0
+        while True:
+            iter, data = self.cmd('cbf.scandump', 'cbf', iter)
+            if not iter:
+                break
+            chunks.append([iter, data])
+
+        self.cmd('del', 'cbf')
+        for iter, data in chunks:
+            self.assertOk(self.cmd('cbf.loadchunk', 'cbf', iter, data))
+        self.assertEqual(expected, self.cmd('cbf.exists', 'cbf', *xrange(1000)))
+        self.assertEqual(500, self.cmd('cbf.info', 'cbf')[5])
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(expected, self.cmd('cbf.exists', 'cbf', *xrange(1000)))
+            self.assertEqual(500, self.cmd('cbf.info', 'cbf')[5])
+
+if __name__ == "__main__":
+    import unittest
+    unittest.main()
@@ -2,6 +2,7 @@
 from rmtest import ModuleTestCase
 from redis import ResponseError
 import sys
+import struct
 from random import randint
 import math
 
@@ -21,7 +22,7 @@ class CMSTest(ModuleTestCase('../redisbloom.so')):
         self.assertEqual([5L], self.cmd('cms.query', 'cms2', 'a'))
         self.assertEqual(['width', 2000, 'depth', 7, 'count', 5], 
                          self.cmd('cms.info', 'cms2'))
-        self.assertEqual(838, self.cmd('MEMORY USAGE', 'cms1'))
+        self.assertEqual(102, self.cmd('MEMORY USAGE', 'cms1'))
 
     def test_validation(self):
         for args in (
@@ -78,6 +79,9 @@ class CMSTest(ModuleTestCase('../redisbloom.so')):
                                     'cms', 'bar', '5', 'baz')
         self.assertRaises(ResponseError, self.cmd, 'cms.incrby',
                                     'cms', 'bar', '5', 'baz')
+        # invalid increments fail before any counter changes
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrby', 'cms', 'bar', '1', 'baz', '-1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrby', 'cms', 'bar', '1', 'baz', 'x')
         self.assertEqual([0, 5, 42], self.cmd('cms.query',
                                     'cms', 'foo', 'bar', 'baz'))
 
@@ -93,6 +97,123 @@ class CMSTest(ModuleTestCase('../redisbloom.so')):
             self.assertEqual([1], self.cmd('cms.query', 'test', 'bar'))
             self.assertEqual([0], self.cmd('cms.query', 'test', 'nonexist'))
     
+    def test_mincrby(self):
+        self.cmd('cms.initbydim', 'a', '1000', '5')
+        self.cmd('cms.initbydim', 'b', '1000', '5')
+        self.assertEqual([1, 2, 3, 5], self.cmd('cms.mincrby',
+                            'a', 'foo', '1', 'b', 'foo', '2', 'a', 'bar', '3', 'a', 'foo', '4'))
+        self.assertEqual([5, 3], self.cmd('cms.query', 'a', 'foo', 'bar'))
+        self.assertEqual([2, 0], self.cmd('cms.query', 'b', 'foo', 'bar'))
+
+        # All keys are checked before counting
+        self.cmd('SET', 'A', 'B')
+        self.assertRaises(ResponseError, self.cmd, 'cms.mincrby', 'a', 'foo', '1', 'noexist', 'foo', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.mincrby', 'a', 'foo', '1', 'A', 'foo', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.mincrby', 'a', 'foo', '-1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.mincrby', 'a', 'foo', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'cms.mincrby', 'a', 'foo', '1', 'b')
+        self.assertEqual([5], self.cmd('cms.query', 'a', 'foo'))
+
+    def test_int_items(self):
+        self.cmd('cms.initbydim', 'ids', '1000', '5')
+        self.assertEqual([3, 1, 5], self.cmd('cms.incrbyint', 'ids', '7', '3', '-8', '1', '7', '2'))
+        # -8 as an unsigned integer
+        self.assertEqual([5, 1, 0],
+                         self.cmd('cms.queryint', 'ids', '7', '18446744073709551608', '9'))
+        packed = struct.pack('<2q', 7, 9)
+        self.assertEqual([9, 4], self.cmd('cms.incrbyint', 'ids', 'PACKED', packed, '4'))
+        self.assertEqual([9, 4], self.cmd('cms.queryint', 'ids', 'PACKED', packed))
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrbyint', 'ids', '7', '-1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrbyint', 'ids', 'x', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrbyint', 'ids', 'PACKED', 'abc', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrbyint', 'noexist', '7', '1')
+
+        # A sketch counts either integer or string items
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrby', 'ids', '7', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.query', 'ids', '7')
+        self.cmd('cms.initbydim', 'strs', '1000', '5')
+        self.cmd('cms.incrby', 'strs', '7', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.incrbyint', 'strs', '7', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.merge', 'strs', '2', 'ids', 'strs')
+
+        self.cmd('cms.initbydim', 'merged', '1000', '5')
+        self.assertEqual('OK', self.cmd('cms.merge', 'merged', '1', 'ids'))
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([9], self.cmd('cms.queryint', 'merged', '7'))
+            self.assertRaises(ResponseError, self.cmd, 'cms.query', 'merged', '7')
+
+    def test_large_incrby(self):
+        # Batches this large are applied in counter order, with the same counts
+        self.cmd('cms.initbydim', 'sorted', '1000000', '3')
+        self.cmd('cms.initbydim', 'plain', '1000000', '3')
+        args = []
+        for i in range(70000):
+            args += ['item%d' % (i % 50000), str(i % 7 + 1)]
+        counts = self.cmd('cms.incrby', 'sorted', *args)
+        plain = []
+        for i in range(0, len(args), 2000):
+            plain += self.cmd('cms.incrby', 'plain', *args[i:i + 2000])
+        self.assertEqual(plain, counts)
+        self.assertEqual(self.cmd('cms.query', 'plain', 'item1', 'item49999'),
+                         self.cmd('cms.query', 'sorted', 'item1', 'item49999'))
+
+    def test_resize(self):
+        # a resized sketch counts exactly like one created with the new width
+        for name, n in (('sparse', 5), ('dense', 2000)):
+            self.cmd('cms.initbydim', name, '1200', '5')
+            self.cmd('cms.initbydim', name + '_ref', '300', '5')
+            args = []
+            for i in xrange(n):
+                args += [str(i), str(i % 7 + 1)]
+            self.cmd('cms.incrby', name, *args)
+            self.cmd('cms.incrby', name + '_ref', *args)
+            self.assertOk(self.cmd('cms.resize', name, '300'))
+            items = [str(i) for i in xrange(n + 10)]
+            self.assertEqual(self.cmd('cms.query', name + '_ref', *items),
+                             self.cmd('cms.query', name, *items))
+            self.assertEqual(self.cmd('cms.info', name + '_ref'), self.cmd('cms.info', name))
+            self.assertOk(self.cmd('cms.merge', name, '2', name, name + '_ref'))
+
+        self.cmd('cms.initbydim', 'small', '40', '5')
+        self.assertOk(self.cmd('cms.resize', 'small', '40'))
+        self.assertOk(self.cmd('cms.resize', 'small', '8'))
+        self.assertEqual([0], self.cmd('cms.query', 'small', 'foo'))
+        self.cmd('cms.incrby', 'small', 'foo', '3')
+        self.assertOk(self.cmd('cms.resize', 'small', '1'))
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([3, 3], self.cmd('cms.query', 'small', 'foo', 'bar'))
+            self.assertEqual(1, self.cmd('cms.info', 'small')[1])
+
+        # Folded counters saturate rather than wrap around
+        for name, n in (('big_sparse', 0), ('big_dense', 100)):
+            self.cmd('cms.initbydim', name, '1000', '5')
+            self.cmd('cms.incrby', name, 'foo', '3000000000', 'bar', '3000000000')
+            for i in xrange(n):
+                self.cmd('cms.incrby', name, str(i), '1')
+            self.assertOk(self.cmd('cms.resize', name, '1'))
+            self.assertEqual([4294967295, 4294967295], self.cmd('cms.query', name, 'foo', 'bar'))
+
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'sparse', '7')
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'sparse', '600')
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'sparse', '0')
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'sparse', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'noexist', '10')
+        self.assertRaises(ResponseError, self.cmd, 'cms.resize', 'sparse')
+
+    def test_init_by_mem(self):
+        self.assertOk(self.cmd('cms.initbymem', 'cms', '100000', '0.01'))
+        info = self.cmd('cms.info', 'cms')
+        self.assertEqual(7, info[3])
+        self.assertLessEqual(info[1] * info[3] * 4, 100000)
+        self.assertGreater(info[1] * info[3] * 4, 99000)
+        self.cmd('cms.incrby', 'cms', 'foo', '5')
+        self.assertEqual([5], self.cmd('cms.query', 'cms', 'foo'))
+
+        for args in (('cms', '100000'), ('cms2', 'x', '0.01'), ('cms2', '0', '0.01'),
+                     ('cms2', '10', '0.01'), ('cms2', '100000', '1')):
+            self.assertRaises(ResponseError, self.cmd, 'cms.initbymem', *args)
+        self.assertRaises(ResponseError, self.cmd, 'cms.initbymem', 'cms', '100000', '0.01')
+
     def test_merge(self):
         self.cmd('cms.initbydim', 'small_1', '20', '5')
         self.cmd('cms.initbydim', 'small_2', '20', '5')
@@ -166,6 +287,27 @@ class CMSTest(ModuleTestCase('../redisbloom.so')):
 #        print(self.cmd('cms.info', 'B'))
 #        print(self.cmd('cms.info', 'C'))
 
+    def test_sparse(self):
+        self.assertOk(self.cmd('cms.initbydim', 'cms', '2000', '5'))
+        self.assertOk(self.cmd('cms.initbydim', 'ref', '2000', '5'))
+        for i in range(200):
+            self.cmd('cms.incrby', 'ref', str(i), 1)
+        self.assertOk(self.cmd('cms.merge', 'ref', 1, 'ref'))
+
+        small = None
+        for i in range(200):
+            self.cmd('cms.incrby', 'cms', str(i), 1)
+            if i == 10:
+                small = self.cmd('MEMORY USAGE', 'cms')
+                for _ in self.client.retry_with_rdb_reload():
+                    self.assertEqual([1, 0], self.cmd('cms.query', 'cms', '5', '100'))
+        # The counter array is only allocated once enough items were added
+        self.assertLess(small, 1000)
+        self.assertGreater(self.cmd('MEMORY USAGE', 'cms'), 40000)
+        items = [str(i) for i in range(300)]
+        self.assertEqual(self.cmd('cms.query', 'ref', *items),
+                         self.cmd('cms.query', 'cms', *items))
+
     def test_smallset(self):
         self.assertOk(self.cmd('cms.initbydim', 'cms1', '2', '2'))
         self.assertEqual([10, 42], self.cmd('cms.incrby', 'cms1', 'foo', '10', 'bar', '42'))
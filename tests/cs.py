@@ -0,0 +1,105 @@
+#!/usr/bin/env python
+from rmtest import ModuleTestCase
+from redis import ResponseError
+import sys
+
+if sys.version >= '3':
+    xrange = range
+
+class CountSketchTest(ModuleTestCase('../redisbloom.so')):
+    def test_simple(self):
+        self.assertOk(self.cmd('cs.initbydim', 'cs', '1000', '5'))
+        self.assertEqual([5, 42], self.cmd('cs.incrby', 'cs', 'foo', '5', 'bar', '42'))
+        self.assertEqual([2], self.cmd('cs.incrby', 'cs', 'foo', '-3'))
+        self.assertEqual([-7], self.cmd('cs.incrby', 'cs', 'baz', '-7'))
+        self.assertEqual([2, 42, -7, 0], self.cmd('cs.query', 'cs', 'foo', 'bar', 'baz', 'nonexist'))
+        self.assertEqual(['width', 1000, 'depth', 5, 'count', 37], self.cmd('cs.info', 'cs'))
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([2, 42, -7], self.cmd('cs.query', 'cs', 'foo', 'bar', 'baz'))
+            self.assertEqual(['width', 1000, 'depth', 5, 'count', 37], self.cmd('cs.info', 'cs'))
+
+    def test_validation(self):
+        self.cmd('set', 'str', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbydim', 'cs', '0', '5')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbydim', 'cs', '1000', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbyprob', 'cs', '1', '0.01')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbyprob', 'cs', '0.01', '0')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbydim', 'cs', '1000')
+
+        self.assertOk(self.cmd('cs.initbyprob', 'cs', '0.1', '0.01'))
+        self.assertEqual(['width', 300, 'depth', 7, 'count', 0], self.cmd('cs.info', 'cs'))
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbydim', 'cs', '1000', '5')
+
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'cs', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'noexist', 'foo', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'str', 'foo', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cms.query', 'cs', 'foo')
+        # invalid increments fail before any counter changes
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'cs', 'foo', '1', 'bar', 'x')
+        self.assertEqual([0], self.cmd('cs.query', 'cs', 'foo'))
+
+    def test_overflow(self):
+        self.assertOk(self.cmd('cs.initbydim', 'cs', '1000', '5'))
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'cs', 'foo', '-9223372036854775808')
+        self.assertEqual([9223372036854775807], self.cmd('cs.incrby', 'cs', 'foo', '9223372036854775807'))
+        # a failing increment undoes the earlier ones of the same call
+        self.assertRaises(ResponseError, self.cmd, 'cs.incrby', 'cs', 'bar', '5', 'foo', '1')
+        self.assertEqual([9223372036854775807, 0], self.cmd('cs.query', 'cs', 'foo', 'bar'))
+        self.assertEqual(9223372036854775807, self.cmd('cs.info', 'cs')[5])
+        self.assertEqual([0], self.cmd('cs.incrby', 'cs', 'foo', '-9223372036854775807'))
+
+        self.assertOk(self.cmd('cs.initbydim', 'big', '1000', '5'))
+        self.cmd('cs.incrby', 'big', 'foo', '9223372036854775807')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'big', '2', 'big', 'big')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'big', '1', 'big', 'WEIGHTS', '-9223372036854775808')
+        self.assertEqual([9223372036854775807], self.cmd('cs.query', 'big', 'foo'))
+
+        # widths past 2^31 are rejected, however small the error
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbyprob', 'tiny', '1e-300', '0.01')
+        self.assertRaises(ResponseError, self.cmd, 'cs.initbyprob', 'tiny', '0.00001', '0.01')
+
+    def test_estimates(self):
+        self.assertOk(self.cmd('cs.initbydim', 'cs', '200', '7'))
+        for i in xrange(10):
+            args = []
+            for j in xrange(1000):
+                args += ['item{}'.format(j), '1' if j % 2 else '-1']
+            self.cmd('cs.incrby', 'cs', *args)
+        self.cmd('cs.incrby', 'cs', 'heavy', '5000', 'light', '-5000')
+
+        # counts of the other items mostly cancel out, each estimate is
+        # within a few times sqrt(sum of squared counts / width) = 7
+        heavy, light = self.cmd('cs.query', 'cs', 'heavy', 'light')
+        self.assertLess(abs(heavy - 5000), 50)
+        self.assertLess(abs(light + 5000), 50)
+        counts = self.cmd('cs.query', 'cs', *['item{}'.format(j) for j in xrange(1000)])
+        errors = [abs(c - (10 if j % 2 else -10)) for j, c in enumerate(counts)]
+        self.assertLess(sum(errors) / 1000.0, 20)
+
+    def test_merge(self):
+        self.assertOk(self.cmd('cs.initbydim', 'a', '1000', '5'))
+        self.assertOk(self.cmd('cs.initbydim', 'b', '1000', '5'))
+        self.assertOk(self.cmd('cs.initbydim', 'c', '1000', '5'))
+        self.assertOk(self.cmd('cs.initbydim', 'small', '100', '5'))
+        self.cmd('cs.incrby', 'a', 'foo', '5', 'bar', '3')
+        self.cmd('cs.incrby', 'b', 'foo', '2', 'baz', '-4')
+
+        self.assertOk(self.cmd('cs.merge', 'c', '2', 'a', 'b'))
+        self.assertEqual([7, 3, -4], self.cmd('cs.query', 'c', 'foo', 'bar', 'baz'))
+        # negative weights subtract sketches, dest may be a source
+        self.assertOk(self.cmd('cs.merge', 'c', '2', 'c', 'b', 'WEIGHTS', '2', '-1'))
+        self.assertEqual([12, 6, -4], self.cmd('cs.query', 'c', 'foo', 'bar', 'baz'))
+        self.assertEqual(6 * 2 - (-2), self.cmd('cs.info', 'c')[5])
+
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'c', '2', 'a', 'small')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'c', '2', 'a')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'c', '2', 'a', 'b', 'WEIGHTS', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'c', '2', 'a', 'b', 'WEIGHTS', '1', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'c', '1', 'noexist')
+        self.assertRaises(ResponseError, self.cmd, 'cs.merge', 'noexist', '1', 'a')
+
+
+if __name__ == "__main__":
+    import unittest
+    unittest.main()
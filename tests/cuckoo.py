@@ -2,6 +2,7 @@
 from rmtest import ModuleTestCase
 from redis import ResponseError
 import sys
+import struct
 
 if sys.version >= '3':
     xrange = range
@@ -43,6 +44,16 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
             for x in xrange(100):
                 self.assertEqual(1, self.cmd('cf.exists', 'nums', str(x)))
 
+    def test_rdb_zero_pages(self):
+        self.cmd('cf.reserve', 'cf', '1000000', 'valuebits', '4')
+        for x in xrange(100):
+            self.cmd('cf.setval', 'cf', str(x), x % 16)
+        info = self.cmd('cf.info', 'cf')
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, self.cmd('cf.info', 'cf'))
+            for x in xrange(100):
+                self.assertEqual(x % 16, self.cmd('cf.getval', 'cf', str(x)))
+
     def test_aof(self):
         self.spawn_server(use_aof=True)
         # Ensure we have a pretty small filter
@@ -67,8 +78,8 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
         self.restart_and_reload()
         for x in xrange(100):
             self.assertEqual(1, self.cmd('cf.exists', 'smallCF2', str(x)))
-        self.assertEqual(573, self.cmd('MEMORY USAGE', 'smallCF'))
-        self.assertEqual(278, self.cmd('MEMORY USAGE', 'smallCF2'))
+        self.assertEqual(581, self.cmd('MEMORY USAGE', 'smallCF'))
+        self.assertEqual(286, self.cmd('MEMORY USAGE', 'smallCF2'))
 
     def test_setnx(self):
         self.assertEqual(1, self.cmd('cf.addnx', 'cf', 'k1'))
@@ -109,6 +120,48 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
         for x in xrange(maxrange):
             self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
 
+    def test_values(self):
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'valuebits', '0')
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'valuebits', '9')
+        self.cmd('cf.reserve', 'plain', '1000')
+        self.assertRaises(ResponseError, self.cmd, 'cf.setval', 'plain', 'foo', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cf.getval', 'plain', 'foo')
+
+        self.cmd('cf.reserve', 'cf', '1000', 'valuebits', '3', 'expansion', '1')
+        self.assertEqual(3, self.cmd('cf.info', 'cf')[-1])
+        self.assertRaises(ResponseError, self.cmd, 'cf.setval', 'cf', 'foo', '8')
+        self.assertRaises(ResponseError, self.cmd, 'cf.setval', 'cf', 'foo', '-1')
+        self.assertEqual(None, self.cmd('cf.getval', 'cf', 'foo'))
+        self.assertEqual(1, self.cmd('cf.setval', 'cf', 'foo', '5'))
+        self.assertEqual(5, self.cmd('cf.getval', 'cf', 'foo'))
+        self.assertEqual(0, self.cmd('cf.setval', 'cf', 'foo', '2'))
+        self.assertEqual(2, self.cmd('cf.getval', 'cf', 'foo'))
+        self.assertEqual(1, self.cmd('cf.exists', 'cf', 'foo'))
+        self.cmd('cf.add', 'cf', 'bar')
+        self.assertEqual(0, self.cmd('cf.getval', 'cf', 'bar'))
+
+        # Fill past the first filter so values are moved around by evictions
+        for x in xrange(3000):
+            self.cmd('cf.setval', 'cf', str(x), x % 8)
+        mismatches = sum(1 for x in xrange(3000) if self.cmd('cf.getval', 'cf', str(x)) != x % 8)
+        self.assertLess(mismatches, 200)
+
+        before = [self.cmd('cf.getval', 'cf', str(x)) for x in xrange(3000)]
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(before, [self.cmd('cf.getval', 'cf', str(x)) for x in xrange(3000)])
+
+        chunks = []
+        while True:
+            last_pos = chunks[-1][0] if chunks else 0
+            chunk = self.cmd('cf.scandump', 'cf', last_pos)
+            if not chunk[0]:
+                break
+            chunks.append(chunk)
+        self.cmd('del', 'cf')
+        for chunk in chunks:
+            self.cmd('cf.loadchunk', 'cf', *chunk)
+        self.assertEqual(before, [self.cmd('cf.getval', 'cf', str(x)) for x in xrange(3000)])
+
     def test_insert(self):
         # Ensure insert with default capacity works
         self.assertEqual(1, self.cmd('cf.add', 'f1', 'foo'))
@@ -161,9 +214,9 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
 
     def test_mem_usage(self):
         self.cmd('CF.RESERVE', 'cf', '1000')
-        self.assertEqual(1108, self.cmd('MEMORY USAGE', 'cf'))
+        self.assertEqual(1116, self.cmd('MEMORY USAGE', 'cf'))
         self.cmd('cf.insert', 'cf', 'nocreate', 'items', 'foo')
-        self.assertEqual(1108, self.cmd('MEMORY USAGE', 'cf'))
+        self.assertEqual(1116, self.cmd('MEMORY USAGE', 'cf'))
 
     def test_max_iterations(self):
         self.cmd('CF.RESERVE a 10 MAXITERATIONS 10')
@@ -204,6 +257,190 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
         self.assertRaises(ResponseError, self.cmd, 'CF.COMPACT a')
         self.assertRaises(ResponseError, self.cmd, 'CF.COMPACT a b')
 
+    def test_bulkload(self):
+        self.cmd('cf.reserve', 'bulk', '4096', 'BUCKETSIZE', '4')
+        items = ['item%d' % i for i in range(3800)]
+        self.assertEqual(1900, self.cmd('cf.bulkload', 'bulk', 'ITEMS', *items[:1900]))
+        self.assertEqual(1900, self.cmd('cf.bulkload', 'bulk', 'ITEMS', *items[1900:]))
+        info = self.cmd('cf.info', 'bulk')
+        self.assertEqual(1, info[info.index('Number of filters') + 1])
+        self.assertEqual(3800, info[info.index('Number of items inserted') + 1])
+        self.assertEqual([1] * 3800, self.cmd('cf.mexists', 'bulk', *items))
+
+        self.assertEqual(2, self.cmd('cf.bulkload', 'autocreated', 'ITEMS', 'a', 'b'))
+        self.assertEqual([1, 1], self.cmd('cf.mexists', 'autocreated', 'a', 'b'))
+        self.assertRaises(ResponseError, self.cmd, 'cf.bulkload', 'missing', 'NOCREATE',
+                          'ITEMS', 'a')
+        self.cmd('cf.addint', 'ints', '1')
+        self.assertRaises(ResponseError, self.cmd, 'cf.bulkload', 'ints', 'ITEMS', 'a')
+
+    def test_int_items(self):
+        self.assertEqual([1, 1, 1], self.cmd('cf.addint', 'ids', '5', '-6', '5'))
+        self.assertEqual([1, 1, 0],
+                         self.cmd('cf.existsint', 'ids', '5', '18446744073709551610', '7'))
+        self.assertEqual([0], self.cmd('cf.existsint', 'missing', '5'))
+        packed = struct.pack('<2Q', 5, 7)
+        self.assertEqual([1, 0], self.cmd('cf.existsint', 'ids', 'PACKED', packed))
+        self.assertEqual([1, 1], self.cmd('cf.addint', 'ids', 'PACKED', packed))
+        self.assertRaises(ResponseError, self.cmd, 'cf.addint', 'ids', '1.5')
+
+        # A filter takes either integer or string items
+        self.assertRaises(ResponseError, self.cmd, 'cf.add', 'ids', '5')
+        self.assertRaises(ResponseError, self.cmd, 'cf.exists', 'ids', '5')
+        self.assertRaises(ResponseError, self.cmd, 'cf.del', 'ids', '5')
+        self.cmd('cf.add', 'strs', '5')
+        self.assertRaises(ResponseError, self.cmd, 'cf.addint', 'strs', '5')
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([1, 1], self.cmd('cf.existsint', 'ids', '7', '-6'))
+            self.assertRaises(ResponseError, self.cmd, 'cf.add', 'ids', '5')
+
+        # Dumps keep the kind of items
+        self.cmd('cf.reserve', 'dumped', '1000')
+        self.cmd('cf.addint', 'dumped', '1', '2')
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('cf.scandump', 'dumped', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'dumped')
+        for pos, data in chunks:
+            self.cmd('cf.loadchunk', 'dumped', pos, data)
+        self.assertEqual([1, 1], self.cmd('cf.existsint', 'dumped', '1', '2'))
+        self.assertRaises(ResponseError, self.cmd, 'cf.add', 'dumped', '1')
+
+    def test_local_placement(self):
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'placement', 'near')
+        self.cmd('cf.reserve', 'cf', '100000', 'placement', 'local')
+        for x in xrange(1000):
+            self.cmd('cf.add', 'cf', str(x))
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual('local', info[info.index('Placement') + 1])
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, self.cmd('cf.info', 'cf'))
+            for x in xrange(1000):
+                self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
+
+        # Dumps keep the placement, without which items would be looked up elsewhere
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('cf.scandump', 'cf', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'cf')
+        for pos, data in chunks:
+            self.cmd('cf.loadchunk', 'cf', pos, data)
+        for x in xrange(1000):
+            self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
+
+    def test_exact_sizing(self):
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'sizing', 'round')
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'sizing', 'exact',
+                          'placement', 'local')
+        self.cmd('cf.reserve', 'cf', '1000', 'sizing', 'exact', 'expansion', '2')
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual(500, info[info.index('Number of buckets') + 1])
+        self.assertEqual('exact', info[info.index('Sizing') + 1])
+        for x in xrange(3000):
+            self.cmd('cf.add', 'cf', str(x))
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual(3, info[info.index('Number of filters') + 1])
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, self.cmd('cf.info', 'cf'))
+            for x in xrange(3000):
+                self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
+
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('cf.scandump', 'cf', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'cf')
+        for pos, data in chunks:
+            self.cmd('cf.loadchunk', 'cf', pos, data)
+        self.assertEqual(info, self.cmd('cf.info', 'cf'))
+        for x in xrange(3000):
+            self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
+
+    def test_hash_key(self):
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'hashkey', 'abc')
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'hashkey')
+        self.cmd('cf.reserve', 'cf', '1000', 'hashkey', 'random', 'valuebits', '4')
+        self.cmd('cf.reserve', 'ints', '1000', 'hashkey', 'ffeeddccbbaa99887766554433221100')
+        for x in xrange(500):
+            self.cmd('cf.add', 'cf', str(x))
+        self.assertEqual(1, self.cmd('cf.setval', 'cf', 'foo', '9'))
+        self.assertEqual([1, 1, 1], self.cmd('cf.addint', 'ints', '1', '2', '3'))
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual('keyed', info[info.index('Hashing') + 1])
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, self.cmd('cf.info', 'cf'))
+            for x in xrange(500):
+                self.assertEqual(1, self.cmd('cf.exists', 'cf', str(x)))
+            self.assertEqual(9, self.cmd('cf.getval', 'cf', 'foo'))
+            self.assertEqual([1, 1, 0], self.cmd('cf.existsint', 'ints', '1', '3', '4'))
+
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('cf.scandump', 'cf', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'cf')
+        for pos, data in chunks:
+            self.cmd('cf.loadchunk', 'cf', pos, data)
+        self.assertEqual(info, self.cmd('cf.info', 'cf'))
+        self.assertEqual(1, self.cmd('cf.del', 'cf', '42'))
+
+    def test_max_memory(self):
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'maxmemory', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'cf.reserve', 'cf', '1000', 'maxmemory', '100')
+        self.cmd('cf.reserve', 'cf', '1000', 'maxmemory', '4000')
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual(4000, info[info.index('Max memory') + 1])
+        self.assertLessEqual(info[info.index('Size') + 1], 4000)
+
+        # The filter holds at least its capacity, then refuses to grow
+        inserted = 0
+        for x in xrange(100000):
+            try:
+                self.cmd('cf.add', 'cf', str(x))
+            except ResponseError:
+                break
+            inserted += 1
+        self.assertGreaterEqual(inserted, 1000)
+        self.assertLess(inserted, 100000)
+        info = self.cmd('cf.info', 'cf')
+        self.assertEqual(1, info[info.index('Number of filters') + 1])
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, self.cmd('cf.info', 'cf'))
+            self.assertRaises(ResponseError, self.cmd, 'cf.add', 'cf', 'foo')
+
+    def test_full_filter(self):
+        # Items which don't fit get one -1 reply each
+        self.cmd('cf.reserve', 'cf', '100', 'maxmemory', '1000')
+        items = [str(x) for x in xrange(2000)]
+        res = self.cmd('cf.insert', 'cf', 'ITEMS', *items)
+        self.assertEqual(2000, len(res))
+        self.assertIn(-1, res)
+        self.assertEqual(set([1, -1]), set(res))
+        self.assertTrue(self.cmd('ping'))
+
+        # Bulk loads reply with the number of items actually added
+        self.cmd('cf.reserve', 'bulk', '100', 'maxmemory', '1000')
+        added = self.cmd('cf.bulkload', 'bulk', 'ITEMS', *items)
+        self.assertLess(added, 2000)
+        info = self.cmd('cf.info', 'bulk')
+        self.assertEqual(added, info[info.index('Number of items inserted') + 1])
+
     def test_max_expansions(self):
         self.cmd('CF.RESERVE', 'cf', '4')
         for i in range(124):
@@ -253,7 +490,7 @@ class CuckooTestCase(ModuleTestCase('../redisbloom.so')):
     
     def test_info(self):
         self.cmd('CF.RESERVE a 1000')
-        self.assertEqual(self.cmd('CF.INFO a'), ['Size', 1080L, 
+        self.assertEqual(self.cmd('CF.INFO a'), ['Size', 1088L, 
                                                  'Number of buckets', 512L, 
                                                  'Number of filters', 1L, 
                                                  'Number of items inserted', 0L, 
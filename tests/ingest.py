@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+from rmtest import ModuleTestCase
+from redis import ResponseError
+import sys
+
+if sys.version >= '3':
+    xrange = range
+
+class IngestTest(ModuleTestCase('../redisbloom.so')):
+    def setUp(self):
+        super(IngestTest, self).setUp()
+        self.assertOk(self.cmd('cf.reserve', 'cf', '1000'))
+        self.assertOk(self.cmd('bf.reserve', 'bf', '0.01', '1000'))
+        self.assertOk(self.cmd('cms.initbydim', 'cms', '1000', '5'))
+        self.assertOk(self.cmd('topk.reserve', 'topk', '3', '50', '4', '0.9'))
+
+    def test_all_roles(self):
+        self.assertEqual([1, 1, 0, 0], self.cmd('sketch.ingest', 'CF', 'cf', 'BF', 'bf',
+                                                'CMS', 'cms', 'TOPK', 'topk',
+                                                'ITEMS', 'a', 'b', 'a', 'a'))
+        self.assertEqual([1, 1], self.cmd('cf.mexists', 'cf', 'a', 'b'))
+        self.assertEqual([1, 1], self.cmd('bf.mexists', 'bf', 'a', 'b'))
+        self.assertEqual([3, 1], self.cmd('cms.query', 'cms', 'a', 'b'))
+        self.assertEqual([3, 1], self.cmd('topk.count', 'topk', 'a', 'b'))
+        # Counts match separate commands
+        self.assertEqual([4], self.cmd('cms.incrby', 'cms', 'a', '1'))
+
+    def test_newonly(self):
+        self.assertEqual([1, 0, 1], self.cmd('sketch.ingest', 'CMS', 'cms', 'CF', 'cf',
+                                             'NEWONLY', 'ITEMS', 'a', 'a', 'b'))
+        self.assertEqual([1, 1], self.cmd('cms.query', 'cms', 'a', 'b'))
+        self.assertEqual([1, 1], self.cmd('cf.count', 'cf', 'a'))
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'cms', 'NEWONLY', 'ITEMS', 'a')
+
+    def test_full_targets(self):
+        self.assertOk(self.cmd('bf.reserve', 'small', '0.01', '2', 'NONSCALING'))
+        items = ['item{}'.format(i) for i in xrange(10)]
+        res = self.cmd('sketch.ingest', 'BF', 'small', 'CMS', 'cms', 'ITEMS', *items)
+        self.assertEqual([1, 1], res[:2])
+        self.assertGreater(res.count(-1), 5)
+        # Other targets still take the items
+        self.assertEqual([1] * 10, self.cmd('cms.query', 'cms', *items))
+
+        # With NEWONLY, items a full CF target can't take are left out
+        self.assertOk(self.cmd('cf.reserve', 'tiny', '100', 'MAXMEMORY', '1000'))
+        self.assertOk(self.cmd('cms.initbydim', 'wide', '100000', '5'))
+        items = ['x{}'.format(i) for i in xrange(1000)]
+        res = self.cmd('sketch.ingest', 'CF', 'tiny', 'CMS', 'wide', 'NEWONLY', 'ITEMS', *items)
+        self.assertIn(-1, res)
+        self.assertEqual([1 if r == 1 else 0 for r in res], self.cmd('cms.query', 'wide', *items))
+
+    def test_max_expansions(self):
+        self.cmd('cf.reserve', 'grown', '4')
+        for i in range(124):
+            self.assertEqual(1, self.cmd('cf.add', 'grown', str(i)))
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'cms', 'CF', 'grown', 'ITEMS', 'a')
+        # Nothing was changed
+        self.assertEqual([0], self.cmd('cms.query', 'cms', 'a'))
+        self.assertEqual(0, self.cmd('cf.exists', 'grown', 'a'))
+
+    def test_no_cf(self):
+        self.assertEqual([1, 1], self.cmd('sketch.ingest', 'CMS', 'cms', 'CMS', 'cms',
+                                          'ITEMS', 'x', 'x'))
+        self.assertEqual([4], self.cmd('cms.query', 'cms', 'x'))
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([4], self.cmd('cms.query', 'cms', 'x'))
+
+    def test_errors(self):
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'missing', 'ITEMS', 'a')
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'BF', 'cms', 'ITEMS', 'a')
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'HLL', 'cms', 'ITEMS', 'a')
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'cms', 'ITEMS')
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'cms')
+        # Nothing was changed by a failed call
+        with self.assertResponseError():
+            self.cmd('sketch.ingest', 'CMS', 'cms', 'CF', 'missing', 'ITEMS', 'a')
+        self.assertEqual([0], self.cmd('cms.query', 'cms', 'a'))
+        self.assertEqual(['width', 1000, 'depth', 5, 'count', 0], self.cmd('cms.info', 'cms'))
+
+if __name__ == "__main__":
+    import unittest
+    unittest.main()
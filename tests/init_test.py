@@ -1,6 +1,7 @@
 from rmtest import ModuleTestCase
 from redis import ResponseError
 import sys
+import time
 
 if sys.version >= '3':
     xrange = range
@@ -24,6 +25,100 @@ class InitTestCFMaxExp(ModuleTestCase('../redisbloom.so', module_args=['CF_MAX_E
         c, s = self.client, self.server
         self.assertOk('OK', self.cmd('set', 'test', 'foo'))
 
+class InitTestColdAfter(ModuleTestCase('../redisbloom.so', module_args=['COLD_AFTER', '1'])):
+    def test_cold_after(self):
+        self.cmd('BF.RESERVE', 'bf', '0.01', '1000000')
+        self.cmd('CF.RESERVE', 'cf', '1000000')
+        for i in xrange(100):
+            self.cmd('BF.ADD', 'bf', str(i))
+            self.cmd('CF.ADD', 'cf', str(i))
+        self.assertEqual('dense', self.cmd('BF.INFO', 'bf')[-1])
+        self.assertEqual('dense', self.cmd('CF.INFO', 'cf')[-1])
+        bfMem = self.cmd('MEMORY USAGE', 'bf')
+        cfMem = self.cmd('MEMORY USAGE', 'cf')
+
+        # Idle filters are packed while serving commands on other keys
+        time.sleep(1.5)
+        self.cmd('BF.ADD', 'other', 'x')
+        self.assertEqual('packed', self.cmd('BF.INFO', 'bf')[-1])
+        self.assertEqual('packed', self.cmd('CF.INFO', 'cf')[-1])
+        self.assertLess(self.cmd('MEMORY USAGE', 'bf') * 3, bfMem)
+        self.assertLess(self.cmd('MEMORY USAGE', 'cf') * 3, cfMem)
+
+        # Saving reads packed filters without unpacking them
+        for key in ('bf', 'cf'):
+            self.cmd('RESTORE', key + '-copy', 0, self.cmd('DUMP', key))
+        self.assertEqual('packed', self.cmd('BF.INFO', 'bf')[-1])
+        self.assertEqual('packed', self.cmd('CF.INFO', 'cf')[-1])
+        for i in xrange(100):
+            self.assertEqual(1, self.cmd('BF.EXISTS', 'bf-copy', str(i)))
+            self.assertEqual(1, self.cmd('CF.EXISTS', 'cf-copy', str(i)))
+
+        # Saving doesn't need the filters to be unpacked first
+        self.cmd('BF.ADD', 'other', 'y')
+        for _ in self.client.retry_with_rdb_reload():
+            for i in xrange(100):
+                self.assertEqual(1, self.cmd('BF.EXISTS', 'bf', str(i)))
+                self.assertEqual(1, self.cmd('CF.EXISTS', 'cf', str(i)))
+            self.assertEqual('dense', self.cmd('BF.INFO', 'bf')[-1])
+            self.assertEqual('dense', self.cmd('CF.INFO', 'cf')[-1])
+            self.assertEqual(0, self.cmd('BF.EXISTS', 'bf', 'nonexist'))
+
+class InitTestBatchMax(ModuleTestCase('../redisbloom.so', module_args=['BATCH_MAX', '16'])):
+    def test_batch_max(self):
+        for i in xrange(100):
+            self.cmd('BF.ADD', 'bf', str(i))
+            self.cmd('CF.ADD', 'cf', str(i))
+        self.cmd('SET', 'str', 'foo')
+
+        # Pipelined checks are answered in batches, in order
+        pipe = self.client.pipeline(transaction=False)
+        for i in xrange(200):
+            pipe.execute_command('BF.EXISTS', 'bf', str(i))
+            pipe.execute_command('CF.EXISTS', 'cf', str(i))
+        pipe.execute_command('BF.EXISTS', 'missing', 'x')
+        pipe.execute_command('CF.EXISTS', 'str', 'x')
+        res = pipe.execute()
+        for i in xrange(100):
+            self.assertEqual([1, 1], res[2 * i:2 * i + 2])
+        self.assertEqual([0, 0], res[400:])
+
+        # Checks from several clients read in the same event loop iteration share
+        # a batch. A script keeps the server busy while they all send theirs.
+        busy = """local t = redis.call('TIME')
+local start = t[1] * 1000000 + t[2]
+repeat t = redis.call('TIME') until t[1] * 1000000 + t[2] - start > 200000
+return 1"""
+        pool = self.client.connection_pool
+        conns = [pool.make_connection() for _ in xrange(9)]
+        conns[0].send_command('EVAL', busy, 0)
+        time.sleep(0.05)
+        for i, conn in enumerate(conns[1:]):
+            conn.send_command('BF.EXISTS', 'bf', str(i * 20))
+        self.assertEqual(1, conns[0].read_response())
+        for i, conn in enumerate(conns[1:]):
+            self.assertEqual(1 if i * 20 < 100 else 0, conn.read_response())
+            conn.disconnect()
+        conns[0].disconnect()
+        info = self.cmd('BF.BATCHINFO')
+        largest = info[info.index('Largest batch') + 1]
+        self.assertGreater(largest, 1)
+        self.assertLessEqual(largest, 16)
+
+        # Scripts and transactions check right away
+        self.assertEqual(1, self.cmd('EVAL', "return redis.call('BF.EXISTS', 'bf', '1')", 0))
+        pipe = self.client.pipeline(transaction=True)
+        pipe.execute_command('CF.EXISTS', 'cf', '1')
+        pipe.execute_command('BF.EXISTS', 'bf', '1')
+        self.assertEqual([1, 1], pipe.execute())
+
+class InitTestCFLoadThreads(ModuleTestCase('../redisbloom.so', module_args=['CF_LOAD_THREADS', '4'])):
+    def test_cf_load_threads(self):
+        items = ['item{}'.format(i) for i in xrange(100000)]
+        self.assertEqual(100000, self.cmd('CF.BULKLOAD', 'cf', 'CAPACITY', '110000', 'ITEMS', *items))
+        self.assertEqual(100000, self.cmd('CF.INFO', 'cf')[7])
+        self.assertEqual([1] * 1000, self.cmd('CF.MEXISTS', 'cf', *items[::100]))
+
 class InitTestCaseFailMissingArgs(ModuleTestCase('../redisbloom.so', module_args=['ONE_VAR'])):
     def test_init_args(self):
         try:
@@ -103,6 +198,46 @@ class InitTestCaseFailCFMaxExpStr(ModuleTestCase('../redisbloom.so', module_args
         else:
             self.assertOk('NotOK')
 
+class InitTestCaseFailColdAfter(ModuleTestCase('../redisbloom.so', module_args=['COLD_AFTER', '-1'])):
+    def test_init_args(self):
+        try:
+            c, s = self.client, self.server
+        except Exception:
+            delattr(self, '_server')
+            self.assertOk('OK')
+        else:
+            self.assertOk('NotOK')
+
+class InitTestCaseFailBatchMax(ModuleTestCase('../redisbloom.so', module_args=['BATCH_MAX', '-1'])):
+    def test_init_args(self):
+        try:
+            c, s = self.client, self.server
+        except Exception:
+            delattr(self, '_server')
+            self.assertOk('OK')
+        else:
+            self.assertOk('NotOK')
+
+class InitTestCaseFailBatchMaxLarge(ModuleTestCase('../redisbloom.so', module_args=['BATCH_MAX', '100000'])):
+    def test_init_args(self):
+        try:
+            c, s = self.client, self.server
+        except Exception:
+            delattr(self, '_server')
+            self.assertOk('OK')
+        else:
+            self.assertOk('NotOK')
+
+class InitTestCaseFailCFLoadThreads(ModuleTestCase('../redisbloom.so', module_args=['CF_LOAD_THREADS', '0'])):
+    def test_init_args(self):
+        try:
+            c, s = self.client, self.server
+        except Exception:
+            delattr(self, '_server')
+            self.assertOk('OK')
+        else:
+            self.assertOk('NotOK')
+
 if __name__ == "__main__":
     import unittest
     unittest.main()
@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+from rmtest import ModuleTestCase
+from redis import ResponseError
+import sys
+
+if sys.version >= '3':
+    xrange = range
+
+class MinHashTest(ModuleTestCase('../redisbloom.so')):
+    def test_simple(self):
+        self.assertOk(self.cmd('mh.reserve', 'a', '256'))
+        self.assertOk(self.cmd('mh.reserve', 'b', '256'))
+        self.assertEqual(['k', 256, 'bits', 32], self.cmd('mh.info', 'a'))
+        self.assertEqual(1.0, float(self.cmd('mh.similarity', 'a', 'b')))
+
+        self.assertOk(self.cmd('mh.add', 'a', *range(0, 1000)))
+        self.assertOk(self.cmd('mh.add', 'b', *range(500, 1500)))
+        self.assertAlmostEqual(1.0 / 3, float(self.cmd('mh.similarity', 'a', 'b')), delta=0.1)
+        self.assertEqual(1.0, float(self.cmd('mh.similarity', 'a', 'a')))
+
+    def test_validation(self):
+        self.assertRaises(ResponseError, self.cmd, 'mh.reserve')
+        self.assertRaises(ResponseError, self.cmd, 'mh.reserve', 'mh', '0')
+        self.assertRaises(ResponseError, self.cmd, 'mh.reserve', 'mh', 'blah')
+        self.assertRaises(ResponseError, self.cmd, 'mh.reserve', 'mh', '100000')
+        self.assertRaises(ResponseError, self.cmd, 'mh.add', 'mh', 'foo')
+
+        self.assertOk(self.cmd('mh.reserve', 'mh'))
+        self.assertOk(self.cmd('mh.reserve', 'mh64', '64'))
+        self.assertRaises(ResponseError, self.cmd, 'mh.reserve', 'mh')
+        self.assertRaises(ResponseError, self.cmd, 'mh.add', 'mh')
+        self.assertRaises(ResponseError, self.cmd, 'mh.similarity', 'mh', 'mh64')
+        self.assertRaises(ResponseError, self.cmd, 'mh.merge', 'mh', 'mh64')
+        self.assertRaises(ResponseError, self.cmd, 'mh.compress', 'mh', '3')
+        self.assertRaises(ResponseError, self.cmd, 'mh.compress', 'mh', '32')
+
+        self.cmd('set', 'str', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'mh.add', 'str', 'foo')
+
+    def test_merge(self):
+        self.assertOk(self.cmd('mh.reserve', 'all', '128'))
+        self.assertOk(self.cmd('mh.reserve', 'low', '128'))
+        self.assertOk(self.cmd('mh.reserve', 'high', '128'))
+        self.assertOk(self.cmd('mh.add', 'all', *range(0, 200)))
+        self.assertOk(self.cmd('mh.add', 'low', *range(0, 100)))
+        self.assertOk(self.cmd('mh.add', 'high', *range(100, 200)))
+        self.assertOk(self.cmd('mh.merge', 'low', 'high'))
+        # the union signature is exactly the signature of the union
+        self.assertEqual(1.0, float(self.cmd('mh.similarity', 'low', 'all')))
+
+    def test_empty(self):
+        self.assertOk(self.cmd('mh.reserve', 'a', '128'))
+        self.assertOk(self.cmd('mh.reserve', 'b', '128'))
+        self.assertEqual(0, float(self.cmd('mh.similarity', 'a', 'b')))
+        self.assertOk(self.cmd('mh.add', 'a', 'foo'))
+        self.assertEqual(0, float(self.cmd('mh.similarity', 'a', 'b')))
+        self.assertEqual(0, float(self.cmd('mh.similarity', 'b', 'a')))
+
+        # Empty registers can't be told apart once compressed
+        self.assertRaises(ResponseError, self.cmd, 'mh.compress', 'b', '4')
+        self.assertOk(self.cmd('mh.compress', 'a', '4'))
+        self.assertEqual(0, float(self.cmd('mh.similarity', 'a', 'b')))
+        self.assertOk(self.cmd('mh.add', 'b', 'foo'))
+        self.assertEqual(1, float(self.cmd('mh.similarity', 'a', 'b')))
+
+    def test_compress(self):
+        self.assertOk(self.cmd('mh.reserve', 'a', '512'))
+        self.assertOk(self.cmd('mh.reserve', 'b', '512'))
+        self.assertOk(self.cmd('mh.add', 'a', *range(0, 1000)))
+        self.assertOk(self.cmd('mh.add', 'b', *range(500, 1500)))
+        full = float(self.cmd('mh.similarity', 'a', 'b'))
+        before = self.cmd('memory usage', 'a')
+
+        self.assertOk(self.cmd('mh.compress', 'a', '4'))
+        self.assertEqual(['k', 512, 'bits', 4], self.cmd('mh.info', 'a'))
+        self.assertLess(self.cmd('memory usage', 'a'), before)
+        self.assertAlmostEqual(full, float(self.cmd('mh.similarity', 'a', 'b')), delta=0.1)
+        self.assertOk(self.cmd('mh.compress', 'b', '8'))
+        self.assertAlmostEqual(full, float(self.cmd('mh.similarity', 'a', 'b')), delta=0.1)
+
+        self.assertRaises(ResponseError, self.cmd, 'mh.add', 'a', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'mh.merge', 'a', 'b')
+        self.assertRaises(ResponseError, self.cmd, 'mh.compress', 'b', '16')
+
+        sim = self.cmd('mh.similarity', 'a', 'b')
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(['k', 512, 'bits', 4], self.cmd('mh.info', 'a'))
+            self.assertEqual(sim, self.cmd('mh.similarity', 'a', 'b'))
+
+if __name__ == "__main__":
+    import unittest
+    unittest.main()
@@ -2,6 +2,7 @@
 from rmtest import ModuleTestCase
 from redis import ResponseError
 import sys
+import struct
 
 if sys.version >= '3':
     xrange = range
@@ -57,6 +58,61 @@ class RebloomTestCase(ModuleTestCase('../redisbloom.so')):
         self.assertEqual([0, 1], self.cmd(
             'bf.mexists', 'test', 'nonexist', 'foo'))
 
+    def test_multi_keys(self):
+        self.assertEqual([1, 1, 1, 0], self.cmd(
+            'bf.maddkeys', 'k1', 'foo', 'k2', 'foo', 'k1', 'bar', 'k1', 'foo'))
+        self.assertEqual([1, 0, 1, 0], self.cmd(
+            'bf.mexistskeys', 'k2', 'foo', 'k2', 'bar', 'k1', 'bar', 'missing', 'foo'))
+        self.assertEqual(1, self.cmd('bf.exists', 'k1', 'foo'))
+
+        # A key of another type fails the whole command
+        self.cmd('set', 'str', 'x')
+        self.assertRaises(ResponseError, self.cmd, 'bf.maddkeys', 'k3', 'foo', 'str', 'foo')
+        self.assertEqual(0, self.cmd('exists', 'k3'))
+        self.assertRaises(ResponseError, self.cmd, 'bf.maddkeys', 'k1')
+        self.assertRaises(ResponseError, self.cmd, 'bf.mexistskeys', 'k1', 'foo', 'k2')
+
+        # Items sent to one key are checked together
+        items = [str(i) for i in xrange(100)]
+        self.cmd('bf.madd', 'many', *items)
+        args = []
+        for i in xrange(200):
+            args += ['many', str(i)]
+        self.assertEqual([1] * 100, self.cmd('bf.mexistskeys', *args)[:100])
+
+    def test_int_items(self):
+        self.assertEqual([1, 1, 1, 0], self.cmd(
+            'bf.maddint', 'ids', '1', '18446744073709551615', '-2', '1'))
+        self.assertEqual([1, 1, 0], self.cmd('bf.mexistsint', 'ids', '-1', '1', '2'))
+        self.assertEqual([0, 0], self.cmd('bf.mexistsint', 'missing', '1', '2'))
+
+        # Packed items are little endian 64 bit integers
+        packed = struct.pack('<2q', 1, -2)
+        self.assertEqual([1, 1], self.cmd('bf.mexistsint', 'ids', 'PACKED', packed))
+        packed += struct.pack('<Q', 5)
+        self.assertEqual([0, 0, 1], self.cmd('bf.maddint', 'ids', 'PACKED', packed))
+        self.assertEqual([1], self.cmd('bf.mexistsint', 'ids', '5'))
+        for args in (('ids', 'x'), ('ids', '18446744073709551616'), ('ids', 'PACKED', 'abc'),
+                     ('ids', 'PACKED')):
+            self.assertRaises(ResponseError, self.cmd, 'bf.mexistsint', *args)
+
+        # A filter takes either integer or string items
+        self.assertRaises(ResponseError, self.cmd, 'bf.add', 'ids', '1')
+        self.assertRaises(ResponseError, self.cmd, 'bf.exists', 'ids', '1')
+        self.assertRaises(ResponseError, self.cmd, 'bf.mexistskeys', 'ids', '1')
+        self.cmd('bf.add', 'strs', '1')
+        self.assertRaises(ResponseError, self.cmd, 'bf.maddint', 'strs', '1')
+        self.assertRaises(ResponseError, self.cmd, 'bf.mexistsint', 'strs', '1')
+
+        # Until then an empty filter takes either
+        self.cmd('bf.reserve', 'empty', '0.01', '1000')
+        self.assertEqual([0], self.cmd('bf.mexistsint', 'empty', '7'))
+        self.assertEqual([1], self.cmd('bf.maddint', 'empty', '7'))
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([1, 1, 1], self.cmd('bf.mexistsint', 'ids', '1', '5', '-2'))
+            self.assertRaises(ResponseError, self.cmd, 'bf.add', 'ids', '1')
+
     def test_validation(self):
         for args in (
             (),
@@ -196,10 +252,10 @@ class RebloomTestCase(ModuleTestCase('../redisbloom.so')):
 
     def test_mem_usage(self):
         self.assertOk(self.cmd('bf.reserve', 'bf', '0.05', '1000'))
-        self.assertEqual(1084, self.cmd('MEMORY USAGE', 'bf'))
+        self.assertEqual(1100, self.cmd('MEMORY USAGE', 'bf'))
         self.assertEqual([1, 1, 1], self.cmd(
             'bf.madd', 'bf', 'foo', 'bar', 'baz'))
-        self.assertEqual(1084, self.cmd('MEMORY USAGE', 'bf'))
+        self.assertEqual(1100, self.cmd('MEMORY USAGE', 'bf'))
         with self.assertResponseError():
             self.cmd('bf.debug', 'bf', 'noexist')
         with self.assertResponseError():
@@ -255,7 +311,7 @@ class RebloomTestCase(ModuleTestCase('../redisbloom.so')):
     def test_info(self):
         self.assertOk(self.cmd('bf.reserve', 'bf', '0.001', '100'))
         self.assertEqual(self.cmd('bf.info bf'), ['Capacity', 100,
-                                                  'Size', 350, 
+                                                  'Size', 366, 
                                                   'Number of filters', 1L, 
                                                   'Number of items inserted', 0L,
                                                   'Expansion rate', 2L])
@@ -265,6 +321,191 @@ class RebloomTestCase(ModuleTestCase('../redisbloom.so')):
         with self.assertResponseError():
             self.cmd('bf.info')                                             
 
+    def test_prefix(self):
+        self.assertOk(self.cmd('bf.reserve', 'bf', '0.001', '1000', 'PREFIXLEN', '8,4'))
+        self.assertEqual([1, 1], self.cmd('bf.madd', 'bf', 'user:123:name', 'item:42'))
+        self.assertEqual(1, self.cmd('bf.existsprefix', 'bf', 'user'))
+        self.assertEqual(1, self.cmd('bf.existsprefix', 'bf', 'user:123'))
+        self.assertEqual(1, self.cmd('bf.existsprefix', 'bf', 'item'))
+        self.assertEqual(0, self.cmd('bf.existsprefix', 'bf', 'user:999'))
+        self.assertEqual(0, self.cmd('bf.exists', 'bf', 'user'))
+        self.assertEqual(0, self.cmd('bf.existsprefix', 'missing', 'user'))
+        with self.assertResponseError():
+            self.cmd('bf.existsprefix', 'bf', 'us')
+        info = ConvertInfo(self.cmd('bf.info', 'bf'))
+        self.assertEqual(info['Prefix lengths'], [4, 8])
+        self.assertEqual(info['Number of items inserted'], 2)
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(1, self.cmd('bf.existsprefix', 'bf', 'user:123'))
+            self.assertEqual(0, self.cmd('bf.existsprefix', 'bf', 'user:999'))
+
+        for args in (['0'], ['4,4'], ['4,'], ['a'], ['1,2,3,4,5,6,7,8,9']):
+            with self.assertResponseError():
+                self.cmd('bf.reserve', 'bad', '0.01', '100', 'PREFIXLEN', *args)
+        with self.assertResponseError():
+            self.cmd('bf.reserve', 'bad', '0.01', '100', 'PREFIXLEN')
+        self.assertEqual(0, self.cmd('exists', 'bad'))
+
+    def test_hash_key(self):
+        self.assertOk(self.cmd('bf.reserve', 'bf', '0.01', '1000', 'HASHKEY', 'RANDOM'))
+        self.assertOk(self.cmd('bf.reserve', 'fixed', '0.01', '1000',
+                               'HASHKEY', '000102030405060708090a0b0c0d0e0f'))
+        for key in ('bf', 'fixed'):
+            self.assertEqual([1] * 100, self.cmd('bf.madd', key, *range(100)))
+            info = ConvertInfo(self.cmd('bf.info', key))
+            self.assertEqual(info['Hashing'], 'keyed')
+        self.assertEqual([1, 0], self.cmd('bf.insert', 'bf', 'NOCREATE', 'ITEMS', 'foo', 'foo'))
+        self.assertEqual([1, 1, 0], self.cmd('bf.mexists', 'bf', '1', 'foo', 'bar'))
+
+        for _ in self.client.retry_with_rdb_reload():
+            for key in ('bf', 'fixed'):
+                self.assertEqual(1, self.cmd('bf.exists', key, '42'))
+                self.assertEqual('keyed', ConvertInfo(self.cmd('bf.info', key))['Hashing'])
+
+        # Dumps keep the key, without which items would be looked up elsewhere
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('bf.scandump', 'fixed', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'fixed')
+        for pos, data in chunks:
+            self.cmd('bf.loadchunk', 'fixed', pos, data)
+        self.assertEqual([1] * 100, self.cmd('bf.mexists', 'fixed', *range(100)))
+
+        for args in (['nothex'], ['0' * 31], ['g' * 32]):
+            with self.assertResponseError():
+                self.cmd('bf.reserve', 'bad', '0.01', '100', 'HASHKEY', *args)
+        with self.assertResponseError():
+            self.cmd('bf.reserve', 'bad', '0.01', '100', 'HASHKEY')
+        with self.assertResponseError():
+            self.cmd('bf.reserve', 'bad', '0.01', '100', 'HASHKEY', 'RANDOM', 'PREFIXLEN', '4')
+        self.assertEqual(0, self.cmd('exists', 'bad'))
+
+    def test_max_memory(self):
+        self.assertOk(self.cmd('bf.reserve', 'bf', 'MAXMEMORY', '20000', '1000'))
+        self.assertOk(self.cmd('bf.reserve', 'fixed', 'MAXMEMORY', '20000', '1000', 'NONSCALING'))
+        for key in ('bf', 'fixed'):
+            info = ConvertInfo(self.cmd('bf.info', key))
+            self.assertEqual(20000, info['Max memory'])
+            self.assertLessEqual(info['Size'], 20000)
+
+        # A budgeted chain stops growing instead of exceeding its budget
+        inserted = 0
+        for x in xrange(100000):
+            try:
+                self.cmd('bf.add', 'bf', x)
+            except ResponseError:
+                break
+            inserted += 1
+        self.assertLess(inserted, 100000)
+        info = ConvertInfo(self.cmd('bf.info', 'bf'))
+        self.assertGreater(info['Number of items inserted'], 1000)
+        self.assertLessEqual(info['Size'], 20000)
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(info, ConvertInfo(self.cmd('bf.info', 'bf')))
+            with self.assertResponseError():
+                self.cmd('bf.add', 'bf', 'foo')
+
+        chunks = []
+        pos = 0
+        while True:
+            pos, data = self.cmd('bf.scandump', 'bf', pos)
+            if pos == 0:
+                break
+            chunks.append((pos, data))
+        self.cmd('del', 'bf')
+        for pos, data in chunks:
+            self.cmd('bf.loadchunk', 'bf', pos, data)
+        self.assertEqual(20000, ConvertInfo(self.cmd('bf.info', 'bf'))['Max memory'])
+
+        for args in (['x', '1000'], ['-1', '1000'], ['100', '1000'], ['20000']):
+            with self.assertResponseError():
+                self.cmd('bf.reserve', 'bad', 'MAXMEMORY', *args)
+        self.assertEqual(0, self.cmd('exists', 'bad'))
+
+    def test_copy(self):
+        self.assertOk(self.cmd('bf.reserve', 'bf', '0.01', '1000', 'PREFIXLEN', '2'))
+        for x in xrange(0, 10000, 500):
+            self.cmd('bf.madd', 'bf', *['item{}'.format(i) for i in xrange(x, x + 500)])
+        info = ConvertInfo(self.cmd('bf.info', 'bf'))
+        self.assertGreater(info['Number of filters'], 2)
+
+        self.assertEqual(1, self.cmd('bf.copy', 'bf', 'copy'))
+        self.assertEqual(info, ConvertInfo(self.cmd('bf.info', 'copy')))
+        self.assertEqual(1, self.cmd('bf.existsprefix', 'copy', 'it'))
+
+        # Copies are independent of each other
+        self.cmd('bf.add', 'copy', 'foo')
+        self.cmd('del', 'bf')
+        self.assertEqual([1, 1, 1], self.cmd('bf.mexists', 'copy', 'item0', 'item9999', 'foo'))
+        self.assertEqual(1, self.cmd('bf.copy', 'copy', 'bf'))
+        self.cmd('bf.add', 'bf', 'bar')
+        self.assertEqual([1, 1], self.cmd('bf.mexists', 'bf', 'foo', 'bar'))
+        self.assertEqual(0, self.cmd('bf.exists', 'copy', 'bar'))
+
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([1, 1, 1], self.cmd('bf.mexists', 'copy', 'item0', 'item9999', 'foo'))
+            self.assertEqual(1, self.cmd('bf.exists', 'bf', 'bar'))
+
+        # Existing destinations are only overwritten with REPLACE
+        self.cmd('set', 'str', 'foo')
+        self.assertEqual(0, self.cmd('bf.copy', 'bf', 'str'))
+        self.assertEqual('foo', self.cmd('get', 'str'))
+        self.assertEqual(1, self.cmd('bf.copy', 'bf', 'str', 'REPLACE'))
+        self.assertEqual(1, self.cmd('bf.exists', 'str', 'bar'))
+
+        self.assertEqual(0, self.cmd('bf.copy', 'noexist', 'dst'))
+        self.assertEqual(0, self.cmd('bf.copy', 'noexist', 'bf', 'REPLACE'))
+        self.assertEqual(1, self.cmd('bf.exists', 'bf', 'bar'))
+        self.assertRaises(ResponseError, self.cmd, 'bf.copy', 'bf', 'bf')
+        self.assertRaises(ResponseError, self.cmd, 'bf.copy', 'bf', 'dst', 'NX')
+        self.assertRaises(ResponseError, self.cmd, 'bf.copy', 'bf')
+        self.cmd('set', 'str', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'bf.copy', 'str', 'dst')
+        self.assertEqual(0, self.cmd('exists', 'dst'))
+
+    def test_sparse(self):
+        self.assertEqual([1, 1, 0], self.cmd('bf.madd', 'bf', 'foo', 'bar', 'foo'))
+        info = [x.decode() for x in self.cmd('bf.debug', 'bf')]
+        self.assertEqual(['size:2', 'sparse hashes:2 limit:12 capacity:100 ratio:0.005'], info)
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual([1, 1, 0], self.cmd('bf.mexists', 'bf', 'foo', 'bar', 'baz'))
+
+        # Sparse filters dump as a single header chunk
+        chunk = self.cmd('bf.scandump', 'bf', 0)
+        self.assertEqual([0, b''], self.cmd('bf.scandump', 'bf', chunk[0]))
+        self.cmd('del', 'bf')
+        self.assertOk(self.cmd('bf.loadchunk', 'bf', *chunk))
+        self.assertEqual([1, 1, 0], self.cmd('bf.mexists', 'bf', 'foo', 'bar', 'baz'))
+
+        for i in range(20):
+            self.cmd('bf.add', 'bf', str(i))
+        info = [x.decode() for x in self.cmd('bf.debug', 'bf')]
+        self.assertEqual('size:22', info[0])
+        self.assertTrue(info[1].startswith('bytes:'))
+        self.assertEqual([1, 1, 1, 0], self.cmd('bf.mexists', 'bf', 'foo', 'bar', '19', 'baz'))
+
+    def test_rdb_zero_pages(self):
+        # A mostly empty filter, plus a full one with no zero pages
+        self.cmd('bf.reserve', 'empty', '0.01', '1000000')
+        self.cmd('bf.reserve', 'full', '0.5', '1000')
+        for i in range(100):
+            self.cmd('bf.add', 'empty', str(i))
+        for i in range(3000):
+            self.cmd('bf.add', 'full', str(i))
+        before = [self.cmd('bf.debug', 'empty'), self.cmd('bf.debug', 'full')]
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(before, [self.cmd('bf.debug', 'empty'), self.cmd('bf.debug', 'full')])
+            for i in range(100):
+                self.assertEqual(1, self.cmd('bf.exists', 'empty', str(i)))
+            for i in range(3000):
+                self.assertEqual(1, self.cmd('bf.exists', 'full', str(i)))
+
     def test_no_1_error_rate(self):
         with self.assertResponseError():
             self.cmd('bf.reserve bf 1 1000')
@@ -311,7 +552,7 @@ class RebloomTestCase(ModuleTestCase('../redisbloom.so')):
         self.assertOk(self.cmd('bf.reserve bf', error_rate, capacity))
         info = ConvertInfo(self.cmd('bf.info bf'))
         self.assertEqual(info["Capacity"], 300000000)
-        self.assertEqual(info["Size"],    1132420284)
+        self.assertEqual(info["Size"],    1132420300)
 
 if __name__ == "__main__":
     import unittest
@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+from rmtest import ModuleTestCase
+from redis import ResponseError
+import sys
+import math
+
+if sys.version >= '3':
+    xrange = range
+
+class TDigestTest(ModuleTestCase('../redisbloom.so')):
+    def test_simple(self):
+        self.assertOk(self.cmd('tdigest.create', 'td1'))
+        self.assertOk(self.cmd('tdigest.add', 'td1', '1', '2', '3', '4', '5'))
+        self.assertEqual(1.0, float(self.cmd('tdigest.min', 'td1')))
+        self.assertEqual(5.0, float(self.cmd('tdigest.max', 'td1')))
+        info = self.cmd('tdigest.info', 'td1')
+        self.assertEqual(['Compression', 100, 'Capacity', 610], info[:4])
+        self.assertEqual(5.0, float(info[9]) + float(info[11]))
+
+        self.assertOk(self.cmd('tdigest.reset', 'td1'))
+        self.assertTrue(math.isnan(float(self.cmd('tdigest.min', 'td1'))))
+        self.assertTrue(math.isnan(float(self.cmd('tdigest.quantile', 'td1', '0.5')[0])))
+
+    def test_validation(self):
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.create')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.create', 'td', '0')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.create', 'td', 'blah')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.create', 'td', '100000')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'td', '1')
+
+        self.assertOk(self.cmd('tdigest.create', 'td'))
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.create', 'td')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'td')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'td', '1', 'blah')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.quantile', 'td', '1.5')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.quantile', 'td', '-0.1')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.cdf', 'td', 'blah')
+        # non-finite samples would corrupt every later answer
+        for value in ('inf', '-inf', 'nan', '1e308', '-1e308'):
+            self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'td', '1', value)
+        # nothing was added by the rejected command
+        self.assertTrue(math.isnan(float(self.cmd('tdigest.max', 'td'))))
+        self.assertOk(self.cmd('tdigest.add', 'td', '1', '3'))
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'td', 'inf')
+        self.assertEqual(2.0, float(self.cmd('tdigest.quantile', 'td', '0.5')[0]))
+        self.assertEqual(3.0, float(self.cmd('tdigest.max', 'td')))
+
+        self.cmd('set', 'str', 'foo')
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.add', 'str', '1')
+
+    def test_quantile(self):
+        self.assertOk(self.cmd('tdigest.create', 'td', '100'))
+        for x in xrange(0, 10000, 100):
+            self.cmd('tdigest.add', 'td', *range(x, x + 100))
+        res = [float(x) for x in
+               self.cmd('tdigest.quantile', 'td', '0', '0.01', '0.5', '0.99', '1')]
+        self.assertEqual(0.0, res[0])
+        self.assertAlmostEqual(100, res[1], delta=10)
+        self.assertAlmostEqual(5000, res[2], delta=100)
+        self.assertAlmostEqual(9900, res[3], delta=10)
+        self.assertEqual(9999.0, res[4])
+
+        res = [float(x) for x in self.cmd('tdigest.cdf', 'td', '-1', '5000', '10000')]
+        self.assertEqual([0.0, 1.0], [res[0], res[2]])
+        self.assertAlmostEqual(0.5, res[1], delta=0.01)
+
+    def test_merge(self):
+        self.assertOk(self.cmd('tdigest.create', 'low'))
+        self.assertOk(self.cmd('tdigest.create', 'high'))
+        self.assertOk(self.cmd('tdigest.create', 'all'))
+        self.cmd('tdigest.add', 'low', *range(0, 500))
+        self.cmd('tdigest.add', 'high', *range(500, 1000))
+        self.assertOk(self.cmd('tdigest.merge', 'all', 'low', 'high'))
+        self.assertEqual(0.0, float(self.cmd('tdigest.min', 'all')))
+        self.assertEqual(999.0, float(self.cmd('tdigest.max', 'all')))
+        self.assertAlmostEqual(500, float(self.cmd('tdigest.quantile', 'all', '0.5')[0]),
+                               delta=10)
+        self.assertRaises(ResponseError, self.cmd, 'tdigest.merge', 'all', 'nonexist')
+
+    def test_rdb(self):
+        self.assertOk(self.cmd('tdigest.create', 'td', '50'))
+        self.cmd('tdigest.add', 'td', *range(0, 1000))
+        before = self.cmd('tdigest.quantile', 'td', '0.1', '0.5', '0.9')
+        for _ in self.client.retry_with_rdb_reload():
+            self.assertEqual(before, self.cmd('tdigest.quantile', 'td', '0.1', '0.5', '0.9'))
+            self.assertEqual(999.0, float(self.cmd('tdigest.max', 'td')))
+
+if __name__ == "__main__":
+    import unittest
+    unittest.main()
@@ -1,5 +1,6 @@
 #include "redismodule.h"
 #include "sb.h"
+#include "murmurhash2.h"
 #include "test.h"
 #include <stdio.h>
 #include <string.h>
@@ -63,6 +64,435 @@ TEST_F(basic, sbExpansion) {
     ASSERT_GT(chain->nfilters, 1);
     SBChain_Free(chain);
 }
+TEST_F(basic, sbPrefixes) {
+    SBChain *chain = SB_NewChain(1000, 0.001, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    uint16_t bad[] = {4, 4};
+    ASSERT_NE(0, SBChain_SetPrefixes(chain, bad, 2));
+    uint16_t lens[] = {9, 3};
+    ASSERT_EQ(0, SBChain_SetPrefixes(chain, lens, 2));
+    ASSERT_EQ(3, chain->prefixes[0]);
+    ASSERT_EQ(9, chain->prefixes[1]);
+    ASSERT_EQ(0, chain->prefixes[2]);
+
+    const char *item = "user:1234:session";
+    ASSERT_NE(0, SBChain_Add(chain, item, strlen(item)));
+    ASSERT_EQ(1, chain->size);
+    ASSERT_EQ(-1, SBChain_CheckPrefix(chain, "user", 4));
+    ASSERT_EQ(1, SBChain_CheckPrefix(chain, "use", 3));
+    ASSERT_EQ(1, SBChain_CheckPrefix(chain, "user:1234", 9));
+    ASSERT_EQ(0, SBChain_CheckPrefix(chain, "user:9999", 9));
+    // Prefixes are not items
+    ASSERT_EQ(0, SBChain_Check(chain, "use", 3));
+
+    // Items shorter than a prefix only store the prefixes that fit
+    ASSERT_NE(0, SBChain_Add(chain, "abcd", 4));
+    ASSERT_EQ(1, SBChain_CheckPrefix(chain, "abc", 3));
+
+    // Lengths survive a header round trip
+    size_t len = 0;
+    char *hdr = SBChain_GetEncodedHeader(chain, &len);
+    const char *errmsg;
+    SBChain *chain2 = SB_NewChainFromHeader(hdr, len, &errmsg);
+    ASSERT_NE(NULL, chain2);
+    ASSERT_EQ(3, chain2->prefixes[0]);
+    ASSERT_EQ(9, chain2->prefixes[1]);
+    ASSERT_EQ(0, chain2->prefixes[2]);
+    ASSERT_EQ(NULL, SB_NewChainFromHeader(hdr, len - 2, &errmsg));
+    SB_FreeEncodedHeader(hdr);
+
+    SBChain_Free(chain2);
+    SBChain_Free(chain);
+}
+
+TEST_F(basic, sbSparse) {
+    SBChain *chain = SB_NewSparseChain(100, 0.01, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND,
+                                       BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    ASSERT_NE(0, SB_IS_SPARSE(chain));
+    uint32_t limit = chain->sparse->limit;
+    ASSERT_GT(limit, 1);
+
+    for (size_t ii = 0; ii < limit; ++ii) {
+        ASSERT_EQ(0, SBChain_Check(chain, &ii, sizeof ii));
+        ASSERT_EQ(1, SBChain_Add(chain, &ii, sizeof ii));
+        ASSERT_EQ(0, SBChain_Add(chain, &ii, sizeof ii));
+    }
+    ASSERT_NE(0, SB_IS_SPARSE(chain));
+    ASSERT_EQ(limit, chain->size);
+    for (size_t ii = limit; ii < 10000; ++ii) {
+        ASSERT_EQ(0, SBChain_Check(chain, &ii, sizeof ii));
+    }
+
+    // Sparse chains are encoded in the header alone
+    size_t len = 0;
+    char *hdr = SBChain_GetEncodedHeader(chain, &len);
+    long long iter = SB_CHUNKITER_INIT;
+    size_t chunklen;
+    ASSERT_EQ(NULL, SBChain_GetEncodedChunk(chain, &iter, &chunklen, 128));
+    const char *errmsg;
+    SBChain *chain2 = SB_NewChainFromHeader(hdr, len, &errmsg);
+    ASSERT_NE(NULL, chain2);
+    ASSERT_NE(0, SB_IS_SPARSE(chain2));
+    ASSERT_EQ(NULL, SB_NewChainFromHeader(hdr, len - 1, &errmsg));
+    SB_FreeEncodedHeader(hdr);
+
+    // One more item converts to the dense encoding, keeping earlier items
+    size_t extra = limit;
+    ASSERT_EQ(1, SBChain_Add(chain2, &extra, sizeof extra));
+    ASSERT_EQ(0, SB_IS_SPARSE(chain2));
+    ASSERT_EQ(1, chain2->nfilters);
+    ASSERT_EQ(limit + 1, chain2->size);
+    for (size_t ii = 0; ii <= limit; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(chain2, &ii, sizeof ii));
+    }
+    ASSERT_EQ(limit + 1, chain2->filters[0].size);
+    ASSERT_EQ(100, chain2->filters[0].inner.entries);
+
+    SBChain_Free(chain2);
+    SBChain_Free(chain);
+}
+
+TEST_F(basic, sbInline) {
+    SBChain *chain = SB_NewChain(100, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    // The first link and its bits directly follow the chain
+    ASSERT_EQ((void *)(chain + 1), (void *)chain->filters);
+    ASSERT_EQ((void *)(chain->filters + 1), (void *)chain->filters[0].inner.bf);
+
+    // Growing moves the links out, leaving the first link's bits in place
+    const unsigned char *bits = chain->filters[0].inner.bf;
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        SBChain_Add(chain, &ii, sizeof ii);
+    }
+    ASSERT_GT(chain->nfilters, 1);
+    ASSERT_NE((void *)(chain + 1), (void *)chain->filters);
+    ASSERT_EQ(bits, chain->filters[0].inner.bf);
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(chain, &ii, sizeof ii));
+    }
+    SBChain_Free(chain);
+
+    // Chains with a single separately allocated link can be moved inline
+    SBChain *plain = SB_NewSparseChain(100, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_EQ(0, SBChain_Densify(plain));
+    ASSERT_NE((void *)(plain + 1), (void *)plain->filters);
+    for (size_t ii = 0; ii < 50; ++ii) {
+        SBChain_Add(plain, &ii, sizeof ii);
+    }
+    chain = SBChain_Inline(plain);
+    ASSERT_EQ((void *)(chain + 1), (void *)chain->filters);
+    ASSERT_EQ(50, chain->size);
+    for (size_t ii = 0; ii < 50; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(chain, &ii, sizeof ii));
+    }
+    ASSERT_EQ(chain, SBChain_Inline(chain));
+    SBChain_Free(chain);
+}
+
+TEST_F(basic, sbPack) {
+    SBChain *chain = SB_NewChain(100000, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        SBChain_Add(chain, &ii, sizeof ii);
+    }
+    size_t dense = SBChain_DataBytes(chain);
+    ASSERT_EQ(0, SBChain_IsPacked(chain));
+
+    ASSERT_GT(SBChain_Pack(chain), 0);
+    ASSERT_EQ(1, SBChain_IsPacked(chain));
+    ASSERT_LT(SBChain_DataBytes(chain) * 3, dense);
+    ASSERT_EQ(0, SBChain_Pack(chain));
+
+    ASSERT_EQ(0, SBChain_Unpack(chain));
+    ASSERT_EQ(0, SBChain_IsPacked(chain));
+    ASSERT_EQ(dense, SBChain_DataBytes(chain));
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(chain, &ii, sizeof ii));
+    }
+
+    // Full filters don't compress and are left as is
+    for (size_t ii = 0; ii < 100000; ++ii) {
+        SBChain_Add(chain, &ii, sizeof ii);
+    }
+    ASSERT_EQ(1, chain->nfilters);
+    ASSERT_EQ(0, SBChain_Pack(chain));
+
+    SBChain_Free(chain);
+}
+
+TEST_F(basic, sbPackedChunks) {
+    // The first link is too full to pack, the second one is packed
+    SBChain *chain = SB_NewChain(10000, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    for (size_t ii = 0; ii < 12200; ++ii) {
+        SBChain_Add(chain, &ii, sizeof ii);
+    }
+    ASSERT_EQ(2, chain->nfilters);
+    ASSERT_GT(SBChain_Pack(chain), 0);
+    ASSERT_EQ(0, chain->filters[0].inner.packed);
+    ASSERT_EQ(1, chain->filters[1].inner.packed);
+
+    // Reading a packed chain leaves it packed
+    size_t total = chain->filters[0].inner.bytes + chain->filters[1].inner.bytes;
+    char *packedBits = malloc(total);
+    long long iter = SB_CHUNKITER_INIT;
+    size_t len, pos = 0;
+    const char *chunk;
+    SBUnpackedLink unpacked = {0};
+    while ((chunk = SBChain_GetPackedChunk(chain, &iter, &len, 4096, &unpacked)) != NULL) {
+        ASSERT_EQ(pos + len + 1, iter);
+        memcpy(packedBits + pos, chunk, len);
+        pos += len;
+    }
+    ASSERT_EQ(0, iter);
+    ASSERT_EQ(total, pos);
+    ASSERT_EQ(1, SBChain_IsPacked(chain));
+    RedisModule_Free(unpacked.bits);
+
+    unsigned char *tmp;
+    const unsigned char *bits = SBChain_LinkBits(chain, 1, &tmp);
+    ASSERT_NE(NULL, tmp);
+    ASSERT_EQ(0, memcmp(bits, packedBits + chain->filters[0].inner.bytes,
+                        chain->filters[1].inner.bytes));
+    RedisModule_Free(tmp);
+    ASSERT_EQ(chain->filters[0].inner.bf, SBChain_LinkBits(chain, 0, &tmp));
+    ASSERT_EQ(NULL, tmp);
+
+    // Same bits as the unpacked chain
+    ASSERT_EQ(0, SBChain_Unpack(chain));
+    ASSERT_EQ(0, memcmp(chain->filters[0].inner.bf, packedBits, chain->filters[0].inner.bytes));
+    ASSERT_EQ(0, memcmp(chain->filters[1].inner.bf, packedBits + chain->filters[0].inner.bytes,
+                        chain->filters[1].inner.bytes));
+    free(packedBits);
+    SBChain_Free(chain);
+}
+
+TEST_F(basic, sbCopy) {
+    // An inline first link, then separately allocated ones
+    SBChain *chain = SB_NewChain(1000, 0.01, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    for (size_t ii = 0; ii < 20000; ++ii) {
+        SBChain_Add(chain, &ii, sizeof ii);
+    }
+    ASSERT_GT(chain->nfilters, 3);
+
+    // Full links are shared, inline bits and the last link copied
+    SBChain *copy = SBChain_Copy(chain);
+    size_t last = chain->nfilters - 1;
+    ASSERT_EQ(chain->nfilters, copy->nfilters);
+    ASSERT_EQ(chain->size, copy->size);
+    ASSERT_NE(chain->filters[0].inner.bf, copy->filters[0].inner.bf);
+    ASSERT_NE(chain->filters[last].inner.bf, copy->filters[last].inner.bf);
+    for (size_t ii = 1; ii < last; ++ii) {
+        ASSERT_EQ(chain->filters[ii].inner.bf, copy->filters[ii].inner.bf);
+        ASSERT_EQ(2, *copy->filters[ii].refs);
+    }
+    SBChain *copy2 = SBChain_Copy(copy);
+    ASSERT_EQ(3, *chain->filters[1].refs);
+
+    // Chains grow apart
+    for (size_t ii = 20000; ii < 21000; ++ii) {
+        SBChain_Add(copy, &ii, sizeof ii);
+    }
+    size_t found = 0;
+    for (size_t ii = 20000; ii < 21000; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(copy, &ii, sizeof ii));
+        found += SBChain_Check(chain, &ii, sizeof ii);
+    }
+    ASSERT_LT(found, 50);
+
+    // Loading a chunk into a link stops sharing it
+    long long iter = SB_CHUNKITER_INIT;
+    size_t len;
+    const char *chunk;
+    const char *errmsg;
+    while ((chunk = SBChain_GetEncodedChunk(chain, &iter, &len, 1 << 20)) != NULL) {
+        ASSERT_EQ(0, SBChain_LoadEncodedChunk(copy2, iter, chunk, len, &errmsg));
+    }
+    ASSERT_EQ(NULL, copy2->filters[1].refs);
+    ASSERT_NE(chain->filters[1].inner.bf, copy2->filters[1].inner.bf);
+    ASSERT_EQ(2, *chain->filters[1].refs);
+
+    // The bits outlive the chain they were shared from
+    SBChain_Free(chain);
+    SBChain_Free(copy2);
+    ASSERT_EQ(1, *copy->filters[1].refs);
+    for (size_t ii = 0; ii < 21000; ++ii) {
+        ASSERT_EQ(1, SBChain_Check(copy, &ii, sizeof ii));
+    }
+    // Links no longer shared are owned again once packing looks at them
+    SBChain_Pack(copy);
+    ASSERT_EQ(NULL, copy->filters[1].refs);
+    ASSERT_EQ(0, copy->filters[1].inner.nofree);
+    SBChain_Free(copy);
+
+    // Sparse chains and their prefixes are copied
+    SBChain *sparse = SB_NewSparseChain(1000, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    const uint16_t lens[] = {2};
+    ASSERT_EQ(0, SBChain_SetPrefixes(sparse, lens, 1));
+    SBChain_Add(sparse, "foo", 3);
+    copy = SBChain_Copy(sparse);
+    SBChain_Free(sparse);
+    ASSERT_EQ(1, SB_IS_SPARSE(copy));
+    ASSERT_EQ(1, SBChain_Check(copy, "foo", 3));
+    ASSERT_EQ(1, SBChain_CheckPrefix(copy, "fo", 2));
+    SBChain_Free(copy);
+}
+
+TEST_F(basic, sbCheckHashes) {
+    // A chain of several links, a NOROUND chain and a sparse chain
+    SBChain *chains[] = {SB_NewChain(100, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH),
+                         SB_NewChain(1000, 0.01, BLOOM_OPT_NOROUND, BF_DEFAULT_GROWTH),
+                         SB_NewSparseChain(1000, 0.01, 0, BF_DEFAULT_GROWTH)};
+    size_t nitems[] = {1000, 500, 20};
+    enum { NCHECKS = 2000 };
+    bloom_hashval *hashes = malloc(NCHECKS * sizeof(*hashes));
+    int *found = malloc(NCHECKS * sizeof(*found));
+    for (size_t cc = 0; cc < sizeof(chains) / sizeof(chains[0]); ++cc) {
+        SBChain *chain = chains[cc];
+        ASSERT_NE(NULL, chain);
+        for (size_t ii = 0; ii < nitems[cc]; ++ii) {
+            SBChain_Add(chain, &ii, sizeof ii);
+        }
+        ASSERT_EQ(cc == 2, SB_IS_SPARSE(chain));
+        ASSERT_EQ(1, cc || chain->nfilters > 1);
+        for (size_t ii = 0; ii < NCHECKS; ++ii) {
+            hashes[ii] = SBChain_GetHash(chain, &ii, sizeof ii);
+        }
+        SBChain_CheckHashes(chain, hashes, NCHECKS, found);
+        for (size_t ii = 0; ii < NCHECKS; ++ii) {
+            ASSERT_EQ(SBChain_Check(chain, &ii, sizeof ii), found[ii]);
+        }
+        SBChain_Free(chain);
+    }
+    free(hashes);
+    free(found);
+}
+
+TEST_F(basic, murmurLanes) {
+    // Runs of equal lengths take the multi-lane path, mixed lengths the scalar one
+    enum { NKEYS = 200 };
+    unsigned char buf[NKEYS + 64];
+    for (size_t ii = 0; ii < sizeof buf; ++ii) {
+        buf[ii] = ii * 131 + 7;
+    }
+    const void *keys[NKEYS];
+    size_t lens[NKEYS];
+    uint32_t seeds32[NKEYS], out32[NKEYS];
+    uint64_t seeds64[NKEYS], out64[NKEYS];
+    bloom_hashval hv[NKEYS];
+    for (size_t len = 0; len <= 41; ++len) {
+        for (size_t ii = 0; ii < NKEYS; ++ii) {
+            keys[ii] = buf + ii % 61;
+            lens[ii] = len == 41 ? ii % 40 : len;
+            seeds32[ii] = ii * 2654435761U;
+            seeds64[ii] = ii * 0x9E3779B97F4A7C15ULL;
+        }
+        MurmurHash2_x(keys, lens, seeds32, NKEYS, out32);
+        MurmurHash64A_Bloom_x(keys, lens, seeds64, NKEYS, out64);
+        for (size_t ii = 0; ii < NKEYS; ++ii) {
+            ASSERT_EQ(MurmurHash2(keys[ii], lens[ii], seeds32[ii]), out32[ii]);
+            ASSERT_EQ(MurmurHash64A_Bloom(keys[ii], lens[ii], seeds64[ii]), out64[ii]);
+        }
+
+        bloom_calc_hashes(keys, lens, NKEYS, hv);
+        for (size_t ii = 0; ii < NKEYS; ++ii) {
+            bloom_hashval one = bloom_calc_hash(keys[ii], lens[ii]);
+            ASSERT_EQ(one.a, hv[ii].a);
+            ASSERT_EQ(one.b, hv[ii].b);
+        }
+        bloom_calc_hashes64(keys, lens, NKEYS, hv);
+        for (size_t ii = 0; ii < NKEYS; ++ii) {
+            bloom_hashval one = bloom_calc_hash64(keys[ii], lens[ii]);
+            ASSERT_EQ(one.a, hv[ii].a);
+            ASSERT_EQ(one.b, hv[ii].b);
+        }
+    }
+}
+
+TEST_F(basic, sbIntItems) {
+    SBChain *chain = SB_NewSparseChain(1000, 0.01, BLOOM_OPT_FORCE64, BF_DEFAULT_GROWTH);
+    ASSERT_NE(NULL, chain);
+    // Empty chains take either kind of items, adopting the first one used
+    ASSERT_EQ(0, SBChain_UseItems(chain, 1, 0));
+    ASSERT_EQ(0, chain->options & BLOOM_OPT_INTITEMS);
+    ASSERT_EQ(0, SBChain_UseItems(chain, 1, 1));
+    ASSERT_NE(0, chain->options & BLOOM_OPT_INTITEMS);
+    ASSERT_EQ(0, SBChain_UseItems(chain, 0, 0));
+
+    // Enough items to make the chain dense and scale it
+    size_t added = 0;
+    for (uint64_t ii = 0; ii < 3000; ++ii) {
+        added += SBChain_AddHashed(chain, NULL, 0, bloom_calc_hash_int(ii * 7919));
+    }
+    ASSERT_GT(added, 2940);
+    ASSERT_GT(chain->nfilters, 1);
+    ASSERT_EQ(-1, SBChain_UseItems(chain, 0, 1));
+    ASSERT_EQ(0, SBChain_UseItems(chain, 1, 1));
+
+    size_t falsePositives = 0;
+    for (uint64_t ii = 0; ii < 3000; ++ii) {
+        bloom_hashval hv = bloom_calc_hash_int(ii * 7919);
+        ASSERT_EQ(0, SBChain_AddHashed(chain, NULL, 0, hv));
+        int found;
+        SBChain_CheckHashes(chain, &hv, 1, &found);
+        ASSERT_NE(0, found);
+        hv = bloom_calc_hash_int(ii * 7919 + 1);
+        SBChain_CheckHashes(chain, &hv, 1, &found);
+        falsePositives += found;
+    }
+    ASSERT_LT(falsePositives, 60);
+    SBChain_Free(chain);
+
+    // Chains storing prefixes only take strings
+    chain = SB_NewChain(100, 0.01, 0, BF_DEFAULT_GROWTH);
+    uint16_t lens[] = {2};
+    ASSERT_EQ(0, SBChain_SetPrefixes(chain, lens, 1));
+    ASSERT_EQ(-1, SBChain_UseItems(chain, 1, 1));
+    SBChain_Free(chain);
+
+    // Distinct integers never share a hash
+    ASSERT_NE(MurmurHash64_Int(0, 0), MurmurHash64_Int(1, 0));
+    ASSERT_NE(MurmurHash64_Int(0, 0), MurmurHash64_Int(0, 1));
+}
+
+TEST_F(basic, sbSortedAdd) {
+    // A large second link takes the batch in bit order, the first one only being checked
+    SBChain *sorted = SB_NewChain(1000, 0.01, 0, 4096);
+    SBChain *plain = SB_NewChain(1000, 0.01, 0, 4096);
+    const size_t n = 3 * SB_SORTED_MIN_BATCH;
+    bloom_hashval *hashes = malloc(n * sizeof(*hashes));
+    int *rv = malloc(n * sizeof(*rv));
+    for (uint64_t ii = 0; ii < 3000; ++ii) {
+        bloom_hashval hv = bloom_calc_hash_int(ii);
+        ASSERT_EQ(SBChain_AddHashed(plain, NULL, 0, hv), SBChain_AddHashed(sorted, NULL, 0, hv));
+    }
+    ASSERT_EQ(2, sorted->nfilters);
+    ASSERT_GE(sorted->filters[1].inner.bytes, SB_SORTED_MIN_BYTES);
+
+    // Items already in the first link, repeated within the batch, or new
+    for (size_t ii = 0; ii < n; ++ii) {
+        hashes[ii] = bloom_calc_hash_int(ii % 5 ? ii : ii % 4000);
+    }
+    ASSERT_EQ(n, SBChain_AddHashes(sorted, NULL, NULL, hashes, n, rv));
+    size_t added = 0;
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(SBChain_AddHashed(plain, NULL, 0, hashes[ii]), rv[ii]);
+        added += rv[ii];
+    }
+    ASSERT_GT(added, n * 3 / 4);
+    ASSERT_EQ(plain->size, sorted->size);
+    ASSERT_EQ(plain->filters[1].size, sorted->filters[1].size);
+    ASSERT_EQ(0, memcmp(plain->filters[1].inner.bf, sorted->filters[1].inner.bf,
+                        sorted->filters[1].inner.bytes));
+
+    free(hashes);
+    free(rv);
+    SBChain_Free(sorted);
+    SBChain_Free(plain);
+}
+
 /*
 // Disabled due to issue 178
 TEST_F(basic, testIssue6_Overflow) {
@@ -142,6 +572,69 @@ TEST_F(basic, testNoRound) {
 }
 
 
+static int bloomPositionsSet(const struct bloom *bm, const uint64_t *pos) {
+    for (uint32_t ii = 0; ii < bm->hashes; ++ii) {
+        if (!(bm->bf[pos[ii] >> 3] & (1 << (pos[ii] & 7)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint64_t bloomBitsSet(const struct bloom *bm) {
+    uint64_t n = 0;
+    for (uint64_t ii = 0; ii < bm->bytes; ++ii) {
+        n += __builtin_popcount(bm->bf[ii]);
+    }
+    return n;
+}
+
+TEST_F(basic, testNoRoundKernels) {
+    // Shapes made by BF.RESERVE and BF.ADD, whose bit counts aren't powers of two
+    SBChain *chains[] = {SB_NewChain(100, 0.01, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND, 2),
+                         SB_NewChain(1000, 0.001, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND, 2),
+                         SB_NewChain(100000, 0.1, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND, 2),
+                         SB_NewChain(100, 0.0001, BLOOM_OPT_NOROUND, 2)};
+    // More hashes than are unrolled, so it keeps the generic loop
+    struct bloom generic;
+    ASSERT_EQ(0, bloom_init(&generic, 100, 0.0000001, BLOOM_OPT_FORCE64 | BLOOM_OPT_NOROUND));
+    ASSERT_LT(BLOOM_MAX_UNROLLED_HASHES, generic.hashes);
+
+    uint64_t pos[BLOOM_MAX_UNROLLED_HASHES];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (size_t cc = 0; cc < sizeof(chains) / sizeof(chains[0]); ++cc) {
+        ASSERT_NE(NULL, chains[cc]);
+        struct bloom *bm = &chains[cc]->filters[0].inner;
+        ASSERT_EQ(0, bm->n2);
+        ASSERT_NE(bm->bits & (bm->bits - 1), 0);
+        ASSERT_LE(bm->hashes, BLOOM_MAX_UNROLLED_HASHES);
+        ASSERT_NE(generic.check, bm->check);
+        ASSERT_NE(generic.add, bm->add);
+
+        // Each add sets exactly the bits at the reference positions
+        for (uint64_t ii = 0; ii < bm->entries; ++ii) {
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            bloom_hashval h = {state, state * 0xff51afd7ed558ccdULL};
+            bloom_positions_h(bm, h, pos);
+            uint64_t before = bloomBitsSet(bm);
+            int wasSet = bloomPositionsSet(bm, pos);
+            ASSERT_EQ(wasSet, bm->add(bm, h));
+            ASSERT_EQ(1, bloomPositionsSet(bm, pos));
+            uint64_t added = bloomBitsSet(bm) - before;
+            ASSERT_LE(added, bm->hashes);
+            ASSERT_EQ(wasSet, added == 0);
+        }
+        for (uint64_t ii = 0; ii < 20000; ++ii) {
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            bloom_hashval h = {state, ~state};
+            bloom_positions_h(bm, h, pos);
+            ASSERT_EQ(bloomPositionsSet(bm, pos), bm->check(bm, h));
+        }
+        SBChain_Free(chains[cc]);
+    }
+    bloom_free(&generic);
+}
+
 /**
  *      self.cmd('bf.reserve', 'myBloom', '0.0001', '100')
         def do_verify():
@@ -1,4 +1,5 @@
 #include "cuckoo.h"
+#include "cf.h"
 #include "test.h"
 #include "murmurhash2.h"
 #include "redismodule.h"
@@ -196,6 +197,366 @@ TEST_F(cuckoo, testBucketSize) {
     CuckooFilter_Free(&ck);
 }
 
+TEST_F(cuckoo, testValues) {
+    CuckooFilter ck;
+    CuckooFilter_InitWithValues(&ck, NUM_BULK / 4, DEFAULT_BUCKETSIZE, 500, 1, 3);
+    ASSERT_EQ(3, CUCKOO_VALUEBITS(&ck));
+
+    uint8_t value;
+    CuckooHash kfoo = CUCKOO_GEN_HASH("foo", 3);
+    ASSERT_EQ(0, CuckooFilter_GetValue(&ck, kfoo, &value));
+    ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_SetValue(&ck, kfoo, 5));
+    ASSERT_EQ(1, CuckooFilter_GetValue(&ck, kfoo, &value));
+    ASSERT_EQ(5, value);
+    ASSERT_EQ(CuckooInsert_Exists, CuckooFilter_SetValue(&ck, kfoo, 2));
+    ASSERT_EQ(1, CuckooFilter_GetValue(&ck, kfoo, &value));
+    ASSERT_EQ(2, value);
+    ASSERT_EQ(1, ck.numItems);
+    ASSERT_EQ(1, CuckooFilter_Delete(&ck, kfoo));
+
+    // Overfill so values follow their fingerprints through relocations and growth
+    for (size_t ii = 0; ii < NUM_BULK; ++ii) {
+        CuckooFilter_SetValue(&ck, CUCKOO_GEN_HASH(&ii, sizeof ii), ii % 8);
+    }
+    ASSERT_GT(ck.numFilters, 1);
+    size_t mismatches = 0;
+    for (size_t ii = 0; ii < NUM_BULK; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_GetValue(&ck, CUCKOO_GEN_HASH(&ii, sizeof ii), &value));
+        if (value != ii % 8) {
+            mismatches++;
+        }
+    }
+    // Only fingerprint collisions return the value of another item
+    ASSERT_LE((double)mismatches, (double)NUM_BULK * 0.06);
+    CuckooFilter_Free(&ck);
+}
+
+TEST_F(cuckoo, testInline) {
+    CuckooFilter *ck = CuckooFilter_New(NUM_BULK / 8, DEFAULT_BUCKETSIZE, 500, 1, 3);
+    ASSERT_NE(NULL, ck);
+    ASSERT_EQ(1, ck->numFilters);
+    ASSERT_EQ(3, CUCKOO_VALUEBITS(ck));
+    ASSERT_EQ((void *)(ck + 1), (void *)ck->filters);
+
+    // Growing keeps the data of the first sub filter in place
+    const MyCuckooBucket *data = ck->filters[0].data;
+    for (size_t ii = 0; ii < NUM_BULK; ++ii) {
+        CuckooFilter_SetValue(ck, CUCKOO_GEN_HASH(&ii, sizeof ii), ii % 8);
+    }
+    ASSERT_GT(ck->numFilters, 1);
+    ASSERT_EQ(data, ck->filters[0].data);
+    for (size_t ii = 0; ii < NUM_BULK; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    CuckooFilter_Free(ck);
+    free(ck);
+
+    // A heap filter with a single sub filter can be moved inline
+    ck = calloc(1, sizeof(*ck));
+    CuckooFilter_Init(ck, NUM_BULK / 8, DEFAULT_BUCKETSIZE, 500, 1);
+    for (size_t ii = 0; ii < 100; ++ii) {
+        CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii));
+    }
+    ck = CuckooFilter_Inline(ck);
+    ASSERT_EQ((void *)(ck + 1), (void *)ck->filters);
+    ASSERT_EQ(100, ck->numItems);
+    for (size_t ii = 0; ii < 100; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testPack) {
+    CuckooFilter *ck = CuckooFilter_New(NUM_BULK * 10, DEFAULT_BUCKETSIZE, 500, 1, 2);
+    ASSERT_NE(NULL, ck);
+    for (size_t ii = 0; ii < NUM_BULK / 10; ++ii) {
+        CuckooFilter_SetValue(ck, CUCKOO_GEN_HASH(&ii, sizeof ii), ii % 4);
+    }
+    size_t dense = CuckooFilter_DataBytes(ck);
+    ASSERT_EQ(0, CuckooFilter_IsPacked(ck));
+
+    ASSERT_GT(CuckooFilter_Pack(ck), 0);
+    ASSERT_EQ(1, CuckooFilter_IsPacked(ck));
+    ASSERT_LT(CuckooFilter_DataBytes(ck) * 3, dense);
+    ASSERT_EQ(0, CuckooFilter_Pack(ck));
+
+    ASSERT_EQ(0, CuckooFilter_Unpack(ck));
+    ASSERT_EQ(0, CuckooFilter_IsPacked(ck));
+    ASSERT_EQ(dense, CuckooFilter_DataBytes(ck));
+    uint8_t value;
+    for (size_t ii = 0; ii < NUM_BULK / 10; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_GetValue(ck, CUCKOO_GEN_HASH(&ii, sizeof ii), &value));
+    }
+
+    // Packing a packed filter may be freed directly
+    CuckooFilter_Pack(ck);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testPackedChunks) {
+    CuckooFilter *ck = CuckooFilter_New(NUM_BULK * 10, DEFAULT_BUCKETSIZE, 500, 1, 2);
+    ASSERT_NE(NULL, ck);
+    for (size_t ii = 0; ii < NUM_BULK / 10; ++ii) {
+        CuckooFilter_SetValue(ck, CUCKOO_GEN_HASH(&ii, sizeof ii), ii % 4);
+    }
+    ASSERT_GT(CuckooFilter_Pack(ck), 0);
+
+    // Reading a packed filter leaves it packed, buckets and values alike
+    size_t total = SUBCF_DATA_SIZE(&ck->filters[0]);
+    char *packedData = malloc(total);
+    long long pos = 1;
+    size_t len, read = 0;
+    const char *chunk;
+    CFUnpackedSub unpacked = {0};
+    while ((chunk = CF_GetPackedChunk(ck, &pos, &len, 1000, &unpacked)) != NULL) {
+        ASSERT_LE(read + len, total);
+        memcpy(packedData + read, chunk, len);
+        read += len;
+    }
+    CF_FreeUnpackedSub(&unpacked);
+    ASSERT_EQ(1, CuckooFilter_IsPacked(ck));
+
+    MyCuckooBucket *tmp;
+    const MyCuckooBucket *data = CuckooFilter_SubData(ck, 0, &tmp);
+    ASSERT_NE(NULL, tmp);
+
+    // Same chunks as the unpacked filter
+    ASSERT_EQ(0, CuckooFilter_Unpack(ck));
+    ASSERT_EQ(0, memcmp(data, ck->filters[0].data, total));
+    free(tmp);
+    pos = 1;
+    size_t offset = 0;
+    while ((chunk = CF_GetEncodedChunk(ck, &pos, &len, 1000)) != NULL) {
+        ASSERT_EQ(0, memcmp(packedData + offset, chunk, len));
+        offset += len;
+    }
+    ASSERT_EQ(read, offset);
+    free(packedData);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testCheckHashes) {
+    // Small enough to need several sub filters
+    CuckooFilter *ck = CuckooFilter_New(1000, DEFAULT_BUCKETSIZE, 500, 2, 0);
+    ASSERT_NE(NULL, ck);
+    for (size_t ii = 0; ii < 5000; ++ii) {
+        CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii));
+    }
+    ASSERT_GT(ck->numFilters, 1);
+
+    size_t n = 10000;
+    CuckooHash *hashes = malloc(n * sizeof(*hashes));
+    int *found = malloc(n * sizeof(*found));
+    for (size_t ii = 0; ii < n; ++ii) {
+        hashes[ii] = CUCKOO_GEN_HASH(&ii, sizeof ii);
+    }
+    CuckooFilter_CheckHashes(ck, hashes, n, found);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(CuckooFilter_Check(ck, hashes[ii]), found[ii]);
+    }
+    free(hashes);
+    free(found);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testBulkLoad) {
+    // 95% of the slots fit without growing, loaded in two chunks
+    CuckooFilter *ck = CuckooFilter_New(1 << 16, 4, 20, 2, 0);
+    ASSERT_NE(NULL, ck);
+    size_t n = (1 << 16) * 95 / 100;
+    CuckooHash *hashes = malloc(n * sizeof(*hashes));
+    for (size_t ii = 0; ii < n; ++ii) {
+        hashes[ii] = CUCKOO_GEN_HASH(&ii, sizeof ii);
+    }
+    ASSERT_EQ(0, CuckooFilter_BulkLoad(ck, hashes, n / 2));
+    ASSERT_EQ(0, CuckooFilter_BulkLoad(ck, hashes + n / 2, n - n / 2));
+    ASSERT_EQ(1, ck->numFilters);
+    ASSERT_EQ(n, ck->numItems);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, hashes[ii]));
+    }
+
+    // Items that do not fit grow the filter as regular inserts do
+    ASSERT_EQ(0, CuckooFilter_BulkLoad(ck, hashes, n));
+    ASSERT_EQ(2, ck->numFilters);
+    ASSERT_EQ(2 * n, ck->numItems);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_GE(CuckooFilter_Count(ck, hashes[ii]), 2);
+    }
+    free(hashes);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testBulkLoadConcurrent) {
+    CuckooFilter *ck = CuckooFilter_New(1 << 18, 4, 20, 2, 0);
+    ASSERT_NE(NULL, ck);
+    size_t n = (1 << 18) * 95 / 100;
+    CuckooHash *hashes = malloc(n * sizeof(*hashes));
+    for (size_t ii = 0; ii < n; ++ii) {
+        hashes[ii] = CUCKOO_GEN_HASH(&ii, sizeof ii);
+    }
+    ASSERT_EQ(0, CuckooFilter_BulkLoadConcurrent(ck, hashes, n, 4));
+    ASSERT_EQ(1, ck->numFilters);
+    ASSERT_EQ(n, ck->numItems);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, hashes[ii]));
+    }
+    CuckooFilter_Free(ck);
+    free(ck);
+
+    // Filters with values are loaded by a single thread
+    ck = CuckooFilter_New(1 << 10, 4, 20, 2, 4);
+    ASSERT_EQ(0, CuckooFilter_BulkLoadConcurrent(ck, hashes, 1 << 10, 4));
+    ASSERT_EQ(1 << 10, ck->numItems);
+    uint8_t value;
+    ASSERT_EQ(1, CuckooFilter_GetValue(ck, hashes[0], &value));
+    ASSERT_EQ(0, value);
+    free(hashes);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testIntItems) {
+    CuckooFilter *ck = CuckooFilter_New(1000, DEFAULT_BUCKETSIZE, 500, 2, 0);
+    ASSERT_NE(NULL, ck);
+    ASSERT_EQ(0, CuckooFilter_UseItems(ck, 1, 1));
+    ASSERT_EQ(1, ck->intItems);
+    for (uint64_t ii = 0; ii < 500; ++ii) {
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, CUCKOO_GEN_INT_HASH(ii)));
+    }
+    ASSERT_EQ(-1, CuckooFilter_UseItems(ck, 0, 1));
+    for (uint64_t ii = 0; ii < 500; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_INT_HASH(ii)));
+    }
+
+    // Once emptied the filter takes either kind again
+    for (uint64_t ii = 0; ii < 500; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Delete(ck, CUCKOO_GEN_INT_HASH(ii)));
+    }
+    ASSERT_EQ(0, CuckooFilter_UseItems(ck, 0, 1));
+    ASSERT_EQ(0, ck->intItems);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testLocalAlt) {
+    CuckooFilter *ck = CuckooFilter_New(1 << 16, 4, 500, 2, 0);
+    ASSERT_NE(NULL, ck);
+    ASSERT_EQ(0, CuckooFilter_UseLocalAlt(ck));
+    ASSERT_EQ(CUCKOO_ALT_CHUNK_BYTES / 4, ck->altChunk);
+
+    // Fills as much as classic placement
+    size_t n = (1 << 16) * 95 / 100;
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    ASSERT_EQ(-1, CuckooFilter_UseLocalAlt(ck));
+    ASSERT_EQ(1, ck->numFilters);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Delete(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    ASSERT_EQ(0, ck->numItems);
+
+    // Sub filters added when growing use the same placement
+    n = 1 << 16;
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    ASSERT_EQ(2, ck->numFilters);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testExactSize) {
+    CuckooFilter *ck = CuckooFilter_NewExact(600001, 4, 500, 2, 0);
+    ASSERT_NE(NULL, ck);
+    ASSERT_EQ(150001, ck->numBuckets);
+    ASSERT_EQ(-1, CuckooFilter_UseLocalAlt(ck));
+
+    size_t n = 600001 * 95 / 100;
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    ASSERT_EQ(1, ck->numFilters);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+
+    // Grows by the expansion, then moves items back once there is room again
+    for (size_t ii = n; ii < 2 * n; ++ii) {
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    ASSERT_EQ(2, ck->numFilters);
+    ASSERT_EQ(300002, ck->filters[1].numBuckets);
+    for (size_t ii = 0; ii < n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Delete(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    CuckooFilter_Compact(ck);
+    for (size_t ii = n; ii < 2 * n; ++ii) {
+        ASSERT_EQ(1, CuckooFilter_Check(ck, CUCKOO_GEN_HASH(&ii, sizeof ii)));
+    }
+    CuckooFilter_Free(ck);
+    free(ck);
+
+    // No more than 2^32 buckets
+    ASSERT_EQ(NULL, CuckooFilter_NewExact(1ULL << 34, 2, 20, 1, 0));
+}
+
+TEST_F(cuckoo, testHashKey) {
+    CuckooFilter *ck = CuckooFilter_New(1000, DEFAULT_BUCKETSIZE, 500, 2, 0);
+    ASSERT_NE(NULL, ck);
+    const uint64_t key[2] = {0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL};
+    ASSERT_EQ(0, CuckooFilter_SetHashKey(ck, key));
+    ASSERT_EQ(1, ck->keyed);
+
+    const void *items[] = {"foo", "bar", "baz"};
+    const size_t lens[] = {3, 3, 3};
+    CuckooHash hashes[3];
+    CuckooFilter_GenHashes(ck, items, lens, 3, hashes);
+    for (size_t ii = 0; ii < 3; ++ii) {
+        ASSERT_EQ(CuckooFilter_Hash(ck, items[ii], lens[ii]), hashes[ii]);
+        ASSERT_NE(CUCKOO_GEN_HASH(items[ii], lens[ii]), hashes[ii]);
+        ASSERT_EQ(CuckooInsert_Inserted, CuckooFilter_Insert(ck, hashes[ii]));
+    }
+    ASSERT_NE(CUCKOO_GEN_INT_HASH(42), CuckooFilter_IntHash(ck, 42));
+    // Items already hashed with the key would be lost
+    ASSERT_EQ(-1, CuckooFilter_SetHashKey(ck, key));
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
+TEST_F(cuckoo, testMaxBytes) {
+    uint16_t bucketSize = 0;
+    uint64_t capacity;
+    ASSERT_EQ(-1, CuckooFilter_FitBytes(1000, 100, 0, 1, &bucketSize, &capacity));
+    ASSERT_EQ(0, CuckooFilter_FitBytes(1000, 4000, 0, 1, &bucketSize, &capacity));
+
+    CuckooFilter *ck = CuckooFilter_NewExact(capacity, bucketSize, 20, 2, 0);
+    ASSERT_NE(NULL, ck);
+    ck->maxBytes = 4000;
+    ASSERT_LE(CuckooFilter_Bytes(ck), 4000);
+    uint64_t ii = 0;
+    while (CuckooFilter_Insert(ck, CUCKOO_GEN_INT_HASH(ii)) == CuckooInsert_Inserted) {
+        ++ii;
+    }
+    // Holds the capacity it was fitted for, without growing past the budget
+    ASSERT_LE(1000, ii);
+    ASSERT_EQ(1, ck->numFilters);
+    CuckooFilter_Free(ck);
+    free(ck);
+}
+
 int main(int argc, char **argv) {
     test__abort_on_fail = 1;
     RedisModule_Calloc = calloc_wrap;
@@ -121,6 +121,20 @@ class TopKTest(ModuleTestCase('../redisbloom.so')):
         self.assertEqual([None, 'foo', None], self.cmd('topk.list', 'test'))
         self.assertEqual(4190, self.cmd('MEMORY USAGE', 'test'))
 
+    def test_max_memory(self):
+        self.assertOk(self.cmd('topk.reserve', 'topk', '10', 'MAXMEMORY', '100000'))
+        info = self.cmd('topk.info', 'topk')
+        self.assertEqual(10, info[1])
+        self.assertEqual(7, info[5])
+        self.assertLessEqual(info[3] * info[5] * 8, 100000)
+        self.assertGreater(info[3], 1000)
+        self.cmd('topk.add', 'topk', 'foo', 'foo', 'bar')
+        self.assertEqual(['foo', 'bar'], self.cmd('topk.list', 'topk'))
+
+        for args in (('t', '10', 'MAXMEMORY', 'x'), ('t', '10', 'MAXMEMORY', '10'),
+                     ('t', '10', 'MAXMEMORY'), ('t', '10', 'MAXBYTES', '100000')):
+            self.assertRaises(ResponseError, self.cmd, 'topk.reserve', *args)
+
     def test_time(self):
         self.cmd('topk.reserve', 'topk', '100', '1000', '5', '0.9')
 